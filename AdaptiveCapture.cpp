@@ -0,0 +1,221 @@
+#include "stdafx.h"
+#include "AdaptiveCapture.h"
+#include "CaptureBuffer.h"
+#include "HookDispatch.h"
+#include "IntervalThread.h"
+#include "PerThread.h"
+#include "Statistics.h"
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+
+// Calls one thread has made to each hook. Only the owning thread writes them. Countdown is how many more calls the thread
+// skips before capturing one while its hook is sampled, which keeps sampling off shared cache lines
+struct alignas(64) ThreadHookCalls
+{
+	ThreadHookCalls();
+
+	// Fold the thread's calls into the retired totals as it exits
+	void Retire();
+
+	std::atomic<UINT64> Calls[MAX_HOOKS];
+	UINT32 Countdown[MAX_HOOKS];
+};
+
+struct HookRate
+{
+	// Calls counted by the last adjustment
+	UINT64 Calls = 0;
+	double CallsPerSecond = 0;
+	UINT32 Throttles = 0;
+};
+
+static bool Enabled = false;
+static double LimitCallsPerSecond = 0;
+static UINT32 ThrottledPeriod = ADAPTIVE_DEFAULT_SAMPLE;
+static std::vector<std::string> HookNames;
+// Hooks which are never throttled, only written by Start
+static bool AlwaysCaptured[MAX_HOOKS] = {};
+
+// Read on every capture and only written by the rate thread when a hook is throttled or restored
+static std::atomic<UINT32> Periods[MAX_HOOKS];
+
+// The calls of exited threads and each hook's rate, only accessed with the thread list locked
+static UINT64 RetiredCalls[MAX_HOOKS] = {};
+static HookRate Rates[MAX_HOOKS];
+
+static const int ThrottlesStat = Statistics::Counter("adaptive.throttles");
+static const int ThrottledHooksStat = Statistics::Gauge("adaptive.throttled_hooks");
+
+// When the rate thread last measured
+static std::chrono::steady_clock::time_point LastAdjustment;
+static IntervalThread RateThread;
+
+ThreadHookCalls::ThreadHookCalls()
+{
+	for (std::atomic<UINT64>& calls : Calls)
+		calls.store(0, std::memory_order_relaxed);
+	std::fill(Countdown, Countdown + MAX_HOOKS, 0);
+}
+
+void ThreadHookCalls::Retire()
+{
+	for (int i = 0; i < MAX_HOOKS; i++)
+		RetiredCalls[i] += Calls[i].load(std::memory_order_relaxed);
+}
+
+bool AdaptiveCapture::ShouldCapture(int hookId)
+{
+	if (!Enabled || (unsigned)hookId >= MAX_HOOKS)
+		return true;
+
+	ThreadHookCalls& calls = PerThread<ThreadHookCalls>::Local();
+	AddOwned(calls.Calls[hookId], (UINT64)1);
+
+	UINT32 period = Periods[hookId].load(std::memory_order_relaxed);
+	if (period <= 1)
+		return period == 1;
+
+	// Capture the first call after the hook is sampled, then one every period calls
+	UINT32& countdown = calls.Countdown[hookId];
+	if (countdown == 0 || countdown >= period) {
+		countdown = period - 1;
+		return true;
+	}
+
+	countdown--;
+	return false;
+}
+
+UINT32 AdaptiveCapture::SamplePeriod(int hookId)
+{
+	return Enabled && (unsigned)hookId < MAX_HOOKS ? Periods[hookId].load(std::memory_order_relaxed) : 1;
+}
+
+static std::string HookName(int hookId)
+{
+	return (size_t)hookId < HookNames.size() ? HookNames[hookId] : std::string();
+}
+
+// Tells readers of the capture file how the hook's captures were thinned out from here on
+static void RecordSwitch(int hookId, UINT32 period, double callsPerSecond)
+{
+	INT64 args[] = {
+		(INT64)std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::system_clock::now().time_since_epoch()).count(),
+		hookId,
+		period,
+		(INT64)callsPerSecond,
+	};
+	CaptureBuffer::Record(ADAPTIVE_CAPTURE_HOOK_ID, _countof(args), args);
+}
+
+// Must be called with the thread list locked
+static void AddUpCalls(const std::vector<ThreadHookCalls*>& threads, UINT64 totals[MAX_HOOKS])
+{
+	std::copy(RetiredCalls, RetiredCalls + MAX_HOOKS, totals);
+	for (ThreadHookCalls* thread : threads) {
+		for (int i = 0; i < MAX_HOOKS; i++)
+			totals[i] += thread->Calls[i].load(std::memory_order_relaxed);
+	}
+}
+
+void AdaptiveCapture::Adjust(double elapsedSeconds)
+{
+	if (elapsedSeconds <= 0)
+		return;
+
+	INT64 throttled = 0;
+	PerThread<ThreadHookCalls>::Visit([&](const std::vector<ThreadHookCalls*>& threads) {
+		UINT64 totals[MAX_HOOKS];
+		AddUpCalls(threads, totals);
+
+		for (int i = 0; i < MAX_HOOKS; i++) {
+			HookRate& rate = Rates[i];
+			rate.CallsPerSecond = (totals[i] - rate.Calls) / elapsedSeconds;
+			rate.Calls = totals[i];
+
+			UINT32 period = Periods[i].load(std::memory_order_relaxed);
+			if (period == 1 && rate.CallsPerSecond > LimitCallsPerSecond && !AlwaysCaptured[i]) {
+				Periods[i].store(ThrottledPeriod, std::memory_order_relaxed);
+				rate.Throttles++;
+				Statistics::Count(ThrottlesStat);
+				RecordSwitch(i, ThrottledPeriod, rate.CallsPerSecond);
+				if (ThrottledPeriod == 0)
+					spdlog::info("Hook {} {} called {:.0f} times a second, no longer capturing", i, HookName(i), rate.CallsPerSecond);
+				else
+					spdlog::info("Hook {} {} called {:.0f} times a second, capturing 1 in {}", i, HookName(i), rate.CallsPerSecond, ThrottledPeriod);
+			}
+			else if (period != 1 && rate.CallsPerSecond < LimitCallsPerSecond * ADAPTIVE_RESTORE_FRACTION) {
+				Periods[i].store(1, std::memory_order_relaxed);
+				RecordSwitch(i, 1, rate.CallsPerSecond);
+				spdlog::info("Hook {} {} down to {:.0f} calls a second, capturing every call", i, HookName(i), rate.CallsPerSecond);
+			}
+
+			throttled += Periods[i].load(std::memory_order_relaxed) != 1 ? 1 : 0;
+		}
+	});
+
+	Statistics::Set(ThrottledHooksStat, throttled);
+}
+
+static void AdjustSinceLast()
+{
+	// Measured rather than assumed to be the interval, since the wait can overrun
+	auto now = std::chrono::steady_clock::now();
+	AdaptiveCapture::Adjust(std::chrono::duration<double>(now - LastAdjustment).count());
+	LastAdjustment = now;
+}
+
+void AdaptiveCapture::Start(double callsPerSecond, UINT32 samplePeriod, const std::vector<std::string>& hookNames, const std::vector<int>& alwaysCaptured)
+{
+	Stop();
+
+	// Throttling to a period of 1 changes nothing, so a hook over the limit would be throttled again every interval
+	if (samplePeriod == 1) {
+		spdlog::error(ADAPTIVE_SAMPLE_VARIABLE " can't be 1 since that captures every call, adaptive capture is off");
+		return;
+	}
+
+	for (std::atomic<UINT32>& period : Periods)
+		period.store(1, std::memory_order_relaxed);
+
+	std::fill(AlwaysCaptured, AlwaysCaptured + MAX_HOOKS, false);
+	for (int hookId : alwaysCaptured) {
+		if ((unsigned)hookId < MAX_HOOKS)
+			AlwaysCaptured[hookId] = true;
+	}
+
+	LimitCallsPerSecond = callsPerSecond;
+	ThrottledPeriod = samplePeriod;
+	HookNames = hookNames;
+	LastAdjustment = std::chrono::steady_clock::now();
+	Enabled = true;
+
+	if (samplePeriod == 0)
+		spdlog::info("Hooks called more than {:.0f} times a second stop capturing", callsPerSecond);
+	else
+		spdlog::info("Hooks called more than {:.0f} times a second capture 1 in {} calls", callsPerSecond, samplePeriod);
+
+	RateThread.Start(ADAPTIVE_INTERVAL_MS, AdjustSinceLast);
+}
+
+void AdaptiveCapture::Stop()
+{
+	if (!RateThread.IsRunning())
+		return;
+
+	RateThread.Stop();
+	Enabled = false;
+
+	PerThread<ThreadHookCalls>::Visit([](const std::vector<ThreadHookCalls*>& threads) {
+		UINT64 totals[MAX_HOOKS];
+		AddUpCalls(threads, totals);
+		for (int i = 0; i < MAX_HOOKS; i++) {
+			if (totals[i] == 0)
+				continue;
+
+			spdlog::info("Hook {} {}: {} call(s), throttled {} time(s){}", i, HookName(i), totals[i], Rates[i].Throttles,
+				Periods[i].load(std::memory_order_relaxed) != 1 ? ", still throttled" : "");
+		}
+	});
+}
@@ -0,0 +1,46 @@
+#pragma once
+
+#include "stdafx.h"
+#include <string>
+#include <vector>
+
+// Environment variable holding the calls per second above which a hook's captures are thinned out. Every call is captured
+// unless it's set
+#define ADAPTIVE_RATE_VARIABLE "ZEROED_PROFILER_ADAPTIVE_RATE"
+
+// Environment variable holding N, where a hook over the rate captures 1 in N calls. 0 stops it capturing altogether
+#define ADAPTIVE_SAMPLE_VARIABLE "ZEROED_PROFILER_ADAPTIVE_SAMPLE"
+#define ADAPTIVE_DEFAULT_SAMPLE 100
+
+// How often call rates are measured
+#define ADAPTIVE_INTERVAL_MS 250
+
+// A throttled hook goes back to capturing every call once its rate falls below this fraction of the limit, so a rate
+// hovering around the limit doesn't switch back and forth every interval
+#define ADAPTIVE_RESTORE_FRACTION 0.5
+
+// Bounds what capturing and dispatching hooks cost under load by thinning out the captures of hooks called faster than a
+// set rate. The capture functions and dispatcher ask ShouldCapture before doing anything, which counts the call into a
+// block owned by the calling thread and decides from the hook's current sampling period, so the injected IL never changes
+// and no method needs to be ReJITted. A background thread adds up each hook's calls every interval and switches hooks
+// between capturing every call and 1 in N as their rate crosses the limit, logging each switch and writing it to the
+// capture file so readers can scale what was captured. Timing and lock wait probes aren't thinned out, and neither are
+// hooks which must see every call, such as the built-in Assembly.Load dump
+class AdaptiveCapture
+{
+public:
+	// Start measuring. hookNames are used to label the log and alwaysCaptured hooks are counted but never throttled. A
+	// samplePeriod of 1 is rejected and leaves every call captured
+	static void Start(double callsPerSecond, UINT32 samplePeriod, const std::vector<std::string>& hookNames, const std::vector<int>& alwaysCaptured);
+	// Stop the rate thread and log each hook's calls and how often it was throttled
+	static void Stop();
+
+	// Counts a call to the hook and returns whether it should be captured. Always true when not started
+	static bool ShouldCapture(int hookId);
+
+	// Measure every hook's rate since the last call and throttle or restore them. Run by the rate thread each interval
+	static void Adjust(double elapsedSeconds);
+
+	// The hook's current sampling period: 1 captures every call, N 1 in N and 0 none
+	static UINT32 SamplePeriod(int hookId);
+};
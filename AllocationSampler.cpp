@@ -0,0 +1,265 @@
+#include "stdafx.h"
+#include "AllocationSampler.h"
+#include "SiteTable.h"
+#include "Utils.h"
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cmath>
+#include <mutex>
+#include <unordered_map>
+
+// Slots probed past the one a key hashes to before a sample is dropped
+#define ALLOCATION_MAX_PROBES 64
+
+// Types logged by Stop
+#define ALLOCATION_LOGGED_TYPES 10
+
+struct AllocationSlot
+{
+	ClassID Class;
+	UINT32 FrameCount;
+	FunctionID Frames[ALLOCATION_STACK_DEPTH];
+	std::atomic<UINT64> Samples;
+	std::atomic<UINT64> Objects;
+	std::atomic<UINT64> Bytes;
+};
+
+// Zero initialised so the allocation path never runs a constructor
+struct SamplingState
+{
+	// Bytes the thread can allocate before its next sample
+	INT64 Remaining;
+	// xorshift state, 0 until the thread's first allocation
+	UINT64 Random;
+};
+
+struct StackWalk
+{
+	FunctionID Frames[ALLOCATION_STACK_DEPTH];
+	size_t Count;
+};
+
+static SiteTable<AllocationSlot, ALLOCATION_TABLE_SIZE, ALLOCATION_MAX_PROBES> Table;
+
+static ICorProfilerInfo4* Info = nullptr;
+static std::string ReportPath;
+static double IntervalBytes = ALLOCATION_DEFAULT_INTERVAL_BYTES;
+
+static std::mutex NamesLock;
+static std::unordered_map<ClassID, std::string> TypeNames;
+static std::unordered_map<FunctionID, std::string> FunctionNames;
+
+static thread_local SamplingState ThreadState;
+
+static UINT64 NextRandom(UINT64& state)
+{
+	state ^= state << 13;
+	state ^= state >> 7;
+	state ^= state << 17;
+	return state;
+}
+
+// Draws from an exponential distribution with the interval as its mean, so samples form a Poisson process over the bytes
+// each thread allocates
+static INT64 NextInterval(UINT64& state)
+{
+	double uniform = ((NextRandom(state) >> 11) + 1) * (1.0 / 9007199254740992.0);
+	return (INT64)(-std::log(uniform) * IntervalBytes) + 1;
+}
+
+static HRESULT STDMETHODCALLTYPE OnFrame(FunctionID funcId, UINT_PTR ip, COR_PRF_FRAME_INFO frameInfo, ULONG32 contextSize, BYTE context[], void* clientData)
+{
+	StackWalk* walk = (StackWalk*)clientData;
+
+	// A function ID of 0 stands for a run of native frames, which are collapsed into one
+	if (funcId == 0 && walk->Count > 0 && walk->Frames[walk->Count - 1] == 0)
+		return S_OK;
+
+	walk->Frames[walk->Count++] = funcId;
+
+	// Returning S_FALSE ends the walk, there's no need to visit frames that won't be kept
+	return walk->Count < ALLOCATION_STACK_DEPTH ? S_OK : S_FALSE;
+}
+
+// Look up the names of a newly claimed slot's type and frames while they're certain to still be loaded
+static void NameSlot(const AllocationSlot& slot)
+{
+	if (Info == nullptr)
+		return;
+
+	std::lock_guard<std::mutex> lock(NamesLock);
+	if (TypeNames.find(slot.Class) == TypeNames.end())
+		TypeNames.emplace(slot.Class, ClassIdToName(Info, slot.Class));
+
+	for (UINT32 i = 0; i < slot.FrameCount; i++) {
+		FunctionID functionId = slot.Frames[i];
+		if (FunctionNames.find(functionId) == FunctionNames.end())
+			FunctionNames.emplace(functionId, functionId != 0 ? FunctionIdToName(Info, functionId) : "[native]");
+	}
+}
+
+void AllocationSampler::Start(ICorProfilerInfo4* pInfo, const std::string& path, UINT64 intervalBytes)
+{
+	Info = pInfo;
+	ReportPath = path;
+	IntervalBytes = (double)intervalBytes;
+
+	if (!path.empty())
+		spdlog::info("Sampling allocations every {} bytes on average to {}", intervalBytes, path);
+}
+
+bool AllocationSampler::Count(SIZE_T size)
+{
+	SamplingState& state = ThreadState;
+	state.Remaining -= (INT64)size;
+	if (state.Remaining > 0)
+		return false;
+
+	// A thread's first allocation only starts its interval
+	bool first = state.Random == 0;
+	if (first)
+		state.Random = (((UINT64)(UINT_PTR)&state * 0x9E3779B97F4A7C15ull) ^ (UINT64)std::chrono::steady_clock::now().time_since_epoch().count()) | 1;
+
+	state.Remaining = NextInterval(state.Random);
+	return !first;
+}
+
+void AllocationSampler::Sample(ClassID classId, SIZE_T size)
+{
+	StackWalk walk;
+	walk.Count = 0;
+
+	// Walking the current thread needs no suspension. A walk ended early reports CORPROF_E_STACKSNAPSHOT_ABORTED, and one that
+	// fails part way still leaves the frames it found, so the frames are used whatever the result
+	if (Info != nullptr)
+		Info->DoStackSnapshot(0, &OnFrame, COR_PRF_SNAPSHOT_DEFAULT, &walk, nullptr, 0);
+
+	Record(classId, size, walk.Frames, walk.Count);
+}
+
+void AllocationSampler::Record(ClassID classId, SIZE_T size, const FunctionID* frames, size_t frameCount)
+{
+	frameCount = std::min(frameCount, (size_t)ALLOCATION_STACK_DEPTH);
+
+	// Each byte is sampled with probability 1/interval, so an object is sampled with probability 1 - e^(-size/interval) and
+	// a sample stands for the reciprocal of that many objects like it
+	double probability = 1.0 - std::exp(-(double)size / IntervalBytes);
+	double objects = probability > 0 ? 1.0 / probability : 1.0;
+	UINT64 objectCount = (UINT64)std::llround(objects);
+	UINT64 byteCount = (UINT64)std::llround(objects * size);
+
+	AllocationSlot* slot = Table.Find(Table.KeyOf(classId, frames, frameCount), [&](AllocationSlot& site) {
+		site.Class = classId;
+		site.FrameCount = (UINT32)frameCount;
+		std::copy(frames, frames + frameCount, site.Frames);
+		NameSlot(site);
+	});
+	if (slot == nullptr)
+		return;
+
+	slot->Samples.fetch_add(1, std::memory_order_relaxed);
+	slot->Objects.fetch_add(objectCount, std::memory_order_relaxed);
+	slot->Bytes.fetch_add(byteCount, std::memory_order_relaxed);
+}
+
+UINT64 AllocationSampler::DroppedSamples()
+{
+	return Table.Dropped();
+}
+
+void AllocationSampler::Snapshot(std::vector<AllocationSite>& sites)
+{
+	sites.clear();
+
+	std::lock_guard<std::mutex> lock(NamesLock);
+	Table.ForEach([&](UINT64 key, const AllocationSlot& slot) {
+		AllocationSite site;
+		site.Class = slot.Class;
+		site.Samples = slot.Samples.load(std::memory_order_relaxed);
+		site.Objects = slot.Objects.load(std::memory_order_relaxed);
+		site.Bytes = slot.Bytes.load(std::memory_order_relaxed);
+
+		auto typeName = TypeNames.find(slot.Class);
+		site.TypeName = typeName != TypeNames.end() ? typeName->second : fmt::format("[type {:x}]", slot.Class);
+
+		// Frames are stored from the allocating method outwards, call sites are written from the outermost frame in
+		for (UINT32 i = slot.FrameCount; i > 0; i--) {
+			FunctionID functionId = slot.Frames[i - 1];
+			auto functionName = FunctionNames.find(functionId);
+			if (!site.CallSite.empty())
+				site.CallSite.push_back(';');
+			site.CallSite += functionName != FunctionNames.end() ? functionName->second : fmt::format("[function {:x}]", functionId);
+		}
+
+		sites.push_back(std::move(site));
+	});
+
+	std::unordered_map<ClassID, UINT64> typeBytes;
+	for (const AllocationSite& site : sites)
+		typeBytes[site.Class] += site.Bytes;
+
+	std::sort(sites.begin(), sites.end(), [&](const AllocationSite& left, const AllocationSite& right) {
+		UINT64 leftType = typeBytes[left.Class], rightType = typeBytes[right.Class];
+		if (leftType != rightType)
+			return leftType > rightType;
+		if (left.Class != right.Class)
+			return left.Class < right.Class;
+		return left.Bytes > right.Bytes;
+	});
+}
+
+static void WriteSite(FILE* file, const AllocationSite& site, const std::string& callSite)
+{
+	fprintf(file, "%s,%s,%llu,%llu,%llu\n", CsvQuote(site.TypeName).c_str(), callSite.c_str(), (unsigned long long)site.Samples,
+		(unsigned long long)site.Objects, (unsigned long long)site.Bytes);
+}
+
+// Writes a line per call site with the type it allocated, after a line for each type totalling all of its call sites which has
+// "*" as its call site. Names are quoted since generic type names contain commas
+static void WriteReport(const std::vector<AllocationSite>& types, const std::vector<AllocationSite>& sites)
+{
+	FILE* file = fopen(ReportPath.c_str(), "w");
+	if (file == nullptr) {
+		spdlog::error("Failed to open allocation file {}", ReportPath);
+		return;
+	}
+
+	fprintf(file, "type,call_site,samples,objects,bytes\n");
+	size_t next = 0;
+	for (const AllocationSite& type : types) {
+		WriteSite(file, type, "*");
+		for (; next < sites.size() && sites[next].Class == type.Class; next++)
+			WriteSite(file, sites[next], CsvQuote(sites[next].CallSite));
+	}
+
+	fclose(file);
+}
+
+void AllocationSampler::Stop()
+{
+	std::vector<AllocationSite> sites;
+	Snapshot(sites);
+
+	// Totals of each type, in the order Snapshot grouped them
+	std::vector<AllocationSite> types;
+	for (const AllocationSite& site : sites) {
+		if (types.empty() || types.back().Class != site.Class)
+			types.push_back({ site.Class, site.TypeName, "*", 0, 0, 0 });
+		types.back().Samples += site.Samples;
+		types.back().Objects += site.Objects;
+		types.back().Bytes += site.Bytes;
+	}
+
+	if (!ReportPath.empty())
+		WriteReport(types, sites);
+
+	for (size_t i = 0; i < types.size() && i < ALLOCATION_LOGGED_TYPES; i++) {
+		spdlog::info("Allocated {}: ~{} object(s), ~{} bytes from {} sample(s)", types[i].TypeName, types[i].Objects,
+			types[i].Bytes, types[i].Samples);
+	}
+
+	UINT64 dropped = DroppedSamples();
+	if (dropped > 0)
+		spdlog::warn("{} allocation sample(s) were dropped because the table of call sites was full", dropped);
+}
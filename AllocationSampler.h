@@ -0,0 +1,55 @@
+#pragma once
+
+#include "stdafx.h"
+#include <string>
+#include <vector>
+
+// Environment variable naming the file sampled allocations are reported to. Allocations aren't tracked unless it's set
+#define ALLOCATION_FILE_VARIABLE "ZEROED_PROFILER_ALLOCATION_FILE"
+
+// Environment variable overriding the mean number of bytes a thread allocates between samples
+#define ALLOCATION_INTERVAL_VARIABLE "ZEROED_PROFILER_ALLOCATION_INTERVAL_BYTES"
+#define ALLOCATION_DEFAULT_INTERVAL_BYTES (512 * 1024)
+
+// Frames kept of each sampled stack, counting out from the allocating method
+#define ALLOCATION_STACK_DEPTH 16
+
+// Distinct type and call site pairs that can be told apart. Samples for new pairs once the table is full are dropped
+#define ALLOCATION_TABLE_SIZE 16384
+
+// Aggregated samples of one type allocated from one call site. Objects and bytes are estimates scaled up from the samples
+struct AllocationSite
+{
+	ClassID Class;
+	std::string TypeName;
+	// The sampled stack from the outermost kept frame to the allocating method, joined by ';'
+	std::string CallSite;
+	UINT64 Samples;
+	UINT64 Objects;
+	UINT64 Bytes;
+};
+
+// Samples allocations from the ObjectAllocated callback. Each thread draws the number of bytes until its next sample from an
+// exponential distribution, so every byte is equally likely to be sampled whatever the size of the object holding it, and
+// the cost of an allocation that isn't sampled is a subtraction. A sampled allocation walks its own stack and is counted in a
+// SiteTable keyed by a hash of its type and stack, so counting is an atomic add. The only lock is taken by the first sample of each call site, to look up its names while
+// the type and functions are certain to still be loaded
+class AllocationSampler
+{
+public:
+	// pInfo may be null, in which case samples aren't named or walked
+	static void Start(ICorProfilerInfo4* pInfo, const std::string& path, UINT64 intervalBytes);
+	// Write the report and log the types allocating the most. Samples taken afterwards are still counted
+	static void Stop();
+
+	// Count an allocation against the calling thread's sampling interval. Returns true if it should be sampled
+	static bool Count(SIZE_T size);
+	// Walk the calling thread's stack and record a sampled allocation from it
+	static void Sample(ClassID classId, SIZE_T size);
+	// Record a sampled allocation. frames run from the allocating method outwards
+	static void Record(ClassID classId, SIZE_T size, const FunctionID* frames, size_t frameCount);
+
+	// Every call site sampled so far, grouped by type with the types allocating the most bytes first
+	static void Snapshot(std::vector<AllocationSite>& sites);
+	static UINT64 DroppedSamples();
+};
@@ -0,0 +1,54 @@
+#include "stdafx.h"
+#include "CallTree.h"
+
+CallTree::CallTree() :
+	m_samples(0)
+{
+	Clear();
+}
+
+void CallTree::Add(const FunctionID* frames, size_t count)
+{
+	UINT32 node = 0;
+	for (size_t i = 0; i < count; i++) {
+		auto inserted = m_children.emplace(EdgeKey{ node, frames[i] }, (UINT32)m_nodes.size());
+		if (inserted.second)
+			m_nodes.push_back({ frames[i], node, 0 });
+		node = inserted.first->second;
+	}
+
+	m_nodes[node].Self++;
+	m_samples++;
+}
+
+void CallTree::Clear()
+{
+	m_nodes.clear();
+	m_nodes.push_back({ 0, 0, 0 });
+	m_children.clear();
+	m_samples = 0;
+}
+
+void CallTree::WriteFolded(FILE* file, const std::function<const std::string&(FunctionID)>& name) const
+{
+	std::vector<UINT32> path;
+	std::string line;
+	for (UINT32 i = 1; i < (UINT32)m_nodes.size(); i++) {
+		if (m_nodes[i].Self == 0)
+			continue;
+
+		// Nodes only link to their parent, so walk up to the root and write the path back out in call order
+		path.clear();
+		for (UINT32 node = i; node != 0; node = m_nodes[node].Parent)
+			path.push_back(node);
+
+		line.clear();
+		for (auto it = path.rbegin(); it != path.rend(); ++it) {
+			if (!line.empty())
+				line.push_back(';');
+			line += name(m_nodes[*it].Function);
+		}
+
+		fprintf(file, "%s %llu\n", line.c_str(), (unsigned long long)m_nodes[i].Self);
+	}
+}
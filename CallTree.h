@@ -0,0 +1,52 @@
+#pragma once
+
+#include "stdafx.h"
+#include <functional>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+// Aggregates sampled stacks into a tree of call paths so a stack seen many times costs one count rather than a copy of its
+// frames. Each node is one function reached through a particular path from the root and counts the samples whose leaf it was
+class CallTree
+{
+public:
+	CallTree();
+
+	// Count a sample. frames run from the outermost call to the leaf
+	void Add(const FunctionID* frames, size_t count);
+	void Clear();
+
+	UINT64 SampleCount() const { return m_samples; }
+	size_t NodeCount() const { return m_nodes.size() - 1; }
+
+	// Write a "root;caller;leaf count" line for every path some sample ended at, the folded format read by flamegraph.pl
+	// and speedscope. name is called for every frame of every line so should be cheap
+	void WriteFolded(FILE* file, const std::function<const std::string&(FunctionID)>& name) const;
+
+private:
+	struct Node
+	{
+		FunctionID Function;
+		UINT32 Parent;
+		UINT64 Self;
+	};
+
+	struct EdgeKey
+	{
+		UINT32 Parent;
+		FunctionID Function;
+
+		bool operator==(const EdgeKey& other) const { return Parent == other.Parent && Function == other.Function; }
+	};
+
+	struct EdgeHash
+	{
+		size_t operator()(const EdgeKey& key) const { return std::hash<FunctionID>()(key.Function) ^ ((size_t)key.Parent * 0x9E3779B9u); }
+	};
+
+	// Node 0 is the root, which stands for no function
+	std::vector<Node> m_nodes;
+	std::unordered_map<EdgeKey, UINT32, EdgeHash> m_children;
+	UINT64 m_samples;
+};
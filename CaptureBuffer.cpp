@@ -0,0 +1,205 @@
+#include "stdafx.h"
+#include "CaptureBuffer.h"
+#include "AdaptiveCapture.h"
+#include "Statistics.h"
+#include <algorithm>
+#include <atomic>
+#include <cstdio>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+// Records held per thread before they're written out. A power of two so positions wrap around the ring cheaply
+#define CAPTURE_BUFFER_RECORDS 4096
+
+// A ring of records written by one thread and drained by whichever thread flushes it. Only the owner advances Written and
+// only a flush, with CaptureLock held, advances Flushed, so the owner never waits for a flush from another thread
+struct ThreadCaptureBuffer
+{
+	ThreadCaptureBuffer();
+	~ThreadCaptureBuffer();
+
+	std::unique_ptr<CaptureRecord[]> Records;
+	// Records recorded so far, stored with release once a record is complete so a flush never reads one half written
+	std::atomic<size_t> Written;
+	// Records written out so far, stored with release once they've been copied so the owner can reuse their slots
+	std::atomic<size_t> Flushed;
+};
+
+// Guards the capture file, the list of live thread buffers and every buffer's Flushed position
+static std::mutex CaptureLock;
+static FILE* CaptureFile = nullptr;
+static std::vector<ThreadCaptureBuffer*> ThreadBuffers;
+
+static thread_local ThreadCaptureBuffer LocalBuffer;
+
+static const int RecordsStat = Statistics::Counter("capture.records");
+// Records flushed with no capture file open. Those flushed as their thread exits aren't counted, since the thread's
+// statistics may already have been retired
+static const int DiscardedStat = Statistics::Counter("capture.discarded");
+
+// Must be called with CaptureLock held. Returns how many records were pending
+static size_t WriteRecords(ThreadCaptureBuffer* buffer)
+{
+	size_t written = buffer->Written.load(std::memory_order_acquire);
+	size_t flushed = buffer->Flushed.load(std::memory_order_relaxed);
+	size_t count = written - flushed;
+
+	if (CaptureFile != nullptr && count > 0) {
+		// Pending records wrap around the end of the ring at most once
+		size_t first = flushed % CAPTURE_BUFFER_RECORDS;
+		size_t firstCount = std::min(count, CAPTURE_BUFFER_RECORDS - first);
+		fwrite(&buffer->Records[first], sizeof(CaptureRecord), firstCount, CaptureFile);
+		if (firstCount < count)
+			fwrite(&buffer->Records[0], sizeof(CaptureRecord), count - firstCount, CaptureFile);
+	}
+
+	buffer->Flushed.store(written, std::memory_order_release);
+	return count;
+}
+
+ThreadCaptureBuffer::ThreadCaptureBuffer() :
+	Records(new CaptureRecord[CAPTURE_BUFFER_RECORDS]),
+	Written(0),
+	Flushed(0) {
+	std::lock_guard<std::mutex> lock(CaptureLock);
+	ThreadBuffers.push_back(this);
+}
+
+ThreadCaptureBuffer::~ThreadCaptureBuffer()
+{
+	std::lock_guard<std::mutex> lock(CaptureLock);
+	WriteRecords(this);
+
+	for (size_t i = 0; i < ThreadBuffers.size(); i++) {
+		if (ThreadBuffers[i] == this) {
+			ThreadBuffers.erase(ThreadBuffers.begin() + i);
+			break;
+		}
+	}
+}
+
+HRESULT CaptureBuffer::Open(const std::string& path)
+{
+	std::lock_guard<std::mutex> lock(CaptureLock);
+	if (CaptureFile != nullptr)
+		fclose(CaptureFile);
+
+	CaptureFile = fopen(path.c_str(), "wb");
+	if (CaptureFile == nullptr) {
+		spdlog::error("Failed to open capture file {}", path);
+		return E_FAIL;
+	}
+
+	spdlog::info("Writing captured arguments to {}", path);
+	return S_OK;
+}
+
+void CaptureBuffer::Close()
+{
+	FlushAll();
+
+	std::lock_guard<std::mutex> lock(CaptureLock);
+	if (CaptureFile != nullptr) {
+		fclose(CaptureFile);
+		CaptureFile = nullptr;
+	}
+}
+
+void CaptureBuffer::Record(int hookId, int argCount, const INT64* args)
+{
+	ThreadCaptureBuffer& buffer = LocalBuffer;
+	Statistics::Count(RecordsStat);
+
+	// A record is always flushed once the ring fills, so there's a free slot on entry
+	size_t written = buffer.Written.load(std::memory_order_relaxed);
+	CaptureRecord& record = buffer.Records[written % CAPTURE_BUFFER_RECORDS];
+	record.HookId = hookId;
+	record.ArgCount = argCount;
+	for (int i = 0; i < argCount; i++)
+		record.Args[i] = args[i];
+	buffer.Written.store(written + 1, std::memory_order_release);
+
+	if (written + 1 - buffer.Flushed.load(std::memory_order_acquire) == CAPTURE_BUFFER_RECORDS) {
+		std::lock_guard<std::mutex> lock(CaptureLock);
+		size_t count = WriteRecords(&buffer);
+		if (CaptureFile == nullptr)
+			Statistics::Count(DiscardedStat, count);
+	}
+}
+
+void CaptureBuffer::FlushAll()
+{
+	std::lock_guard<std::mutex> lock(CaptureLock);
+	for (ThreadCaptureBuffer* buffer : ThreadBuffers) {
+		size_t count = WriteRecords(buffer);
+		if (CaptureFile == nullptr)
+			Statistics::Count(DiscardedStat, count);
+	}
+
+	if (CaptureFile != nullptr)
+		fflush(CaptureFile);
+}
+
+// calli targets, one per argument count. Arguments are widened to 64 bits by the injected IL
+static void STDMETHODCALLTYPE Capture0(int hookId)
+{
+	if (!AdaptiveCapture::ShouldCapture(hookId))
+		return;
+
+	CaptureBuffer::Record(hookId, 0, nullptr);
+}
+
+static void STDMETHODCALLTYPE Capture1(int hookId, INT64 arg0)
+{
+	if (!AdaptiveCapture::ShouldCapture(hookId))
+		return;
+
+	INT64 args[] = { arg0 };
+	CaptureBuffer::Record(hookId, 1, args);
+}
+
+static void STDMETHODCALLTYPE Capture2(int hookId, INT64 arg0, INT64 arg1)
+{
+	if (!AdaptiveCapture::ShouldCapture(hookId))
+		return;
+
+	INT64 args[] = { arg0, arg1 };
+	CaptureBuffer::Record(hookId, 2, args);
+}
+
+static void STDMETHODCALLTYPE Capture3(int hookId, INT64 arg0, INT64 arg1, INT64 arg2)
+{
+	if (!AdaptiveCapture::ShouldCapture(hookId))
+		return;
+
+	INT64 args[] = { arg0, arg1, arg2 };
+	CaptureBuffer::Record(hookId, 3, args);
+}
+
+static void STDMETHODCALLTYPE Capture4(int hookId, INT64 arg0, INT64 arg1, INT64 arg2, INT64 arg3)
+{
+	if (!AdaptiveCapture::ShouldCapture(hookId))
+		return;
+
+	INT64 args[] = { arg0, arg1, arg2, arg3 };
+	CaptureBuffer::Record(hookId, 4, args);
+}
+
+void* CaptureBuffer::GetCaptureFunction(int argCount)
+{
+	switch (argCount) {
+	case 0:
+		return (void*)&Capture0;
+	case 1:
+		return (void*)&Capture1;
+	case 2:
+		return (void*)&Capture2;
+	case 3:
+		return (void*)&Capture3;
+	case 4:
+		return (void*)&Capture4;
+	default:
+		return nullptr;
+	}
+}
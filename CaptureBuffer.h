@@ -0,0 +1,54 @@
+#pragma once
+
+#include "stdafx.h"
+#include <string>
+
+// Environment variable naming the file captured arguments are written to
+#define CAPTURE_FILE_VARIABLE "ZEROED_PROFILER_CAPTURE_FILE"
+
+// Most arguments a single inline capture can record
+#define MAX_CAPTURE_ARGS 4
+
+// Hook IDs below zero mark records the profiler writes itself rather than a hook's captures
+//
+// A garbage collection, written once the runtime resumes after it. Args are the wall clock time it finished in nanoseconds
+// since the Unix epoch, (GC index << 16) | (1 << 8 if induced) | the oldest generation collected, the time the runtime was
+// paused for it in nanoseconds and the bytes which survived it
+#define GC_CAPTURE_HOOK_ID -1
+// Written straight after each GC record. Args are the bytes in generations 0, 1 and 2 and in the large and pinned object
+// heaps once the GC finished
+#define GC_HEAP_CAPTURE_HOOK_ID -2
+// Written for each of the sites exceptions are thrown from most when the profiler stops, most thrown first. Args are the
+// site's ID in the exception report, the number of exceptions and the total and longest time from throw to catch in nanoseconds
+#define EXCEPTION_CAPTURE_HOOK_ID -3
+// Written whenever adaptive capture throttles or restores a hook. Args are the wall clock time in nanoseconds since the
+// Unix epoch, the hook's ID, its new sampling period, where 1 captures every call, N 1 in N and 0 none, and the calls per
+// second which caused the switch. Records from other threads may be written before or after it
+#define ADAPTIVE_CAPTURE_HOOK_ID -4
+
+// A captured invocation, as written to the capture file
+struct CaptureRecord
+{
+	INT32 HookId;
+	INT32 ArgCount;
+	INT64 Args[MAX_CAPTURE_ARGS];
+};
+
+// Collects records from hooked methods into a buffer owned by the calling thread so the hot path never takes a lock.
+// Buffers are written to the capture file when they fill, when their thread exits and when the profiler shuts down.
+// If no capture file has been opened records are still buffered but discarded when flushed
+class CaptureBuffer
+{
+public:
+	static HRESULT Open(const std::string& path);
+	static void Close();
+
+	static void Record(int hookId, int argCount, const INT64* args);
+
+	// Write out every thread's pending records. Threads may keep recording while it runs, anything recorded after a thread's
+	// buffer was written out waits for the next flush
+	static void FlushAll();
+
+	// Native function the injected calli targets for a hook capturing argCount arguments, or nullptr if argCount is unsupported
+	static void* GetCaptureFunction(int argCount);
+};
@@ -0,0 +1,131 @@
+#include "stdafx.h"
+#include "ControlChannel.h"
+#include "HookDispatch.h"
+#include <chrono>
+#include <fstream>
+#include <sstream>
+
+// Returns true if the file asks for the profiler to detach
+static bool ApplyControl(const std::string& contents)
+{
+	bool detach = false;
+
+	// Work out the final states before touching the live flags so a hook being kept off is never briefly switched on
+	bool states[MAX_HOOKS];
+	for (bool& initial : states)
+		initial = true;
+
+	std::istringstream lines(contents);
+	std::string line;
+	while (std::getline(lines, line)) {
+		size_t comment = line.find('#');
+		if (comment != std::string::npos)
+			line.erase(comment);
+
+		std::istringstream fields(line);
+		std::string hook, state;
+		if (!(fields >> hook))
+			continue;
+
+		if (hook == "detach") {
+			detach = true;
+			continue;
+		}
+
+		if (!(fields >> state) || (state != "on" && state != "off")) {
+			spdlog::error("Ignoring control line \"{}\", expected \"<hook ID> on|off\"", line);
+			continue;
+		}
+
+		bool enabled = state == "on";
+		if (hook == "*") {
+			for (bool& hookState : states)
+				hookState = enabled;
+			continue;
+		}
+
+		char* end = nullptr;
+		long hookId = strtol(hook.c_str(), &end, 10);
+		if (end == hook.c_str() || *end != '\0' || hookId < 0 || hookId >= MAX_HOOKS) {
+			spdlog::error("Ignoring control line \"{}\", invalid hook ID", line);
+			continue;
+		}
+
+		states[hookId] = enabled;
+	}
+
+	for (int i = 0; i < MAX_HOOKS; i++)
+		SetHookEnabled(i, states[i]);
+
+	return detach;
+}
+
+ControlChannel::ControlChannel() :
+	m_stopping(false) {
+}
+
+ControlChannel::~ControlChannel()
+{
+	Stop();
+}
+
+void ControlChannel::Start(const std::string& path, std::function<bool()> detachRequested)
+{
+	m_path = path;
+	m_detachRequested = detachRequested;
+	m_stopping = false;
+
+	// Applied synchronously so hooks start in the requested state before any managed code runs. A detach left over
+	// from a previous session is ignored, only one written while we're running counts
+	if (Poll())
+		spdlog::warn("Ignoring detach in control file {} written before the profiler started", m_path);
+
+	m_thread = std::thread(&ControlChannel::Run, this);
+}
+
+void ControlChannel::Stop()
+{
+	if (!m_thread.joinable())
+		return;
+
+	{
+		std::lock_guard<std::mutex> lock(m_lock);
+		m_stopping = true;
+	}
+	m_signal.notify_one();
+	m_thread.join();
+}
+
+void ControlChannel::Run()
+{
+	std::unique_lock<std::mutex> lock(m_lock);
+	while (!m_signal.wait_for(lock, std::chrono::milliseconds(CONTROL_POLL_INTERVAL_MS), [this] { return m_stopping; })) {
+		lock.unlock();
+		if (Poll()) {
+			// Detaching unloads the profiler, so stop watching the file once it's under way. The handler runs on this
+			// thread since RequestProfilerDetach must be called from a thread the profiler created
+			if (m_detachRequested && m_detachRequested())
+				return;
+			spdlog::warn("Detach requested through {} didn't go ahead, still watching the file", m_path);
+		}
+		lock.lock();
+	}
+}
+
+bool ControlChannel::Poll()
+{
+	std::string contents;
+	std::ifstream file(m_path);
+	if (file) {
+		std::ostringstream buffer;
+		buffer << file.rdbuf();
+		contents = buffer.str();
+	}
+
+	if (contents == m_contents)
+		return false;
+
+	spdlog::info("Control file {} changed, applying hook states", m_path);
+	m_contents = contents;
+	return ApplyControl(contents);
+}
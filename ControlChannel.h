@@ -0,0 +1,43 @@
+#pragma once
+
+#include "stdafx.h"
+#include <condition_variable>
+#include <functional>
+#include <mutex>
+#include <string>
+#include <thread>
+
+// Environment variable naming the file hooks are switched on and off through
+#define CONTROL_FILE_VARIABLE "ZEROED_PROFILER_CONTROL_FILE"
+
+// How often the control file is checked for changes
+#define CONTROL_POLL_INTERVAL_MS 250
+
+// Switches hooks on and off at runtime from a control file. Each line is "<hook ID> on|off" or "* on|off" and '#' starts
+// a comment. Whenever the file changes every hook is re-enabled and the lines are applied in order, so "* off" followed by
+// "3 on" leaves only hook 3 running. A missing or empty file leaves every hook enabled. A "detach" line asks for the
+// profiler to be removed from the process
+class ControlChannel
+{
+public:
+	ControlChannel();
+	~ControlChannel();
+
+	// Apply the file's current contents, then keep watching it from a background thread. detachRequested is called
+	// from that thread when a detach is written to the file, and returns whether the detach went ahead. The file keeps
+	// being watched if it didn't
+	void Start(const std::string& path, std::function<bool()> detachRequested);
+	void Stop();
+
+private:
+	void Run();
+	bool Poll();
+
+	std::string m_path;
+	std::string m_contents;
+	std::function<bool()> m_detachRequested;
+	std::thread m_thread;
+	std::mutex m_lock;
+	std::condition_variable m_signal;
+	bool m_stopping;
+};
@@ -0,0 +1,232 @@
+#include "stdafx.h"
+#include "ExceptionTracker.h"
+#include "CaptureBuffer.h"
+#include "SiteTable.h"
+#include "Utils.h"
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <mutex>
+#include <unordered_map>
+
+// Slots probed past the one a key hashes to before an exception is dropped
+#define EXCEPTION_MAX_PROBES 32
+
+// Sites logged by Stop
+#define EXCEPTION_LOGGED_SITES 10
+
+struct ExceptionSlot
+{
+	ClassID Class;
+	FunctionID Thrower;
+	FunctionID Catcher;
+	std::atomic<UINT64> Count;
+	std::atomic<UINT64> TotalNs;
+	std::atomic<UINT64> MaxNs;
+};
+
+struct InFlightException
+{
+	ClassID Class;
+	// 0 until the search phase enters its first method
+	FunctionID Thrower;
+	INT64 ThrownNs;
+};
+
+// Zero initialised so the callbacks never run a constructor for it
+struct ExceptionStack
+{
+	InFlightException Entries[EXCEPTION_MAX_NESTED];
+	int Count;
+};
+
+static SiteTable<ExceptionSlot, EXCEPTION_TABLE_SIZE, EXCEPTION_MAX_PROBES> Table;
+// Exceptions pushed off a thread's full stack of exceptions in flight
+static std::atomic<UINT64> Dropped{ 0 };
+
+static ICorProfilerInfo4* Info = nullptr;
+static std::string ReportPath;
+
+static std::mutex NamesLock;
+static std::unordered_map<ClassID, std::string> TypeNames;
+static std::unordered_map<FunctionID, std::string> FunctionNames;
+
+static thread_local ExceptionStack ThreadExceptions;
+
+static INT64 Now()
+{
+	return (INT64)std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+// Must be called with NamesLock held
+static void NameFunction(FunctionID functionId)
+{
+	if (FunctionNames.find(functionId) == FunctionNames.end())
+		FunctionNames.emplace(functionId, functionId != 0 ? FunctionIdToName(Info, functionId) : "[native]");
+}
+
+// Look up the names of a newly claimed slot's type and methods while they're certain to still be loaded
+static void NameSlot(const ExceptionSlot& slot)
+{
+	if (Info == nullptr)
+		return;
+
+	std::lock_guard<std::mutex> lock(NamesLock);
+	if (TypeNames.find(slot.Class) == TypeNames.end())
+		TypeNames.emplace(slot.Class, ClassIdToName(Info, slot.Class));
+
+	NameFunction(slot.Thrower);
+	NameFunction(slot.Catcher);
+}
+
+static std::string FindName(const std::unordered_map<UINT_PTR, std::string>& names, UINT_PTR id, const char* kind)
+{
+	auto found = names.find(id);
+	return found != names.end() ? found->second : fmt::format("[{} {:x}]", kind, id);
+}
+
+void ExceptionTracker::Start(ICorProfilerInfo4* pInfo, const std::string& path)
+{
+	Info = pInfo;
+	ReportPath = path;
+
+	if (!path.empty())
+		spdlog::info("Tracking exceptions to {}", path);
+}
+
+void ExceptionTracker::Thrown(ClassID classId)
+{
+	ExceptionStack& stack = ThreadExceptions;
+
+	// A full stack most likely holds exceptions that were replaced rather than caught, so the oldest makes way
+	if (stack.Count == EXCEPTION_MAX_NESTED) {
+		std::copy(stack.Entries + 1, stack.Entries + stack.Count, stack.Entries);
+		stack.Count--;
+		Dropped.fetch_add(1, std::memory_order_relaxed);
+	}
+
+	InFlightException& entry = stack.Entries[stack.Count++];
+	entry.Class = classId;
+	entry.Thrower = 0;
+	entry.ThrownNs = Now();
+}
+
+void ExceptionTracker::SearchFunctionEnter(FunctionID functionId)
+{
+	ExceptionStack& stack = ThreadExceptions;
+	if (stack.Count > 0 && stack.Entries[stack.Count - 1].Thrower == 0)
+		stack.Entries[stack.Count - 1].Thrower = functionId;
+}
+
+void ExceptionTracker::CatcherEnter(FunctionID functionId)
+{
+	// The innermost exception is the one being caught, an outer one can't be caught until it is
+	ExceptionStack& stack = ThreadExceptions;
+	if (stack.Count == 0)
+		return;
+
+	InFlightException entry = stack.Entries[--stack.Count];
+	if (entry.Class != 0)
+		Record(entry.Class, entry.Thrower, functionId, (UINT64)(Now() - entry.ThrownNs));
+}
+
+void ExceptionTracker::Record(ClassID classId, FunctionID thrower, FunctionID catcher, UINT64 durationNs)
+{
+	FunctionID functions[] = { thrower, catcher };
+	ExceptionSlot* slot = Table.Find(Table.KeyOf(classId, functions, _countof(functions)), [&](ExceptionSlot& site) {
+		site.Class = classId;
+		site.Thrower = thrower;
+		site.Catcher = catcher;
+		NameSlot(site);
+	});
+	if (slot == nullptr)
+		return;
+
+	slot->Count.fetch_add(1, std::memory_order_relaxed);
+	slot->TotalNs.fetch_add(durationNs, std::memory_order_relaxed);
+	UINT64 max = slot->MaxNs.load(std::memory_order_relaxed);
+	while (durationNs > max && !slot->MaxNs.compare_exchange_weak(max, durationNs, std::memory_order_relaxed)) {
+	}
+}
+
+UINT64 ExceptionTracker::DroppedExceptions()
+{
+	return Dropped.load(std::memory_order_relaxed) + Table.Dropped();
+}
+
+void ExceptionTracker::Snapshot(std::vector<ExceptionSite>& sites)
+{
+	sites.clear();
+
+	std::lock_guard<std::mutex> lock(NamesLock);
+	Table.ForEach([&](UINT64 key, const ExceptionSlot& slot) {
+		ExceptionSite site;
+		site.Id = key;
+		site.Class = slot.Class;
+		site.Thrower = slot.Thrower;
+		site.Catcher = slot.Catcher;
+		site.TypeName = FindName(TypeNames, slot.Class, "type");
+		site.ThrowerName = FindName(FunctionNames, slot.Thrower, "function");
+		site.CatcherName = FindName(FunctionNames, slot.Catcher, "function");
+		site.Count = slot.Count.load(std::memory_order_relaxed);
+		site.TotalNs = slot.TotalNs.load(std::memory_order_relaxed);
+		site.MaxNs = slot.MaxNs.load(std::memory_order_relaxed);
+		sites.push_back(std::move(site));
+	});
+
+	std::sort(sites.begin(), sites.end(), [](const ExceptionSite& left, const ExceptionSite& right) {
+		if (left.Count != right.Count)
+			return left.Count > right.Count;
+		return left.TotalNs > right.TotalNs;
+	});
+}
+
+// Writes a line per site, the ones thrown from most first. Names are quoted since generic names contain commas
+static void WriteReport(const std::vector<ExceptionSite>& sites)
+{
+	FILE* file = fopen(ReportPath.c_str(), "w");
+	if (file == nullptr) {
+		spdlog::error("Failed to open exception file {}", ReportPath);
+		return;
+	}
+
+	fprintf(file, "site,type,thrown_from,caught_in,count,total_us,mean_us,max_us\n");
+	for (const ExceptionSite& site : sites) {
+		fprintf(file, "%lld,%s,%s,%s,%llu,%.1f,%.1f,%.1f\n", (long long)site.Id, CsvQuote(site.TypeName).c_str(),
+			CsvQuote(site.ThrowerName).c_str(), CsvQuote(site.CatcherName).c_str(), (unsigned long long)site.Count,
+			site.TotalNs / 1e3, site.TotalNs / 1e3 / site.Count, site.MaxNs / 1e3);
+	}
+
+	fclose(file);
+}
+
+void ExceptionTracker::Stop()
+{
+	std::vector<ExceptionSite> sites;
+	Snapshot(sites);
+
+	if (!ReportPath.empty())
+		WriteReport(sites);
+
+	UINT64 count = 0, totalNs = 0;
+	for (const ExceptionSite& site : sites) {
+		count += site.Count;
+		totalNs += site.TotalNs;
+	}
+
+	spdlog::info("{} exception(s) caught from {} site(s), {:.3f} ms between throwing and catching them", count, sites.size(), totalNs / 1e6);
+	for (size_t i = 0; i < sites.size() && i < EXCEPTION_LOGGED_SITES; i++) {
+		spdlog::info("Exception {} thrown from {} caught in {}: {} time(s), {:.3f} ms", sites[i].TypeName, sites[i].ThrowerName,
+			sites[i].CatcherName, sites[i].Count, sites[i].TotalNs / 1e6);
+	}
+
+	// IDs are written as signed so they match the report however the capture file is read
+	for (size_t i = 0; i < sites.size() && i < EXCEPTION_CAPTURED_SITES; i++) {
+		INT64 args[] = { (INT64)sites[i].Id, (INT64)sites[i].Count, (INT64)sites[i].TotalNs, (INT64)sites[i].MaxNs };
+		CaptureBuffer::Record(EXCEPTION_CAPTURE_HOOK_ID, _countof(args), args);
+	}
+
+	UINT64 dropped = DroppedExceptions();
+	if (dropped > 0)
+		spdlog::warn("{} exception(s) were dropped because the table of sites was full or too many were in flight on a thread", dropped);
+}
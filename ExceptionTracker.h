@@ -0,0 +1,64 @@
+#pragma once
+
+#include "stdafx.h"
+#include <string>
+#include <vector>
+
+// Environment variable naming the file exception sites are reported to. Exceptions aren't tracked unless it's set
+#define EXCEPTION_FILE_VARIABLE "ZEROED_PROFILER_EXCEPTION_FILE"
+
+// Exceptions in flight at once on one thread, eg. one thrown from a finally block while another unwinds through it
+#define EXCEPTION_MAX_NESTED 4
+
+// Distinct type, throw site and catch site triples that can be told apart. Exceptions at new sites once the table is full
+// are dropped
+#define EXCEPTION_TABLE_SIZE 4096
+
+// Sites written to the capture file by Stop, the ones thrown from most first
+#define EXCEPTION_CAPTURED_SITES 16
+
+// Aggregated exceptions of one type thrown from one method and caught in another. Times are in nanoseconds
+struct ExceptionSite
+{
+	// Identifies the site in the report and in EXCEPTION_CAPTURE_HOOK_ID records
+	UINT64 Id;
+	ClassID Class;
+	FunctionID Thrower;
+	FunctionID Catcher;
+	std::string TypeName;
+	std::string ThrowerName;
+	std::string CatcherName;
+	UINT64 Count;
+	UINT64 TotalNs;
+	UINT64 MaxNs;
+};
+
+// Tracks exceptions from the runtime's exception callbacks. ExceptionThrown starts an exception on the throwing thread, the
+// first method its search phase visits is where it was thrown from, and ExceptionCatcherEnter ends it once both passes
+// have found the handler and unwound to it. The time between the two is the cost of handling it. Each thread keeps its
+// exceptions in flight on a small stack of its own, and caught exceptions are counted into a SiteTable, so threads
+// throwing at once only meet on atomic adds. Rethrowing counts as a new exception thrown from the method doing it. An
+// exception replaced by another thrown from a finally block is never caught, so it's forgotten once newer exceptions push
+// it off the thread's stack
+class ExceptionTracker
+{
+public:
+	// pInfo is used to name types and methods, and may be null
+	static void Start(ICorProfilerInfo4* pInfo, const std::string& path);
+	// Write the report, log the sites thrown from most and write them to the capture file. Exceptions caught afterwards are
+	// still counted
+	static void Stop();
+
+	// A classId of 0, for an exception whose type couldn't be read, still takes its place on the thread's stack so its catch
+	// isn't mistaken for an outer exception's, but it's never counted
+	static void Thrown(ClassID classId);
+	static void SearchFunctionEnter(FunctionID functionId);
+	static void CatcherEnter(FunctionID functionId);
+
+	// Count a caught exception
+	static void Record(ClassID classId, FunctionID thrower, FunctionID catcher, UINT64 durationNs);
+
+	// Every site seen so far, the ones thrown from most first
+	static void Snapshot(std::vector<ExceptionSite>& sites);
+	static UINT64 DroppedExceptions();
+};
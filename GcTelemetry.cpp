@@ -0,0 +1,202 @@
+#include "stdafx.h"
+#include "GcTelemetry.h"
+#include "CaptureBuffer.h"
+#include <algorithm>
+#include <chrono>
+#include <mutex>
+#include <vector>
+
+// Heap sizes recorded per GC. Generations past 2 are the large object heap and, from .NET 5, the pinned object heap, which
+// share the last column
+#define GC_HEAP_COLUMNS 4
+
+struct GcRecord
+{
+	UINT64 Index;
+	int Generation;
+	bool Induced;
+	std::chrono::steady_clock::time_point Started;
+	INT64 FinishedNs;
+	UINT64 DurationNs;
+	UINT64 PauseNs;
+	UINT64 SurvivedBytes;
+	INT64 HeapBytes[GC_HEAP_COLUMNS];
+};
+
+static std::mutex GcLock;
+static ICorProfilerInfo4* Info = nullptr;
+
+static bool Recording = false;
+
+static GcRecord InProgress[GC_MAX_NESTED];
+static int InProgressCount = 0;
+// GCs started past GC_MAX_NESTED, whose finish is ignored
+static int SkippedCount = 0;
+// Finished GCs wait for the runtime to resume so their whole pause is known
+static std::vector<GcRecord> Finished;
+
+static bool Suspended = false;
+static std::chrono::steady_clock::time_point SuspendStart;
+
+static UINT64 GcCount = 0;
+static UINT64 GenerationCounts[3];
+static UINT64 InducedCount = 0;
+static UINT64 TotalPauseNs = 0;
+static UINT64 MaxPauseNs = 0;
+
+static UINT64 NanosecondsSince(std::chrono::steady_clock::time_point start)
+{
+	return (UINT64)std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - start).count();
+}
+
+// Must be called with GcLock held
+static void ReadHeapSizes(INT64 heapBytes[GC_HEAP_COLUMNS])
+{
+	std::fill(heapBytes, heapBytes + GC_HEAP_COLUMNS, 0);
+
+	COR_PRF_GC_GENERATION_RANGE ranges[64];
+	ULONG rangeCount = 0;
+	if (FAILED(Info->GetGenerationBounds(_countof(ranges), &rangeCount, ranges)))
+		return;
+
+	// Heaps split into more ranges than fit are read again in full
+	std::vector<COR_PRF_GC_GENERATION_RANGE> allRanges;
+	COR_PRF_GC_GENERATION_RANGE* pRanges = ranges;
+	if (rangeCount > _countof(ranges)) {
+		allRanges.resize(rangeCount);
+		if (FAILED(Info->GetGenerationBounds(rangeCount, &rangeCount, allRanges.data())))
+			return;
+		rangeCount = std::min(rangeCount, (ULONG)allRanges.size());
+		pRanges = allRanges.data();
+	}
+
+	for (ULONG i = 0; i < rangeCount; i++)
+		heapBytes[std::min((int)pRanges[i].generation, GC_HEAP_COLUMNS - 1)] += (INT64)pRanges[i].rangeLength;
+}
+
+// Must be called with GcLock held
+static void WriteRecord(const GcRecord& gc)
+{
+	INT64 args[] = {
+		gc.FinishedNs,
+		(INT64)((gc.Index << 16) | (gc.Induced ? 1 << 8 : 0) | (UINT64)gc.Generation),
+		(INT64)gc.PauseNs,
+		(INT64)gc.SurvivedBytes,
+	};
+	CaptureBuffer::Record(GC_CAPTURE_HOOK_ID, _countof(args), args);
+	CaptureBuffer::Record(GC_HEAP_CAPTURE_HOOK_ID, GC_HEAP_COLUMNS, gc.HeapBytes);
+
+	GenerationCounts[gc.Generation]++;
+	InducedCount += gc.Induced ? 1 : 0;
+	TotalPauseNs += gc.PauseNs;
+	MaxPauseNs = std::max(MaxPauseNs, gc.PauseNs);
+
+	spdlog::debug("GC {} of generation {}{} took {} us with the runtime paused for {} us, {} bytes survived", gc.Index, gc.Generation,
+		gc.Induced ? " (induced)" : "", gc.DurationNs / 1000, gc.PauseNs / 1000, gc.SurvivedBytes);
+}
+
+void GcTelemetry::Start(ICorProfilerInfo4* pInfo, bool countSurvivors)
+{
+	std::lock_guard<std::mutex> lock(GcLock);
+	Info = pInfo;
+	Recording = true;
+	spdlog::info("Recording garbage collections to the capture file{}", countSurvivors ? " along with the bytes surviving them" : "");
+}
+
+void GcTelemetry::Stop()
+{
+	std::lock_guard<std::mutex> lock(GcLock);
+	if (!Recording)
+		return;
+
+	// GCs which finished without a resume being seen, eg. while the runtime is shutting down, are written without their pause
+	for (const GcRecord& gc : Finished)
+		WriteRecord(gc);
+	Finished.clear();
+
+	UINT64 written = GenerationCounts[0] + GenerationCounts[1] + GenerationCounts[2];
+	spdlog::info("{} garbage collection(s): {} gen 0, {} gen 1, {} gen 2, {} induced. Paused for {:.3f} ms in total, {:.3f} ms at most",
+		written, GenerationCounts[0], GenerationCounts[1], GenerationCounts[2], InducedCount, TotalPauseNs / 1e6, MaxPauseNs / 1e6);
+	Recording = false;
+}
+
+void GcTelemetry::SuspendStarted(COR_PRF_SUSPEND_REASON reason)
+{
+	if (reason != COR_PRF_SUSPEND_FOR_GC && reason != COR_PRF_SUSPEND_FOR_GC_PREP)
+		return;
+
+	std::lock_guard<std::mutex> lock(GcLock);
+	if (!Recording)
+		return;
+	Suspended = true;
+	SuspendStart = std::chrono::steady_clock::now();
+}
+
+void GcTelemetry::ResumeFinished()
+{
+	std::lock_guard<std::mutex> lock(GcLock);
+	if (!Suspended)
+		return;
+	Suspended = false;
+
+	// A background GC runs across several pauses, and is charged for each along with any foreground GCs run inside it
+	UINT64 pauseNs = NanosecondsSince(SuspendStart);
+	for (int i = 0; i < InProgressCount; i++)
+		InProgress[i].PauseNs += pauseNs;
+
+	for (GcRecord& gc : Finished) {
+		gc.PauseNs += pauseNs;
+		WriteRecord(gc);
+	}
+	Finished.clear();
+}
+
+void GcTelemetry::GcStarted(int generationCount, const BOOL generationCollected[], COR_PRF_GC_REASON reason)
+{
+	std::lock_guard<std::mutex> lock(GcLock);
+	if (!Recording)
+		return;
+	GcCount++;
+	if (InProgressCount == GC_MAX_NESTED) {
+		spdlog::warn("More than {} GCs in progress, GC {} won't be recorded", GC_MAX_NESTED, GcCount);
+		SkippedCount++;
+		return;
+	}
+
+	// The large and pinned object heaps are only collected along with generation 2
+	GcRecord& gc = InProgress[InProgressCount++];
+	gc = {};
+	gc.Index = GcCount;
+	for (int i = 0; i < generationCount && i < 3; i++) {
+		if (generationCollected[i])
+			gc.Generation = i;
+	}
+	gc.Induced = reason == COR_PRF_GC_INDUCED;
+	gc.Started = std::chrono::steady_clock::now();
+}
+
+void GcTelemetry::Survived(UINT64 bytes)
+{
+	std::lock_guard<std::mutex> lock(GcLock);
+	if (InProgressCount > 0)
+		InProgress[InProgressCount - 1].SurvivedBytes += bytes;
+}
+
+void GcTelemetry::GcFinished()
+{
+	std::lock_guard<std::mutex> lock(GcLock);
+	if (SkippedCount > 0) {
+		SkippedCount--;
+		return;
+	}
+	if (InProgressCount == 0)
+		return;
+
+	GcRecord gc = InProgress[--InProgressCount];
+	gc.DurationNs = NanosecondsSince(gc.Started);
+	gc.FinishedNs = (INT64)std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::system_clock::now().time_since_epoch()).count();
+	if (Info != nullptr)
+		ReadHeapSizes(gc.HeapBytes);
+
+	Finished.push_back(gc);
+}
@@ -0,0 +1,31 @@
+#pragma once
+
+#include "stdafx.h"
+
+// Environment variable which when "1" records every garbage collection into the capture file
+#define GC_TELEMETRY_VARIABLE "ZEROED_PROFILER_GC_TELEMETRY"
+// Environment variable which when "1" also counts the bytes surviving each GC. That needs COR_PRF_MONITOR_GC, which has
+// the runtime report every surviving and moved range to the profiler, so it's only available from startup
+#define GC_SURVIVORS_VARIABLE "ZEROED_PROFILER_GC_SURVIVORS"
+
+// Most GCs in progress at once, a background GC with a foreground GC inside it
+#define GC_MAX_NESTED 4
+
+// Records each garbage collection's generation, reason, pause, survivors and the size of every generation afterwards as
+// GC_CAPTURE_HOOK_ID and GC_HEAP_CAPTURE_HOOK_ID records in the capture file, so GC activity can be lined up against
+// latency measured elsewhere. The pause is the time from the runtime starting to suspend for a GC until it has resumed.
+// GCs are followed through COR_PRF_HIGH_BASIC_GC, so survivors are only counted when asked for, see GC_SURVIVORS_VARIABLE.
+// GC callbacks arrive from whichever thread triggered the GC and from the background GC thread, so state is kept under a lock
+class GcTelemetry
+{
+public:
+	static void Start(ICorProfilerInfo4* pInfo, bool countSurvivors);
+	// Log a summary of the GCs seen
+	static void Stop();
+
+	static void SuspendStarted(COR_PRF_SUSPEND_REASON reason);
+	static void ResumeFinished();
+	static void GcStarted(int generationCount, const BOOL generationCollected[], COR_PRF_GC_REASON reason);
+	static void Survived(UINT64 bytes);
+	static void GcFinished();
+};
@@ -0,0 +1,110 @@
+#include "stdafx.h"
+#include "HookConfig.h"
+#include "CaptureBuffer.h"
+#include "Utils.h"
+#include <sstream>
+
+// Callback for configured dispatch hooks. The payload length is recorded so both modes produce comparable captures
+static void STDMETHODCALLTYPE RecordPayloadLength(int hookId, BYTE* data, int size)
+{
+	INT64 length = size;
+	CaptureBuffer::Record(hookId, 1, &length);
+}
+
+static HRESULT ParseHookEntry(const std::string& entry, HookDefinition& hook)
+{
+	size_t moduleEnd = entry.find('!');
+	size_t argsStart = entry.find('(', moduleEnd == std::string::npos ? 0 : moduleEnd);
+	size_t argsEnd = entry.find(')', argsStart == std::string::npos ? 0 : argsStart);
+	if (moduleEnd == std::string::npos || argsStart == std::string::npos || argsEnd == std::string::npos) {
+		spdlog::error("Hook \"{}\" should look like Module.dll!Namespace.Class.Method(args)", entry);
+		return E_INVALIDARG;
+	}
+
+	std::string qualifiedMethod = entry.substr(moduleEnd + 1, argsStart - moduleEnd - 1);
+	size_t classEnd = qualifiedMethod.rfind('.');
+	if (classEnd == std::string::npos || classEnd == 0 || classEnd == qualifiedMethod.size() - 1) {
+		spdlog::error("Hook \"{}\" is missing a class or method name", entry);
+		return E_INVALIDARG;
+	}
+
+	hook.TargetModule = Utf8ToWide(entry.substr(0, moduleEnd));
+	hook.TargetClass = Utf8ToWide(qualifiedMethod.substr(0, classEnd));
+	hook.TargetMethod = Utf8ToWide(qualifiedMethod.substr(classEnd + 1));
+	hook.BuildTargetSignature = nullptr;
+
+	std::vector<short> args;
+	std::istringstream argStream(entry.substr(argsStart + 1, argsEnd - argsStart - 1));
+	std::string arg;
+	while (std::getline(argStream, arg, ',')) {
+		if (arg.empty())
+			continue;
+
+		char* end = nullptr;
+		long slot = strtol(arg.c_str(), &end, 10);
+		if (*end != '\0' || slot < 0 || slot > 0xFFFF) {
+			spdlog::error("Hook \"{}\" has an invalid argument slot \"{}\"", entry, arg);
+			return E_INVALIDARG;
+		}
+		args.push_back((short)slot);
+	}
+
+	static const std::string timedSuffix = "+timed";
+	std::string mode = entry.substr(argsEnd + 1);
+	hook.Timed = mode.size() >= timedSuffix.size() && mode.compare(mode.size() - timedSuffix.size(), timedSuffix.size(), timedSuffix) == 0;
+	if (hook.Timed)
+		mode.erase(mode.size() - timedSuffix.size());
+	hook.AlwaysCaptured = false;
+
+	if (mode.empty() || mode == "=dispatch") {
+		if (args.size() != 1) {
+			spdlog::error("Dispatch hook \"{}\" must forward exactly one byte[] argument", entry);
+			return E_INVALIDARG;
+		}
+		hook.Mode = HookMode::Dispatch;
+		hook.PayloadArg = args[0];
+		hook.Callback = RecordPayloadLength;
+	}
+	else if (mode == "=inline") {
+		if (args.size() > MAX_CAPTURE_ARGS) {
+			spdlog::error("Inline hook \"{}\" captures more than {} arguments", entry, MAX_CAPTURE_ARGS);
+			return E_INVALIDARG;
+		}
+		hook.Mode = HookMode::InlineCapture;
+		hook.PayloadArg = 0;
+		hook.Callback = nullptr;
+		hook.CaptureArgs = args;
+	}
+	else if (mode == "=timed") {
+		if (!args.empty()) {
+			spdlog::error("Timing hook \"{}\" doesn't capture arguments", entry);
+			return E_INVALIDARG;
+		}
+		hook.Mode = HookMode::TimingOnly;
+		hook.PayloadArg = 0;
+		hook.Callback = nullptr;
+		hook.Timed = true;
+	}
+	else {
+		spdlog::error("Hook \"{}\" has unknown mode \"{}\"", entry, mode);
+		return E_INVALIDARG;
+	}
+
+	return S_OK;
+}
+
+HRESULT ParseHookConfig(const std::string& config, std::vector<HookDefinition>& hooks)
+{
+	std::istringstream entries(config);
+	std::string entry;
+	while (std::getline(entries, entry, ';')) {
+		if (entry.empty())
+			continue;
+
+		HookDefinition hook;
+		FAIL_CHECK(ParseHookEntry(entry, hook), "Failed to parse " HOOK_CONFIG_VARIABLE);
+		hooks.push_back(hook);
+	}
+
+	return S_OK;
+}
@@ -0,0 +1,17 @@
+#pragma once
+
+#include "stdafx.h"
+#include "HookDefinition.h"
+#include <string>
+#include <vector>
+
+// Environment variable holding additional hooks to install
+#define HOOK_CONFIG_VARIABLE "ZEROED_PROFILER_HOOKS"
+
+// Parse hooks from the ZEROED_PROFILER_HOOKS format. Entries are separated by ';' and take the form
+//   <module>!<namespace>.<class>.<method>(<arg>[,<arg>...])[=dispatch|inline][+timed]
+//   <module>!<namespace>.<class>.<method>()=timed
+// where each arg is an IL argument slot. Dispatch hooks (the default) take a single byte[] argument and record
+// its length, inline hooks record each listed argument. +timed also records how long each call takes, and =timed
+// records only that. Targets are matched by name, taking the first overload
+HRESULT ParseHookConfig(const std::string& config, std::vector<HookDefinition>& hooks);
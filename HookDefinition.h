@@ -0,0 +1,79 @@
+#pragma once
+
+#include "stdafx.h"
+#include "HookDispatch.h"
+#include "CaptureBuffer.h"
+#include <string>
+#include <vector>
+
+// Builds the signature used to locate a hook target. Some signatures reference types defined in the
+// target module (eg. the System.Reflection.Assembly return type of Assembly.Load) so they can only be
+// built once the module's metadata has been opened
+typedef HRESULT(*TargetSignatureBuilder)(IMetaDataImport* pImport, std::vector<COR_SIGNATURE>& signature);
+
+enum class HookMode
+{
+	// Pass a byte[] argument to the module's shared dispatcher, which pins it and P/Invokes ZeroedDispatch
+	Dispatch,
+	// Widen fixed size arguments (integers, pointers, enums) to 64 bits and calli straight into a native
+	// capture function, skipping the managed dispatcher and any pinning
+	InlineCapture,
+	// Inject nothing at entry beyond the timing probe. Only useful on a timed hook
+	TimingOnly,
+	// Time the call like a timed hook, but pass the lock object in PayloadArg to LockContention on exit instead of
+	// recording into MethodTiming. Used by the built-in Monitor hooks
+	LockWait,
+};
+
+// Describes a managed method we want to hook along with how its arguments reach native code.
+// A hook's ID is its index in the profiler's hook list and is what the injected IL passes back to native code
+struct HookDefinition
+{
+	WSTRING TargetModule;
+	WSTRING TargetClass;
+	WSTRING TargetMethod;
+	// When null the target is located by name alone
+	TargetSignatureBuilder BuildTargetSignature;
+
+	HookMode Mode;
+
+	// Dispatch: the IL argument slot (including 'this' for instance methods) holding the byte[] forwarded to the callback.
+	// LockWait: the slot holding the lock object
+	short PayloadArg;
+
+	// Dispatch: native function the dispatcher jumps to for this hook
+	HookCallback Callback;
+
+	// InlineCapture: the IL argument slots to record, at most MAX_CAPTURE_ARGS
+	std::vector<short> CaptureArgs;
+
+	// Read a timestamp after the hook's prologue and again before every ret, recording the elapsed time in MethodTiming
+	bool Timed;
+
+	// Capture every call even when adaptive capture would thin out the hook's calls
+	bool AlwaysCaptured;
+};
+
+// The result of installing a hook into a module
+struct InstalledHook
+{
+	int HookId;
+	HookMode Mode;
+	// The method def of the method being hooked
+	mdMethodDef TargetMethodDef;
+	// The shared dispatcher injected into the target's module
+	mdMethodDef DispatcherMethod;
+	short PayloadArg;
+	// Stand alone signature for the inline capture calli
+	mdSignature CaptureSignature;
+	// Bit i is set when captured argument i is unsigned or a pointer, so it's widened with conv.u8 instead of conv.i8
+	int UnsignedCaptureArgs;
+	bool Timed;
+	// Stand alone signatures for the timing calli at entry and before each ret. Also used by LockWait hooks
+	mdSignature TimingEnterSignature;
+	mdSignature TimingLeaveSignature;
+	// LockWait: RuntimeHelpers.GetHashCode(object), which identifies the lock object across GCs, and the signature of the
+	// calli recording a contended wait
+	mdToken LockIdentityMethod;
+	mdSignature LockContendedSignature;
+};
@@ -0,0 +1,67 @@
+#include "stdafx.h"
+#include "HookDispatch.h"
+#include "AdaptiveCapture.h"
+#include "Statistics.h"
+
+// Jump table indexed by hook ID. Written during Initialize before any hooks are installed and only read afterwards
+static HookCallback HookTable[MAX_HOOKS] = {};
+
+// Non-zero when the hook is enabled. Written by the control channel at any time, the IL sees a change on its next call
+static volatile INT32 HookEnabled[MAX_HOOKS] = {};
+
+static const int DispatchCallsStat = Statistics::Counter("dispatch.calls");
+
+bool RegisterHookCallback(int hookId, HookCallback callback)
+{
+	if (hookId < 0 || hookId >= MAX_HOOKS) {
+		spdlog::error("Hook ID {} exceeds the dispatch table size of {}", hookId, MAX_HOOKS);
+		return false;
+	}
+
+	HookTable[hookId] = callback;
+	return true;
+}
+
+void ResetHookCallbacks()
+{
+	for (HookCallback& callback : HookTable)
+		callback = nullptr;
+
+	SetAllHooksEnabled(true);
+}
+
+void SetHookEnabled(int hookId, bool enabled)
+{
+	if ((unsigned)hookId >= MAX_HOOKS) {
+		spdlog::error("Hook ID {} exceeds the dispatch table size of {}", hookId, MAX_HOOKS);
+		return;
+	}
+
+	HookEnabled[hookId] = enabled ? 1 : 0;
+}
+
+void SetAllHooksEnabled(bool enabled)
+{
+	for (volatile INT32& flag : HookEnabled)
+		flag = enabled ? 1 : 0;
+}
+
+const volatile INT32* GetHookEnabledFlag(int hookId)
+{
+	return (unsigned)hookId < MAX_HOOKS ? &HookEnabled[hookId] : nullptr;
+}
+
+extern "C" ZEROED_EXPORT void STDAPICALLTYPE ZeroedDispatch(int hookId, BYTE* data, int size)
+{
+	// Hook IDs are baked into the injected IL so a bad ID means the IL and table have gone out of sync
+	if ((unsigned)hookId >= MAX_HOOKS || HookTable[hookId] == nullptr) {
+		spdlog::error("Dispatch for unknown hook ID {}", hookId);
+		return;
+	}
+
+	if (!AdaptiveCapture::ShouldCapture(hookId))
+		return;
+
+	Statistics::Count(DispatchCallsStat);
+	HookTable[hookId](hookId, data, size);
+}
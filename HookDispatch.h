@@ -0,0 +1,24 @@
+#pragma once
+
+#include "stdafx.h"
+
+// Native handler for a hook. Receives the hook's ID and the pinned contents of the payload array, or null/0 when the array was null or empty
+typedef void (STDMETHODCALLTYPE* HookCallback)(int hookId, BYTE* data, int size);
+
+// Upper bound on the number of hooks the jump table can dispatch to
+#define MAX_HOOKS 256
+
+// Register the native handler for a hook ID, returning false if the ID is out of range. Must be called before any module containing the hook is instrumented
+bool RegisterHookCallback(int hookId, HookCallback callback);
+void ResetHookCallbacks();
+
+// Every hook's injected IL reads its enable flag before calling out, so hooks can be switched off without re-JITting the
+// methods they're installed in. Flags start enabled and are reset along with the callbacks
+void SetHookEnabled(int hookId, bool enabled);
+void SetAllHooksEnabled(bool enabled);
+
+// Address of the hook's enable flag, baked into its injected IL. The flag lives for the lifetime of the process
+const volatile INT32* GetHookEnabledFlag(int hookId);
+
+// Single P/Invoke target shared by every injected dispatcher. Jumps to the registered handler for hookId
+extern "C" ZEROED_EXPORT void STDAPICALLTYPE ZeroedDispatch(int hookId, BYTE* data, int size);
@@ -0,0 +1,425 @@
+#include "stdafx.h"
+#include "ILTemplate.h"
+
+// Label positions are -1 until MarkLabel is called
+#define UNMARKED_LABEL -1
+
+static bool IsUnconditionalTransfer(unsigned opcode)
+{
+	switch (opcode) {
+	case CEE_BR:
+	case CEE_BR_S:
+	case CEE_LEAVE:
+	case CEE_LEAVE_S:
+	case CEE_RET:
+	case CEE_THROW:
+	case CEE_RETHROW:
+	case CEE_ENDFINALLY:
+	case CEE_JMP:
+		return true;
+	default:
+		return false;
+	}
+}
+
+static void SetOperand(ILInstr* pInstr, INT64 value)
+{
+	switch (s_OpCodeFlags[pInstr->m_opcode] & OPCODEFLAGS_SizeMask) {
+	case 1:
+		pInstr->m_Arg8 = (INT8)value;
+		break;
+	case 2:
+		pInstr->m_Arg16 = (INT16)value;
+		break;
+	case 4:
+		pInstr->m_Arg32 = (INT32)value;
+		break;
+	case 8:
+		pInstr->m_Arg64 = value;
+		break;
+	}
+}
+
+// Picks the shortest ldc.i4 form able to hold value
+static unsigned LdcI4Opcode(INT32 value)
+{
+	if (value >= -1 && value <= 8)
+		return CEE_LDC_I4_0 + value;
+	if (value >= -128 && value <= 127)
+		return CEE_LDC_I4_S;
+
+	return CEE_LDC_I4;
+}
+
+// Picks the shortest ldarg form able to address index
+static unsigned LdargOpcode(UINT16 index)
+{
+	if (index <= 3)
+		return CEE_LDARG_0 + index;
+	if (index <= 255)
+		return CEE_LDARG_S;
+
+	return CEE_LDARG;
+}
+
+// Picks the shortest ldloc form able to address index
+static unsigned LdlocOpcode(UINT16 index)
+{
+	if (index <= 3)
+		return CEE_LDLOC_0 + index;
+	if (index <= 255)
+		return CEE_LDLOC_S;
+
+	return CEE_LDLOC;
+}
+
+// Picks the shortest stloc form able to address index
+static unsigned StlocOpcode(UINT16 index)
+{
+	if (index <= 3)
+		return CEE_STLOC_0 + index;
+	if (index <= 255)
+		return CEE_STLOC_S;
+
+	return CEE_STLOC;
+}
+
+ILTemplate::ILTemplate() :
+	m_slotCount(0),
+	m_maxStack(0),
+	m_compiled(false),
+	m_error(nullptr) {
+}
+
+ILLabel ILTemplate::DefineLabel()
+{
+	m_labelPositions.push_back(UNMARKED_LABEL);
+	return { (int)m_labelPositions.size() - 1 };
+}
+
+ILSlot ILTemplate::DefineSlot()
+{
+	return { m_slotCount++ };
+}
+
+ILTemplate& ILTemplate::MarkLabel(ILLabel label)
+{
+	if (m_labelPositions[label.Index] != UNMARKED_LABEL)
+		return Fail("label marked more than once");
+
+	m_labelPositions[label.Index] = (int)m_steps.size();
+	return *this;
+}
+
+ILTemplate& ILTemplate::Op(OPCODE opcode)
+{
+	if (s_OpCodeFlags[opcode] != 0)
+		return Fail("Op used for an instruction which takes an operand");
+	if (k_rgnStackPops[opcode] == VARIABLE_STACK_POPS)
+		return Fail("Op used for an instruction with a variable stack effect, use Call or Ret");
+
+	return Append(opcode, OperandKind::None, 0, k_rgnStackPops[opcode], k_rgnStackPushes[opcode]);
+}
+
+ILTemplate& ILTemplate::Token(OPCODE opcode, mdToken token)
+{
+	if (s_OpCodeFlags[opcode] != 4 || k_rgnStackPops[opcode] == VARIABLE_STACK_POPS)
+		return Fail("Token used for an instruction which doesn't take a token");
+
+	return Append(opcode, OperandKind::Immediate, token, k_rgnStackPops[opcode], k_rgnStackPushes[opcode]);
+}
+
+ILTemplate& ILTemplate::Token(OPCODE opcode, ILSlot slot)
+{
+	if (s_OpCodeFlags[opcode] != 4 || k_rgnStackPops[opcode] == VARIABLE_STACK_POPS)
+		return Fail("Token used for an instruction which doesn't take a token");
+
+	return Append(opcode, OperandKind::Slot, slot.Index, k_rgnStackPops[opcode], k_rgnStackPushes[opcode]);
+}
+
+ILTemplate& ILTemplate::LdcI4(INT32 value)
+{
+	return Append(LdcI4Opcode(value), OperandKind::Immediate, value, 0, 1);
+}
+
+ILTemplate& ILTemplate::LdcI4(ILSlot slot)
+{
+	return Append(CEE_LDC_I4, OperandKind::LdcI4Slot, slot.Index, 0, 1);
+}
+
+ILTemplate& ILTemplate::LdcI8(INT64 value)
+{
+	return Append(CEE_LDC_I8, OperandKind::Immediate, value, 0, 1);
+}
+
+ILTemplate& ILTemplate::LdcI8(ILSlot slot)
+{
+	return Append(CEE_LDC_I8, OperandKind::Slot, slot.Index, 0, 1);
+}
+
+ILTemplate& ILTemplate::Ldarg(UINT16 index)
+{
+	return Append(LdargOpcode(index), OperandKind::Immediate, index, 0, 1);
+}
+
+ILTemplate& ILTemplate::Ldarg(ILSlot slot)
+{
+	return Append(CEE_LDARG, OperandKind::LdargSlot, slot.Index, 0, 1);
+}
+
+ILTemplate& ILTemplate::Ldloc(UINT16 index)
+{
+	if (index <= 3)
+		return Append(CEE_LDLOC_0 + index, OperandKind::None, 0, 0, 1);
+	if (index <= 255)
+		return Append(CEE_LDLOC_S, OperandKind::Immediate, index, 0, 1);
+
+	return Append(CEE_LDLOC, OperandKind::Immediate, index, 0, 1);
+}
+
+ILTemplate& ILTemplate::Ldloc(ILSlot slot)
+{
+	return Append(CEE_LDLOC, OperandKind::LdlocSlot, slot.Index, 0, 1);
+}
+
+ILTemplate& ILTemplate::Stloc(UINT16 index)
+{
+	if (index <= 3)
+		return Append(CEE_STLOC_0 + index, OperandKind::None, 0, 1, 0);
+	if (index <= 255)
+		return Append(CEE_STLOC_S, OperandKind::Immediate, index, 1, 0);
+
+	return Append(CEE_STLOC, OperandKind::Immediate, index, 1, 0);
+}
+
+ILTemplate& ILTemplate::Stloc(ILSlot slot)
+{
+	return Append(CEE_STLOC, OperandKind::StlocSlot, slot.Index, 1, 0);
+}
+
+ILTemplate& ILTemplate::Branch(OPCODE opcode, ILLabel label)
+{
+	if ((s_OpCodeFlags[opcode] & OPCODEFLAGS_BranchTarget) == 0)
+		return Fail("Branch used for a non-branch instruction");
+
+	// Short forms are widened by ILRewriter::Export if the target ends up out of range
+	return Append(opcode, OperandKind::Label, label.Index, k_rgnStackPops[opcode], k_rgnStackPushes[opcode]);
+}
+
+ILTemplate& ILTemplate::Call(OPCODE opcode, mdToken method, int argCount, bool returnsValue)
+{
+	if (opcode != CEE_CALL && opcode != CEE_CALLVIRT && opcode != CEE_CALLI && opcode != CEE_NEWOBJ)
+		return Fail("Call used for a non-call instruction");
+
+	return Append(opcode, OperandKind::Immediate, method, argCount, returnsValue ? 1 : 0);
+}
+
+ILTemplate& ILTemplate::Call(OPCODE opcode, ILSlot method, int argCount, bool returnsValue)
+{
+	if (opcode != CEE_CALL && opcode != CEE_CALLVIRT && opcode != CEE_CALLI && opcode != CEE_NEWOBJ)
+		return Fail("Call used for a non-call instruction");
+
+	return Append(opcode, OperandKind::Slot, method.Index, argCount, returnsValue ? 1 : 0);
+}
+
+ILTemplate& ILTemplate::Ret(bool returnsValue)
+{
+	return Append(CEE_RET, OperandKind::None, 0, returnsValue ? 1 : 0, 0);
+}
+
+ILTemplate& ILTemplate::Append(unsigned opcode, OperandKind kind, INT64 value, int pops, int pushes)
+{
+	m_compiled = false;
+	m_steps.push_back({ opcode, kind, value, pops, pushes });
+	return *this;
+}
+
+ILTemplate& ILTemplate::Fail(const char* reason)
+{
+	// Only the first error is kept, it's reported when the template is compiled
+	if (m_error == nullptr)
+		m_error = reason;
+	return *this;
+}
+
+/// <summary>
+/// Walk the template tracking the evaluation stack depth. Every path must agree on the depth at a label, nothing may pop
+/// more than has been pushed and the template must leave the stack as it found it so it can be spliced anywhere
+/// </summary>
+HRESULT ILTemplate::Compile()
+{
+	m_compiled = false;
+	m_maxStack = 0;
+
+	if (m_error != nullptr) {
+		spdlog::error("Invalid IL template: {}", m_error);
+		return E_FAIL;
+	}
+
+	for (size_t i = 0; i < m_labelPositions.size(); i++) {
+		if (m_labelPositions[i] == UNMARKED_LABEL) {
+			spdlog::error("Invalid IL template: label {} is never marked", i);
+			return E_FAIL;
+		}
+	}
+
+	// Stack depth on entry to each label, -1 until a path reaching it has been seen
+	std::vector<int> labelDepths(m_labelPositions.size(), -1);
+
+	int depth = 0;
+	bool reachable = true;
+	for (size_t i = 0; i <= m_steps.size(); i++) {
+		for (size_t label = 0; label < m_labelPositions.size(); label++) {
+			if (m_labelPositions[label] != (int)i)
+				continue;
+
+			if (!reachable) {
+				if (labelDepths[label] == -1) {
+					spdlog::error("Invalid IL template: unable to determine stack depth at label {}", label);
+					return E_FAIL;
+				}
+				depth = labelDepths[label];
+				reachable = true;
+			}
+			else if (labelDepths[label] == -1) {
+				labelDepths[label] = depth;
+			}
+			else if (labelDepths[label] != depth) {
+				spdlog::error("Invalid IL template: stack depth mismatch at label {} ({} vs {})", label, labelDepths[label], depth);
+				return E_FAIL;
+			}
+		}
+
+		if (i == m_steps.size())
+			break;
+
+		const Step& step = m_steps[i];
+		if (!reachable) {
+			spdlog::error("Invalid IL template: instruction {} is unreachable", i);
+			return E_FAIL;
+		}
+
+		if (depth < step.Pops) {
+			spdlog::error("Invalid IL template: instruction {} pops {} value(s) from a stack of {}", i, step.Pops, depth);
+			return E_FAIL;
+		}
+		depth = depth - step.Pops + step.Pushes;
+		if ((unsigned)depth > m_maxStack)
+			m_maxStack = depth;
+
+		if (step.Kind == OperandKind::Label) {
+			// leave empties the evaluation stack
+			int targetDepth = (step.Opcode == CEE_LEAVE || step.Opcode == CEE_LEAVE_S) ? 0 : depth;
+			int& recorded = labelDepths[(size_t)step.Value];
+			if (recorded == -1) {
+				recorded = targetDepth;
+			}
+			else if (recorded != targetDepth) {
+				spdlog::error("Invalid IL template: branch at {} has stack depth {} but its target expects {}", i, targetDepth, recorded);
+				return E_FAIL;
+			}
+		}
+
+		if (IsUnconditionalTransfer(step.Opcode))
+			reachable = false;
+	}
+
+	// Falling through, or branching to a label after the last instruction, continues into the original method body
+	if (reachable && depth != 0) {
+		spdlog::error("Invalid IL template: falls through with {} value(s) left on the stack", depth);
+		return E_FAIL;
+	}
+
+	m_compiled = true;
+	return S_OK;
+}
+
+unsigned ILTemplate::GetMaxStack() const
+{
+	return m_maxStack;
+}
+
+HRESULT ILTemplate::SpliceBefore(ILRewriter& rewriter, ILInstr* pWhere, const std::vector<INT64>& slotValues) const
+{
+	return Splice(rewriter, pWhere, slotValues, false);
+}
+
+HRESULT ILTemplate::SpliceAt(ILRewriter& rewriter, ILInstr* pWhere, const std::vector<INT64>& slotValues) const
+{
+	return Splice(rewriter, pWhere, slotValues, true);
+}
+
+HRESULT ILTemplate::Splice(ILRewriter& rewriter, ILInstr* pWhere, const std::vector<INT64>& slotValues, bool redirect) const
+{
+	if (!m_compiled) {
+		spdlog::error("Attempted to splice an IL template which hasn't been compiled");
+		return E_FAIL;
+	}
+
+	if (slotValues.size() != (size_t)m_slotCount) {
+		spdlog::error("IL template expects {} slot value(s) but was given {}", m_slotCount, slotValues.size());
+		return E_INVALIDARG;
+	}
+
+	if (m_steps.empty())
+		return S_OK;
+
+	// Instructions are created and linked up front so labels can refer forwards, then the whole chain is spliced in at once
+	std::vector<ILInstr*> instrs(m_steps.size());
+	for (size_t i = 0; i < m_steps.size(); i++) {
+		instrs[i] = rewriter.NewILInstr();
+		IfNullRet(instrs[i]);
+
+		if (i > 0) {
+			instrs[i - 1]->m_pNext = instrs[i];
+			instrs[i]->m_pPrev = instrs[i - 1];
+		}
+	}
+
+	for (size_t i = 0; i < m_steps.size(); i++) {
+		const Step& step = m_steps[i];
+		ILInstr* pInstr = instrs[i];
+		pInstr->m_opcode = step.Opcode;
+
+		switch (step.Kind) {
+		case OperandKind::None:
+			break;
+		case OperandKind::Immediate:
+			SetOperand(pInstr, step.Value);
+			break;
+		case OperandKind::Slot:
+			SetOperand(pInstr, slotValues[(size_t)step.Value]);
+			break;
+		case OperandKind::LdcI4Slot:
+			pInstr->m_opcode = LdcI4Opcode((INT32)slotValues[(size_t)step.Value]);
+			SetOperand(pInstr, slotValues[(size_t)step.Value]);
+			break;
+		case OperandKind::LdargSlot:
+			pInstr->m_opcode = LdargOpcode((UINT16)slotValues[(size_t)step.Value]);
+			SetOperand(pInstr, slotValues[(size_t)step.Value]);
+			break;
+		case OperandKind::LdlocSlot:
+			pInstr->m_opcode = LdlocOpcode((UINT16)slotValues[(size_t)step.Value]);
+			SetOperand(pInstr, slotValues[(size_t)step.Value]);
+			break;
+		case OperandKind::StlocSlot:
+			pInstr->m_opcode = StlocOpcode((UINT16)slotValues[(size_t)step.Value]);
+			SetOperand(pInstr, slotValues[(size_t)step.Value]);
+			break;
+		case OperandKind::Label:
+		{
+			size_t position = (size_t)m_labelPositions[(size_t)step.Value];
+			pInstr->m_pTarget = position < instrs.size() ? instrs[position] : pWhere;
+			break;
+		}
+		}
+	}
+
+	// Redirect before splicing so the template's own branches to pWhere are left alone
+	if (redirect)
+		rewriter.RedirectTargets(pWhere, instrs.front());
+
+	rewriter.SpliceBefore(pWhere, instrs.front(), instrs.back(), m_maxStack);
+
+	return S_OK;
+}
@@ -0,0 +1,101 @@
+#pragma once
+
+#include "stdafx.h"
+#include "ilrewriter.h"
+#include <vector>
+
+// A branch target within an ILTemplate. Labels marked after the last instruction target the code the template is spliced in front of
+struct ILLabel
+{
+	int Index;
+};
+
+// An operand supplied when the template is spliced into a method, eg. a hook ID or a token which is only known once the module is loaded
+struct ILSlot
+{
+	int Index;
+};
+
+// A small IL assembler for the bodies we inject. Templates are built and compiled once, which resolves labels, picks the
+// shortest encoding for constant operands and checks the evaluation stack, and are then spliced into any number of methods.
+// Operands bound to slots have their encoding picked at splice time, so ldc.i4/ldarg stay as small as the bound value allows
+class ILTemplate
+{
+public:
+	ILTemplate();
+
+	ILLabel DefineLabel();
+	ILSlot DefineSlot();
+	ILTemplate& MarkLabel(ILLabel label);
+
+	// Instructions with no operand and a fixed stack effect
+	ILTemplate& Op(OPCODE opcode);
+
+	// Instructions taking a metadata token (ldelema, ldsfld, box etc)
+	ILTemplate& Token(OPCODE opcode, mdToken token);
+	ILTemplate& Token(OPCODE opcode, ILSlot slot);
+
+	ILTemplate& LdcI4(INT32 value);
+	ILTemplate& LdcI4(ILSlot slot);
+	ILTemplate& LdcI8(INT64 value);
+	ILTemplate& LdcI8(ILSlot slot);
+
+	ILTemplate& Ldarg(UINT16 index);
+	ILTemplate& Ldarg(ILSlot slot);
+	ILTemplate& Ldloc(UINT16 index);
+	ILTemplate& Ldloc(ILSlot slot);
+	ILTemplate& Stloc(UINT16 index);
+	ILTemplate& Stloc(ILSlot slot);
+
+	ILTemplate& Branch(OPCODE opcode, ILLabel label);
+
+	// Calls have a signature dependent stack effect so it must be given explicitly. For calli argCount includes the function pointer
+	ILTemplate& Call(OPCODE opcode, mdToken method, int argCount, bool returnsValue);
+	ILTemplate& Call(OPCODE opcode, ILSlot method, int argCount, bool returnsValue);
+	ILTemplate& Ret(bool returnsValue);
+
+	// Validate the template. Must succeed before the template can be spliced
+	HRESULT Compile();
+
+	unsigned GetMaxStack() const;
+
+	// Insert the template before pWhere, binding slot i to slotValues[i]
+	HRESULT SpliceBefore(ILRewriter& rewriter, ILInstr* pWhere, const std::vector<INT64>& slotValues) const;
+
+	// As SpliceBefore, but branches and exception clauses referring to pWhere are moved onto the template so it runs however
+	// pWhere is reached. Used for epilogues in front of ret, which is often a branch target
+	HRESULT SpliceAt(ILRewriter& rewriter, ILInstr* pWhere, const std::vector<INT64>& slotValues) const;
+
+private:
+	enum class OperandKind
+	{
+		None,
+		Immediate,
+		Label,
+		Slot,
+		LdcI4Slot,
+		LdargSlot,
+		LdlocSlot,
+		StlocSlot,
+	};
+
+	struct Step
+	{
+		unsigned Opcode;
+		OperandKind Kind;
+		INT64 Value;
+		int Pops;
+		int Pushes;
+	};
+
+	ILTemplate& Append(unsigned opcode, OperandKind kind, INT64 value, int pops, int pushes);
+	ILTemplate& Fail(const char* reason);
+	HRESULT Splice(ILRewriter& rewriter, ILInstr* pWhere, const std::vector<INT64>& slotValues, bool redirect) const;
+
+	std::vector<Step> m_steps;
+	std::vector<int> m_labelPositions;
+	int m_slotCount;
+	unsigned m_maxStack;
+	bool m_compiled;
+	const char* m_error;
+};
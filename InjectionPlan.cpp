@@ -0,0 +1,780 @@
+#include "stdafx.h"
+#include "InjectionPlan.h"
+#include "COMPtrHolder.h"
+#include "ilrewriter.h"
+#include "ILTemplate.h"
+#include "Utils.h"
+
+// Names of the injected dispatcher and the native export it P/Invokes. The export name must match ZeroedDispatch in HookDispatch.h
+static LPCWSTR DispatcherMethodName = WSTR("Dispatch");
+static LPCWSTR DispatchCallbackName = WSTR("ZeroedDispatch");
+
+// Body of the injected dispatcher, compiled once by CompileTemplates. Slot 0 is the System.Byte token, slot 1 the ZeroedDispatch P/Invoke
+static ILTemplate DispatcherBody;
+
+// Assemblies which may forward the core types (System.Object, System.Byte etc) when a hook targets a module other than the core library
+static LPCWSTR CoreLibraryNames[] = { WSTR("System.Private.CoreLib"), WSTR("mscorlib"), WSTR("System.Runtime"), WSTR("netstandard") };
+
+InjectionPlan::InjectionPlan(LPCWSTR typeName, LPCWSTR nativeModuleName) :
+	m_typeName(typeName),
+	m_nativeModuleName(nativeModuleName),
+	m_pInvokeMethod(mdMethodDefNil),
+	m_dispatcherMethod(mdMethodDefNil),
+	m_pInfo(nullptr),
+	m_moduleId(0),
+	m_pEmit(nullptr),
+	m_pImport(nullptr),
+	m_coreLibraryRef(mdAssemblyRefNil) {
+}
+
+void InjectionPlan::AddHook(int hookId, const HookDefinition* hook)
+{
+	m_targets.push_back({ hookId, hook, mdMethodDefNil, mdSignatureNil, 0, mdSignatureNil, mdSignatureNil, mdTokenNil, mdSignatureNil });
+}
+
+bool InjectionPlan::IsEmpty() const
+{
+	return m_targets.empty();
+}
+
+/// <summary>
+/// Emit the plan into the target module. Targets are resolved first so nothing is injected into modules where none of the hooked methods exist
+/// </summary>
+HRESULT InjectionPlan::Emit(ICorProfilerInfo4* pInfo, ModuleID moduleId, IMetaDataEmit* pEmit, IMetaDataImport* pImport, std::vector<InstalledHook>& installedHooks)
+{
+	m_pInfo = pInfo;
+	m_moduleId = moduleId;
+	m_pEmit = pEmit;
+	m_pImport = pImport;
+
+	// Resolve every target up front, dropping any hooks whose target doesn't exist in this module
+	bool anyDispatch = false;
+	for (PlannedTarget& target : m_targets) {
+		if (FAILED(ResolveTarget(target))) {
+			spdlog::warn("Unable to resolve {}.{}, hook will not be installed", WideToUtf8(target.Hook->TargetClass), WideToUtf8(target.Hook->TargetMethod));
+			target.Token = mdMethodDefNil;
+			continue;
+		}
+
+		bool timed = target.Hook->Timed || target.Hook->Mode == HookMode::LockWait;
+		if (timed && FAILED(ResolveTimingSignatures(target))) {
+			spdlog::warn("Unable to time {}.{}, hook will not be installed", WideToUtf8(target.Hook->TargetClass), WideToUtf8(target.Hook->TargetMethod));
+			target.Token = mdMethodDefNil;
+			continue;
+		}
+
+		if (target.Hook->Mode == HookMode::TimingOnly || target.Hook->Mode == HookMode::LockWait)
+			continue;
+
+		if (target.Hook->Mode == HookMode::InlineCapture) {
+			if (FAILED(ResolveCaptureSignature(target))) {
+				spdlog::warn("Unable to capture arguments of {}.{}, hook will not be installed", WideToUtf8(target.Hook->TargetClass), WideToUtf8(target.Hook->TargetMethod));
+				target.Token = mdMethodDefNil;
+			}
+			continue;
+		}
+
+		if (FAILED(CheckPayloadArg(target))) {
+			spdlog::warn("Unable to forward the payload of {}.{}, hook will not be installed", WideToUtf8(target.Hook->TargetClass), WideToUtf8(target.Hook->TargetMethod));
+			target.Token = mdMethodDefNil;
+			continue;
+		}
+
+		anyDispatch = true;
+	}
+
+	// Inline capture hooks call straight into native code so the dispatcher is only needed for dispatch hooks
+	if (anyDispatch) {
+		FAIL_CHECK(EmitDispatcher(), "Failed to inject dispatcher");
+	}
+
+	for (const PlannedTarget& target : m_targets) {
+		if (target.Token == mdMethodDefNil)
+			continue;
+
+		installedHooks.push_back({ target.HookId, target.Hook->Mode, target.Token, m_dispatcherMethod, target.Hook->PayloadArg, target.CaptureSignature,
+			target.UnsignedCaptureArgs, target.Hook->Timed, target.TimingEnterSignature, target.TimingLeaveSignature, target.LockIdentityMethod,
+			target.LockContendedSignature });
+	}
+
+	spdlog::debug("Installing {} hook(s)", installedHooks.size());
+
+	return S_OK;
+}
+
+/// <summary>
+/// Inject the type housing the shared dispatcher along with its P/Invoke back into ZeroedDispatch
+/// </summary>
+HRESULT InjectionPlan::EmitDispatcher()
+{
+	// Define a new type which will house the dispatcher
+	mdTypeDef tdInjectedType;
+	spdlog::debug("Injecting custom type \"{}\"", WideToUtf8(m_typeName));
+	FAIL_CHECK(DefineCustomType(&tdInjectedType), "Failed to inject type into target module");
+
+	// Generate the metadata signature for the native profiler module
+	mdModuleRef mrZeroedProfilerReference;
+	spdlog::debug("Adding reference to module {}", WideToUtf8(m_nativeModuleName));
+	FAIL_CHECK(m_pEmit->DefineModuleRef(m_nativeModuleName, &mrZeroedProfilerReference), "DefineModuleRef against the native profiler DLL failed");
+
+	// Add the P/Invoke every hook in this module funnels through
+	FAIL_CHECK(AddPInvoke(tdInjectedType, mrZeroedProfilerReference), "Failed to add P/Invoke {}", WideToUtf8(DispatchCallbackName));
+
+	spdlog::debug("Adding method definition for {}", WideToUtf8(DispatcherMethodName));
+	FAIL_CHECK(AddDispatcherMethod(tdInjectedType), "Failed to add dispatcher method");
+
+	spdlog::debug("Setting IL for {}", WideToUtf8(DispatcherMethodName));
+	FAIL_CHECK(SetILForDispatcherMethod(), "Failed to set IL for {}", WideToUtf8(DispatcherMethodName));
+
+	return S_OK;
+}
+
+// Resolve the MethodDef for the method we want to hook
+HRESULT InjectionPlan::ResolveTarget(PlannedTarget& target)
+{
+	const HookDefinition* hook = target.Hook;
+
+	mdTypeDef typeDef;
+	spdlog::debug("Looking for class {}", WideToUtf8(hook->TargetClass));
+	FAIL_CHECK(m_pImport->FindTypeDefByName(hook->TargetClass.c_str(), mdTypeDefNil, &typeDef), "Failed to find class '{}'", WideToUtf8(hook->TargetClass));
+
+	spdlog::debug("Found class, looking for method {}", WideToUtf8(hook->TargetMethod));
+	if (hook->BuildTargetSignature != nullptr) {
+		// Take special care to ensure the parameters and return types are correct
+		std::vector<COR_SIGNATURE> targetMethodSignature;
+		FAIL_CHECK(hook->BuildTargetSignature(m_pImport, targetMethodSignature), "Failed to build target method signature");
+
+		FAIL_CHECK(m_pImport->FindMethod(typeDef, hook->TargetMethod.c_str(), targetMethodSignature.data(), (ULONG)targetMethodSignature.size(), &target.Token),
+			"FindMethod with signature failed for {}.{}", WideToUtf8(hook->TargetClass), WideToUtf8(hook->TargetMethod));
+	}
+	else {
+		// Hooks without a signature (eg. those from ZEROED_PROFILER_HOOKS) take the first overload with a matching name
+		HCORENUM hEnum = nullptr;
+		ULONG count = 0;
+		HRESULT hr = m_pImport->EnumMethodsWithName(&hEnum, typeDef, hook->TargetMethod.c_str(), &target.Token, 1, &count);
+		m_pImport->CloseEnum(hEnum);
+		if (FAILED(hr) || count == 0) {
+			spdlog::error("Failed to find method {}.{}", WideToUtf8(hook->TargetClass), WideToUtf8(hook->TargetMethod));
+			return FAILED(hr) ? hr : E_FAIL;
+		}
+	}
+
+	spdlog::debug("Found {} - {}.{}", WideToUtf8(hook->TargetModule), WideToUtf8(hook->TargetClass), WideToUtf8(hook->TargetMethod));
+
+	return S_OK;
+}
+
+/// <summary>
+/// Locate the assembly ref this module uses to reach the core library. Only needed when hooking modules which don't define the core types themselves
+/// </summary>
+HRESULT InjectionPlan::ResolveCoreLibraryRef(mdAssemblyRef* pAssemblyRef)
+{
+	if (m_coreLibraryRef != mdAssemblyRefNil) {
+		*pAssemblyRef = m_coreLibraryRef;
+		return S_OK;
+	}
+
+	COMPtrHolder<IMetaDataAssemblyImport> pAssemblyImport;
+	FAIL_CHECK(m_pImport->QueryInterface(IID_IMetaDataAssemblyImport, (LPVOID*)&pAssemblyImport), "IID_IMetaDataAssemblyImport: QueryInterface failed");
+
+	HCORENUM hEnum = nullptr;
+	mdAssemblyRef assemblyRefs[32];
+	ULONG count = 0;
+	while (m_coreLibraryRef == mdAssemblyRefNil && SUCCEEDED(pAssemblyImport->EnumAssemblyRefs(&hEnum, assemblyRefs, _countof(assemblyRefs), &count)) && count > 0) {
+		for (ULONG i = 0; i < count && m_coreLibraryRef == mdAssemblyRefNil; i++) {
+			WCHAR name[256];
+			ULONG nameLength = 0;
+			ASSEMBLYMETADATA metadata = {};
+			if (FAILED(pAssemblyImport->GetAssemblyRefProps(assemblyRefs[i], nullptr, nullptr, name, _countof(name), &nameLength, &metadata, nullptr, nullptr, nullptr)))
+				continue;
+
+			for (LPCWSTR coreLibraryName : CoreLibraryNames) {
+				if (WStrCmp(name, coreLibraryName) == 0) {
+					m_coreLibraryRef = assemblyRefs[i];
+					break;
+				}
+			}
+		}
+	}
+	pAssemblyImport->CloseEnum(hEnum);
+
+	if (m_coreLibraryRef == mdAssemblyRefNil) {
+		spdlog::error("Module does not reference a known core library");
+		return E_FAIL;
+	}
+
+	*pAssemblyRef = m_coreLibraryRef;
+	return S_OK;
+}
+
+/// <summary>
+/// Resolve a type from the core library. When the module is the core library the TypeDef is returned, otherwise a TypeRef
+/// is found or defined against the core library's assembly ref. Results are cached so each type is only resolved once per plan
+/// </summary>
+HRESULT InjectionPlan::ResolveCoreType(LPCWSTR typeName, mdToken* ptkType)
+{
+	auto cached = m_coreTypes.find(typeName);
+	if (cached != m_coreTypes.end()) {
+		*ptkType = cached->second;
+		return S_OK;
+	}
+
+	mdToken tkType = mdTokenNil;
+	if (FAILED(m_pImport->FindTypeDefByName(typeName, mdTokenNil, &tkType))) {
+		mdAssemblyRef coreLibraryRef;
+		FAIL_CHECK(ResolveCoreLibraryRef(&coreLibraryRef), "Failed to resolve core library for {}", WideToUtf8(typeName));
+
+		if (FAILED(m_pImport->FindTypeRef(coreLibraryRef, typeName, &tkType)))
+			FAIL_CHECK(m_pEmit->DefineTypeRefByName(coreLibraryRef, typeName, &tkType), "Failed to define type ref for {}", WideToUtf8(typeName));
+	}
+
+	m_coreTypes[typeName] = tkType;
+	*ptkType = tkType;
+	return S_OK;
+}
+
+/// <summary>
+/// Resolve a method of a core library type. Inside the core library it's the method's own MethodDef, anywhere else a MemberRef
+/// </summary>
+HRESULT InjectionPlan::ResolveCoreMethod(LPCWSTR typeName, LPCWSTR methodName, const std::vector<COR_SIGNATURE>& signature, mdToken* ptkMethod)
+{
+	mdToken tkType;
+	FAIL_CHECK(ResolveCoreType(typeName, &tkType), "Failed to resolve {}", WideToUtf8(typeName));
+
+	if (TypeFromToken(tkType) == mdtTypeDef) {
+		FAIL_CHECK(m_pImport->FindMethod(tkType, methodName, signature.data(), (ULONG)signature.size(), ptkMethod),
+			"Failed to find {}.{}", WideToUtf8(typeName), WideToUtf8(methodName));
+		return S_OK;
+	}
+
+	if (FAILED(m_pImport->FindMemberRef(tkType, methodName, signature.data(), (ULONG)signature.size(), ptkMethod)))
+		FAIL_CHECK(m_pEmit->DefineMemberRef(tkType, methodName, signature.data(), (ULONG)signature.size(), ptkMethod),
+			"Failed to define member ref for {}.{}", WideToUtf8(typeName), WideToUtf8(methodName));
+	return S_OK;
+}
+
+// Stand alone signatures (locals and calli targets) are shared between everything in the plan with the same layout
+HRESULT InjectionPlan::ResolveSignature(const std::vector<COR_SIGNATURE>& signature, mdSignature* ptkSignature)
+{
+	auto cached = m_signatures.find(signature);
+	if (cached != m_signatures.end()) {
+		*ptkSignature = cached->second;
+		return S_OK;
+	}
+
+	FAIL_CHECK(m_pEmit->GetTokenFromSig(signature.data(), (ULONG)signature.size(), ptkSignature), "Failed in create stand alone sig");
+	m_signatures[signature] = *ptkSignature;
+	return S_OK;
+}
+
+// Advance past a single type in a signature blob. Returns false if the blob is malformed
+static bool SkipType(PCCOR_SIGNATURE& pSig, PCCOR_SIGNATURE pEnd)
+{
+	if (pSig >= pEnd)
+		return false;
+
+	CorElementType elementType = CorSigUncompressElementType(pSig);
+	switch (elementType) {
+	case ELEMENT_TYPE_VOID:
+	case ELEMENT_TYPE_BOOLEAN:
+	case ELEMENT_TYPE_CHAR:
+	case ELEMENT_TYPE_I1:
+	case ELEMENT_TYPE_U1:
+	case ELEMENT_TYPE_I2:
+	case ELEMENT_TYPE_U2:
+	case ELEMENT_TYPE_I4:
+	case ELEMENT_TYPE_U4:
+	case ELEMENT_TYPE_I8:
+	case ELEMENT_TYPE_U8:
+	case ELEMENT_TYPE_R4:
+	case ELEMENT_TYPE_R8:
+	case ELEMENT_TYPE_STRING:
+	case ELEMENT_TYPE_OBJECT:
+	case ELEMENT_TYPE_I:
+	case ELEMENT_TYPE_U:
+	case ELEMENT_TYPE_TYPEDBYREF:
+		return true;
+	case ELEMENT_TYPE_PTR:
+	case ELEMENT_TYPE_BYREF:
+	case ELEMENT_TYPE_SZARRAY:
+	case ELEMENT_TYPE_PINNED:
+		return SkipType(pSig, pEnd);
+	case ELEMENT_TYPE_CMOD_REQD:
+	case ELEMENT_TYPE_CMOD_OPT:
+		CorSigUncompressToken(pSig);
+		return SkipType(pSig, pEnd);
+	case ELEMENT_TYPE_VALUETYPE:
+	case ELEMENT_TYPE_CLASS:
+		CorSigUncompressToken(pSig);
+		return pSig <= pEnd;
+	case ELEMENT_TYPE_VAR:
+	case ELEMENT_TYPE_MVAR:
+		CorSigUncompressData(pSig);
+		return pSig <= pEnd;
+	case ELEMENT_TYPE_GENERICINST:
+	{
+		if (!SkipType(pSig, pEnd))
+			return false;
+		ULONG argCount = CorSigUncompressData(pSig);
+		for (ULONG i = 0; i < argCount; i++) {
+			if (!SkipType(pSig, pEnd))
+				return false;
+		}
+		return true;
+	}
+	case ELEMENT_TYPE_ARRAY:
+	{
+		if (!SkipType(pSig, pEnd))
+			return false;
+		CorSigUncompressData(pSig); // Rank
+		ULONG sizeCount = CorSigUncompressData(pSig);
+		for (ULONG i = 0; i < sizeCount; i++)
+			CorSigUncompressData(pSig);
+		ULONG lowerBoundCount = CorSigUncompressData(pSig);
+		for (ULONG i = 0; i < lowerBoundCount; i++) {
+			int lowerBound;
+			pSig += CorSigUncompressSignedInt(pSig, &lowerBound);
+		}
+		return pSig <= pEnd;
+	}
+	case ELEMENT_TYPE_FNPTR:
+	{
+		CorSigUncompressCallingConv(pSig);
+		ULONG paramCount = CorSigUncompressData(pSig);
+		for (ULONG i = 0; i <= paramCount; i++) {
+			if (!SkipType(pSig, pEnd))
+				return false;
+		}
+		return true;
+	}
+	default:
+		return false;
+	}
+}
+
+/// <summary>
+/// Check whether an enum is defined in this module. Enums from other modules are referenced through TypeRefs
+/// whose base type can't be checked without opening the defining module, so they're treated as unsupported
+/// </summary>
+bool InjectionPlan::IsEnum(mdToken tkType)
+{
+	if (TypeFromToken(tkType) != mdtTypeDef)
+		return false;
+
+	mdToken tkExtends = mdTokenNil;
+	if (FAILED(m_pImport->GetTypeDefProps(tkType, nullptr, 0, nullptr, nullptr, &tkExtends)))
+		return false;
+
+	WCHAR baseName[256];
+	ULONG baseNameLength = 0;
+	if (TypeFromToken(tkExtends) == mdtTypeRef) {
+		if (FAILED(m_pImport->GetTypeRefProps(tkExtends, nullptr, baseName, _countof(baseName), &baseNameLength)))
+			return false;
+	}
+	else if (TypeFromToken(tkExtends) == mdtTypeDef) {
+		if (FAILED(m_pImport->GetTypeDefProps(tkExtends, baseName, _countof(baseName), &baseNameLength, nullptr, nullptr)))
+			return false;
+	}
+	else {
+		return false;
+	}
+
+	return WStrCmp(baseName, WSTR("System.Enum")) == 0;
+}
+
+// Reads the element type of an enum's value__ field, which holds its value. Falls back to int32, the default
+// underlying type, if the field can't be read
+CorElementType InjectionPlan::GetEnumUnderlyingType(mdTypeDef tkType)
+{
+	HCORENUM hEnum = nullptr;
+	mdFieldDef field;
+	ULONG count = 0;
+	HRESULT hr = m_pImport->EnumFieldsWithName(&hEnum, tkType, WSTR("value__"), &field, 1, &count);
+	m_pImport->CloseEnum(hEnum);
+
+	PCCOR_SIGNATURE pSig;
+	ULONG cbSig;
+	if (FAILED(hr) || count == 0 ||
+		FAILED(m_pImport->GetFieldProps(field, nullptr, nullptr, 0, nullptr, nullptr, &pSig, &cbSig, nullptr, nullptr, nullptr)))
+		return ELEMENT_TYPE_I4;
+
+	// FIELD CustomMod* Type
+	PCCOR_SIGNATURE pEnd = pSig + cbSig;
+	if (pSig >= pEnd || *pSig++ != IMAGE_CEE_CS_CALLCONV_FIELD)
+		return ELEMENT_TYPE_I4;
+	while (pSig < pEnd && (*pSig == ELEMENT_TYPE_CMOD_REQD || *pSig == ELEMENT_TYPE_CMOD_OPT)) {
+		pSig++;
+		CorSigUncompressToken(pSig);
+	}
+
+	return pSig < pEnd ? (CorElementType)*pSig : ELEMENT_TYPE_I4;
+}
+
+// Arguments which fit in 64 bits: integers, pointers and enums. pUnsigned is set for those that must be widened with
+// conv.u8 rather than conv.i8 so their value isn't sign extended
+bool InjectionPlan::IsFixedSizeType(PCCOR_SIGNATURE pType, PCCOR_SIGNATURE pEnd, bool* pUnsigned)
+{
+	while (pType < pEnd && (*pType == ELEMENT_TYPE_CMOD_REQD || *pType == ELEMENT_TYPE_CMOD_OPT)) {
+		pType++;
+		CorSigUncompressToken(pType);
+	}
+
+	if (pType >= pEnd)
+		return false;
+
+	CorElementType elementType = CorSigUncompressElementType(pType);
+	if (elementType == ELEMENT_TYPE_VALUETYPE) {
+		mdToken tkType = CorSigUncompressToken(pType);
+		if (!IsEnum(tkType))
+			return false;
+		elementType = GetEnumUnderlyingType(tkType);
+	}
+
+	switch (elementType) {
+	case ELEMENT_TYPE_I1:
+	case ELEMENT_TYPE_I2:
+	case ELEMENT_TYPE_I4:
+	case ELEMENT_TYPE_I8:
+	case ELEMENT_TYPE_I:
+		*pUnsigned = false;
+		return true;
+	case ELEMENT_TYPE_BOOLEAN:
+	case ELEMENT_TYPE_CHAR:
+	case ELEMENT_TYPE_U1:
+	case ELEMENT_TYPE_U2:
+	case ELEMENT_TYPE_U4:
+	case ELEMENT_TYPE_U8:
+	case ELEMENT_TYPE_U:
+	case ELEMENT_TYPE_PTR:
+	case ELEMENT_TYPE_FNPTR:
+		*pUnsigned = true;
+		return true;
+	default:
+		return false;
+	}
+}
+
+/// <summary>
+/// Find where each of the target's parameters starts in its signature, and the IL argument slot of the first one,
+/// which is 1 for instance methods where slot 0 is 'this'
+/// </summary>
+HRESULT InjectionPlan::GetParameterTypes(const PlannedTarget& target, std::vector<PCCOR_SIGNATURE>& params, PCCOR_SIGNATURE* pEnd, short* pFirstParamSlot)
+{
+	const HookDefinition* hook = target.Hook;
+	PCCOR_SIGNATURE pSig;
+	ULONG cbSig;
+	FAIL_CHECK(m_pImport->GetMethodProps(target.Token, nullptr, nullptr, 0, nullptr, nullptr, &pSig, &cbSig, nullptr, nullptr),
+		"GetMethodProps failed for {}.{}", WideToUtf8(hook->TargetClass), WideToUtf8(hook->TargetMethod));
+
+	*pEnd = pSig + cbSig;
+	ULONG callingConvention = CorSigUncompressCallingConv(pSig);
+	if (callingConvention & IMAGE_CEE_CS_CALLCONV_GENERIC)
+		CorSigUncompressData(pSig);
+	ULONG paramCount = CorSigUncompressData(pSig);
+
+	// Skip the return type and note where each parameter starts
+	params.clear();
+	bool valid = SkipType(pSig, *pEnd);
+	for (ULONG i = 0; valid && i < paramCount; i++) {
+		params.push_back(pSig);
+		valid = SkipType(pSig, *pEnd);
+	}
+
+	if (!valid) {
+		spdlog::error("Unable to parse signature of {}.{}", WideToUtf8(hook->TargetClass), WideToUtf8(hook->TargetMethod));
+		return E_FAIL;
+	}
+
+	*pFirstParamSlot = ((callingConvention & IMAGE_CEE_CS_CALLCONV_HASTHIS) && !(callingConvention & IMAGE_CEE_CS_CALLCONV_EXPLICITTHIS)) ? 1 : 0;
+	return S_OK;
+}
+
+/// <summary>
+/// Check the argument a dispatch hook forwards is a byte[], which the dispatcher pins and passes to ZeroedDispatch
+/// </summary>
+HRESULT InjectionPlan::CheckPayloadArg(const PlannedTarget& target)
+{
+	const HookDefinition* hook = target.Hook;
+	std::vector<PCCOR_SIGNATURE> params;
+	PCCOR_SIGNATURE pEnd;
+	short firstParamSlot;
+	FAIL_CHECK(GetParameterTypes(target, params, &pEnd, &firstParamSlot), "Unable to read the parameters of {}.{}", WideToUtf8(hook->TargetClass), WideToUtf8(hook->TargetMethod));
+
+	int param = hook->PayloadArg - firstParamSlot;
+	if (param < 0 || param >= (int)params.size() || pEnd - params[param] < 2 ||
+		params[param][0] != ELEMENT_TYPE_SZARRAY || params[param][1] != ELEMENT_TYPE_U1) {
+		spdlog::error("Argument {} of {}.{} isn't a byte[]", hook->PayloadArg, WideToUtf8(hook->TargetClass), WideToUtf8(hook->TargetMethod));
+		return E_INVALIDARG;
+	}
+
+	return S_OK;
+}
+
+/// <summary>
+/// Check every argument an inline capture hook records is fixed size, then resolve the calli signature used to
+/// pass them to the native capture function: unmanaged stdcall void(int32 hookId, int64 arg...)
+/// </summary>
+HRESULT InjectionPlan::ResolveCaptureSignature(PlannedTarget& target)
+{
+	const HookDefinition* hook = target.Hook;
+	if (hook->CaptureArgs.size() > MAX_CAPTURE_ARGS) {
+		spdlog::error("Inline capture supports at most {} arguments", MAX_CAPTURE_ARGS);
+		return E_INVALIDARG;
+	}
+
+	// IL argument slot 0 is 'this' for instance methods, which isn't something we can capture
+	std::vector<PCCOR_SIGNATURE> params;
+	PCCOR_SIGNATURE pEnd;
+	short firstParamSlot;
+	FAIL_CHECK(GetParameterTypes(target, params, &pEnd, &firstParamSlot), "Unable to read the parameters of {}.{}", WideToUtf8(hook->TargetClass), WideToUtf8(hook->TargetMethod));
+
+	target.UnsignedCaptureArgs = 0;
+	for (size_t i = 0; i < hook->CaptureArgs.size(); i++) {
+		short slot = hook->CaptureArgs[i];
+		int param = slot - firstParamSlot;
+		bool isUnsigned = false;
+		if (param < 0 || param >= (int)params.size() || !IsFixedSizeType(params[param], pEnd, &isUnsigned)) {
+			spdlog::error("Argument {} of {}.{} isn't a fixed size integer, pointer or enum", slot, WideToUtf8(hook->TargetClass), WideToUtf8(hook->TargetMethod));
+			return E_INVALIDARG;
+		}
+		if (isUnsigned)
+			target.UnsignedCaptureArgs |= 1 << i;
+	}
+
+	std::vector<COR_SIGNATURE> captureSig = {
+		IMAGE_CEE_CS_CALLCONV_STDCALL,                 // Unmanaged stdcall
+		(COR_SIGNATURE)(hook->CaptureArgs.size() + 1), // Hook ID plus each argument
+		ELEMENT_TYPE_VOID,                             // No return
+		ELEMENT_TYPE_I4                                // Hook ID
+	};
+	captureSig.insert(captureSig.end(), hook->CaptureArgs.size(), ELEMENT_TYPE_I8);
+
+	FAIL_CHECK(ResolveSignature(captureSig, &target.CaptureSignature), "Failed to create inline capture signature");
+
+	return S_OK;
+}
+
+/// <summary>
+/// Inject a new type into the target module. This custom type will house our hook function and any custom managed functions we may want to use
+/// </summary>
+/// <returns></returns>
+HRESULT InjectionPlan::DefineCustomType(mdTypeDef* tdInjectedType)
+{
+	// Retrieve a reference to System.Object so we can configure our new type to extend it
+	mdToken systemObjectRef = mdTokenNil;
+	FAIL_CHECK(ResolveCoreType(WSTR("System.Object"), &systemObjectRef), "Failed to retrieve System.Object");
+
+	// Define a new type so we have somewhere to safely store all our methods
+	FAIL_CHECK(m_pEmit->DefineTypeDef(m_typeName, tdSealed | tdAbstract | tdPublic, systemObjectRef, nullptr, tdInjectedType), "Error encountered whilst injecting {}", WideToUtf8(m_typeName));
+
+	return S_OK;
+}
+
+// Creates the PInvoke back into ZeroedDispatch
+HRESULT InjectionPlan::AddPInvoke(mdTypeDef td, mdModuleRef mr)
+{
+	/*
+	*  [DllImport("ZeroedProfiler"), CallingConvention = CallingConvention.StdCall)]
+	*  public static extern void ZeroedDispatch(int hookId, byte* data, int size);
+	*/
+	COR_SIGNATURE pInvokeSignature[] = {
+		IMAGE_CEE_CS_CALLCONV_DEFAULT,     // Calling convention (DEFAULT = static)
+		3,                                 // 3 inputs
+		ELEMENT_TYPE_VOID,                 // No return
+		ELEMENT_TYPE_I4,                   // Hook ID
+		ELEMENT_TYPE_PTR, ELEMENT_TYPE_U1, // Byte array pointer,
+		ELEMENT_TYPE_I4                    // Byte array length
+	};
+
+	spdlog::debug("Injecting pinvoke {}", WideToUtf8(DispatchCallbackName));
+
+	// Define a new public static pinvoke method in our custom type. This will represent our pinvoke back to native land
+	FAIL_CHECK(m_pEmit->DefineMethod(td,
+		DispatchCallbackName,
+		~mdAbstract & (mdStatic | mdPublic | mdPinvokeImpl),
+		pInvokeSignature,
+		sizeof(pInvokeSignature),
+		0,
+		miPreserveSig,
+		&m_pInvokeMethod), "Failed in DefineMethod when creating P/Invoke method {}", WideToUtf8(DispatchCallbackName));
+
+	FAIL_CHECK(m_pEmit->DefinePinvokeMap(m_pInvokeMethod,
+		pmCallConvStdcall | pmNoMangle,
+		DispatchCallbackName,
+		mr), "Failed in DefinePinvokeMap when creating P/Invoke method {}", WideToUtf8(DispatchCallbackName));
+
+	return S_OK;
+}
+
+/// <summary>
+/// Define the shared dispatcher in our custom type. Note that this method will have no body until we set one in SetILForDispatcherMethod
+/// </summary>
+HRESULT InjectionPlan::AddDispatcherMethod(mdTypeDef td)
+{
+	/*
+	*  public static void Dispatch(int hookId, byte[] payload);
+	*/
+	COR_SIGNATURE dispatcherSignature[] = {
+		IMAGE_CEE_CS_CALLCONV_DEFAULT,        // Calling convention (DEFAULT = static)
+		2,                                    // 2 inputs
+		ELEMENT_TYPE_VOID,                    // No return
+		ELEMENT_TYPE_I4,                      // Hook ID
+		ELEMENT_TYPE_SZARRAY, ELEMENT_TYPE_U1 // Byte array
+	};
+
+	FAIL_CHECK(m_pEmit->DefineMethod(td,
+		DispatcherMethodName,
+		mdStatic | mdPublic,
+		dispatcherSignature,
+		sizeof(dispatcherSignature),
+		0,
+		miIL | miNoInlining,
+		&m_dispatcherMethod), "Failed to add dispatcher method to custom type");
+
+	// As our method will be calling native code, we'll need to add give it the SecuritySafeCriticalAttribute
+	// https://learn.microsoft.com/en-us/dotnet/api/system.security.securitysafecriticalattribute?view=netframework-4.8.1
+	COR_SIGNATURE sigSafeCriticalCtor[] = {
+		IMAGE_CEE_CS_CALLCONV_HASTHIS,
+		0x00,                               // Number of arguments
+		ELEMENT_TYPE_VOID,                  // Return type
+	};
+
+	mdToken tkSafeCritical;
+	FAIL_CHECK(ResolveCoreType(WSTR("System.Security.SecuritySafeCriticalAttribute"), &tkSafeCritical),
+		"Failed to resolve System.Security.SecuritySafeCriticalAttribute");
+
+	mdToken tkSafeCriticalCtor = mdTokenNil;
+	if (TypeFromToken(tkSafeCritical) == mdtTypeDef) {
+		FAIL_CHECK(m_pImport->FindMember(tkSafeCritical, WSTR(".ctor"), sigSafeCriticalCtor, sizeof(sigSafeCriticalCtor), &tkSafeCriticalCtor),
+			"FindMember(System.Security.SecuritySafeCriticalAttribute..ctor) failed");
+	}
+	else if (FAILED(m_pImport->FindMemberRef(tkSafeCritical, WSTR(".ctor"), sigSafeCriticalCtor, sizeof(sigSafeCriticalCtor), &tkSafeCriticalCtor))) {
+		FAIL_CHECK(m_pEmit->DefineMemberRef(tkSafeCritical, WSTR(".ctor"), sigSafeCriticalCtor, sizeof(sigSafeCriticalCtor), &tkSafeCriticalCtor),
+			"DefineMemberRef(System.Security.SecuritySafeCriticalAttribute..ctor) failed");
+	}
+
+	// Attach SecuritySafeCriticalAttribute attribute to the dispatcher
+	mdToken tkCustomAttribute;
+	FAIL_CHECK(m_pEmit->DefineCustomAttribute(m_dispatcherMethod, tkSafeCriticalCtor, NULL, 0, &tkCustomAttribute),
+		"DefineMethod - Failed to define custom attribute");
+
+	return S_OK;
+}
+
+/// <summary>
+/// Build the IL templates shared by every plan. Called once during profiler initialisation, which happens again if the
+/// profiler is attached after detaching from the same process, so the template is rebuilt from empty
+/// </summary>
+HRESULT InjectionPlan::CompileTemplates()
+{
+	DispatcherBody = ILTemplate();
+	ILTemplate& il = DispatcherBody;
+	ILSlot byteType = il.DefineSlot();
+	ILSlot pInvokeMethod = il.DefineSlot();
+	ILLabel empty = il.DefineLabel();
+	ILLabel nonEmpty = il.DefineLabel();
+	ILLabel call = il.DefineLabel();
+
+	// Pin the payload, using a null pointer when there's nothing to pin
+	il.Ldarg(1).Op(CEE_DUP).Stloc(1).Branch(CEE_BRFALSE_S, empty)
+		.Ldloc(1).Op(CEE_LDLEN).Op(CEE_CONV_I4).Branch(CEE_BRTRUE_S, nonEmpty);
+
+	il.MarkLabel(empty)
+		.LdcI4(0).Op(CEE_CONV_U).Stloc(0)
+		.LdcI4(0).Stloc(2)
+		.Branch(CEE_BR_S, call);
+
+	il.MarkLabel(nonEmpty)
+		.Ldloc(1).LdcI4(0).Token(CEE_LDELEMA, byteType).Op(CEE_CONV_U).Stloc(0)
+		.Ldloc(1).Op(CEE_LDLEN).Op(CEE_CONV_I4).Stloc(2);
+
+	// ZeroedDispatch(hookId, data, size), then unpin
+	il.MarkLabel(call)
+		.Ldarg(0).Ldloc(0).Ldloc(2).Call(CEE_CALL, pInvokeMethod, 3, false)
+		.Op(CEE_LDNULL).Stloc(1)
+		.Ret(false);
+
+	return il.Compile();
+}
+
+// Dynamiclly define the IL for the dispatcher. This pins the payload array and forwards it along with the hook ID
+// to ZeroedDispatch, which jumps to the native handler registered for that ID
+HRESULT InjectionPlan::SetILForDispatcherMethod()
+{
+	/*------Type Vars------*/
+	mdToken tdBytes = mdTokenNil; // System.Byte
+
+	/*------Type Resolution------*/
+	// Resolve System.Byte
+	FAIL_CHECK(ResolveCoreType(WSTR("System.Byte"), &tdBytes), "Failed to resolve System.Byte");
+
+	/*------Locals Signature Generation------*/
+	std::vector<COR_SIGNATURE> localSig = {
+	  IMAGE_CEE_CS_CALLCONV_LOCAL_SIG,      // SIG_LOCAL_SIG
+	  0x03,                                 // Number of locals
+	  ELEMENT_TYPE_PTR, ELEMENT_TYPE_U1,    // 0: System.Byte*
+	  ELEMENT_TYPE_PINNED,                  // Prevent GC/moving of value
+	  ELEMENT_TYPE_SZARRAY, ELEMENT_TYPE_U1,// 1: System.Byte[]
+	  ELEMENT_TYPE_I4                       // 2: Payload length
+	};
+
+	mdSignature tkLocalSig = mdTokenNil;
+	FAIL_CHECK(ResolveSignature(localSig, &tkLocalSig), "Failed in create local sig");
+
+	/*------Method Body------*/
+	ILRewriter rewriter(m_pInfo, NULL, m_moduleId, m_dispatcherMethod);
+	FAIL_CHECK(rewriter.Initialize(tkLocalSig), "Failed to initalise IL rewriter");
+
+	FAIL_CHECK(DispatcherBody.SpliceBefore(rewriter, rewriter.GetILList(), { tdBytes, m_pInvokeMethod }), "Failed to splice dispatcher body");
+	FAIL_CHECK(rewriter.Export(), "Failed to export IL");
+
+	return S_OK;
+}
+
+/// <summary>
+/// Resolve the calli signatures for a timed hook's probes: unmanaged stdcall int64() at entry and
+/// unmanaged stdcall void(int32 hookId, int64 start) before each ret. A LockWait hook's exit also passes the lock object's
+/// RuntimeHelpers.GetHashCode, which unlike its address survives the GC moving it
+/// </summary>
+HRESULT InjectionPlan::ResolveTimingSignatures(PlannedTarget& target)
+{
+	std::vector<COR_SIGNATURE> enterSig = {
+		IMAGE_CEE_CS_CALLCONV_STDCALL, // Unmanaged stdcall
+		0,                             // No arguments
+		ELEMENT_TYPE_I8                // Returns the start timestamp
+	};
+	FAIL_CHECK(ResolveSignature(enterSig, &target.TimingEnterSignature), "Failed to create timing entry signature");
+
+	std::vector<COR_SIGNATURE> leaveSig = {
+		IMAGE_CEE_CS_CALLCONV_STDCALL, // Unmanaged stdcall
+		2,                             // Hook ID and start timestamp
+		ELEMENT_TYPE_VOID,             // No return
+		ELEMENT_TYPE_I4,               // Hook ID
+		ELEMENT_TYPE_I8                // Start timestamp
+	};
+	if (target.Hook->Mode == HookMode::LockWait) {
+		leaveSig[2] = ELEMENT_TYPE_I8; // Returns the ticks waited if contended
+
+		std::vector<COR_SIGNATURE> contendedSig = {
+			IMAGE_CEE_CS_CALLCONV_STDCALL, // Unmanaged stdcall
+			3,                             // Hook ID, ticks waited and the lock
+			ELEMENT_TYPE_VOID,             // No return
+			ELEMENT_TYPE_I4,               // Hook ID
+			ELEMENT_TYPE_I8,               // Ticks waited
+			ELEMENT_TYPE_I4                // Lock object's hash code
+		};
+		FAIL_CHECK(ResolveSignature(contendedSig, &target.LockContendedSignature), "Failed to create contended wait signature");
+
+		std::vector<COR_SIGNATURE> hashCodeSig = {
+			IMAGE_CEE_CS_CALLCONV_DEFAULT, // Static
+			1,                             // The object
+			ELEMENT_TYPE_I4,               // Returns its hash code
+			ELEMENT_TYPE_OBJECT
+		};
+		FAIL_CHECK(ResolveCoreMethod(WSTR("System.Runtime.CompilerServices.RuntimeHelpers"), WSTR("GetHashCode"), hashCodeSig, &target.LockIdentityMethod),
+			"Failed to resolve RuntimeHelpers.GetHashCode");
+	}
+	FAIL_CHECK(ResolveSignature(leaveSig, &target.TimingLeaveSignature), "Failed to create timing exit signature");
+
+	return S_OK;
+}
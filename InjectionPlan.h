@@ -0,0 +1,75 @@
+#pragma once
+
+#include "stdafx.h"
+#include "HookDefinition.h"
+#include <map>
+#include <string>
+#include <vector>
+
+// Describes everything that needs to be injected into a single module to support the hooks targeting it.
+// Every dispatch hook in a module shares one dispatcher method and one P/Invoke back into ZeroedDispatch, so the
+// injected metadata and JIT work per module is constant regardless of how many hooks target it. Inline capture
+// hooks only need a calli signature. The whole plan is emitted in a single pass with type, assembly and module
+// references resolved once
+class InjectionPlan
+{
+public:
+	InjectionPlan(LPCWSTR typeName, LPCWSTR nativeModuleName);
+
+	static HRESULT CompileTemplates();
+
+	void AddHook(int hookId, const HookDefinition* hook);
+	bool IsEmpty() const;
+
+	HRESULT Emit(ICorProfilerInfo4* pInfo, ModuleID moduleId, IMetaDataEmit* pEmit, IMetaDataImport* pImport, std::vector<InstalledHook>& installedHooks);
+
+private:
+	struct PlannedTarget
+	{
+		int HookId;
+		const HookDefinition* Hook;
+		mdMethodDef Token;
+		mdSignature CaptureSignature;
+		int UnsignedCaptureArgs;
+		mdSignature TimingEnterSignature;
+		mdSignature TimingLeaveSignature;
+		mdToken LockIdentityMethod;
+		mdSignature LockContendedSignature;
+	};
+
+	HRESULT ResolveTarget(PlannedTarget& target);
+	HRESULT GetParameterTypes(const PlannedTarget& target, std::vector<PCCOR_SIGNATURE>& params, PCCOR_SIGNATURE* pEnd, short* pFirstParamSlot);
+	HRESULT CheckPayloadArg(const PlannedTarget& target);
+	HRESULT ResolveCaptureSignature(PlannedTarget& target);
+	HRESULT ResolveTimingSignatures(PlannedTarget& target);
+	bool IsFixedSizeType(PCCOR_SIGNATURE pType, PCCOR_SIGNATURE pEnd, bool* pUnsigned);
+	bool IsEnum(mdToken tkType);
+	CorElementType GetEnumUnderlyingType(mdTypeDef tkType);
+	HRESULT ResolveCoreLibraryRef(mdAssemblyRef* pAssemblyRef);
+	HRESULT ResolveCoreType(LPCWSTR typeName, mdToken* ptkType);
+	HRESULT ResolveCoreMethod(LPCWSTR typeName, LPCWSTR methodName, const std::vector<COR_SIGNATURE>& signature, mdToken* ptkMethod);
+	HRESULT ResolveSignature(const std::vector<COR_SIGNATURE>& signature, mdSignature* ptkSignature);
+	HRESULT EmitDispatcher();
+	HRESULT DefineCustomType(mdTypeDef* tdInjectedType);
+	HRESULT AddPInvoke(mdTypeDef td, mdModuleRef mr);
+	HRESULT AddDispatcherMethod(mdTypeDef td);
+	HRESULT SetILForDispatcherMethod();
+
+	LPCWSTR m_typeName;
+	LPCWSTR m_nativeModuleName;
+
+	std::vector<PlannedTarget> m_targets;
+	mdMethodDef m_pInvokeMethod;
+	mdMethodDef m_dispatcherMethod;
+
+	// Only valid for the duration of Emit
+	ICorProfilerInfo4* m_pInfo;
+	ModuleID m_moduleId;
+	IMetaDataEmit* m_pEmit;
+	IMetaDataImport* m_pImport;
+
+	// Tokens resolved once per plan and shared between every injected method
+	mdAssemblyRef m_coreLibraryRef;
+	std::map<WSTRING, mdToken> m_coreTypes;
+	std::map<std::vector<COR_SIGNATURE>, mdSignature> m_signatures;
+};
@@ -0,0 +1,51 @@
+#include "stdafx.h"
+#include "IntervalThread.h"
+#include <chrono>
+
+IntervalThread::IntervalThread() :
+	m_intervalMs(0),
+	m_stopping(false) {
+}
+
+IntervalThread::~IntervalThread()
+{
+	Stop();
+}
+
+void IntervalThread::Start(unsigned intervalMs, std::function<void()> tick)
+{
+	Stop();
+
+	m_tick = tick;
+	m_intervalMs = intervalMs;
+	m_stopping = false;
+	m_thread = std::thread(&IntervalThread::Run, this);
+}
+
+void IntervalThread::Stop()
+{
+	if (!m_thread.joinable())
+		return;
+
+	{
+		std::lock_guard<std::mutex> lock(m_lock);
+		m_stopping = true;
+	}
+	m_signal.notify_one();
+	m_thread.join();
+}
+
+bool IntervalThread::IsRunning() const
+{
+	return m_thread.joinable();
+}
+
+void IntervalThread::Run()
+{
+	std::unique_lock<std::mutex> lock(m_lock);
+	while (!m_signal.wait_for(lock, std::chrono::milliseconds(m_intervalMs), [this] { return m_stopping; })) {
+		lock.unlock();
+		m_tick();
+		lock.lock();
+	}
+}
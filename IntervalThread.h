@@ -0,0 +1,34 @@
+#pragma once
+
+#include "stdafx.h"
+#include <condition_variable>
+#include <functional>
+#include <mutex>
+#include <thread>
+
+// A background thread calling a function at a fixed interval until stopped, which the profiler's aggregators use to add
+// up per-thread blocks and rewrite their files. Declare it after everything the function uses, so if the library is
+// unloaded without Stop being called the destructor stops it before they're destroyed. Destroying a running std::thread
+// would terminate the process
+class IntervalThread
+{
+public:
+	IntervalThread();
+	~IntervalThread();
+
+	// Call tick every intervalMs, the first time one interval after starting. Stops the previous thread if still running
+	void Start(unsigned intervalMs, std::function<void()> tick);
+	// Wait for a tick in progress to return and the thread to exit. Does nothing if it isn't running
+	void Stop();
+	bool IsRunning() const;
+
+private:
+	void Run();
+
+	std::function<void()> m_tick;
+	unsigned m_intervalMs;
+	std::thread m_thread;
+	std::mutex m_lock;
+	std::condition_variable m_signal;
+	bool m_stopping;
+};
@@ -0,0 +1,224 @@
+#include "stdafx.h"
+#include "JitAccounting.h"
+#include "Utils.h"
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <map>
+#include <mutex>
+#include <unordered_map>
+
+struct JitInProgress
+{
+	FunctionID Function;
+	ModuleID Module;
+	mdMethodDef MethodDef;
+	bool ReJit;
+	INT64 StartNs;
+	UINT32 ILBytes;
+};
+
+// Zero initialised so the callbacks never run a constructor for it
+struct JitStack
+{
+	JitInProgress Entries[JIT_MAX_NESTED];
+	int Count;
+};
+
+typedef std::pair<ModuleID, mdMethodDef> MethodKey;
+
+static ICorProfilerInfo4* Info = nullptr;
+static std::string ReportPath;
+static bool Enabled = false;
+
+static std::mutex CostLock;
+static std::map<MethodKey, MethodJitCost> Costs;
+// Rewrites which haven't been matched with the compilation they were made for yet
+static std::map<MethodKey, UINT64> PendingRewrites;
+static std::unordered_map<ModuleID, std::string> ModuleNames;
+
+static std::atomic<UINT64> ProfilerNs{ 0 };
+
+static thread_local JitStack ThreadCompilations;
+
+// Must be called with CostLock held
+static const std::string& ModuleName(ModuleID moduleId)
+{
+	auto found = ModuleNames.find(moduleId);
+	if (found != ModuleNames.end())
+		return found->second;
+
+	WCHAR path[300];
+	ULONG pathLength = 0;
+	std::string name;
+	if (SUCCEEDED(Info->GetModuleInfo(moduleId, nullptr, _countof(path), &pathLength, path, nullptr))) {
+		name = WideToUtf8(path);
+		size_t separator = name.find_last_of("/\\");
+		if (separator != std::string::npos)
+			name.erase(0, separator + 1);
+	}
+	else {
+		name = fmt::format("[module {:x}]", moduleId);
+	}
+
+	return ModuleNames.emplace(moduleId, name).first->second;
+}
+
+void JitAccounting::Start(ICorProfilerInfo4* pInfo, const std::string& path)
+{
+	Info = pInfo;
+	ReportPath = path;
+	Enabled = true;
+
+	if (!path.empty())
+		spdlog::info("Timing JIT compilations to {}", path);
+}
+
+bool JitAccounting::IsEnabled()
+{
+	return Enabled;
+}
+
+INT64 JitAccounting::Now()
+{
+	return (INT64)std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+void JitAccounting::CompilationStarted(FunctionID functionId, ModuleID moduleId, mdMethodDef methodDef, bool rejit, INT64 startNs)
+{
+	JitStack& stack = ThreadCompilations;
+	if (stack.Count == JIT_MAX_NESTED)
+		return;
+
+	JitInProgress& entry = stack.Entries[stack.Count++];
+	entry.Function = functionId;
+	entry.Module = moduleId;
+	entry.MethodDef = methodDef;
+	entry.ReJit = rejit;
+	entry.StartNs = startNs;
+	entry.ILBytes = 0;
+
+	LPCBYTE pHeader = nullptr;
+	ULONG bodySize = 0;
+	if (Info != nullptr && SUCCEEDED(Info->GetILFunctionBody(moduleId, methodDef, &pHeader, &bodySize)))
+		entry.ILBytes = bodySize;
+}
+
+void JitAccounting::CompilationFinished(FunctionID functionId, HRESULT hrStatus)
+{
+	INT64 finishedNs = Now();
+
+	// Normally the innermost compilation, unless one was lost to nesting too deep or started before we attached
+	JitStack& stack = ThreadCompilations;
+	int index = stack.Count - 1;
+	while (index >= 0 && stack.Entries[index].Function != functionId)
+		index--;
+	if (index < 0)
+		return;
+
+	JitInProgress entry = stack.Entries[index];
+	std::copy(stack.Entries + index + 1, stack.Entries + stack.Count, stack.Entries + index);
+	stack.Count--;
+
+	UINT64 durationNs = (UINT64)(finishedNs - entry.StartNs);
+	MethodKey key(entry.Module, entry.MethodDef);
+	{
+		std::lock_guard<std::mutex> lock(CostLock);
+		auto inserted = Costs.emplace(key, MethodJitCost());
+		MethodJitCost& cost = inserted.first->second;
+		if (inserted.second) {
+			cost.Module = entry.Module;
+			cost.MethodDef = entry.MethodDef;
+			cost.ModuleName = Info != nullptr ? ModuleName(entry.Module) : fmt::format("[module {:x}]", entry.Module);
+			cost.MethodName = Info != nullptr ? FunctionIdToName(Info, functionId) : fmt::format("[method {:x}]", entry.MethodDef);
+		}
+
+		cost.Compilations++;
+		cost.ReJits += entry.ReJit ? 1 : 0;
+		cost.Failures += FAILED(hrStatus) ? 1 : 0;
+		cost.ILBytes = std::max(cost.ILBytes, entry.ILBytes);
+		cost.TotalNs += durationNs;
+		cost.MaxNs = std::max(cost.MaxNs, durationNs);
+
+		auto rewrite = PendingRewrites.find(key);
+		if (rewrite != PendingRewrites.end()) {
+			cost.Rewrites++;
+			cost.RewriteNs += rewrite->second;
+			PendingRewrites.erase(rewrite);
+		}
+	}
+
+	AddProfilerTime((UINT64)(Now() - finishedNs));
+}
+
+void JitAccounting::Rewritten(ModuleID moduleId, mdMethodDef methodDef, UINT64 durationNs)
+{
+	std::lock_guard<std::mutex> lock(CostLock);
+	PendingRewrites[MethodKey(moduleId, methodDef)] += durationNs;
+}
+
+void JitAccounting::AddProfilerTime(UINT64 durationNs)
+{
+	ProfilerNs.fetch_add(durationNs, std::memory_order_relaxed);
+}
+
+UINT64 JitAccounting::Snapshot(std::vector<MethodJitCost>& costs)
+{
+	costs.clear();
+	{
+		std::lock_guard<std::mutex> lock(CostLock);
+		for (const auto& cost : Costs)
+			costs.push_back(cost.second);
+	}
+
+	std::sort(costs.begin(), costs.end(), [](const MethodJitCost& left, const MethodJitCost& right) { return left.TotalNs > right.TotalNs; });
+	return ProfilerNs.load(std::memory_order_relaxed);
+}
+
+// Writes a line per method, most expensive first. Names are quoted since they can contain commas
+static void WriteReport(const std::vector<MethodJitCost>& costs)
+{
+	FILE* file = fopen(ReportPath.c_str(), "w");
+	if (file == nullptr) {
+		spdlog::error("Failed to open JIT file {}", ReportPath);
+		return;
+	}
+
+	fprintf(file, "module,method,compilations,rejits,failures,il_bytes,total_us,mean_us,max_us,rewrites,rewrite_us\n");
+	for (const MethodJitCost& cost : costs) {
+		fprintf(file, "%s,%s,%u,%u,%u,%u,%.1f,%.1f,%.1f,%u,%.1f\n", CsvQuote(cost.ModuleName).c_str(), CsvQuote(cost.MethodName).c_str(),
+			cost.Compilations, cost.ReJits, cost.Failures, cost.ILBytes, cost.TotalNs / 1e3, cost.TotalNs / 1e3 / cost.Compilations,
+			cost.MaxNs / 1e3, cost.Rewrites, cost.RewriteNs / 1e3);
+	}
+
+	fclose(file);
+}
+
+void JitAccounting::Stop()
+{
+	if (!Enabled)
+		return;
+
+	std::vector<MethodJitCost> costs;
+	UINT64 profilerNs = Snapshot(costs);
+
+	if (!ReportPath.empty())
+		WriteReport(costs);
+
+	UINT64 compilations = 0, totalNs = 0, rewriteNs = 0;
+	for (const MethodJitCost& cost : costs) {
+		compilations += cost.Compilations;
+		totalNs += cost.TotalNs;
+		rewriteNs += cost.RewriteNs;
+	}
+
+	// Nested compilations are counted inside the one that triggered them as well as on their own, so this overstates JIT time
+	// slightly when there are many. GetReJITParameters runs before a ReJIT's compilations start, so the profiler's share can
+	// exceed 100% when most compilations are ReJITs
+	spdlog::info("{} JIT compilation(s) of {} method(s) took {:.3f} ms. The profiler's JIT callbacks took {:.3f} ms ({:.1f}% of that), {:.3f} ms of it rewriting IL",
+		compilations, costs.size(), totalNs / 1e6, profilerNs / 1e6, totalNs > 0 ? 100.0 * profilerNs / totalNs : 0.0, rewriteNs / 1e6);
+	for (size_t i = 0; i < costs.size() && i < JIT_LOGGED_METHODS; i++) {
+		spdlog::info("JIT {} {}: {:.3f} ms over {} compilation(s), {} IL bytes", costs[i].ModuleName, costs[i].MethodName,
+			costs[i].TotalNs / 1e6, costs[i].Compilations, costs[i].ILBytes);
+	}
+}
@@ -0,0 +1,58 @@
+#pragma once
+
+#include "stdafx.h"
+#include <string>
+#include <vector>
+
+// Environment variable naming the file JIT costs are reported to. JIT compilations aren't timed unless it's set
+#define JIT_FILE_VARIABLE "ZEROED_PROFILER_JIT_FILE"
+
+// Most compilations in progress on one thread at once. Compiling a method can load types whose initialisation compiles more
+#define JIT_MAX_NESTED 8
+
+// Methods logged by Stop
+#define JIT_LOGGED_METHODS 10
+
+// JIT costs of one method, over every instantiation and every time it was compiled or recompiled
+struct MethodJitCost
+{
+	ModuleID Module;
+	mdMethodDef MethodDef;
+	std::string ModuleName;
+	std::string MethodName;
+	UINT32 Compilations;
+	UINT32 ReJits;
+	UINT32 Failures;
+	// Size of the method's IL body, header included, before any rewrite
+	UINT32 ILBytes;
+	UINT64 TotalNs;
+	UINT64 MaxNs;
+	UINT32 Rewrites;
+	UINT64 RewriteNs;
+};
+
+// Times each JIT compilation from the runtime's started callback to its finished callback, keeping the start on a per thread
+// stack so compilations on different threads overlap freely. Costs are aggregated per method under a lock, which is cheap
+// next to a compilation. The time spent in the profiler's own JIT callbacks, rewriting IL included, is totalled separately
+// so its share of JIT time can be reported
+class JitAccounting
+{
+public:
+	// pInfo is used to read IL sizes and names, and may be null
+	static void Start(ICorProfilerInfo4* pInfo, const std::string& path);
+	// Write the report and log the most expensive methods
+	static void Stop();
+	static bool IsEnabled();
+
+	static INT64 Now();
+
+	static void CompilationStarted(FunctionID functionId, ModuleID moduleId, mdMethodDef methodDef, bool rejit, INT64 startNs);
+	static void CompilationFinished(FunctionID functionId, HRESULT hrStatus);
+	// The hook rewrite of a method, counted against its next compilation
+	static void Rewritten(ModuleID moduleId, mdMethodDef methodDef, UINT64 durationNs);
+	// Time spent in a profiler callback during JIT
+	static void AddProfilerTime(UINT64 durationNs);
+
+	// Every method compiled so far, most expensive first. Returns the total time spent in the profiler's callbacks
+	static UINT64 Snapshot(std::vector<MethodJitCost>& costs);
+};
@@ -0,0 +1,307 @@
+#include "stdafx.h"
+#include "LoadTimeline.h"
+#include "Utils.h"
+#include <algorithm>
+#include <chrono>
+#include <cstring>
+#include <mutex>
+#include <unordered_map>
+
+static ICorProfilerInfo4* Info = nullptr;
+static std::string ReportPath;
+static bool Enabled = false;
+static INT64 OriginNs = 0;
+
+static std::mutex EventLock;
+static std::vector<LoadEvent> Events;
+// Loads which haven't finished, by index into Events. Assembly and module ids can overlap so they're kept apart
+static std::unordered_map<UINT64, size_t> PendingAssemblies;
+static std::unordered_map<UINT64, size_t> PendingModules;
+// Modules whose load finished but which haven't been instrumented yet
+static std::unordered_map<ModuleID, size_t> LoadedModules;
+
+static std::vector<std::string> Strings;
+static std::unordered_map<std::string, UINT32> StringIndexes;
+static std::unordered_map<AppDomainID, UINT32> AppDomainNames;
+
+// Must be called with EventLock held
+static UINT32 Intern(const std::string& value)
+{
+	auto found = StringIndexes.find(value);
+	if (found != StringIndexes.end())
+		return found->second;
+
+	UINT32 index = (UINT32)Strings.size();
+	Strings.push_back(value);
+	StringIndexes.emplace(value, index);
+	return index;
+}
+
+// Must be called with EventLock held
+static UINT32 AppDomainName(AppDomainID appDomainId)
+{
+	auto found = AppDomainNames.find(appDomainId);
+	if (found != AppDomainNames.end())
+		return found->second;
+
+	WCHAR name[300];
+	ULONG nameLength = 0;
+	std::string value;
+	if (SUCCEEDED(Info->GetAppDomainInfo(appDomainId, _countof(name), &nameLength, name, nullptr)))
+		value = WideToUtf8(name);
+	else
+		value = fmt::format("[app domain {:x}]", appDomainId);
+
+	return AppDomainNames.emplace(appDomainId, Intern(value)).first->second;
+}
+
+// The size of a loaded PE image from its optional header, or 0 when the base doesn't hold one
+static UINT32 ImageSize(LPCBYTE base)
+{
+	if (base == nullptr || base[0] != 'M' || base[1] != 'Z')
+		return 0;
+
+	UINT32 headerOffset = *(const UINT32*)(base + 0x3C);
+	LPCBYTE header = base + headerOffset;
+	if (headerOffset == 0 || headerOffset > 0x1000 || memcmp(header, "PE\0\0", 4) != 0)
+		return 0;
+
+	// SizeOfImage sits at the same offset in PE32 and PE32+ optional headers, which follow the 20 byte file header
+	return *(const UINT32*)(header + 4 + 20 + 56);
+}
+
+static void Begin(LoadKind kind, UINT64 id, std::unordered_map<UINT64, size_t>& pending)
+{
+	LoadEvent loadEvent = {};
+	loadEvent.Id = id;
+	loadEvent.StartNs = LoadTimeline::Now() - OriginNs;
+	loadEvent.Kind = kind;
+
+	std::lock_guard<std::mutex> lock(EventLock);
+	pending[id] = Events.size();
+	Events.push_back(loadEvent);
+}
+
+// Finishes the load and returns its index, or -1 if its start wasn't seen. Must be called with EventLock held
+static ptrdiff_t Finish(UINT64 id, HRESULT hrStatus, INT64 finishNs, std::unordered_map<UINT64, size_t>& pending)
+{
+	auto found = pending.find(id);
+	if (found == pending.end())
+		return -1;
+
+	size_t index = found->second;
+	pending.erase(found);
+
+	LoadEvent& loadEvent = Events[index];
+	loadEvent.FinishNs = std::max(finishNs, loadEvent.StartNs + 1);
+	loadEvent.Status = hrStatus;
+	return (ptrdiff_t)index;
+}
+
+void LoadTimeline::Start(ICorProfilerInfo4* pInfo, const std::string& path)
+{
+	Info = pInfo;
+	ReportPath = path;
+	OriginNs = Now();
+	Enabled = true;
+
+	if (!path.empty())
+		spdlog::info("Recording assembly loads to {}", path);
+}
+
+bool LoadTimeline::IsEnabled()
+{
+	return Enabled;
+}
+
+INT64 LoadTimeline::Now()
+{
+	return (INT64)std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+void LoadTimeline::AssemblyStarted(AssemblyID assemblyId)
+{
+	Begin(LoadKind::Assembly, assemblyId, PendingAssemblies);
+}
+
+void LoadTimeline::AssemblyFinished(AssemblyID assemblyId, HRESULT hrStatus)
+{
+	INT64 finishNs = Now() - OriginNs;
+
+	// The assembly is only named once it's loaded
+	WCHAR name[300];
+	ULONG nameLength = 0;
+	AppDomainID appDomainId = 0;
+	bool described = Info != nullptr && SUCCEEDED(Info->GetAssemblyInfo(assemblyId, _countof(name), &nameLength, name, &appDomainId, nullptr));
+
+	std::lock_guard<std::mutex> lock(EventLock);
+	ptrdiff_t index = Finish(assemblyId, hrStatus, finishNs, PendingAssemblies);
+	if (index < 0)
+		return;
+
+	LoadEvent& loadEvent = Events[index];
+	loadEvent.Name = Intern(described ? WideToUtf8(name) : fmt::format("[assembly {:x}]", assemblyId));
+	loadEvent.Context = described ? AppDomainName(appDomainId) : Intern("");
+}
+
+void LoadTimeline::ModuleStarted(ModuleID moduleId)
+{
+	Begin(LoadKind::Module, moduleId, PendingModules);
+}
+
+void LoadTimeline::ModuleFinished(ModuleID moduleId, HRESULT hrStatus)
+{
+	INT64 finishNs = Now() - OriginNs;
+
+	WCHAR path[300];
+	ULONG pathLength = 0;
+	LPCBYTE base = nullptr;
+	AssemblyID assemblyId = 0;
+	DWORD flags = 0;
+	bool described = Info != nullptr && SUCCEEDED(Info->GetModuleInfo2(moduleId, &base, _countof(path), &pathLength, path, &assemblyId, &flags));
+
+	AppDomainID appDomainId = 0;
+	bool inAppDomain = described && SUCCEEDED(Info->GetAssemblyInfo(assemblyId, 0, nullptr, nullptr, &appDomainId, nullptr));
+
+	std::string name;
+	if (described && pathLength > 0) {
+		name = WideToUtf8(path);
+		size_t separator = name.find_last_of("/\\");
+		if (separator != std::string::npos)
+			name.erase(0, separator + 1);
+	}
+	else {
+		name = fmt::format("[module {:x}]", moduleId);
+	}
+
+	// Dynamic modules have no image, and a failed load may not have mapped one
+	UINT32 imageBytes = described && SUCCEEDED(hrStatus) && (flags & COR_PRF_MODULE_DYNAMIC) == 0 ? ImageSize(base) : 0;
+
+	std::lock_guard<std::mutex> lock(EventLock);
+	ptrdiff_t index = Finish(moduleId, hrStatus, finishNs, PendingModules);
+	if (index < 0)
+		return;
+
+	LoadEvent& loadEvent = Events[index];
+	loadEvent.Name = Intern(name);
+	loadEvent.Context = inAppDomain ? AppDomainName(appDomainId) : Intern("");
+	loadEvent.Flags = flags;
+	loadEvent.ImageBytes = imageBytes;
+	LoadedModules[moduleId] = (size_t)index;
+}
+
+void LoadTimeline::ModuleInstrumented(ModuleID moduleId, UINT64 durationNs)
+{
+	std::lock_guard<std::mutex> lock(EventLock);
+	auto found = LoadedModules.find(moduleId);
+	if (found == LoadedModules.end())
+		return;
+
+	Events[found->second].ProfilerNs = (UINT32)std::min<UINT64>(durationNs, UINT32_MAX);
+	LoadedModules.erase(found);
+}
+
+void LoadTimeline::Snapshot(std::vector<LoadEvent>& events, std::vector<std::string>& strings)
+{
+	std::lock_guard<std::mutex> lock(EventLock);
+	events = Events;
+	strings = Strings;
+}
+
+static const char* KindName(LoadKind kind)
+{
+	return kind == LoadKind::Assembly ? "assembly" : "module";
+}
+
+// Writes a line per load in the order they started. Loads still in progress have no duration. Names are quoted since they
+// can contain commas
+static void WriteReport(const std::vector<LoadEvent>& events, const std::vector<std::string>& strings)
+{
+	FILE* file = fopen(ReportPath.c_str(), "w");
+	if (file == nullptr) {
+		spdlog::error("Failed to open load file {}", ReportPath);
+		return;
+	}
+
+	fprintf(file, "kind,name,context,start_ms,duration_us,profiler_us,image_bytes,precompiled,flags,status\n");
+	for (const LoadEvent& loadEvent : events) {
+		bool finished = loadEvent.FinishNs != 0;
+		bool module = loadEvent.Kind == LoadKind::Module;
+		std::string name = finished ? strings[loadEvent.Name] : fmt::format("[{} {:x}]", KindName(loadEvent.Kind), loadEvent.Id);
+
+		fprintf(file, "%s,%s,%s,%.3f,%s,%s,%s,%s,%s,%s\n", KindName(loadEvent.Kind), CsvQuote(name).c_str(),
+			CsvQuote(finished ? strings[loadEvent.Context] : "").c_str(), loadEvent.StartNs / 1e6,
+			finished ? fmt::format("{:.1f}", (loadEvent.FinishNs - loadEvent.StartNs) / 1e3).c_str() : "",
+			finished && module ? fmt::format("{:.1f}", loadEvent.ProfilerNs / 1e3).c_str() : "",
+			finished && module ? std::to_string(loadEvent.ImageBytes).c_str() : "",
+			finished && module ? ((loadEvent.Flags & COR_PRF_MODULE_NGEN) != 0 ? "1" : "0") : "",
+			finished && module ? fmt::format("0x{:x}", loadEvent.Flags).c_str() : "",
+			finished ? fmt::format("0x{:08x}", (UINT32)loadEvent.Status).c_str() : "");
+	}
+
+	fclose(file);
+}
+
+void LoadTimeline::Stop()
+{
+	if (!Enabled)
+		return;
+
+	std::vector<LoadEvent> events;
+	std::vector<std::string> strings;
+	Snapshot(events, strings);
+
+	if (!ReportPath.empty())
+		WriteReport(events, strings);
+
+	UINT32 assemblies = 0, modules = 0, precompiled = 0, failed = 0, unfinished = 0;
+	UINT64 assemblyNs = 0, precompiledNs = 0, ilOnlyNs = 0, profilerNs = 0;
+	INT64 firstNs = INT64_MAX, lastNs = 0;
+	std::vector<const LoadEvent*> slowest;
+	for (const LoadEvent& loadEvent : events) {
+		if (loadEvent.FinishNs == 0) {
+			unfinished++;
+			continue;
+		}
+
+		UINT64 durationNs = (UINT64)(loadEvent.FinishNs - loadEvent.StartNs);
+		firstNs = std::min(firstNs, loadEvent.StartNs);
+		lastNs = std::max(lastNs, loadEvent.FinishNs);
+		failed += FAILED(loadEvent.Status) ? 1 : 0;
+
+		if (loadEvent.Kind == LoadKind::Assembly) {
+			assemblies++;
+			assemblyNs += durationNs;
+			slowest.push_back(&loadEvent);
+		}
+		else if ((loadEvent.Flags & COR_PRF_MODULE_NGEN) != 0) {
+			modules++;
+			precompiled++;
+			precompiledNs += durationNs;
+			profilerNs += loadEvent.ProfilerNs;
+		}
+		else {
+			modules++;
+			ilOnlyNs += durationNs;
+			profilerNs += loadEvent.ProfilerNs;
+		}
+	}
+
+	if (assemblies + modules == 0) {
+		spdlog::info("No assembly loads were seen");
+		return;
+	}
+
+	// Module loads happen inside their assembly's load, so the two totals overlap rather than add up
+	spdlog::info("Loaded {} assemblies and {} modules over {:.3f} ms, {} failed and {} unfinished. Assembly loads took {:.3f} ms, module loads {:.3f} ms for {} precompiled and {:.3f} ms for {} IL only, and instrumenting modules took {:.3f} ms",
+		assemblies, modules, (lastNs - firstNs) / 1e6, failed, unfinished, assemblyNs / 1e6, precompiledNs / 1e6, precompiled,
+		ilOnlyNs / 1e6, modules - precompiled, profilerNs / 1e6);
+
+	std::sort(slowest.begin(), slowest.end(), [](const LoadEvent* left, const LoadEvent* right) {
+		return left->FinishNs - left->StartNs > right->FinishNs - right->StartNs;
+	});
+	for (size_t i = 0; i < slowest.size() && i < LOAD_LOGGED_EVENTS; i++) {
+		spdlog::info("Assembly {} loaded in {:.3f} ms, {:.3f} ms after the profiler started", strings[slowest[i]->Name],
+			(slowest[i]->FinishNs - slowest[i]->StartNs) / 1e6, slowest[i]->StartNs / 1e6);
+	}
+}
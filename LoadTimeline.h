@@ -0,0 +1,64 @@
+#pragma once
+
+#include "stdafx.h"
+#include <string>
+#include <vector>
+
+// Environment variable naming the file the load timeline is written to. Loads aren't timed unless it's set
+#define LOAD_FILE_VARIABLE "ZEROED_PROFILER_LOAD_FILE"
+
+// Slowest assembly loads logged by Stop
+#define LOAD_LOGGED_EVENTS 10
+
+enum class LoadKind : UINT8
+{
+	Assembly,
+	Module,
+};
+
+// One assembly or module load, kept small since a large application loads hundreds. Times are in nanoseconds since the
+// timeline started and names are indexes into its string table
+struct LoadEvent
+{
+	UINT64 Id;
+	INT64 StartNs;
+	// 0 until the load finishes
+	INT64 FinishNs;
+	// Modules: time spent instrumenting it once it loaded, which isn't part of the load itself
+	UINT32 ProfilerNs;
+	// Modules: the image's size in memory, 0 for dynamic modules
+	UINT32 ImageBytes;
+	UINT32 Name;
+	// The app domain the load happened in
+	UINT32 Context;
+	// Modules: COR_PRF_MODULE_FLAGS
+	DWORD Flags;
+	HRESULT Status;
+	LoadKind Kind;
+};
+
+// Records when each assembly and module starts and finishes loading, from the runtime's load callbacks, to show where cold
+// start time goes. Loads are rare next to everything else the profiler sees, so events go into a single list under a lock
+// and are only named once they finish, when the runtime can describe them. The profiler API doesn't expose
+// AssemblyLoadContext, so the context recorded is the app domain, with collectible modules flagged
+class LoadTimeline
+{
+public:
+	// pInfo is used to describe loads and may be null
+	static void Start(ICorProfilerInfo4* pInfo, const std::string& path);
+	// Write the timeline and log a summary of where load time went
+	static void Stop();
+	static bool IsEnabled();
+
+	static INT64 Now();
+
+	static void AssemblyStarted(AssemblyID assemblyId);
+	static void AssemblyFinished(AssemblyID assemblyId, HRESULT hrStatus);
+	static void ModuleStarted(ModuleID moduleId);
+	static void ModuleFinished(ModuleID moduleId, HRESULT hrStatus);
+	// Time the profiler spent instrumenting a module after it finished loading
+	static void ModuleInstrumented(ModuleID moduleId, UINT64 durationNs);
+
+	// Every load seen so far in the order they started, and the strings their names index
+	static void Snapshot(std::vector<LoadEvent>& events, std::vector<std::string>& strings);
+};
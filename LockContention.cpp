@@ -0,0 +1,388 @@
+#include "stdafx.h"
+#include "LockContention.h"
+#include "IntervalThread.h"
+#include "PerThread.h"
+#include "Statistics.h"
+#include "Utils.h"
+#include <algorithm>
+#include <atomic>
+#include <cstdio>
+#include <unordered_map>
+
+// Locks and call sites logged by Stop
+#define LOCK_LOGGED 5
+
+// Prefix of the methods a site is looked for outside of
+#define LOCK_MONITOR_PREFIX "System.Threading.Monitor."
+
+struct LockWaitEvent
+{
+	UINT64 Lock;
+	UINT64 Ticks;
+	UINT32 FrameCount;
+	FunctionID Frames[LOCK_SITE_FRAMES];
+};
+
+// Contended waits one thread has made which the merge thread hasn't collected yet. Only the owning thread writes Head,
+// and only the merge thread writes Tail
+struct ThreadLockWaits
+{
+	ThreadLockWaits();
+
+	// Collect the thread's last waits as it exits
+	void Retire();
+
+	std::atomic<UINT32> Head;
+	std::atomic<UINT32> Tail;
+	LockWaitEvent Events[LOCK_EVENT_BUFFER];
+};
+
+// Contended waits on one lock, the histogram in ticks laid out like a Statistics one
+struct LockTotals
+{
+	StatSummary Waits;
+	// Ticks waited at each call site
+	std::unordered_map<FunctionID, UINT64> SiteTicks;
+};
+
+struct StackWalk
+{
+	FunctionID Frames[LOCK_SITE_FRAMES];
+	size_t Count;
+};
+
+// Every acquisition's wait in ticks, contended or not, and contended waits dropped because a thread's ring was full
+static const int WaitTicksStat = Statistics::Histogram("lock.wait_ticks");
+static const int DroppedWaitsStat = Statistics::Counter("lock.dropped_waits");
+
+// Everything collected from the threads' rings, only accessed with the thread list locked
+static std::unordered_map<UINT64, LockTotals> Locks;
+static std::unordered_map<FunctionID, StatSummary> Sites;
+static std::unordered_map<FunctionID, std::string> FunctionNames;
+
+static ICorProfilerInfo4* Info = nullptr;
+// Calibrated by the merge thread so starting doesn't wait on TicksPerNanosecond. Until then the threshold is in nanoseconds,
+// which on a TSC only counts a few more waits as contended
+static std::atomic<UINT64> ContendedTicks{ LOCK_CONTENDED_NS };
+// A walk which fails once fails the same way on every contended wait, so it's only logged the first time
+static std::atomic<bool> WalkFailureLogged{ false };
+
+static std::string LockPath;
+// Collections the merge thread has made since starting
+static unsigned Collections = 0;
+static IntervalThread MergeThread;
+
+ThreadLockWaits::ThreadLockWaits() :
+	Head(0),
+	Tail(0) {
+}
+
+static void AddWait(StatSummary& totals, UINT64 ticks)
+{
+	totals.Min = totals.Count == 0 ? ticks : std::min(totals.Min, ticks);
+	totals.Max = std::max(totals.Max, ticks);
+	totals.Count++;
+	totals.Sum += ticks;
+	totals.Buckets[Statistics::BucketOf(ticks)]++;
+}
+
+// Must be called with the thread list locked
+static const std::string& FunctionName(FunctionID functionId)
+{
+	auto found = FunctionNames.find(functionId);
+	if (found != FunctionNames.end())
+		return found->second;
+
+	std::string name;
+	if (functionId == 0)
+		name = "[unknown]";
+	else if (Info != nullptr)
+		name = FunctionIdToName(Info, functionId);
+	else
+		name = fmt::format("[function {:x}]", functionId);
+
+	return FunctionNames.emplace(functionId, name).first->second;
+}
+
+// The first frame outside Monitor, so waits are charged to the method taking the lock rather than the overload it called.
+// Must be called with the thread list locked
+static FunctionID FindSite(const LockWaitEvent& event)
+{
+	for (UINT32 i = 0; i < event.FrameCount; i++) {
+		FunctionID functionId = event.Frames[i];
+		if (functionId != 0 && FunctionName(functionId).compare(0, sizeof(LOCK_MONITOR_PREFIX) - 1, LOCK_MONITOR_PREFIX) != 0)
+			return functionId;
+	}
+
+	return 0;
+}
+
+// Must be called with the thread list locked
+static void Drain(ThreadLockWaits& waits)
+{
+	UINT32 head = waits.Head.load(std::memory_order_acquire);
+	UINT32 tail = waits.Tail.load(std::memory_order_relaxed);
+	for (; tail != head; tail++) {
+		const LockWaitEvent& event = waits.Events[tail % LOCK_EVENT_BUFFER];
+		FunctionID site = FindSite(event);
+
+		LockTotals& lock = Locks[event.Lock];
+		AddWait(lock.Waits, event.Ticks);
+		lock.SiteTicks[site] += event.Ticks;
+		AddWait(Sites[site], event.Ticks);
+	}
+
+	waits.Tail.store(tail, std::memory_order_release);
+}
+
+void ThreadLockWaits::Retire()
+{
+	Drain(*this);
+}
+
+bool LockContention::Record(UINT64 ticks)
+{
+	Statistics::Record(WaitTicksStat, ticks);
+	return ticks >= ContendedTicks.load(std::memory_order_relaxed);
+}
+
+void LockContention::RecordContended(UINT64 lockId, UINT64 ticks, const FunctionID* frames, size_t frameCount)
+{
+	// Contended waits are rare enough that only threads which make one carry a ring
+	ThreadLockWaits& waits = PerThread<ThreadLockWaits>::Local();
+	UINT32 head = waits.Head.load(std::memory_order_relaxed);
+	if (head - waits.Tail.load(std::memory_order_acquire) == LOCK_EVENT_BUFFER) {
+		Statistics::Count(DroppedWaitsStat);
+		return;
+	}
+
+	LockWaitEvent& event = waits.Events[head % LOCK_EVENT_BUFFER];
+	event.Lock = lockId;
+	event.Ticks = ticks;
+	event.FrameCount = (UINT32)std::min(frameCount, (size_t)LOCK_SITE_FRAMES);
+	std::copy(frames, frames + event.FrameCount, event.Frames);
+	waits.Head.store(head + 1, std::memory_order_release);
+}
+
+static HRESULT STDMETHODCALLTYPE OnFrame(FunctionID funcId, UINT_PTR ip, COR_PRF_FRAME_INFO frameInfo, ULONG32 contextSize, BYTE context[], void* clientData)
+{
+	StackWalk* walk = (StackWalk*)clientData;
+
+	// A function ID of 0 stands for a run of native frames, which are collapsed into one
+	if (funcId == 0 && walk->Count > 0 && walk->Frames[walk->Count - 1] == 0)
+		return S_OK;
+
+	walk->Frames[walk->Count++] = funcId;
+	return walk->Count < LOCK_SITE_FRAMES ? S_OK : S_FALSE;
+}
+
+static INT64 STDMETHODCALLTYPE LockLeave(int hookId, INT64 start)
+{
+	INT64 end = MethodTiming::Now();
+
+	// The TSC of a core the thread migrated to can trail the one it started on
+	UINT64 ticks = end > start ? (UINT64)(end - start) : 0;
+	return LockContention::Record(ticks) ? (INT64)ticks : 0;
+}
+
+static void STDMETHODCALLTYPE LockContended(int hookId, INT64 ticks, INT32 lockHash)
+{
+	// Only contended waits are attributed to a call site, and they've already cost far more than the walk
+	StackWalk walk;
+	walk.Count = 0;
+	if (Info != nullptr) {
+		// A walk ended early by OnFrame reports CORPROF_E_STACKSNAPSHOT_ABORTED, and one that fails part way still leaves the
+		// frames it found, so the wait is recorded either way
+		HRESULT hr = Info->DoStackSnapshot(0, &OnFrame, COR_PRF_SNAPSHOT_DEFAULT, &walk, nullptr, 0);
+		if (FAILED(hr) && hr != CORPROF_E_STACKSNAPSHOT_ABORTED && !WalkFailureLogged.exchange(true, std::memory_order_relaxed))
+			spdlog::warn("DoStackSnapshot failed, contended waits may be missing their call site: {}", HrToString(hr));
+	}
+
+	LockContention::RecordContended((UINT32)lockHash, (UINT64)ticks, walk.Frames, walk.Count);
+}
+
+void* LockContention::GetLeaveFunction()
+{
+	return (void*)&LockLeave;
+}
+
+void* LockContention::GetContendedFunction()
+{
+	return (void*)&LockContended;
+}
+
+static void Summarise(UINT64 id, const std::string& name, const StatSummary& totals, double ticksPerNs, LockWaitSummary& summary)
+{
+	summary.Id = id;
+	summary.Name = name;
+	MethodTiming::Summarise(totals, ticksPerNs, summary.Waits);
+}
+
+// The statistic registered as id, or nullptr if it hasn't recorded anything
+static const StatSummary* FindStat(const std::vector<StatSummary>& stats, StatKind kind, int id)
+{
+	auto found = std::find_if(stats.begin(), stats.end(), [&](const StatSummary& stat) { return stat.Kind == kind && stat.Id == id; });
+	return found != stats.end() ? &*found : nullptr;
+}
+
+HookTimingSummary LockContention::Merge(std::vector<LockWaitSummary>& locks, std::vector<LockWaitSummary>& sites)
+{
+	double ticksPerNs = MethodTiming::TicksPerNanosecond();
+
+	std::vector<StatSummary> stats;
+	Statistics::Snapshot(stats);
+	const StatSummary* acquisitions = FindStat(stats, StatKind::Histogram, WaitTicksStat);
+	HookTimingSummary all = {};
+	if (acquisitions != nullptr)
+		MethodTiming::Summarise(*acquisitions, ticksPerNs, all);
+
+	locks.clear();
+	sites.clear();
+	PerThread<ThreadLockWaits>::Visit([&](const std::vector<ThreadLockWaits*>& threads) {
+		for (ThreadLockWaits* waits : threads)
+			Drain(*waits);
+
+		for (const auto& entry : Locks) {
+			LockWaitSummary summary;
+			Summarise(entry.first, fmt::format("0x{:x}", entry.first), entry.second.Waits, ticksPerNs, summary);
+
+			auto topSite = std::max_element(entry.second.SiteTicks.begin(), entry.second.SiteTicks.end(),
+				[](const std::pair<const FunctionID, UINT64>& left, const std::pair<const FunctionID, UINT64>& right) { return left.second < right.second; });
+			summary.TopSite = topSite != entry.second.SiteTicks.end() ? FunctionName(topSite->first) : "";
+			locks.push_back(std::move(summary));
+		}
+
+		for (const auto& entry : Sites) {
+			LockWaitSummary summary;
+			Summarise(entry.first, FunctionName(entry.first), entry.second, ticksPerNs, summary);
+			sites.push_back(std::move(summary));
+		}
+	});
+
+	auto longestFirst = [](const LockWaitSummary& left, const LockWaitSummary& right) { return left.Waits.TotalNs > right.Waits.TotalNs; };
+	std::sort(locks.begin(), locks.end(), longestFirst);
+	std::sort(sites.begin(), sites.end(), longestFirst);
+	return all;
+}
+
+UINT64 LockContention::DroppedWaits()
+{
+	std::vector<StatSummary> stats;
+	Statistics::Snapshot(stats);
+	const StatSummary* dropped = FindStat(stats, StatKind::Counter, DroppedWaitsStat);
+	return dropped != nullptr ? (UINT64)dropped->Value : 0;
+}
+
+static void WriteLine(FILE* file, const char* kind, const LockWaitSummary& summary)
+{
+	const HookTimingSummary& waits = summary.Waits;
+	fprintf(file, "%s,%s,%s,%llu,%.1f,%.1f,%.1f,%.1f,%.1f,", kind, CsvQuote(summary.Name).c_str(), CsvQuote(summary.TopSite).c_str(),
+		(unsigned long long)waits.Calls, waits.TotalNs / 1e3, waits.Calls > 0 ? waits.TotalNs / 1e3 / waits.Calls : 0.0,
+		waits.MaxNs / 1e3, waits.PercentileNs(0.5) / 1e3, waits.PercentileNs(0.99) / 1e3);
+
+	const char* separator = "";
+	for (int i = 0; i < STATS_HISTOGRAM_BUCKETS; i++) {
+		if (waits.Buckets[i] == 0)
+			continue;
+		fprintf(file, "%s%.0f:%llu", separator, waits.BucketLimitNs[i], (unsigned long long)waits.Buckets[i]);
+		separator = " ";
+	}
+	fprintf(file, "\n");
+}
+
+// Rewrites the lock file with a line for every acquisition, then one per lock and one per call site waited on longest
+// first. The histogram column lists "<bucket upper bound in ns>:<waits>" like the timing file
+static void WriteReport(const HookTimingSummary& all, const std::vector<LockWaitSummary>& locks, const std::vector<LockWaitSummary>& sites)
+{
+	if (LockPath.empty())
+		return;
+
+	FILE* file = fopen(LockPath.c_str(), "w");
+	if (file == nullptr) {
+		spdlog::error("Failed to open lock file {}", LockPath);
+		return;
+	}
+
+	fprintf(file, "kind,name,top_site,waits,total_us,mean_us,max_us,p50_us,p99_us,histogram\n");
+	LockWaitSummary allSummary;
+	allSummary.Id = 0;
+	allSummary.Name = "*";
+	allSummary.Waits = all;
+	WriteLine(file, "all", allSummary);
+	for (const LockWaitSummary& lock : locks)
+		WriteLine(file, "lock", lock);
+	for (const LockWaitSummary& site : sites)
+		WriteLine(file, "site", site);
+
+	fclose(file);
+}
+
+static void MergeAndWrite()
+{
+	std::vector<LockWaitSummary> locks, sites;
+	HookTimingSummary all = LockContention::Merge(locks, sites);
+	WriteReport(all, locks, sites);
+}
+
+// Collects waits often enough that busy threads don't fill their rings, and summarises them less often
+static void Collect()
+{
+	if (Collections++ == 0)
+		ContendedTicks.store((UINT64)(LOCK_CONTENDED_NS * MethodTiming::TicksPerNanosecond()), std::memory_order_relaxed);
+
+	if (Collections % (LOCK_WRITE_INTERVAL_MS / LOCK_MERGE_INTERVAL_MS) == 0) {
+		MergeAndWrite();
+	}
+	else {
+		PerThread<ThreadLockWaits>::Visit([](const std::vector<ThreadLockWaits*>& threads) {
+			for (ThreadLockWaits* waits : threads)
+				Drain(*waits);
+		});
+	}
+}
+
+void LockContention::Start(ICorProfilerInfo4* pInfo, const std::string& path)
+{
+	Stop();
+
+	Info = pInfo;
+	LockPath = path;
+	Collections = 0;
+	WalkFailureLogged = false;
+	Statistics::Enable();
+
+	if (!LockPath.empty())
+		spdlog::info("Measuring lock waits to {}, counting waits over {} ns as contended", LockPath, LOCK_CONTENDED_NS);
+
+	MergeThread.Start(LOCK_MERGE_INTERVAL_MS, Collect);
+}
+
+void LockContention::Stop()
+{
+	if (!MergeThread.IsRunning())
+		return;
+
+	MergeThread.Stop();
+
+	std::vector<LockWaitSummary> locks, sites;
+	HookTimingSummary all = Merge(locks, sites);
+	WriteReport(all, locks, sites);
+
+	UINT64 contended = 0;
+	for (const LockWaitSummary& site : sites)
+		contended += site.Waits.Calls;
+
+	spdlog::info("{} Monitor acquisition(s), {} contended, {:.3f} ms waiting in total", all.Calls, contended, all.TotalNs / 1e6);
+	for (size_t i = 0; i < locks.size() && i < LOCK_LOGGED; i++) {
+		spdlog::info("Lock {} mostly from {}: {} contended wait(s), {:.3f} ms, p99 {:.0f} ns, max {:.0f} ns", locks[i].Name, locks[i].TopSite,
+			locks[i].Waits.Calls, locks[i].Waits.TotalNs / 1e6, locks[i].Waits.PercentileNs(0.99), locks[i].Waits.MaxNs);
+	}
+	for (size_t i = 0; i < sites.size() && i < LOCK_LOGGED; i++) {
+		spdlog::info("Lock waits in {}: {} contended wait(s), {:.3f} ms, p99 {:.0f} ns, max {:.0f} ns", sites[i].Name, sites[i].Waits.Calls,
+			sites[i].Waits.TotalNs / 1e6, sites[i].Waits.PercentileNs(0.99), sites[i].Waits.MaxNs);
+	}
+
+	UINT64 dropped = DroppedWaits();
+	if (dropped > 0)
+		spdlog::warn("{} contended wait(s) were dropped because a thread's buffer filled before they were collected", dropped);
+}
@@ -0,0 +1,67 @@
+#pragma once
+
+#include "stdafx.h"
+#include "MethodTiming.h"
+#include <string>
+#include <vector>
+
+// Environment variable naming the file lock contention is reported to. The Monitor hooks aren't installed unless it's set
+#define LOCK_FILE_VARIABLE "ZEROED_PROFILER_LOCK_FILE"
+
+// Waits at least this long count as contended and are attributed to their lock and call site. Shorter ones only count
+// towards the overall histogram
+#define LOCK_CONTENDED_NS 1000
+
+// Contended waits each thread can hold before the merge thread collects them. Any more are dropped
+#define LOCK_EVENT_BUFFER 256
+
+// Frames walked from a contended wait looking for the first one outside Monitor
+#define LOCK_SITE_FRAMES 4
+
+// How often the merge thread collects contended waits, and how often it rewrites the lock file
+#define LOCK_MERGE_INTERVAL_MS 50
+#define LOCK_WRITE_INTERVAL_MS 1000
+
+// Contended waits on one lock or at one call site
+struct LockWaitSummary
+{
+	// The lock object's RuntimeHelpers.GetHashCode, or the waiting method's FunctionID
+	UINT64 Id;
+	std::string Name;
+	// Locks: the call site which waited for it longest
+	std::string TopSite;
+	// Calls are the waits. HookId isn't used
+	HookTimingSummary Waits;
+};
+
+// Measures how long Monitor.Enter and Monitor.TryEnter wait. The hooks read a timestamp on entry like a timed hook, and on
+// exit pass it to the leave function, which records every acquisition into a Statistics histogram. Only when the wait was
+// contended does the hook go on to hash the lock object and call the contended function, which walks the thread's stack
+// to find who was waiting and queues the wait in the thread's own ring of events. A background thread drains every ring,
+// aggregates the waits per lock and per call site and rewrites the lock file. Locks are identified by
+// RuntimeHelpers.GetHashCode, which stays the same when the GC moves the object but isn't unique, so the rare locks
+// sharing a hash code are reported together
+class LockContention
+{
+public:
+	// pInfo is used to walk stacks and name call sites, and may be null
+	static void Start(ICorProfilerInfo4* pInfo, const std::string& path);
+	// Stop the merge thread, write the file a final time and log the most contended locks and call sites
+	static void Stop();
+
+	// Count an acquisition made by the calling thread, returning whether its wait was long enough to count as contended
+	static bool Record(UINT64 ticks);
+	// Queue a contended wait made by the calling thread. frames run from the innermost outwards
+	static void RecordContended(UINT64 lockId, UINT64 ticks, const FunctionID* frames, size_t frameCount);
+
+	// Collect every thread's contended waits and summarise them, the locks and sites waited on longest first. Returns the
+	// waits of every acquisition, contended or not
+	static HookTimingSummary Merge(std::vector<LockWaitSummary>& locks, std::vector<LockWaitSummary>& sites);
+	static UINT64 DroppedWaits();
+
+	// Native function the injected calli targets on exit: unmanaged stdcall int64(int32 hookId, int64 start), returning the
+	// ticks waited if the wait was contended and 0 otherwise
+	static void* GetLeaveFunction();
+	// Native function called after a contended exit: unmanaged stdcall void(int32 hookId, int64 ticks, int32 lockHash)
+	static void* GetContendedFunction();
+};
@@ -0,0 +1,211 @@
+#include "stdafx.h"
+#include "MethodTiming.h"
+#include "IntervalThread.h"
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <thread>
+
+#if defined(_M_X64) || defined(_M_IX86) || defined(__x86_64__) || defined(__i386__)
+#define TIMING_USE_TSC
+#ifdef _MSC_VER
+#include <intrin.h>
+#else
+#include <x86intrin.h>
+#endif
+#endif
+
+// Calibrating the TSC against the monotonic clock over less than this is too coarse to be useful
+#define TIMING_CALIBRATION_MS 20
+
+// Statistics histogram each hook's ticks are recorded into plus one, so hooks Start hasn't registered are 0 and record nothing
+static std::atomic<int> HookHistograms[MAX_HOOKS];
+
+static std::string TimingPath;
+static std::vector<std::string> HookNames;
+static IntervalThread MergeThread;
+
+// Timestamps taken when the module loaded, which TicksPerNanosecond measures the TSC against
+static const INT64 CalibrationTicks = MethodTiming::Now();
+static const std::chrono::steady_clock::time_point CalibrationTime = std::chrono::steady_clock::now();
+
+INT64 MethodTiming::Now()
+{
+#ifdef TIMING_USE_TSC
+	return (INT64)__rdtsc();
+#else
+	return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+#endif
+}
+
+void MethodTiming::Record(int hookId, INT64 start, INT64 end)
+{
+	if ((unsigned)hookId >= MAX_HOOKS)
+		return;
+
+	// The TSC of a core the thread migrated to can trail the one it started on
+	UINT64 ticks = end > start ? (UINT64)(end - start) : 0;
+	Statistics::Record(HookHistograms[hookId].load(std::memory_order_relaxed) - 1, ticks);
+}
+
+double MethodTiming::TicksPerNanosecond()
+{
+#ifdef TIMING_USE_TSC
+	auto elapsed = std::chrono::steady_clock::now() - CalibrationTime;
+	if (elapsed < std::chrono::milliseconds(TIMING_CALIBRATION_MS))
+		std::this_thread::sleep_for(std::chrono::milliseconds(TIMING_CALIBRATION_MS) - elapsed);
+
+	INT64 ticks = Now() - CalibrationTicks;
+	INT64 nanoseconds = std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - CalibrationTime).count();
+	return nanoseconds > 0 ? (double)ticks / nanoseconds : 1.0;
+#else
+	return 1.0;
+#endif
+}
+
+double HookTimingSummary::PercentileNs(double fraction) const
+{
+	UINT64 threshold = (UINT64)(Calls * fraction);
+	UINT64 seen = 0;
+	for (int i = 0; i < STATS_HISTOGRAM_BUCKETS; i++) {
+		seen += Buckets[i];
+		if (seen > threshold)
+			return std::min(BucketLimitNs[i], MaxNs);
+	}
+
+	return MaxNs;
+}
+
+void MethodTiming::Summarise(const StatSummary& ticks, double ticksPerNs, HookTimingSummary& summary)
+{
+	summary.HookId = 0;
+	summary.Calls = ticks.Count;
+	summary.TotalNs = ticks.Sum / ticksPerNs;
+	summary.MinNs = ticks.Count > 0 ? ticks.Min / ticksPerNs : 0;
+	summary.MaxNs = ticks.Max / ticksPerNs;
+	for (int i = 0; i < STATS_HISTOGRAM_BUCKETS; i++) {
+		summary.Buckets[i] = ticks.Buckets[i];
+		summary.BucketLimitNs[i] = Statistics::BucketLimit(i) / ticksPerNs;
+	}
+}
+
+void MethodTiming::Merge(std::vector<HookTimingSummary>& summaries)
+{
+	std::vector<StatSummary> stats;
+	Statistics::Snapshot(stats);
+	double ticksPerNs = TicksPerNanosecond();
+
+	summaries.clear();
+	for (int i = 0; i < MAX_HOOKS; i++) {
+		int histogram = HookHistograms[i].load(std::memory_order_relaxed) - 1;
+		auto found = std::find_if(stats.begin(), stats.end(),
+			[&](const StatSummary& stat) { return stat.Kind == StatKind::Histogram && stat.Id == histogram; });
+		if (histogram < 0 || found == stats.end())
+			continue;
+
+		HookTimingSummary summary;
+		Summarise(*found, ticksPerNs, summary);
+		summary.HookId = i;
+		summaries.push_back(summary);
+	}
+}
+
+static std::string HookName(int hookId)
+{
+	return (size_t)hookId < HookNames.size() ? HookNames[hookId] : std::string();
+}
+
+// Rewrites the timing file with one line per hook. The histogram column lists "<bucket upper bound in ns>:<calls>" for each
+// bucket holding any calls
+static void WriteTimings(const std::vector<HookTimingSummary>& summaries)
+{
+	if (TimingPath.empty())
+		return;
+
+	FILE* file = fopen(TimingPath.c_str(), "w");
+	if (file == nullptr) {
+		spdlog::error("Failed to open timing file {}", TimingPath);
+		return;
+	}
+
+	fprintf(file, "hook,method,calls,mean_ns,min_ns,max_ns,p50_ns,p90_ns,p99_ns,histogram\n");
+	for (const HookTimingSummary& summary : summaries) {
+		fprintf(file, "%d,%s,%llu,%.1f,%.1f,%.1f,%.1f,%.1f,%.1f,", summary.HookId, HookName(summary.HookId).c_str(),
+			(unsigned long long)summary.Calls, summary.TotalNs / summary.Calls, summary.MinNs, summary.MaxNs,
+			summary.PercentileNs(0.5), summary.PercentileNs(0.9), summary.PercentileNs(0.99));
+
+		const char* separator = "";
+		for (int i = 0; i < STATS_HISTOGRAM_BUCKETS; i++) {
+			if (summary.Buckets[i] == 0)
+				continue;
+			fprintf(file, "%s%.0f:%llu", separator, summary.BucketLimitNs[i], (unsigned long long)summary.Buckets[i]);
+			separator = " ";
+		}
+		fprintf(file, "\n");
+	}
+
+	fclose(file);
+}
+
+static void MergeAndWrite()
+{
+	std::vector<HookTimingSummary> summaries;
+	MethodTiming::Merge(summaries);
+	WriteTimings(summaries);
+}
+
+void MethodTiming::Start(const std::string& path, unsigned intervalMs, const std::vector<std::string>& hookNames)
+{
+	Stop();
+
+	TimingPath = path;
+	HookNames = hookNames;
+
+	// Histograms are looked up by name, so starting again with the same hooks carries on counting into the same ones
+	for (size_t i = 0; i < hookNames.size() && i < MAX_HOOKS; i++)
+		HookHistograms[i].store(Statistics::Histogram(fmt::format("timing.{}.{}_ticks", i, hookNames[i]).c_str()) + 1, std::memory_order_relaxed);
+	Statistics::Enable();
+
+	if (!TimingPath.empty())
+		spdlog::info("Writing method timings to {} every {} ms", TimingPath, intervalMs);
+
+	MergeThread.Start(intervalMs, MergeAndWrite);
+}
+
+void MethodTiming::Stop()
+{
+	if (!MergeThread.IsRunning())
+		return;
+
+	MergeThread.Stop();
+
+	std::vector<HookTimingSummary> summaries;
+	Merge(summaries);
+	WriteTimings(summaries);
+
+	for (const HookTimingSummary& summary : summaries) {
+		spdlog::info("Hook {} {}: {} call(s), mean {:.0f} ns, p50 {:.0f} ns, p99 {:.0f} ns, max {:.0f} ns", summary.HookId, HookName(summary.HookId),
+			summary.Calls, summary.TotalNs / summary.Calls, summary.PercentileNs(0.5), summary.PercentileNs(0.99), summary.MaxNs);
+	}
+}
+
+static INT64 STDMETHODCALLTYPE TimingEnter()
+{
+	return MethodTiming::Now();
+}
+
+static void STDMETHODCALLTYPE TimingLeave(int hookId, INT64 start)
+{
+	MethodTiming::Record(hookId, start, MethodTiming::Now());
+}
+
+void* MethodTiming::GetEnterFunction()
+{
+	return (void*)&TimingEnter;
+}
+
+void* MethodTiming::GetLeaveFunction()
+{
+	return (void*)&TimingLeave;
+}
@@ -0,0 +1,57 @@
+#pragma once
+
+#include "stdafx.h"
+#include "HookDispatch.h"
+#include "Statistics.h"
+#include <string>
+#include <vector>
+
+// Environment variable naming the file merged method timings are written to
+#define TIMING_FILE_VARIABLE "ZEROED_PROFILER_TIMING_FILE"
+
+// Environment variable overriding how often per-thread timings are merged and the timing file rewritten
+#define TIMING_INTERVAL_VARIABLE "ZEROED_PROFILER_TIMING_INTERVAL_MS"
+#define TIMING_DEFAULT_INTERVAL_MS 1000
+
+// Merged timings of a single hook. Durations are in nanoseconds and the buckets are those of a Statistics histogram
+struct HookTimingSummary
+{
+	int HookId;
+	UINT64 Calls;
+	double TotalNs;
+	double MinNs;
+	double MaxNs;
+	UINT64 Buckets[STATS_HISTOGRAM_BUCKETS];
+	// Upper bound of each bucket
+	double BucketLimitNs[STATS_HISTOGRAM_BUCKETS];
+
+	// Upper bound of the bucket the given fraction of calls fall within, so within 1/8 of the true percentile
+	double PercentileNs(double fraction) const;
+};
+
+// Times calls to timed hooks. The injected IL calls the entry function for a start timestamp after the hook's prologue and
+// passes it to the exit function before every ret. Timestamps are read from the TSC on x86 and from the monotonic clock
+// elsewhere. Each timed hook records its ticks into a Statistics histogram, so recording takes no lock and no locked
+// instruction. A background thread merges the histograms at an interval, converts them to nanoseconds and rewrites the
+// timing file. Counts read mid-update may be off by the call in flight, which the next merge corrects
+class MethodTiming
+{
+public:
+	// Start merging. With an empty path timings are only logged when the profiler stops. hookNames are used to label the output
+	static void Start(const std::string& path, unsigned intervalMs, const std::vector<std::string>& hookNames);
+	// Stop the merge thread, write the file a final time and log each hook's timings
+	static void Stop();
+
+	// Merge every thread's counts. Hooks which haven't completed a call are left out
+	static void Merge(std::vector<HookTimingSummary>& summaries);
+
+	static INT64 Now();
+	static void Record(int hookId, INT64 start, INT64 end);
+	static double TicksPerNanosecond();
+	// Convert a Statistics histogram of ticks to nanoseconds
+	static void Summarise(const StatSummary& ticks, double ticksPerNs, HookTimingSummary& summary);
+
+	// Native functions the injected calli targets: unmanaged stdcall int64() at entry and void(int32 hookId, int64 start) on exit
+	static void* GetEnterFunction();
+	static void* GetLeaveFunction();
+};
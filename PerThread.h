@@ -0,0 +1,83 @@
+#pragma once
+
+#include "stdafx.h"
+#include <algorithm>
+#include <atomic>
+#include <mutex>
+#include <vector>
+
+// Gives every thread a Block of its own, allocated on the thread's first call to Local, so hot paths can record into it
+// without a lock. Readers visit every live thread's block with the thread list locked. When a thread exits its block's
+// Retire is called with the same lock held, so it can fold what the thread recorded into totals kept alongside the list,
+// then the block is freed. Block must be default constructible and have a void Retire()
+template <typename Block>
+class PerThread
+{
+public:
+	// The calling thread's block
+	static Block& Local()
+	{
+		Holder& holder = LocalHolder;
+		if (holder.Owned == nullptr) {
+			Block* block = new Block();
+			std::lock_guard<std::mutex> lock(Lock());
+			Threads().push_back(block);
+			holder.Owned = block;
+		}
+		return *holder.Owned;
+	}
+
+	// Call visitor(const std::vector<Block*>&) with every live thread's block. No thread retires its block until it
+	// returns, so totals Retire folds into can be read alongside the live blocks without counting a thread twice
+	template <typename Visitor>
+	static void Visit(Visitor visitor)
+	{
+		std::lock_guard<std::mutex> lock(Lock());
+		const std::vector<Block*>& threads = Threads();
+		visitor(threads);
+	}
+
+private:
+	struct Holder
+	{
+		~Holder()
+		{
+			if (Owned == nullptr)
+				return;
+
+			std::lock_guard<std::mutex> lock(Lock());
+			Owned->Retire();
+			std::vector<Block*>& threads = Threads();
+			threads.erase(std::remove(threads.begin(), threads.end(), Owned), threads.end());
+			delete Owned;
+		}
+
+		Block* Owned = nullptr;
+	};
+
+	// Function statics since blocks may be allocated during static initialisation of other files
+	static std::mutex& Lock()
+	{
+		static std::mutex lock;
+		return lock;
+	}
+
+	static std::vector<Block*>& Threads()
+	{
+		static std::vector<Block*> threads;
+		return threads;
+	}
+
+	static thread_local Holder LocalHolder;
+};
+
+template <typename Block>
+thread_local typename PerThread<Block>::Holder PerThread<Block>::LocalHolder;
+
+// Add to a value in a per-thread block. The owning thread is the only writer, so a plain load and store does the job of a
+// locked add, and readers on other threads see either the old or the new value
+template <typename T>
+inline void AddOwned(std::atomic<T>& value, T amount)
+{
+	value.store(value.load(std::memory_order_relaxed) + amount, std::memory_order_relaxed);
+}
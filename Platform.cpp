@@ -0,0 +1,247 @@
+#include "stdafx.h"
+#include "Platform.h"
+#include <cstdlib>
+
+#ifndef _WIN32
+#include <stdio.h>
+#include <unistd.h>
+#endif
+
+#ifdef _WIN32
+
+size_t WStrLen(LPCWSTR str)
+{
+	return wcslen(str);
+}
+
+int WStrCmp(LPCWSTR left, LPCWSTR right)
+{
+	return wcscmp(left, right);
+}
+
+int WStrICmp(LPCWSTR left, LPCWSTR right)
+{
+	return _wcsicmp(left, right);
+}
+
+std::string WStrToUtf8(LPCWSTR str, size_t length)
+{
+	if (length == 0) return {};
+	int size_needed = WideCharToMultiByte(CP_UTF8, 0, str, (int)length, nullptr, 0, nullptr, nullptr);
+	std::string strTo(size_needed, 0);
+	WideCharToMultiByte(CP_UTF8, 0, str, (int)length, &strTo[0], size_needed, nullptr, nullptr);
+	return strTo;
+}
+
+WSTRING Utf8ToWStr(const char* str, size_t length)
+{
+	if (length == 0) return {};
+	int size_needed = MultiByteToWideChar(CP_UTF8, 0, str, (int)length, nullptr, 0);
+	WSTRING wstrTo(size_needed, 0);
+	MultiByteToWideChar(CP_UTF8, 0, str, (int)length, &wstrTo[0], size_needed);
+	return wstrTo;
+}
+
+std::string SystemErrorMessage(HRESULT hr)
+{
+	char* msgBuf = nullptr;
+	DWORD size = FormatMessageA(
+		FORMAT_MESSAGE_ALLOCATE_BUFFER | FORMAT_MESSAGE_FROM_SYSTEM | FORMAT_MESSAGE_IGNORE_INSERTS,
+		nullptr,
+		hr,
+		MAKELANGID(LANG_NEUTRAL, SUBLANG_DEFAULT),
+		(LPSTR)&msgBuf,
+		0,
+		nullptr);
+
+	std::string message;
+	if (size && msgBuf)
+	{
+		message = msgBuf;
+		LocalFree(msgBuf);
+	}
+	return message;
+}
+
+UINT32 CurrentProcessId()
+{
+	return GetCurrentProcessId();
+}
+
+std::string TempDirectory()
+{
+	char path[MAX_PATH + 1];
+	DWORD length = GetTempPathA(_countof(path), path);
+	if (length == 0 || length > _countof(path))
+		return ".\\";
+
+	return std::string(path, length);
+}
+
+bool ThreadCpuCounter(DWORD osThreadId, UINT64* pCounter)
+{
+	HANDLE thread = OpenThread(THREAD_QUERY_LIMITED_INFORMATION, FALSE, osThreadId);
+	if (thread == nullptr)
+		return false;
+
+	// Unlike GetThreadTimes this isn't rounded to the scheduler tick, so it still moves between closely spaced readings
+	ULONG64 cycles = 0;
+	BOOL ok = QueryThreadCycleTime(thread, &cycles);
+	CloseHandle(thread);
+	if (!ok)
+		return false;
+
+	*pCounter = cycles;
+	return true;
+}
+
+#else
+
+// The PAL declares these but leaves their definition to the host (corguids.lib on Windows)
+const IID IID_IUnknown = { 0x00000000, 0x0000, 0x0000, { 0xC0, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x46 } };
+const IID IID_IClassFactory = { 0x00000001, 0x0000, 0x0000, { 0xC0, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x46 } };
+
+size_t WStrLen(LPCWSTR str)
+{
+	return std::char_traits<WCHAR>::length(str);
+}
+
+int WStrCmp(LPCWSTR left, LPCWSTR right)
+{
+	while (*left != 0 && *left == *right) {
+		left++;
+		right++;
+	}
+	return (int)*left - (int)*right;
+}
+
+static WCHAR FoldCase(WCHAR c)
+{
+	return (c >= 'A' && c <= 'Z') ? (WCHAR)(c - 'A' + 'a') : c;
+}
+
+int WStrICmp(LPCWSTR left, LPCWSTR right)
+{
+	while (*left != 0 && FoldCase(*left) == FoldCase(*right)) {
+		left++;
+		right++;
+	}
+	return (int)FoldCase(*left) - (int)FoldCase(*right);
+}
+
+std::string WStrToUtf8(LPCWSTR str, size_t length)
+{
+	std::string strTo;
+	strTo.reserve(length);
+	for (size_t i = 0; i < length; i++) {
+		UINT32 c = str[i];
+		// Combine surrogate pairs, passing unpaired surrogates through as is
+		if (c >= 0xD800 && c <= 0xDBFF && i + 1 < length && str[i + 1] >= 0xDC00 && str[i + 1] <= 0xDFFF) {
+			c = 0x10000 + ((c - 0xD800) << 10) + (str[++i] - 0xDC00);
+		}
+
+		if (c < 0x80) {
+			strTo.push_back((char)c);
+		}
+		else if (c < 0x800) {
+			strTo.push_back((char)(0xC0 | (c >> 6)));
+			strTo.push_back((char)(0x80 | (c & 0x3F)));
+		}
+		else if (c < 0x10000) {
+			strTo.push_back((char)(0xE0 | (c >> 12)));
+			strTo.push_back((char)(0x80 | ((c >> 6) & 0x3F)));
+			strTo.push_back((char)(0x80 | (c & 0x3F)));
+		}
+		else {
+			strTo.push_back((char)(0xF0 | (c >> 18)));
+			strTo.push_back((char)(0x80 | ((c >> 12) & 0x3F)));
+			strTo.push_back((char)(0x80 | ((c >> 6) & 0x3F)));
+			strTo.push_back((char)(0x80 | (c & 0x3F)));
+		}
+	}
+	return strTo;
+}
+
+WSTRING Utf8ToWStr(const char* str, size_t length)
+{
+	WSTRING wstrTo;
+	wstrTo.reserve(length);
+	const BYTE* p = (const BYTE*)str;
+	const BYTE* end = p + length;
+	while (p < end) {
+		UINT32 c = *p++;
+		int continuation = 0;
+		if (c >= 0xF0) {
+			c &= 0x07;
+			continuation = 3;
+		}
+		else if (c >= 0xE0) {
+			c &= 0x0F;
+			continuation = 2;
+		}
+		else if (c >= 0xC0) {
+			c &= 0x1F;
+			continuation = 1;
+		}
+
+		for (; continuation > 0 && p < end && (*p & 0xC0) == 0x80; continuation--) {
+			c = (c << 6) | (*p++ & 0x3F);
+		}
+
+		if (c >= 0x10000) {
+			c -= 0x10000;
+			wstrTo.push_back((WCHAR)(0xD800 + (c >> 10)));
+			wstrTo.push_back((WCHAR)(0xDC00 + (c & 0x3FF)));
+		}
+		else {
+			wstrTo.push_back((WCHAR)c);
+		}
+	}
+	return wstrTo;
+}
+
+std::string SystemErrorMessage(HRESULT hr)
+{
+	// There's no system message table outside of Windows
+	return {};
+}
+
+UINT32 CurrentProcessId()
+{
+	return (UINT32)getpid();
+}
+
+std::string TempDirectory()
+{
+	const char* tmpdir = std::getenv("TMPDIR");
+	std::string path = tmpdir != nullptr && *tmpdir != '\0' ? tmpdir : "/tmp";
+	if (path.back() != '/')
+		path.push_back('/');
+
+	return path;
+}
+
+bool ThreadCpuCounter(DWORD osThreadId, UINT64* pCounter)
+{
+#ifdef __linux__
+	// The first field of schedstat is the time the thread has spent on a CPU in nanoseconds
+	char path[64];
+	snprintf(path, sizeof(path), "/proc/self/task/%u/schedstat", (unsigned)osThreadId);
+	FILE* file = fopen(path, "r");
+	if (file == nullptr)
+		return false;
+
+	unsigned long long runNs = 0;
+	bool ok = fscanf(file, "%llu", &runNs) == 1;
+	fclose(file);
+	if (!ok)
+		return false;
+
+	*pCounter = runNs;
+	return true;
+#else
+	return false;
+#endif
+}
+
+#endif
@@ -0,0 +1,41 @@
+#pragma once
+
+// Thin layer over the few Win32 facilities the profiler relies on so the same sources build against the Windows SDK
+// and against the CoreCLR PAL headers on Linux/macOS. Outside of Windows WCHAR is a 16 bit char16_t rather than
+// wchar_t, so wide literals and strings handed to the runtime must go through WSTR/WSTRING instead of L""/std::wstring
+#include <string>
+
+#ifdef _WIN32
+#define WSTR(str) L##str
+#define ZEROED_EXPORT
+#else
+#define WSTR(str) u##str
+#define ZEROED_EXPORT __attribute__((visibility("default")))
+#endif
+
+#ifndef _countof
+#define _countof(a) (sizeof(a) / sizeof((a)[0]))
+#endif
+
+typedef std::basic_string<WCHAR> WSTRING;
+
+size_t WStrLen(LPCWSTR str);
+int WStrCmp(LPCWSTR left, LPCWSTR right);
+// Case insensitive comparison. Only ASCII letters are folded outside of Windows, which is all module and type names need
+int WStrICmp(LPCWSTR left, LPCWSTR right);
+
+std::string WStrToUtf8(LPCWSTR str, size_t length);
+WSTRING Utf8ToWStr(const char* str, size_t length);
+
+// Returns the system's description of an error code, or an empty string if there isn't one
+std::string SystemErrorMessage(HRESULT hr);
+
+UINT32 CurrentProcessId();
+
+// Directory for temporary files, including the trailing separator
+std::string TempDirectory();
+
+// Reads a counter which only advances while the given OS thread is running on a CPU, so two readings tell whether it ran in
+// between. It's CPU cycles on Windows and CPU nanoseconds on Linux. Returns false if the thread has exited or there's no
+// way to read the counter on this platform
+bool ThreadCpuCounter(DWORD osThreadId, UINT64* pCounter);
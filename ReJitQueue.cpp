@@ -0,0 +1,69 @@
+#include "stdafx.h"
+#include "ReJitQueue.h"
+#include "Utils.h"
+
+ReJitQueue::ReJitQueue() :
+	m_pInfo(nullptr),
+	m_stopping(false) {
+}
+
+ReJitQueue::~ReJitQueue()
+{
+	Stop();
+}
+
+void ReJitQueue::Start(ICorProfilerInfo4* pInfo)
+{
+	m_pInfo = pInfo;
+	m_stopping = false;
+	m_thread = std::thread(&ReJitQueue::Run, this);
+}
+
+void ReJitQueue::Stop()
+{
+	if (!m_thread.joinable())
+		return;
+
+	{
+		std::lock_guard<std::mutex> lock(m_lock);
+		m_stopping = true;
+	}
+	m_signal.notify_one();
+	m_thread.join();
+}
+
+void ReJitQueue::Enqueue(ModuleID moduleId, mdMethodDef methodDef)
+{
+	{
+		std::lock_guard<std::mutex> lock(m_lock);
+		m_moduleIds.push_back(moduleId);
+		m_methodDefs.push_back(methodDef);
+	}
+	m_signal.notify_one();
+}
+
+void ReJitQueue::Run()
+{
+	std::vector<ModuleID> moduleIds;
+	std::vector<mdMethodDef> methodDefs;
+
+	for (;;) {
+		{
+			std::unique_lock<std::mutex> lock(m_lock);
+			m_signal.wait(lock, [this] { return m_stopping || !m_moduleIds.empty(); });
+			if (m_stopping)
+				return;
+
+			moduleIds.swap(m_moduleIds);
+			methodDefs.swap(m_methodDefs);
+		}
+
+		spdlog::debug("Requesting ReJIT of {} method(s)", moduleIds.size());
+		HRESULT hr = m_pInfo->RequestReJIT((ULONG)moduleIds.size(), moduleIds.data(), methodDefs.data());
+		if (FAILED(hr))
+			spdlog::error("RequestReJIT failed for {} method(s): {}", moduleIds.size(), HrToString(hr));
+
+		moduleIds.clear();
+		methodDefs.clear();
+	}
+}
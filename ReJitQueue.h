@@ -0,0 +1,33 @@
+#pragma once
+
+#include "stdafx.h"
+#include <condition_variable>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+// Collects methods that need their hooks applied and hands them to RequestReJIT from a thread owned by the profiler.
+// RequestReJIT suspends the runtime so it can't be called from callbacks such as ModuleLoadFinished which run with
+// loader locks held. Methods queued together are requested in a single batch so the runtime is only suspended once
+class ReJitQueue
+{
+public:
+	ReJitQueue();
+	~ReJitQueue();
+
+	void Start(ICorProfilerInfo4* pInfo);
+	void Stop();
+
+	void Enqueue(ModuleID moduleId, mdMethodDef methodDef);
+
+private:
+	void Run();
+
+	ICorProfilerInfo4* m_pInfo;
+	std::thread m_thread;
+	std::mutex m_lock;
+	std::condition_variable m_signal;
+	std::vector<ModuleID> m_moduleIds;
+	std::vector<mdMethodDef> m_methodDefs;
+	bool m_stopping;
+};
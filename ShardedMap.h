@@ -0,0 +1,106 @@
+#pragma once
+
+#include "stdafx.h"
+#include <mutex>
+#include <shared_mutex>
+#include <unordered_map>
+
+// A hash map split into independently locked shards so threads writing different keys rarely contend, eg. modules
+// loading in parallel each installing their own hooks.
+//
+// Each shard is a plain map behind a reader/writer lock. Reads share the lock so JIT threads looking up hooks don't
+// block each other, and writes only wait for readers of the same shard. Entries are updated in place, so memory stays
+// proportional to the live entries however many times modules load and unload
+template <typename Key, typename Value, size_t ShardCount = 16>
+class ShardedMap
+{
+public:
+	ShardedMap() = default;
+	ShardedMap(const ShardedMap&) = delete;
+	ShardedMap& operator=(const ShardedMap&) = delete;
+
+	// Adds the entry unless the key is already present. Returns false if it was
+	bool TryAdd(const Key& key, const Value& value)
+	{
+		Shard& shard = ShardFor(key);
+		std::unique_lock<std::shared_mutex> lock(shard.Lock);
+		return shard.Entries.emplace(key, value).second;
+	}
+
+	void Set(const Key& key, const Value& value)
+	{
+		Shard& shard = ShardFor(key);
+		std::unique_lock<std::shared_mutex> lock(shard.Lock);
+		shard.Entries[key] = value;
+	}
+
+	// Removes the key's entry, returning whether there was one
+	bool Remove(const Key& key)
+	{
+		Shard& shard = ShardFor(key);
+		std::unique_lock<std::shared_mutex> lock(shard.Lock);
+		return shard.Entries.erase(key) != 0;
+	}
+
+	// Calls visitor(const Value&) with the key's value if present, returning whether it was. The visitor runs with the
+	// shard's read lock held, so it should copy out what it needs and mustn't write to the map
+	template <typename Visitor>
+	bool Visit(const Key& key, Visitor visitor) const
+	{
+		const Shard& shard = ShardFor(key);
+		std::shared_lock<std::shared_mutex> lock(shard.Lock);
+		auto entry = shard.Entries.find(key);
+		if (entry == shard.Entries.end())
+			return false;
+
+		visitor(entry->second);
+		return true;
+	}
+
+	// Calls visitor(const Key&, const Value&) for every entry. Shards are read one at a time so this isn't a snapshot
+	// of the whole map, and as with Visit the visitor mustn't write to the map
+	template <typename Visitor>
+	void ForEach(Visitor visitor) const
+	{
+		for (const Shard& shard : m_shards) {
+			std::shared_lock<std::shared_mutex> lock(shard.Lock);
+			for (const auto& entry : shard.Entries)
+				visitor(entry.first, entry.second);
+		}
+	}
+
+	void Clear()
+	{
+		for (Shard& shard : m_shards) {
+			std::unique_lock<std::shared_mutex> lock(shard.Lock);
+			shard.Entries.clear();
+		}
+	}
+
+private:
+	// Padded to a cache line so writers locking one shard don't slow readers of its neighbours
+	struct alignas(64) Shard
+	{
+		mutable std::shared_mutex Lock;
+		std::unordered_map<Key, Value> Entries;
+	};
+
+	Shard& ShardFor(const Key& key)
+	{
+		return m_shards[ShardIndex(key)];
+	}
+
+	const Shard& ShardFor(const Key& key) const
+	{
+		return m_shards[ShardIndex(key)];
+	}
+
+	static size_t ShardIndex(const Key& key)
+	{
+		// IDs handed out by the runtime are aligned pointers, so mix the hash before picking a shard or most would go unused
+		UINT64 hash = (UINT64)std::hash<Key>()(key) * 0x9E3779B97F4A7C15ull;
+		return (size_t)(hash >> 32) % ShardCount;
+	}
+
+	Shard m_shards[ShardCount];
+};
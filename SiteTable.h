@@ -0,0 +1,85 @@
+#pragma once
+
+#include "stdafx.h"
+#include <atomic>
+
+// A fixed size open addressing table of sites, eg. the call sites allocations are sampled from, which threads count into
+// at once without a lock. A site is found by a hash of whatever identifies it. The first thread to see a new site claims
+// a free slot for its key with a compare and swap and fills it in, and counting into a site is then up to the caller's
+// atomic adds. Slots are never released, and a site which can't find a slot within MaxProbes of its hash is dropped.
+//
+// The table has no constructor, so one declared static is zero initialised and pages no site touches are never
+// committed. Site must be valid all zeroes
+template <typename Site, size_t Size, size_t MaxProbes>
+class SiteTable
+{
+	static_assert((Size & (Size - 1)) == 0, "SiteTable size must be a power of two");
+
+public:
+	// Hash the identity of a site into a key. Never 0, which marks a free slot
+	template <typename T>
+	static UINT64 KeyOf(UINT64 first, const T* rest, size_t count)
+	{
+		UINT64 hash = 0xCBF29CE484222325ull ^ first;
+		for (size_t i = 0; i < count; i++)
+			hash = (hash ^ (UINT64)rest[i]) * 0x100000001B3ull;
+
+		hash ^= hash >> 33;
+		hash *= 0xFF51AFD7ED558CCDull;
+		hash ^= hash >> 33;
+		return hash != 0 ? hash : 1;
+	}
+
+	// The key's site, or nullptr when the table is too full around its hash. A new site is passed to fill(Site&) before
+	// ForEach visits it, though threads counting into the same site may already be adding to it
+	template <typename Fill>
+	Site* Find(UINT64 key, Fill fill)
+	{
+		for (size_t probe = 0; probe < MaxProbes; probe++) {
+			Slot& slot = m_slots[(key + probe) & (Size - 1)];
+
+			UINT64 current = slot.Key.load(std::memory_order_acquire);
+			if (current == 0 && slot.Key.compare_exchange_strong(current, key, std::memory_order_acq_rel)) {
+				fill(slot.Value);
+				slot.Ready.store(true, std::memory_order_release);
+				current = key;
+			}
+
+			if (current == key)
+				return &slot.Value;
+		}
+
+		m_dropped.fetch_add(1, std::memory_order_relaxed);
+		return nullptr;
+	}
+
+	// Call visitor(UINT64 key, const Site&) for every site filled in so far. Counts of a slot claimed but not yet filled in
+	// are picked up by the next call
+	template <typename Visitor>
+	void ForEach(Visitor visitor) const
+	{
+		for (const Slot& slot : m_slots) {
+			if (slot.Ready.load(std::memory_order_acquire))
+				visitor(slot.Key.load(std::memory_order_relaxed), slot.Value);
+		}
+	}
+
+	// Sites dropped since the table filled up
+	UINT64 Dropped() const
+	{
+		return m_dropped.load(std::memory_order_relaxed);
+	}
+
+private:
+	struct Slot
+	{
+		// 0 while the slot is free, claimed once and never released
+		std::atomic<UINT64> Key;
+		// Set once the claiming thread has filled in the site
+		std::atomic<bool> Ready;
+		Site Value;
+	};
+
+	Slot m_slots[Size];
+	std::atomic<UINT64> m_dropped;
+};
@@ -0,0 +1,204 @@
+#include "stdafx.h"
+#include "StackSampler.h"
+#include "COMPtrHolder.h"
+#include "Utils.h"
+#include <algorithm>
+#include <chrono>
+
+StackSampler::StackSampler() :
+	m_pInfo(nullptr),
+	m_intervalMs(SAMPLE_DEFAULT_INTERVAL_MS),
+	m_wallClock(false),
+	m_stopping(false),
+	m_sampleCount(0),
+	m_failedWalks(0),
+	m_suspendedMs(0) {
+}
+
+StackSampler::~StackSampler()
+{
+	Stop();
+}
+
+HRESULT StackSampler::Start(ICorProfilerInfo4* pInfo, const std::string& path, unsigned intervalMs, bool wallClock)
+{
+	Stop();
+
+	// SuspendRuntime and ResumeRuntime let a profiler thread stop every managed thread at a safe point so their stacks can be
+	// walked from outside. Earlier runtimes only allow walking another thread's stack on Windows, by suspending it directly
+	HRESULT hr = pInfo->QueryInterface(IID_ICorProfilerInfo10, (void**)&m_pInfo);
+	if (FAILED(hr)) {
+		spdlog::error("Sampling needs ICorProfilerInfo10 which this runtime doesn't provide, samples won't be taken");
+		return hr;
+	}
+
+	m_path = path;
+	m_intervalMs = intervalMs;
+	m_wallClock = wallClock;
+	m_stopping = false;
+	m_tree.Clear();
+	m_sampleCount = 0;
+	m_failedWalks = 0;
+	m_suspendedMs = 0;
+
+	spdlog::info("Sampling {} every {} ms to {}", wallClock ? "every thread" : "running threads", intervalMs, path);
+	m_thread = std::thread(&StackSampler::Run, this);
+	return S_OK;
+}
+
+void StackSampler::Stop()
+{
+	if (m_thread.joinable()) {
+		{
+			std::lock_guard<std::mutex> lock(m_lock);
+			m_stopping = true;
+		}
+		m_signal.notify_one();
+		m_thread.join();
+
+		WriteProfile();
+		spdlog::info("Took {} sample(s), {} distinct stack node(s), {} failed walk(s), mean pause {:.3f} ms", m_sampleCount,
+			m_tree.NodeCount(), m_failedWalks, m_sampleCount > 0 ? m_suspendedMs / m_sampleCount : 0.0);
+	}
+
+	if (m_pInfo != nullptr) {
+		m_pInfo->Release();
+		m_pInfo = nullptr;
+	}
+}
+
+void StackSampler::Run()
+{
+	auto lastWrite = std::chrono::steady_clock::now();
+
+	std::unique_lock<std::mutex> lock(m_lock);
+	while (!m_signal.wait_for(lock, std::chrono::milliseconds(m_intervalMs), [this] { return m_stopping; })) {
+		lock.unlock();
+
+		TakeSample();
+
+		auto now = std::chrono::steady_clock::now();
+		if (now - lastWrite >= std::chrono::milliseconds(SAMPLE_WRITE_INTERVAL_MS)) {
+			WriteProfile();
+			lastWrite = now;
+		}
+
+		lock.lock();
+	}
+}
+
+void StackSampler::TakeSample()
+{
+	auto suspended = std::chrono::steady_clock::now();
+
+	// Fails while the runtime is already suspended, for a GC or another profiler request. The next interval tries again
+	HRESULT hr = m_pInfo->SuspendRuntime();
+	if (FAILED(hr)) {
+		spdlog::debug("SuspendRuntime failed, skipping sample: {}", HrToString(hr));
+		return;
+	}
+
+	COMPtrHolder<ICorProfilerThreadEnum> pThreads;
+	hr = m_pInfo->EnumThreads(&pThreads);
+	if (SUCCEEDED(hr)) {
+		ThreadID threadIds[64];
+		ULONG fetched = 0;
+		while (SUCCEEDED(pThreads->Next(_countof(threadIds), threadIds, &fetched)) && fetched > 0) {
+			for (ULONG i = 0; i < fetched; i++)
+				SampleThread(threadIds[i]);
+		}
+	}
+	else {
+		spdlog::error("EnumThreads failed: {}", HrToString(hr));
+	}
+
+	hr = m_pInfo->ResumeRuntime();
+	if (FAILED(hr))
+		spdlog::error("ResumeRuntime failed: {}", HrToString(hr));
+
+	// Looking names up reads metadata, which can wait on loader locks held by the threads that were suspended, so new
+	// functions are only named once they're running again. A collectible assembly unloaded in between leaves its functions
+	// unknown
+	for (FunctionID functionId : m_unnamed)
+		FunctionName(functionId);
+	m_unnamed.clear();
+
+	// Threads which weren't seen this time have exited
+	m_cpuCounters.swap(m_nextCpuCounters);
+	m_nextCpuCounters.clear();
+
+	m_sampleCount++;
+	m_suspendedMs += std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - suspended).count();
+}
+
+void StackSampler::SampleThread(ThreadID threadId)
+{
+	DWORD osThreadId = 0;
+	UINT64 cpuCounter = 0;
+	if (!m_wallClock && SUCCEEDED(m_pInfo->GetThreadInfo(threadId, &osThreadId)) && ThreadCpuCounter(osThreadId, &cpuCounter)) {
+		m_nextCpuCounters[osThreadId] = cpuCounter;
+
+		auto previous = m_cpuCounters.find(osThreadId);
+		if (previous != m_cpuCounters.end() && previous->second == cpuCounter)
+			return;
+	}
+
+	m_frames.clear();
+	HRESULT hr = m_pInfo->DoStackSnapshot(threadId, &StackSampler::OnFrame, COR_PRF_SNAPSHOT_DEFAULT, this, nullptr, 0);
+	if (FAILED(hr)) {
+		m_failedWalks++;
+		return;
+	}
+
+	// Threads which haven't run managed code yet, or are outside of it entirely, have nothing to record
+	if (m_frames.empty())
+		return;
+
+	// Frames are reported from the leaf outwards, the tree wants them from the root
+	std::reverse(m_frames.begin(), m_frames.end());
+	m_tree.Add(m_frames.data(), m_frames.size());
+}
+
+HRESULT STDMETHODCALLTYPE StackSampler::OnFrame(FunctionID funcId, UINT_PTR ip, COR_PRF_FRAME_INFO frameInfo, ULONG32 contextSize, BYTE context[], void* clientData)
+{
+	StackSampler* sampler = (StackSampler*)clientData;
+	if (sampler->m_frames.size() >= SAMPLE_MAX_FRAMES)
+		return S_OK;
+
+	// A function ID of 0 stands for a run of native frames, which are collapsed into one
+	if (funcId == 0 && !sampler->m_frames.empty() && sampler->m_frames.back() == 0)
+		return S_OK;
+
+	sampler->m_frames.push_back(funcId);
+
+	// Unloading a collectible assembly can free the function before the profile is written, so it's named right after the
+	// runtime resumes
+	if (sampler->m_names.find(funcId) == sampler->m_names.end())
+		sampler->m_unnamed.push_back(funcId);
+	return S_OK;
+}
+
+const std::string& StackSampler::FunctionName(FunctionID functionId)
+{
+	auto found = m_names.find(functionId);
+	if (found != m_names.end())
+		return found->second;
+
+	// A function ID of 0 stands for a run of native frames
+	return m_names.emplace(functionId, functionId != 0 ? FunctionIdToName(m_pInfo, functionId) : "[native]").first->second;
+}
+
+/// <summary>
+/// Rewrite the sample file with every stack sampled so far. Only called from the sampling thread, or once it's stopped
+/// </summary>
+void StackSampler::WriteProfile()
+{
+	FILE* file = fopen(m_path.c_str(), "w");
+	if (file == nullptr) {
+		spdlog::error("Failed to open sample file {}", m_path);
+		return;
+	}
+
+	m_tree.WriteFolded(file, [this](FunctionID functionId) -> const std::string& { return FunctionName(functionId); });
+	fclose(file);
+}
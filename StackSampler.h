@@ -0,0 +1,77 @@
+#pragma once
+
+#include "stdafx.h"
+#include "CallTree.h"
+#include <condition_variable>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+// Environment variable naming the file sampled stacks are written to. Sampling is off unless it's set
+#define SAMPLE_FILE_VARIABLE "ZEROED_PROFILER_SAMPLE_FILE"
+
+// Environment variable overriding the time between samples
+#define SAMPLE_INTERVAL_VARIABLE "ZEROED_PROFILER_SAMPLE_INTERVAL_MS"
+#define SAMPLE_DEFAULT_INTERVAL_MS 10
+
+// Environment variable which when "1" samples every managed thread, including those which haven't run since the last sample
+#define SAMPLE_WALL_CLOCK_VARIABLE "ZEROED_PROFILER_SAMPLE_WALL_CLOCK"
+
+// How often the sample file is rewritten while sampling, so a process that's killed still leaves a recent profile
+#define SAMPLE_WRITE_INTERVAL_MS 5000
+
+// Deepest stack recorded. Frames beyond it, nearest the root, are dropped
+#define SAMPLE_MAX_FRAMES 256
+
+// Periodically samples the managed stack of every thread from a thread owned by the profiler. Each sample suspends the
+// runtime, walks each thread with DoStackSnapshot and resumes it, so the cost is set by the interval and the number of threads
+// rather than by how often methods are called. Unless sampling wall clock time, threads which haven't been on a CPU since the
+// previous sample are skipped so blocked threads don't drown out the ones doing work. Stacks are aggregated into a CallTree
+// and written in the folded format. Suspending the runtime from a profiler thread needs ICorProfilerInfo10 (.NET Core 3.0)
+class StackSampler
+{
+public:
+	StackSampler();
+	~StackSampler();
+
+	HRESULT Start(ICorProfilerInfo4* pInfo, const std::string& path, unsigned intervalMs, bool wallClock);
+	// Stop sampling and write the file a final time
+	void Stop();
+
+private:
+	void Run();
+	void TakeSample();
+	void SampleThread(ThreadID threadId);
+	void WriteProfile();
+
+	const std::string& FunctionName(FunctionID functionId);
+
+	static HRESULT STDMETHODCALLTYPE OnFrame(FunctionID funcId, UINT_PTR ip, COR_PRF_FRAME_INFO frameInfo, ULONG32 contextSize, BYTE context[], void* clientData);
+
+	ICorProfilerInfo10* m_pInfo;
+	std::string m_path;
+	unsigned m_intervalMs;
+	bool m_wallClock;
+
+	std::thread m_thread;
+	std::mutex m_lock;
+	std::condition_variable m_signal;
+	bool m_stopping;
+
+	// Only touched by the sampling thread
+	CallTree m_tree;
+	std::vector<FunctionID> m_frames;
+	// Names are looked up as soon as the runtime resumes from the sample a function is first seen in, while it's all but
+	// certain to still be loaded
+	std::unordered_map<FunctionID, std::string> m_names;
+	// Functions seen in the current sample which haven't been named yet, possibly more than once
+	std::vector<FunctionID> m_unnamed;
+	// Each thread's CPU counter at the previous sample, keyed by OS thread ID
+	std::unordered_map<DWORD, UINT64> m_cpuCounters;
+	std::unordered_map<DWORD, UINT64> m_nextCpuCounters;
+	UINT64 m_sampleCount;
+	UINT64 m_failedWalks;
+	double m_suspendedMs;
+};
@@ -0,0 +1,443 @@
+#include "stdafx.h"
+#include "Statistics.h"
+#include "IntervalThread.h"
+#include "PerThread.h"
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <mutex>
+
+#ifdef _MSC_VER
+#include <intrin.h>
+#endif
+
+// Threads' blocks are aligned to this so no two threads ever write the same cache line
+#define STATS_CACHE_LINE 64
+
+// One histogram on one thread. Only the owning thread writes it
+struct alignas(STATS_CACHE_LINE) HistogramCounters
+{
+	HistogramCounters();
+
+	std::atomic<UINT64> Count;
+	std::atomic<UINT64> Sum;
+	std::atomic<UINT64> Min;
+	std::atomic<UINT64> Max;
+	std::atomic<UINT64> Buckets[STATS_HISTOGRAM_BUCKETS];
+};
+
+// Every statistic one thread has recorded. Only the owning thread writes the values. Gauges hold the thread's adjustments,
+// which may be negative when another thread made the matching increase. Histograms are allocated the first time the
+// thread records into each so a thread which records a few counters stays a few cache lines
+struct alignas(STATS_CACHE_LINE) ThreadStats
+{
+	ThreadStats();
+	~ThreadStats();
+
+	// Fold the thread's statistics into the retired totals as it exits
+	void Retire();
+
+	std::atomic<UINT64> Counters[STATS_MAX_COUNTERS];
+	std::atomic<INT64> Gauges[STATS_MAX_GAUGES];
+	std::atomic<HistogramCounters*> Histograms[STATS_MAX_HISTOGRAMS];
+};
+
+// Running totals of one histogram, built up by a snapshot or from threads which have exited. Min is only meaningful once
+// Count is non-zero, which keeps the retired totals zero initialised
+struct HistogramTotals
+{
+	UINT64 Count;
+	UINT64 Sum;
+	UINT64 Min;
+	UINT64 Max;
+	UINT64 Buckets[STATS_HISTOGRAM_BUCKETS];
+
+	void Add(const HistogramCounters& counters);
+	void Add(const HistogramTotals& totals);
+};
+
+struct StatTotals
+{
+	UINT64 Counters[STATS_MAX_COUNTERS];
+	INT64 Gauges[STATS_MAX_GAUGES];
+	// Only as long as the highest histogram any thread has recorded into, since most of the IDs are never registered
+	std::vector<HistogramTotals> Histograms;
+};
+
+// Gauges set outright, each on its own cache line since different gauges are set from different threads
+struct alignas(STATS_CACHE_LINE) SetGauge
+{
+	std::atomic<INT64> Value{ 0 };
+};
+
+// Names of every registered statistic by kind, indexed by ID. A function static since statistics are registered during
+// static initialisation of other files
+struct StatRegistry
+{
+	std::mutex Lock;
+	std::vector<std::string> Names[3];
+};
+
+static StatRegistry& Registry()
+{
+	static StatRegistry registry;
+	return registry;
+}
+
+static bool Enabled = false;
+
+// Statistics of exited threads, only accessed with the thread list locked
+static StatTotals RetiredTotals;
+static SetGauge SetGauges[STATS_MAX_GAUGES];
+
+static std::string StatsPath;
+static IntervalThread ReaderThread;
+
+HistogramCounters::HistogramCounters() :
+	Count(0),
+	Sum(0),
+	Min(UINT64_MAX),
+	Max(0) {
+	for (std::atomic<UINT64>& bucket : Buckets)
+		bucket.store(0, std::memory_order_relaxed);
+}
+
+ThreadStats::ThreadStats()
+{
+	for (std::atomic<UINT64>& counter : Counters)
+		counter.store(0, std::memory_order_relaxed);
+	for (std::atomic<INT64>& gauge : Gauges)
+		gauge.store(0, std::memory_order_relaxed);
+	for (std::atomic<HistogramCounters*>& histogram : Histograms)
+		histogram.store(nullptr, std::memory_order_relaxed);
+}
+
+ThreadStats::~ThreadStats()
+{
+	for (std::atomic<HistogramCounters*>& histogram : Histograms)
+		delete histogram.load(std::memory_order_relaxed);
+}
+
+void HistogramTotals::Add(const HistogramCounters& counters)
+{
+	UINT64 count = counters.Count.load(std::memory_order_relaxed);
+	if (count == 0)
+		return;
+
+	UINT64 min = counters.Min.load(std::memory_order_relaxed);
+	Min = Count == 0 ? min : std::min(Min, min);
+	Max = std::max(Max, counters.Max.load(std::memory_order_relaxed));
+	Count += count;
+	Sum += counters.Sum.load(std::memory_order_relaxed);
+	for (int i = 0; i < STATS_HISTOGRAM_BUCKETS; i++)
+		Buckets[i] += counters.Buckets[i].load(std::memory_order_relaxed);
+}
+
+void HistogramTotals::Add(const HistogramTotals& totals)
+{
+	if (totals.Count == 0)
+		return;
+
+	Min = Count == 0 ? totals.Min : std::min(Min, totals.Min);
+	Max = std::max(Max, totals.Max);
+	Count += totals.Count;
+	Sum += totals.Sum;
+	for (int i = 0; i < STATS_HISTOGRAM_BUCKETS; i++)
+		Buckets[i] += totals.Buckets[i];
+}
+
+static void AddThread(StatTotals& totals, const ThreadStats& stats)
+{
+	for (int i = 0; i < STATS_MAX_COUNTERS; i++)
+		totals.Counters[i] += stats.Counters[i].load(std::memory_order_relaxed);
+	for (int i = 0; i < STATS_MAX_GAUGES; i++)
+		totals.Gauges[i] += stats.Gauges[i].load(std::memory_order_relaxed);
+	for (int i = 0; i < STATS_MAX_HISTOGRAMS; i++) {
+		HistogramCounters* histogram = stats.Histograms[i].load(std::memory_order_acquire);
+		if (histogram == nullptr)
+			continue;
+
+		if ((size_t)i >= totals.Histograms.size())
+			totals.Histograms.resize(i + 1);
+		totals.Histograms[i].Add(*histogram);
+	}
+}
+
+void ThreadStats::Retire()
+{
+	AddThread(RetiredTotals, *this);
+}
+
+// The calling thread's block, or nullptr when statistics aren't being recorded
+static inline ThreadStats* LocalThreadStats()
+{
+	return Enabled ? &PerThread<ThreadStats>::Local() : nullptr;
+}
+
+static int Register(StatKind kind, const char* name, int limit)
+{
+	StatRegistry& registry = Registry();
+	std::lock_guard<std::mutex> lock(registry.Lock);
+
+	std::vector<std::string>& names = registry.Names[(int)kind];
+	auto found = std::find(names.begin(), names.end(), name);
+	if (found != names.end())
+		return (int)(found - names.begin());
+
+	if ((int)names.size() == limit)
+		return -1;
+
+	names.push_back(name);
+	return (int)names.size() - 1;
+}
+
+int Statistics::Counter(const char* name)
+{
+	return Register(StatKind::Counter, name, STATS_MAX_COUNTERS);
+}
+
+int Statistics::Gauge(const char* name)
+{
+	return Register(StatKind::Gauge, name, STATS_MAX_GAUGES);
+}
+
+int Statistics::Histogram(const char* name)
+{
+	return Register(StatKind::Histogram, name, STATS_MAX_HISTOGRAMS);
+}
+
+void Statistics::Enable()
+{
+	Enabled = true;
+}
+
+bool Statistics::IsEnabled()
+{
+	return Enabled;
+}
+
+INT64 Statistics::Now()
+{
+	return (INT64)std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+void Statistics::Count(int counter, UINT64 value)
+{
+	ThreadStats* stats = LocalThreadStats();
+	if (stats != nullptr && (unsigned)counter < STATS_MAX_COUNTERS)
+		AddOwned(stats->Counters[counter], value);
+}
+
+void Statistics::Adjust(int gauge, INT64 delta)
+{
+	ThreadStats* stats = LocalThreadStats();
+	if (stats != nullptr && (unsigned)gauge < STATS_MAX_GAUGES)
+		AddOwned(stats->Gauges[gauge], delta);
+}
+
+void Statistics::Set(int gauge, INT64 value)
+{
+	// Adjustments are added on top, so a gauge is normally either set or adjusted, not both
+	if (Enabled && (unsigned)gauge < STATS_MAX_GAUGES)
+		SetGauges[gauge].Value.store(value, std::memory_order_relaxed);
+}
+
+void Statistics::Record(int histogram, UINT64 value)
+{
+	ThreadStats* stats = LocalThreadStats();
+	if (stats == nullptr || (unsigned)histogram >= STATS_MAX_HISTOGRAMS)
+		return;
+
+	HistogramCounters* counters = stats->Histograms[histogram].load(std::memory_order_relaxed);
+	if (counters == nullptr) {
+		counters = new HistogramCounters();
+		stats->Histograms[histogram].store(counters, std::memory_order_release);
+	}
+
+	AddOwned(counters->Count, (UINT64)1);
+	AddOwned(counters->Sum, value);
+	if (value < counters->Min.load(std::memory_order_relaxed))
+		counters->Min.store(value, std::memory_order_relaxed);
+	if (value > counters->Max.load(std::memory_order_relaxed))
+		counters->Max.store(value, std::memory_order_relaxed);
+	AddOwned(counters->Buckets[BucketOf(value)], (UINT64)1);
+}
+
+int Statistics::BucketOf(UINT64 value)
+{
+	if (value < STATS_SUB_BUCKETS)
+		return (int)value;
+
+#ifdef _MSC_VER
+	unsigned long highBit;
+	_BitScanReverse64(&highBit, value);
+#else
+	int highBit = 63 - __builtin_clzll(value);
+#endif
+	// Which power of two the value falls in picks the group of buckets, and the bits below the top one pick the bucket within it
+	int shift = (int)highBit - STATS_SUB_BUCKET_BITS;
+	return (shift + 1) * STATS_SUB_BUCKETS + (int)((value >> shift) & (STATS_SUB_BUCKETS - 1));
+}
+
+UINT64 Statistics::BucketLimit(int bucket)
+{
+	if (bucket < STATS_SUB_BUCKETS)
+		return (UINT64)bucket;
+
+	int shift = bucket / STATS_SUB_BUCKETS - 1;
+	UINT64 lower = (UINT64)(STATS_SUB_BUCKETS + bucket % STATS_SUB_BUCKETS) << shift;
+	return lower + ((1ULL << shift) - 1);
+}
+
+UINT64 StatSummary::Percentile(double fraction) const
+{
+	UINT64 threshold = (UINT64)(Count * fraction);
+	UINT64 seen = 0;
+	for (int i = 0; i < STATS_HISTOGRAM_BUCKETS; i++) {
+		seen += Buckets[i];
+		if (seen > threshold)
+			return std::min(Statistics::BucketLimit(i), Max);
+	}
+
+	return Max;
+}
+
+void Statistics::Snapshot(std::vector<StatSummary>& stats)
+{
+	std::vector<std::string> names[3];
+	{
+		StatRegistry& registry = Registry();
+		std::lock_guard<std::mutex> lock(registry.Lock);
+		for (int i = 0; i < 3; i++)
+			names[i] = registry.Names[i];
+	}
+
+	StatTotals totals;
+	PerThread<ThreadStats>::Visit([&](const std::vector<ThreadStats*>& threads) {
+		totals = RetiredTotals;
+		for (ThreadStats* thread : threads)
+			AddThread(totals, *thread);
+	});
+
+	stats.clear();
+	for (size_t i = 0; i < names[(int)StatKind::Counter].size(); i++) {
+		if (totals.Counters[i] == 0)
+			continue;
+
+		StatSummary summary = {};
+		summary.Id = (int)i;
+		summary.Name = names[(int)StatKind::Counter][i];
+		summary.Kind = StatKind::Counter;
+		summary.Value = (INT64)totals.Counters[i];
+		stats.push_back(summary);
+	}
+
+	for (size_t i = 0; i < names[(int)StatKind::Gauge].size(); i++) {
+		StatSummary summary = {};
+		summary.Id = (int)i;
+		summary.Name = names[(int)StatKind::Gauge][i];
+		summary.Kind = StatKind::Gauge;
+		summary.Value = SetGauges[i].Value.load(std::memory_order_relaxed) + totals.Gauges[i];
+		stats.push_back(summary);
+	}
+
+	for (size_t i = 0; i < names[(int)StatKind::Histogram].size() && i < totals.Histograms.size(); i++) {
+		const HistogramTotals& histogram = totals.Histograms[i];
+		if (histogram.Count == 0)
+			continue;
+
+		StatSummary summary = {};
+		summary.Id = (int)i;
+		summary.Name = names[(int)StatKind::Histogram][i];
+		summary.Kind = StatKind::Histogram;
+		summary.Count = histogram.Count;
+		summary.Sum = histogram.Sum;
+		summary.Min = histogram.Min;
+		summary.Max = histogram.Max;
+		std::copy(histogram.Buckets, histogram.Buckets + STATS_HISTOGRAM_BUCKETS, summary.Buckets);
+		stats.push_back(summary);
+	}
+}
+
+static const char* KindName(StatKind kind)
+{
+	switch (kind) {
+	case StatKind::Counter:
+		return "counter";
+	case StatKind::Gauge:
+		return "gauge";
+	default:
+		return "histogram";
+	}
+}
+
+// Rewrites the statistics file with one line per statistic. Counters and gauges only fill in value, histograms leave it empty
+static void WriteStats(const std::vector<StatSummary>& stats)
+{
+	if (StatsPath.empty())
+		return;
+
+	FILE* file = fopen(StatsPath.c_str(), "w");
+	if (file == nullptr) {
+		spdlog::error("Failed to open statistics file {}", StatsPath);
+		return;
+	}
+
+	fprintf(file, "kind,name,value,count,mean,min,p50,p90,p99,p999,max\n");
+	for (const StatSummary& stat : stats) {
+		if (stat.Kind != StatKind::Histogram) {
+			fprintf(file, "%s,%s,%lld,,,,,,,,\n", KindName(stat.Kind), stat.Name.c_str(), (long long)stat.Value);
+			continue;
+		}
+
+		fprintf(file, "%s,%s,,%llu,%.1f,%llu,%llu,%llu,%llu,%llu,%llu\n", KindName(stat.Kind), stat.Name.c_str(),
+			(unsigned long long)stat.Count, (double)stat.Sum / stat.Count, (unsigned long long)stat.Min,
+			(unsigned long long)stat.Percentile(0.5), (unsigned long long)stat.Percentile(0.9), (unsigned long long)stat.Percentile(0.99),
+			(unsigned long long)stat.Percentile(0.999), (unsigned long long)stat.Max);
+	}
+
+	fclose(file);
+}
+
+static void SnapshotAndWrite()
+{
+	std::vector<StatSummary> stats;
+	Statistics::Snapshot(stats);
+	WriteStats(stats);
+}
+
+void Statistics::Start(const std::string& path, unsigned intervalMs)
+{
+	Stop();
+
+	StatsPath = path;
+	Enabled = true;
+
+	if (!StatsPath.empty())
+		spdlog::info("Writing statistics to {} every {} ms", StatsPath, intervalMs);
+
+	ReaderThread.Start(intervalMs, SnapshotAndWrite);
+}
+
+void Statistics::Stop()
+{
+	if (!ReaderThread.IsRunning())
+		return;
+
+	ReaderThread.Stop();
+
+	std::vector<StatSummary> stats;
+	Snapshot(stats);
+	WriteStats(stats);
+
+	for (const StatSummary& stat : stats) {
+		if (stat.Kind != StatKind::Histogram) {
+			spdlog::info("{} {}: {}", KindName(stat.Kind), stat.Name, stat.Value);
+			continue;
+		}
+
+		spdlog::info("histogram {}: {} value(s), mean {:.1f}, p50 {}, p99 {}, max {}", stat.Name, stat.Count, (double)stat.Sum / stat.Count,
+			stat.Percentile(0.5), stat.Percentile(0.99), stat.Max);
+	}
+}
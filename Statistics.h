@@ -0,0 +1,92 @@
+#pragma once
+
+#include "stdafx.h"
+#include <string>
+#include <vector>
+
+// Environment variable naming the file statistics are written to. Nothing is recorded unless it's set
+#define STATS_FILE_VARIABLE "ZEROED_PROFILER_STATS_FILE"
+
+// Environment variable overriding how often every thread's statistics are aggregated and the file rewritten
+#define STATS_INTERVAL_VARIABLE "ZEROED_PROFILER_STATS_INTERVAL_MS"
+#define STATS_DEFAULT_INTERVAL_MS 1000
+
+// Statistics of each kind which can be registered. Registering more returns an ID which records nothing. There are enough
+// histograms for every hook to be timed, see MAX_HOOKS, on top of the profiler's own
+#define STATS_MAX_COUNTERS 256
+#define STATS_MAX_GAUGES 64
+#define STATS_MAX_HISTOGRAMS 320
+
+// Histograms split each power of two into 2^STATS_SUB_BUCKET_BITS equal buckets, so a bucket's bounds are within 1/8 of any
+// value it holds whatever its magnitude. Values below 2^STATS_SUB_BUCKET_BITS get a bucket each
+#define STATS_SUB_BUCKET_BITS 3
+#define STATS_SUB_BUCKETS (1 << STATS_SUB_BUCKET_BITS)
+#define STATS_HISTOGRAM_BUCKETS ((64 - STATS_SUB_BUCKET_BITS + 1) * STATS_SUB_BUCKETS)
+
+enum class StatKind : UINT8
+{
+	// Only ever increases
+	Counter,
+	// Goes up and down, or is set outright
+	Gauge,
+	// A distribution of values, such as durations in nanoseconds or sizes in bytes
+	Histogram,
+};
+
+// A statistic aggregated across every thread
+struct StatSummary
+{
+	// What the statistic was registered as
+	int Id;
+	std::string Name;
+	StatKind Kind;
+	// Counters' totals and gauges' values
+	INT64 Value;
+	// Histograms only
+	UINT64 Count;
+	UINT64 Sum;
+	UINT64 Min;
+	UINT64 Max;
+	UINT64 Buckets[STATS_HISTOGRAM_BUCKETS];
+
+	// Upper bound of the bucket the given fraction of values fall within, so within 1/8 of the true percentile
+	UINT64 Percentile(double fraction) const;
+};
+
+// Counters, gauges and histograms any part of the profiler can record into from any thread without contending with other
+// threads. Statistics are registered by name, normally during static initialisation, and recorded by the ID that returns.
+// Each thread records into a cache line aligned block of its own, allocated on its first record, which only it writes,
+// so recording takes no lock and no locked instruction. A reader thread adds every thread's blocks up at an interval and
+// rewrites the statistics file, and the blocks of exited threads are folded into a shared total. Gauges can also be set
+// outright, which suits values a single thread owns. Recording does nothing until Start or Enable is called
+class Statistics
+{
+public:
+	// Register a statistic, or look up the ID of one already registered with the same name
+	static int Counter(const char* name);
+	static int Gauge(const char* name);
+	static int Histogram(const char* name);
+
+	// Start recording and aggregating. With an empty path statistics are only logged when the profiler stops
+	static void Start(const std::string& path, unsigned intervalMs);
+	// Stop the reader thread, write the file a final time and log every statistic recorded
+	static void Stop();
+	// Start recording without the reader thread, for parts of the profiler which snapshot and report their own statistics
+	static void Enable();
+	static bool IsEnabled();
+
+	// Nanoseconds from the monotonic clock, for timing histograms
+	static INT64 Now();
+
+	static void Count(int counter, UINT64 value = 1);
+	static void Adjust(int gauge, INT64 delta);
+	static void Set(int gauge, INT64 value);
+	static void Record(int histogram, UINT64 value);
+
+	// Add up every thread's statistics. Counters and histograms which haven't recorded anything are left out
+	static void Snapshot(std::vector<StatSummary>& stats);
+
+	// Histogram bucket a value falls in, and the largest value each bucket holds
+	static int BucketOf(UINT64 value);
+	static UINT64 BucketLimit(int bucket);
+};
@@ -2,44 +2,41 @@
 #include <sstream>
 #include <iomanip>
 #include "Utils.h"
+#include "COMPtrHolder.h"
 
 std::string HrToString(HRESULT hr)
 {
-	char* msgBuf = nullptr;
-	DWORD size = FormatMessageA(
-		FORMAT_MESSAGE_ALLOCATE_BUFFER | FORMAT_MESSAGE_FROM_SYSTEM | FORMAT_MESSAGE_IGNORE_INSERTS,
-		nullptr,
-		hr,
-		MAKELANGID(LANG_NEUTRAL, SUBLANG_DEFAULT),
-		(LPSTR)&msgBuf,
-		0,
-		nullptr);
-
-	std::string message;
-	if (size && msgBuf)
+	std::string message = SystemErrorMessage(hr);
+	if (message.empty())
 	{
-		message = msgBuf;
-		LocalFree(msgBuf);
-	}
-	else
-	{
-		message = "Unknown error parsing HR";
+		message = fmt::format("Unknown error parsing HR 0x{:08x}", (UINT32)hr);
 	}
 	return message;
 }
 
-std::string WideToUtf8(const std::wstring& wstr) {
-	if (wstr.empty()) return {};
-	int size_needed = WideCharToMultiByte(CP_UTF8, 0, wstr.c_str(), (int)wstr.size(), nullptr, 0, nullptr, nullptr);
-	std::string strTo(size_needed, 0);
-	WideCharToMultiByte(CP_UTF8, 0, wstr.c_str(), (int)wstr.size(), &strTo[0], size_needed, nullptr, nullptr);
-	return strTo;
+std::string WideToUtf8(const WSTRING& wstr) {
+	return WStrToUtf8(wstr.c_str(), wstr.size());
+}
+
+std::string CsvQuote(const std::string& value) {
+	std::string quoted = "\"";
+	for (char c : value) {
+		if (c == '"')
+			quoted.push_back('"');
+		quoted.push_back(c);
+	}
+	quoted.push_back('"');
+	return quoted;
+}
+
+WSTRING Utf8ToWide(const std::string& str) {
+	return Utf8ToWStr(str.c_str(), str.size());
 }
 
 BOOL EndsWith(LPCWSTR wszContainer, LPCWSTR wszProspectiveEnding)
 {
-	size_t cchContainer = wcslen(wszContainer);
-	size_t cchEnding = wcslen(wszProspectiveEnding);
+	size_t cchContainer = WStrLen(wszContainer);
+	size_t cchEnding = WStrLen(wszProspectiveEnding);
 
 	if (cchContainer < cchEnding)
 		return FALSE;
@@ -47,7 +44,7 @@ BOOL EndsWith(LPCWSTR wszContainer, LPCWSTR wszProspectiveEnding)
 	if (cchEnding == 0)
 		return FALSE;
 
-	if (_wcsicmp(
+	if (WStrICmp(
 		wszProspectiveEnding,
 		&(wszContainer[cchContainer - cchEnding])) != 0)
 	{
@@ -232,4 +229,72 @@ void ParseRawILStream(LPCBYTE stream, ULONG streamLen) {
 	}
 
 
-}
\ No newline at end of file
+}
+
+// Prefixes name with its declaring types, outermost first
+static std::string QualifyWithTypeDef(IMetaDataImport* pImport, mdTypeDef typeDef, std::string name, const char* separator)
+{
+	while (!IsNilToken(typeDef)) {
+		WCHAR typeName[256];
+		ULONG typeNameLength = 0;
+		if (FAILED(pImport->GetTypeDefProps(typeDef, typeName, _countof(typeName), &typeNameLength, nullptr, nullptr)))
+			break;
+		name = name.empty() ? WideToUtf8(typeName) : WideToUtf8(typeName) + separator + name;
+
+		// Fails for a type that isn't nested
+		mdTypeDef enclosing = mdTypeDefNil;
+		if (FAILED(pImport->GetNestedClassProps(typeDef, &enclosing)))
+			break;
+		typeDef = enclosing;
+		separator = "+";
+	}
+
+	return name;
+}
+
+std::string FunctionIdToName(ICorProfilerInfo4* pInfo, FunctionID functionId)
+{
+	COMPtrHolder<IMetaDataImport> pImport;
+	mdToken token = mdTokenNil;
+	mdTypeDef typeDef = mdTypeDefNil;
+	WCHAR methodName[256];
+	ULONG methodNameLength = 0;
+	if (FAILED(pInfo->GetTokenAndMetaDataFromFunction(functionId, IID_IMetaDataImport, (IUnknown**)&pImport, &token)) ||
+		FAILED(pImport->GetMethodProps(token, &typeDef, methodName, _countof(methodName), &methodNameLength, nullptr, nullptr, nullptr, nullptr, nullptr)))
+		return fmt::format("[unknown function {:x}]", functionId);
+
+	return QualifyWithTypeDef(pImport, typeDef, WideToUtf8(methodName), ".");
+}
+
+std::string ClassIdToName(ICorProfilerInfo4* pInfo, ClassID classId)
+{
+	CorElementType elementType;
+	ClassID elementClassId = 0;
+	ULONG rank = 0;
+	if (pInfo->IsArrayClass(classId, &elementType, &elementClassId, &rank) == S_OK) {
+		std::string elementName = elementClassId != 0 ? ClassIdToName(pInfo, elementClassId) : fmt::format("[element type {:x}]", (int)elementType);
+		return elementName + "[" + std::string(rank > 1 ? rank - 1 : 0, ',') + "]";
+	}
+
+	ModuleID moduleId = 0;
+	mdTypeDef typeDef = mdTypeDefNil;
+	ClassID typeArgs[8];
+	ULONG32 typeArgCount = 0;
+	COMPtrHolder<IMetaDataImport> pImport;
+	if (FAILED(pInfo->GetClassIDInfo2(classId, &moduleId, &typeDef, nullptr, _countof(typeArgs), &typeArgCount, typeArgs)) ||
+		FAILED(pInfo->GetModuleMetaData(moduleId, ofRead, IID_IMetaDataImport, (IUnknown**)&pImport)))
+		return fmt::format("[unknown type {:x}]", classId);
+
+	std::string name = QualifyWithTypeDef(pImport, typeDef, std::string(), "+");
+	if (typeArgCount > 0) {
+		name.push_back('<');
+		for (ULONG32 i = 0; i < typeArgCount && i < _countof(typeArgs); i++) {
+			if (i > 0)
+				name.push_back(',');
+			name += ClassIdToName(pInfo, typeArgs[i]);
+		}
+		name.push_back('>');
+	}
+
+	return name;
+}
@@ -14,7 +14,15 @@
 // Converts a HRESULT code into a string
 std::string HrToString(HRESULT hr);
 
-std::string WideToUtf8(const std::wstring& wstr);
+std::string WideToUtf8(const WSTRING& wstr);
+// Wraps a field in double quotes for a CSV file, doubling any quotes inside it
+std::string CsvQuote(const std::string& value);
+WSTRING Utf8ToWide(const std::string& str);
 void ParseRawILStream(LPCBYTE stream, ULONG streamLen);
 std::vector<BYTE> HexStringToByteVector(const std::string& hex);
 BOOL EndsWith(LPCWSTR wszContainer, LPCWSTR wszProspectiveEnding);
+
+// Names a function as Namespace.Type.Method, with nested types joined by '+' as they are in managed stack traces
+std::string FunctionIdToName(ICorProfilerInfo4* pInfo, FunctionID functionId);
+// Names a loaded type as Namespace.Type, followed by its type arguments in angle brackets and [] for each array rank
+std::string ClassIdToName(ICorProfilerInfo4* pInfo, ClassID classId);
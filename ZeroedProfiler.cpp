@@ -2,13 +2,36 @@
 #include "ZeroedProfiler.h"
 #include <iostream>
 #include <vector>
-#include <windows.h>
 #include <string>
 #include <sstream>
 #include <iomanip>
 #include <cor.h>
 #include <corprof.h>
 #include "Utils.h"
+#include "InjectionPlan.h"
+#include "HookDispatch.h"
+#include "HookConfig.h"
+#include "CaptureBuffer.h"
+#include "MethodTiming.h"
+#include "AllocationSampler.h"
+#include "JitAccounting.h"
+#include "ExceptionTracker.h"
+#include "LockContention.h"
+#include "LoadTimeline.h"
+#include "Statistics.h"
+#include "AdaptiveCapture.h"
+#include "GcTelemetry.h"
+#include <cstdlib>
+#include <cstring>
+#include <chrono>
+#include <thread>
+
+static const int RewritesStat = Statistics::Counter("il.rewrites");
+static const int RewriteNsStat = Statistics::Histogram("il.rewrite_ns");
+static const int ReJitErrorsStat = Statistics::Counter("il.rejit_errors");
+static const int HooksInstalledStat = Statistics::Counter("hooks.installed");
+static const int ThreadsCreatedStat = Statistics::Counter("runtime.threads_created");
+static const int ThreadsStat = Statistics::Gauge("runtime.threads");
 
 ZeroedProfiler::ZeroedProfiler() :
 	ClrBridge(NULL),
@@ -21,9 +44,9 @@ HRESULT STDMETHODCALLTYPE ZeroedProfiler::QueryInterface(REFIID riid, void** ppv
 {
 	if (ppvObject == nullptr) return E_POINTER;
 
-	if (riid == IID_IUnknown || riid == __uuidof(ICorProfilerCallback) ||
-		riid == __uuidof(ICorProfilerCallback2) || riid == __uuidof(ICorProfilerCallback3) ||
-		riid == __uuidof(ICorProfilerCallback4)) {
+	if (riid == IID_IUnknown || riid == IID_ICorProfilerCallback ||
+		riid == IID_ICorProfilerCallback2 || riid == IID_ICorProfilerCallback3 ||
+		riid == IID_ICorProfilerCallback4) {
 		*ppvObject = static_cast<ICorProfilerCallback4*>(this);
 		AddRef();
 		return S_OK;
@@ -44,26 +67,348 @@ ULONG STDMETHODCALLTYPE ZeroedProfiler::Release() {
 }
 
 HRESULT STDMETHODCALLTYPE ZeroedProfiler::Initialize(IUnknown* pICorProfilerInfoUnk) {
-	HRESULT hr = pICorProfilerInfoUnk->QueryInterface(__uuidof(ICorProfilerInfo4), (void**)&ClrBridge);
+	const char* disableNgen = std::getenv(DISABLE_NGEN_VARIABLE);
+	DisableNgen = disableNgen != nullptr && strcmp(disableNgen, "1") == 0;
+
+	const char* hookConfig = std::getenv(HOOK_CONFIG_VARIABLE);
+	const char* controlFile = std::getenv(CONTROL_FILE_VARIABLE);
+	return Start(pICorProfilerInfoUnk, hookConfig != nullptr ? hookConfig : "", controlFile != nullptr ? controlFile : "", false);
+}
+
+/// <summary>
+/// Called instead of Initialize when the profiler is attached to a running process. The attaching tool can't set our
+/// environment so the hook configuration, in the same format as ZEROED_PROFILER_HOOKS, is passed as the client data.
+/// The control file defaults to zeroed-profiler-[pid].control in the temp directory so the session can be detached
+/// https://learn.microsoft.com/en-us/dotnet/framework/unmanaged-api/profiling/icorprofilercallback3-initializeforattach-method
+/// </summary>
+HRESULT STDMETHODCALLTYPE ZeroedProfiler::InitializeForAttach(IUnknown* pCorProfilerInfoUnk, void* pvClientData, UINT cbClientData) {
+	std::string hookConfig;
+	if (pvClientData != nullptr)
+		hookConfig.assign((const char*)pvClientData, strnlen((const char*)pvClientData, cbClientData));
+
+	// NGEN images can only be disabled at startup, code that's already running is hooked through ReJIT
+	DisableNgen = false;
+
+	const char* controlFileVariable = std::getenv(CONTROL_FILE_VARIABLE);
+	std::string controlFile = controlFileVariable != nullptr ?
+		controlFileVariable : fmt::format("{}zeroed-profiler-{}.control", TempDirectory(), CurrentProcessId());
+
+	spdlog::info("Attaching with hook configuration \"{}\", control file {}", hookConfig, controlFile);
+	return Start(pCorProfilerInfoUnk, hookConfig, controlFile, true);
+}
+
+/// <summary>
+/// Modules loaded before we attached never raise ModuleLoadFinished, so find them and inject their hooks now. Hooked
+/// methods which have already been JITted pick up their hook through ReJIT
+/// https://learn.microsoft.com/en-us/dotnet/framework/unmanaged-api/profiling/icorprofilercallback3-profilerattachcomplete-method
+/// </summary>
+HRESULT STDMETHODCALLTYPE ZeroedProfiler::ProfilerAttachComplete() {
+	COMPtrHolder<ICorProfilerModuleEnum> pModules;
+	FAIL_CHECK(ClrBridge->EnumModules(&pModules), "Failed to enumerate loaded modules");
+
+	ModuleID moduleIds[64];
+	ULONG fetched = 0;
+	size_t moduleCount = 0;
+	while (SUCCEEDED(pModules->Next(_countof(moduleIds), moduleIds, &fetched)) && fetched > 0) {
+		for (ULONG i = 0; i < fetched; i++) {
+			// Failures are logged and only affect the one module
+			InstrumentModule(moduleIds[i]);
+		}
+		moduleCount += fetched;
+	}
+
+	spdlog::info("Attached, found {} loaded module(s)", moduleCount);
+	return S_OK;
+}
+
+/// <summary>
+/// Revert every hooked method back to its original code, then ask the runtime to unload the profiler. Runs on the control
+/// channel's thread since RequestProfilerDetach can't be called from a managed thread. Returns false if the detach was
+/// refused or failed, leaving the profiler loaded
+/// </summary>
+bool ZeroedProfiler::Detach() {
+	if (DisableNgen) {
+		spdlog::error("Hooks applied with " DISABLE_NGEN_VARIABLE " set can't be reverted, ignoring detach");
+		return false;
+	}
+	if (SampleAllocations) {
+		spdlog::error("The runtime can't stop raising allocation callbacks once " ALLOCATION_FILE_VARIABLE " is set, ignoring detach");
+		return false;
+	}
+
+	// A timed call which started before the revert runs its exit probe whenever it returns, which may be long after the
+	// library has been unloaded. Lock waits are timed the same way and a thread can stay blocked in Monitor.Enter indefinitely
+	for (const HookDefinition& hook : Hooks) {
+		if (hook.Mode == HookMode::LockWait) {
+			spdlog::error("Lock waits measured with " LOCK_FILE_VARIABLE " set may still be running, ignoring detach");
+			return false;
+		}
+		if (hook.Timed) {
+			spdlog::error("Timed hook on {}.{} may still be running, ignoring detach", WideToUtf8(hook.TargetClass), WideToUtf8(hook.TargetMethod));
+			return false;
+		}
+	}
+
+	spdlog::info("Detaching");
+	Detaching = true;
+
+	// Stop calling out straight away, and stop queueing ReJITs which would reinstate hooks after the revert
+	SetAllHooksEnabled(false);
+	ReJitRequests.Stop();
+	Sampler.Stop();
+
+	std::vector<ModuleID> moduleIds;
+	std::vector<mdMethodDef> methodDefs;
+	InstalledHooks.ForEach([&](ModuleID moduleId, const std::vector<InstalledHook>& hooks) {
+		for (const InstalledHook& hook : hooks) {
+			moduleIds.push_back(moduleId);
+			methodDefs.push_back(hook.TargetMethodDef);
+		}
+	});
+
+	if (!moduleIds.empty()) {
+		std::vector<HRESULT> statuses(moduleIds.size());
+		HRESULT hr = ClrBridge->RequestRevert((ULONG)moduleIds.size(), moduleIds.data(), methodDefs.data(), statuses.data());
+		if (FAILED(hr)) {
+			spdlog::error("RequestRevert failed, hooks are disabled but the profiler will stay loaded: {}", HrToString(hr));
+			return false;
+		}
+
+		// A method we couldn't revert still calls into this library, so unloading it would crash the process
+		for (size_t i = 0; i < statuses.size(); i++) {
+			if (FAILED(statuses[i])) {
+				spdlog::error("Failed to revert method {:x} in module {:x}, hooks are disabled but the profiler will stay loaded: {}",
+					methodDefs[i], moduleIds[i], HrToString(statuses[i]));
+				return false;
+			}
+		}
+	}
+
+	// The runtime only waits for threads to leave profiler callbacks. Threads which passed a hook's enable check before
+	// it was cleared may still be in a capture function or ZeroedDispatch, so give them time to return
+	std::this_thread::sleep_for(std::chrono::milliseconds(DETACH_DRAIN_MS));
+	AdaptiveCapture::Stop();
+	GcTelemetry::Stop();
+	if (TrackExceptions)
+		ExceptionTracker::Stop();
+	CaptureBuffer::FlushAll();
+	MethodTiming::Stop();
+	JitAccounting::Stop();
+	LockContention::Stop();
+	LoadTimeline::Stop();
+	Statistics::Stop();
+
+	HRESULT hr = ClrBridge->RequestProfilerDetach(DETACH_TIMEOUT_MS);
+	if (FAILED(hr)) {
+		spdlog::error("RequestProfilerDetach failed, hooks are disabled but the profiler will stay loaded: {}", HrToString(hr));
+		return false;
+	}
+
+	return true;
+}
+
+/// <summary>
+/// Called once the runtime has unloaded every hook and is about to unload the profiler. No other callbacks will follow
+/// https://learn.microsoft.com/en-us/dotnet/framework/unmanaged-api/profiling/icorprofilercallback3-profilerdetachsucceeded-method
+/// </summary>
+HRESULT STDMETHODCALLTYPE ZeroedProfiler::ProfilerDetachSucceeded() {
+	spdlog::info("Detached");
+
+	Control.Stop();
+	CaptureBuffer::Close();
+
+	InstalledHooks.Clear();
+
+	if (ClrBridge)
+	{
+		ClrBridge->Release();
+		ClrBridge = nullptr;
+	}
+
+	return S_OK;
+}
+
+HRESULT ZeroedProfiler::Start(IUnknown* pICorProfilerInfoUnk, const std::string& hookConfig, const std::string& controlFile, bool attaching) {
+	// Started first so everything after it can record
+	const char* statsFile = std::getenv(STATS_FILE_VARIABLE);
+	if (statsFile != nullptr) {
+		const char* statsInterval = std::getenv(STATS_INTERVAL_VARIABLE);
+		unsigned intervalMs = statsInterval != nullptr ? (unsigned)strtoul(statsInterval, nullptr, 10) : 0;
+		Statistics::Start(statsFile, intervalMs > 0 ? intervalMs : STATS_DEFAULT_INTERVAL_MS);
+	}
+
+	const char* lockFile = std::getenv(LOCK_FILE_VARIABLE);
+	TrackLocks = lockFile != nullptr;
+	RegisterHooks(hookConfig);
+
+	HRESULT hr = CompileTemplates();
+	if (FAILED(hr)) {
+		spdlog::error("Failed to compile IL templates");
+		return hr;
+	}
+
+	// Captures are still buffered without a file so the hook overhead is the same either way
+	const char* captureFile = std::getenv(CAPTURE_FILE_VARIABLE);
+	if (captureFile != nullptr)
+		CaptureBuffer::Open(captureFile);
+
+	// Timings are merged in the background whenever a hook is timed, the file only decides whether they're written out
+	std::vector<std::string> hookNames;
+	std::vector<int> alwaysCaptured;
+	bool anyTimed = false;
+	for (const HookDefinition& hook : Hooks) {
+		if (hook.AlwaysCaptured)
+			alwaysCaptured.push_back((int)hookNames.size());
+		hookNames.push_back(WideToUtf8(hook.TargetClass) + "." + WideToUtf8(hook.TargetMethod));
+		anyTimed |= hook.Timed;
+	}
+
+	if (anyTimed) {
+		const char* timingFile = std::getenv(TIMING_FILE_VARIABLE);
+		const char* timingInterval = std::getenv(TIMING_INTERVAL_VARIABLE);
+		unsigned intervalMs = timingInterval != nullptr ? (unsigned)strtoul(timingInterval, nullptr, 10) : 0;
+		MethodTiming::Start(timingFile != nullptr ? timingFile : "", intervalMs > 0 ? intervalMs : TIMING_DEFAULT_INTERVAL_MS, hookNames);
+	}
+
+	// Captures are only thinned out once a rate is set
+	const char* adaptiveRate = std::getenv(ADAPTIVE_RATE_VARIABLE);
+	double callsPerSecond = adaptiveRate != nullptr ? strtod(adaptiveRate, nullptr) : 0;
+	if (callsPerSecond > 0) {
+		const char* adaptiveSample = std::getenv(ADAPTIVE_SAMPLE_VARIABLE);
+		UINT32 samplePeriod = adaptiveSample != nullptr ? (UINT32)strtoul(adaptiveSample, nullptr, 10) : ADAPTIVE_DEFAULT_SAMPLE;
+		AdaptiveCapture::Start(callsPerSecond, samplePeriod, hookNames, alwaysCaptured);
+	}
+
+	hr = pICorProfilerInfoUnk->QueryInterface(IID_ICorProfilerInfo4, (void**)&ClrBridge);
 	if (FAILED(hr)) {
 		spdlog::error("Failed to retrieve interface");
 		return hr;
 	}
-	hr = ClrBridge->SetEventMask(
-		COR_PRF_MONITOR_MODULE_LOADS |
-		COR_PRF_MONITOR_JIT_COMPILATION |
-		COR_PRF_DISABLE_ALL_NGEN_IMAGES);
+
+	// DisableNgen is set by Initialize from the environment, and cleared by InitializeForAttach
+	DWORD eventMask = COR_PRF_MONITOR_MODULE_LOADS;
+	if (DisableNgen)
+		eventMask |= COR_PRF_MONITOR_JIT_COMPILATION | COR_PRF_DISABLE_ALL_NGEN_IMAGES;
+	else
+		eventMask |= COR_PRF_ENABLE_REJIT;
+
+	// Without NGEN disabled JIT callbacks are only used to time compilations, the hooks still go in through ReJIT
+	const char* jitFile = std::getenv(JIT_FILE_VARIABLE);
+	if (jitFile != nullptr) {
+		JitAccounting::Start(ClrBridge, jitFile);
+		eventMask |= COR_PRF_MONITOR_JIT_COMPILATION;
+	}
+
+	const char* exceptionFile = std::getenv(EXCEPTION_FILE_VARIABLE);
+	TrackExceptions = exceptionFile != nullptr;
+	if (TrackExceptions) {
+		ExceptionTracker::Start(ClrBridge, exceptionFile);
+		eventMask |= COR_PRF_MONITOR_EXCEPTIONS;
+	}
+
+	// JIT compilations are monitored so callers can be kept from inlining the Monitor methods, which would skip the hooks.
+	// Contended waits walk the stack to find their call site
+	if (TrackLocks) {
+		LockContention::Start(ClrBridge, lockFile);
+		eventMask |= COR_PRF_MONITOR_JIT_COMPILATION | COR_PRF_ENABLE_STACK_SNAPSHOT;
+	}
+
+	// Module loads are already monitored to inject hooks
+	const char* loadFile = std::getenv(LOAD_FILE_VARIABLE);
+	if (loadFile != nullptr) {
+		LoadTimeline::Start(ClrBridge, loadFile);
+		eventMask |= COR_PRF_MONITOR_ASSEMBLY_LOADS;
+	}
+
+	// Threads are only monitored to count them. Timing and lock waits record through Statistics too, but don't need them
+	if (statsFile != nullptr)
+		eventMask |= COR_PRF_MONITOR_THREADS;
+
+	const char* sampleFile = std::getenv(SAMPLE_FILE_VARIABLE);
+	if (sampleFile != nullptr)
+		eventMask |= COR_PRF_ENABLE_STACK_SNAPSHOT;
+
+	// GCs are followed through the basic GC events, which unlike COR_PRF_MONITOR_GC don't have the runtime walk the heap
+	// to report every surviving object to us. Survivors are only counted when asked for, from startup
+	DWORD highEventMask = COR_PRF_HIGH_MONITOR_NONE;
+	COMPtrHolder<ICorProfilerInfo5> pInfo5;
+	const char* gcTelemetry = std::getenv(GC_TELEMETRY_VARIABLE);
+	if (gcTelemetry != nullptr && strcmp(gcTelemetry, "1") == 0) {
+		const char* gcSurvivors = std::getenv(GC_SURVIVORS_VARIABLE);
+		bool countSurvivors = gcSurvivors != nullptr && strcmp(gcSurvivors, "1") == 0;
+		if (countSurvivors && attaching) {
+			spdlog::error(GC_SURVIVORS_VARIABLE " is ignored when attaching, survivors can only be counted from startup");
+			countSurvivors = false;
+		}
+
+		if (FAILED(ClrBridge->QueryInterface(IID_ICorProfilerInfo5, (void**)&pInfo5))) {
+			spdlog::error("GC telemetry needs ICorProfilerInfo5 which this runtime doesn't provide, GCs won't be recorded");
+		}
+		else {
+			GcTelemetry::Start(ClrBridge, countSurvivors);
+			eventMask |= COR_PRF_MONITOR_SUSPENDS;
+			highEventMask |= COR_PRF_HIGH_BASIC_GC;
+			if (countSurvivors)
+				eventMask |= COR_PRF_MONITOR_GC;
+		}
+	}
+
+	// Allocation callbacks can only be turned on at startup
+	const char* allocationFile = std::getenv(ALLOCATION_FILE_VARIABLE);
+	if (allocationFile != nullptr && attaching)
+		spdlog::error(ALLOCATION_FILE_VARIABLE " is ignored when attaching, allocations can only be sampled from startup");
+	SampleAllocations = allocationFile != nullptr && !attaching;
+	if (SampleAllocations) {
+		const char* allocationInterval = std::getenv(ALLOCATION_INTERVAL_VARIABLE);
+		UINT64 intervalBytes = allocationInterval != nullptr ? strtoull(allocationInterval, nullptr, 10) : 0;
+		AllocationSampler::Start(ClrBridge, allocationFile, intervalBytes > 0 ? intervalBytes : ALLOCATION_DEFAULT_INTERVAL_BYTES);
+		eventMask |= COR_PRF_ENABLE_OBJECT_ALLOCATED | COR_PRF_MONITOR_OBJECT_ALLOCATED | COR_PRF_ENABLE_STACK_SNAPSHOT;
+	}
+
+	hr = highEventMask != COR_PRF_HIGH_MONITOR_NONE ? pInfo5->SetEventMask2(eventMask, highEventMask) : ClrBridge->SetEventMask(eventMask);
 	if (FAILED(hr)) {
 		spdlog::error("Failed to set event mask");
 		return hr;
 	}
 
+	if (!DisableNgen)
+		ReJitRequests.Start(ClrBridge);
+
+	// A runtime that can't be sampled only loses the profile, hooks still work
+	if (sampleFile != nullptr) {
+		const char* sampleInterval = std::getenv(SAMPLE_INTERVAL_VARIABLE);
+		const char* wallClock = std::getenv(SAMPLE_WALL_CLOCK_VARIABLE);
+		unsigned intervalMs = sampleInterval != nullptr ? (unsigned)strtoul(sampleInterval, nullptr, 10) : 0;
+		Sampler.Start(ClrBridge, sampleFile, intervalMs > 0 ? intervalMs : SAMPLE_DEFAULT_INTERVAL_MS,
+			wallClock != nullptr && strcmp(wallClock, "1") == 0);
+	}
+
+	// Started last so a failed start never leaves it running, and a detach it asks for always finds the runtime's interface
+	if (!controlFile.empty())
+		Control.Start(controlFile, [this] { return Detach(); });
+
 	return S_OK;
 }
 
 HRESULT STDMETHODCALLTYPE ZeroedProfiler::Shutdown() {
 	spdlog::info("Shutting down");
 
+	ReJitRequests.Stop();
+	Sampler.Stop();
+	Control.Stop();
+	AdaptiveCapture::Stop();
+	GcTelemetry::Stop();
+	if (TrackExceptions)
+		ExceptionTracker::Stop();
+	CaptureBuffer::Close();
+	MethodTiming::Stop();
+	if (SampleAllocations)
+		AllocationSampler::Stop();
+	JitAccounting::Stop();
+	LockContention::Stop();
+	LoadTimeline::Stop();
+	Statistics::Stop();
+
 	if (ClrBridge)
 	{
 		ClrBridge->Release();
@@ -73,6 +418,39 @@ HRESULT STDMETHODCALLTYPE ZeroedProfiler::Shutdown() {
 	return S_OK;
 }
 
+/// <summary>
+/// Called when an assembly starts loading. Only monitored to record the load timeline
+/// https://learn.microsoft.com/en-us/dotnet/framework/unmanaged-api/profiling/icorprofilercallback-assemblyloadstarted-method
+/// </summary>
+HRESULT STDMETHODCALLTYPE ZeroedProfiler::AssemblyLoadStarted(AssemblyID assemblyId) {
+	if (LoadTimeline::IsEnabled())
+		LoadTimeline::AssemblyStarted(assemblyId);
+
+	return S_OK;
+}
+
+/// <summary>
+/// Called when an assembly has finished loading, after its manifest module
+/// https://learn.microsoft.com/en-us/dotnet/framework/unmanaged-api/profiling/icorprofilercallback-assemblyloadfinished-method
+/// </summary>
+HRESULT STDMETHODCALLTYPE ZeroedProfiler::AssemblyLoadFinished(AssemblyID assemblyId, HRESULT hrStatus) {
+	if (LoadTimeline::IsEnabled())
+		LoadTimeline::AssemblyFinished(assemblyId, hrStatus);
+
+	return S_OK;
+}
+
+/// <summary>
+/// Called when a module starts loading
+/// https://learn.microsoft.com/en-us/dotnet/framework/unmanaged-api/profiling/icorprofilercallback-moduleloadstarted-method
+/// </summary>
+HRESULT STDMETHODCALLTYPE ZeroedProfiler::ModuleLoadStarted(ModuleID moduleId) {
+	if (LoadTimeline::IsEnabled())
+		LoadTimeline::ModuleStarted(moduleId);
+
+	return S_OK;
+}
+
 /// <summary>
 /// Called whenever a module has finished loading into the target process
 /// https://learn.microsoft.com/en-us/dotnet/framework/unmanaged-api/profiling/icorprofilercallback-moduleloadfinished-method
@@ -81,13 +459,67 @@ HRESULT STDMETHODCALLTYPE ZeroedProfiler::Shutdown() {
 /// <param name="hrStatus"></param>
 /// <returns></returns>
 HRESULT STDMETHODCALLTYPE ZeroedProfiler::ModuleLoadFinished(ModuleID moduleId, HRESULT hrStatus) {
+	if (!LoadTimeline::IsEnabled())
+		return InstrumentModule(moduleId);
+
+	// The load has finished by the time the callback is raised, so instrumenting it is timed separately as the profiler's cost
+	LoadTimeline::ModuleFinished(moduleId, hrStatus);
+	INT64 started = LoadTimeline::Now();
+	HRESULT hr = InstrumentModule(moduleId);
+	LoadTimeline::ModuleInstrumented(moduleId, (UINT64)(LoadTimeline::Now() - started));
+	return hr;
+}
+
+/// <summary>
+/// Called when a collectible assembly's module starts unloading. Its hooks are dropped so the ID, which the runtime can hand
+/// to a later module, doesn't carry them over and a detach doesn't try to revert methods which no longer exist
+/// https://learn.microsoft.com/en-us/dotnet/framework/unmanaged-api/profiling/icorprofilercallback-moduleunloadstarted-method
+/// </summary>
+HRESULT STDMETHODCALLTYPE ZeroedProfiler::ModuleUnloadStarted(ModuleID moduleId) {
+	if (InstalledHooks.Remove(moduleId))
+		spdlog::debug("Module {:x} unloading, dropped its hooks", moduleId);
+
+	return S_OK;
+}
+
+/// <summary>
+/// Only monitored when STATS_FILE_VARIABLE is set, to count managed threads. Raised on the thread which created the new one,
+/// and ThreadDestroyed on whichever thread cleans it up, so statistics blocks are tied to OS threads rather than these
+/// https://learn.microsoft.com/en-us/dotnet/framework/unmanaged-api/profiling/icorprofilercallback-threadcreated-method
+/// </summary>
+HRESULT STDMETHODCALLTYPE ZeroedProfiler::ThreadCreated(ThreadID threadId) {
+	Statistics::Count(ThreadsCreatedStat);
+	Statistics::Adjust(ThreadsStat, 1);
+	return S_OK;
+}
+
+HRESULT STDMETHODCALLTYPE ZeroedProfiler::ThreadDestroyed(ThreadID threadId) {
+	Statistics::Adjust(ThreadsStat, -1);
+	return S_OK;
+}
+
+/// <summary>
+/// Inject every hook targeting a module. Called as each module loads, and for modules which were already loaded when we attached
+/// </summary>
+HRESULT ZeroedProfiler::InstrumentModule(ModuleID moduleId) {
+	if (Detaching)
+		return S_OK;
+
 	WCHAR moduleName[300];
 	ULONG moduleNameLength = 0;
 	AssemblyID assemblyID;
 	DWORD moduleFlags;
 
 	// Retrieve the name of the module that just loaded
-	FAIL_CHECK(ClrBridge->GetModuleInfo2(moduleId, nullptr, _countof(moduleName), &moduleNameLength, moduleName, &assemblyID, &moduleFlags), "Failed to retrieve loaded module details");
+	HRESULT hr = ClrBridge->GetModuleInfo2(moduleId, nullptr, _countof(moduleName), &moduleNameLength, moduleName, &assemblyID, &moduleFlags);
+	if (hr == CORPROF_E_DATAINCOMPLETE) {
+		// Enumerated while attaching before it finished loading. It'll be instrumented when ModuleLoadFinished is raised
+		return S_OK;
+	}
+	if (FAILED(hr)) {
+		spdlog::error("Failed to retrieve loaded module details: {}", HrToString(hr));
+		return hr;
+	}
 	if ((moduleFlags & COR_PRF_MODULE_WINDOWS_RUNTIME)) {
 		// Ignore Windows runtime modules
 		return S_OK;
@@ -109,72 +541,63 @@ HRESULT STDMETHODCALLTYPE ZeroedProfiler::ModuleLoadFinished(ModuleID moduleId,
 
 	spdlog::info("ModuleLoadFinished for {}, ADName = {}", WideToUtf8(moduleName), WideToUtf8(appDomainName));*/
 
-	// Check to see if the module being loaded contains the function we want to hook
-	if (!EndsWith(moduleName, TargetModule))
+	// Collect every hook targeting this module into a single plan so shared metadata is only emitted once
+	InjectionPlan plan(TypeName, ModuleName);
+	for (size_t i = 0; i < Hooks.size(); i++) {
+		if (EndsWith(moduleName, Hooks[i].TargetModule.c_str()))
+			plan.AddHook((int)i, &Hooks[i]);
+	}
+
+	if (plan.IsEmpty())
 		return S_OK;
 
-	// Store module ID for later use
-	ModuleId = moduleId;
+	// A module loading while we attach can be both enumerated and raise ModuleLoadFinished, only inject into it once.
+	// The entry is claimed empty and filled in once the hooks are installed
+	if (!InstalledHooks.TryAdd(moduleId, {}))
+		return S_OK;
 
-	IMetaDataEmit* pEmit = nullptr;
-	IMetaDataImport* pImport = nullptr;
+	COMPtrHolder<IMetaDataEmit> pEmit;
+	COMPtrHolder<IMetaDataImport> pImport;
 
 	// Retrieve a metadata emitter so we can manipulate the target assembly
 	{
 		COMPtrHolder<IUnknown> pUnk;
 
-		FAIL_CHECK(ClrBridge->GetModuleMetaData(moduleId, ofWrite, IID_IMetaDataEmit, &pUnk), "IID_IMetaDataEmit: GetModuleMetaData failed {} Error: {}", WideToUtf8(TargetModule));
-		FAIL_CHECK(pUnk->QueryInterface(IID_IMetaDataEmit, (LPVOID*)&pEmit), "IID_IMetaDataEmit: QueryInterface failed {} Error: {}", WideToUtf8(TargetModule));
-		pEmit->AddRef();
+		FAIL_CHECK(ClrBridge->GetModuleMetaData(moduleId, ofWrite, IID_IMetaDataEmit, &pUnk), "IID_IMetaDataEmit: GetModuleMetaData failed {}", WideToUtf8(moduleName));
+		FAIL_CHECK(pUnk->QueryInterface(IID_IMetaDataEmit, (LPVOID*)&pEmit), "IID_IMetaDataEmit: QueryInterface failed {}", WideToUtf8(moduleName));
 	}
 
 	// Retrieve a metadata importer so we can manipulate the target assembly
 	{
 		COMPtrHolder<IUnknown> pUnk;
 
-		FAIL_CHECK(ClrBridge->GetModuleMetaData(moduleId, ofRead, IID_IMetaDataImport, &pUnk), "IID_IMetaDataImport: GetModuleMetaData failed {}", WideToUtf8(TargetModule));
-		FAIL_CHECK(pUnk->QueryInterface(IID_IMetaDataImport, (LPVOID*)&pImport), "IID_IMetaDataImport: QueryInterface failed {}", WideToUtf8(TargetModule));
-		pImport->AddRef();
+		FAIL_CHECK(ClrBridge->GetModuleMetaData(moduleId, ofRead, IID_IMetaDataImport, &pUnk), "IID_IMetaDataImport: GetModuleMetaData failed {}", WideToUtf8(moduleName));
+		FAIL_CHECK(pUnk->QueryInterface(IID_IMetaDataImport, (LPVOID*)&pImport), "IID_IMetaDataImport: QueryInterface failed {}", WideToUtf8(moduleName));
 	}
 
-	// Now that the metadata handles are open, we can setup our signatures which will be needed later on
-
-	// Setup target method signature
-	spdlog::debug("Building target signature");
-	FAIL_CHECK(SetupTargetMethodSignature(pImport), "Failed to build target method signature");
-
-	// Get the metadata token of the target function
-	spdlog::debug("Getting reference to target method {}.{}", WideToUtf8(TargetClass), WideToUtf8(TargetMethod));
-	FAIL_CHECK(GetTargetMethodToken(&targetMethodDef, pEmit, pImport), "Failed to resolve target method");
+	std::vector<InstalledHook> installedHooks;
+	FAIL_CHECK(plan.Emit(ClrBridge, moduleId, pEmit, pImport, installedHooks), "Failed to inject hooks into {}", WideToUtf8(moduleName));
 
-	// Define a new type which will house our helper functions
-	mdTypeDef tdInjectedType;
-	spdlog::debug("Injecting custom type \"{}\" into {}", WideToUtf8(TypeName), WideToUtf8(TargetModule));
-	FAIL_CHECK(DefineCustomType(moduleId, &tdInjectedType, pEmit, pImport), "Failed to inject type into target module");
-
-	// Generate the metadata signature for a new module
-	mdModuleRef mrZeroedProfilerReference;
-	spdlog::debug("Adding reference to module {}", WideToUtf8(ModuleName));
-	FAIL_CHECK(pEmit->DefineModuleRef(ModuleName, &mrZeroedProfilerReference), "DefineModuleRef against the native profiler DLL failed");
+	if (installedHooks.empty())
+		return S_OK;
 
-	// Add a new pinvoke method to our custom type
-	spdlog::debug("Adding PInvoke reference AssemblyLoadCallback");
-	AddPInvoke(tdInjectedType, mrZeroedProfilerReference, pEmit);
+	InstalledHooks.Set(moduleId, installedHooks);
+	Statistics::Count(HooksInstalledStat, installedHooks.size());
 
-	// Define our hook method
-	spdlog::debug("Adding method definition for {}", WideToUtf8(ManagedHelperName));
-	AddManagedHookMethod(tdInjectedType, pEmit, pImport);
+	// Without NGEN disabled the target may already have precompiled code, so its hook is applied when the runtime asks for
+	// ReJIT parameters. Methods which haven't run yet are compiled straight from the hooked IL
+	if (!DisableNgen) {
+		for (const InstalledHook& hook : installedHooks)
+			ReJitRequests.Enqueue(moduleId, hook.TargetMethodDef);
+	}
 
-	// Set the IL for the hook method
-	spdlog::debug("Setting IL for {}", WideToUtf8(ManagedHelperName));
-	FAIL_CHECK(SetILForHookMethod(pEmit, pImport), "Failed to set IL for {}", WideToUtf8(ManagedHelperName));
-	
 	return S_OK;
 }
 
 
 HRESULT ZeroedProfiler::JITCompilationStarted(FunctionID functionID, BOOL fIsSafeToBlock)
 {
+	INT64 started = JitAccounting::IsEnabled() ? JitAccounting::Now() : 0;
 	mdToken methodDef;
 	ClassID classID;
 	ModuleID moduleID;
@@ -182,386 +605,568 @@ HRESULT ZeroedProfiler::JITCompilationStarted(FunctionID functionID, BOOL fIsSaf
 	// Resolve function module ID and method def token so hooks can determine if they should handle this compilation
 	FAIL_CHECK(ClrBridge->GetFunctionInfo(functionID, &classID, &moduleID, &methodDef), "GetFunctionInfo failed"); // Theres not much we can do about this failing, bail out		
 
-	if (moduleID == ModuleId && methodDef == targetMethodDef) {
-		spdlog::debug("JITCompilationStarted for {}", WideToUtf8(TargetMethod));
+	if (JitAccounting::IsEnabled())
+		JitAccounting::CompilationStarted(functionID, moduleID, methodDef, false, started);
+
+	// JIT compilations are also monitored to time them, but hooks only go in here when ReJIT isn't applying them
+	InstalledHook hook;
+	if (DisableNgen && FindInstalledHook(moduleID, methodDef, hook)) {
+		const HookDefinition& definition = Hooks[hook.HookId];
+		spdlog::debug("JITCompilationStarted for {}", WideToUtf8(definition.TargetMethod));
 
-		FAIL_CHECK(RewriteIL(moduleID, methodDef), "SetILForManagedHelper failed for {}", WideToUtf8(TargetMethod));
+		INT64 rewriteStarted = JitAccounting::IsEnabled() ? JitAccounting::Now() : 0;
+		FAIL_CHECK(RewriteIL(moduleID, hook, NULL), "Failed to rewrite IL for {}", WideToUtf8(definition.TargetMethod));
+		if (JitAccounting::IsEnabled())
+			JitAccounting::Rewritten(moduleID, methodDef, (UINT64)(JitAccounting::Now() - rewriteStarted));
 	}
 
+	if (JitAccounting::IsEnabled())
+		JitAccounting::AddProfilerTime((UINT64)(JitAccounting::Now() - started));
 	return S_OK;
 }
 
-// Uses the general-purpose ILRewriter class to import original
-// IL, rewrite it, and send the result to the CLR
-HRESULT ZeroedProfiler::RewriteIL(ModuleID moduleID, mdMethodDef methodDef)
+/// <summary>
+/// Only monitored when JIT_FILE_VARIABLE is set, or with NGEN disabled
+/// https://learn.microsoft.com/en-us/dotnet/framework/unmanaged-api/profiling/icorprofilercallback-jitcompilationfinished-method
+/// </summary>
+HRESULT ZeroedProfiler::JITCompilationFinished(FunctionID functionId, HRESULT hrStatus, BOOL fIsSafeToBlock)
 {
-	ILRewriter* rewriter = new ILRewriter(ClrBridge, NULL, moduleID, methodDef);
+	if (JitAccounting::IsEnabled())
+		JitAccounting::CompilationFinished(functionId, hrStatus);
+	return S_OK;
+}
 
-	FAIL_CHECK(rewriter->Initialize(), "Failed to initalise IL rewriter");
-	FAIL_CHECK(rewriter->Import(), "Failed to import existing method IL");
+/// <summary>
+/// Keeps hooked methods from being inlined, since an inlined copy would skip the hook. Only raised while JIT compilations are
+/// monitored, and callers compiled before a hook was installed keep any copy they already inlined
+/// https://learn.microsoft.com/en-us/dotnet/framework/unmanaged-api/profiling/icorprofilercallback-jitinlining-method
+/// </summary>
+HRESULT ZeroedProfiler::JITInlining(FunctionID callerId, FunctionID calleeId, BOOL* pfShouldInline)
+{
+	mdToken methodDef;
+	ClassID classID;
+	ModuleID moduleID;
+	InstalledHook hook;
+	if (SUCCEEDED(ClrBridge->GetFunctionInfo(calleeId, &classID, &moduleID, &methodDef)) && FindInstalledHook(moduleID, methodDef, hook))
+		*pfShouldInline = FALSE;
 
-	spdlog::debug("Injecting redirect to managed helper", methodDef, managedHelperMethod);
-	ILInstr* pFirstOriginalInstr = rewriter->GetILList()->m_pNext;
-	ILInstr* pNewInstr = NULL;
+	return S_OK;
+}
 
-	static OPCODE staticOrder[4] = { CEE_LDARG_0, CEE_LDARG_1, CEE_LDARG_2, CEE_LDARG_3 };
+/// <summary>
+/// Called when a method queued through RequestReJIT is about to be recompiled. The hooked IL is handed back through pFunctionControl
+/// https://learn.microsoft.com/en-us/dotnet/framework/unmanaged-api/profiling/icorprofilercallback4-getrejitparameters-method
+/// </summary>
+HRESULT ZeroedProfiler::GetReJITParameters(ModuleID moduleId, mdMethodDef methodId, ICorProfilerFunctionControl* pFunctionControl)
+{
+	INT64 started = JitAccounting::IsEnabled() ? JitAccounting::Now() : 0;
 
-	if (targetMethodIsStatic && numArgsToLog > 4 || !targetMethodIsStatic && numArgsToLog > 3) {
-		spdlog::error("Too many arguments");
-		return E_FAIL;
-	}
+	InstalledHook hook;
+	if (FindInstalledHook(moduleId, methodId, hook)) {
+		const HookDefinition& definition = Hooks[hook.HookId];
+		spdlog::debug("GetReJITParameters for {}", WideToUtf8(definition.TargetMethod));
 
-	for (int i = 0; i < numArgsToLog; i++) {
-		pNewInstr = rewriter->NewILInstr();
-		pNewInstr->m_opcode = staticOrder[i];
-		rewriter->InsertBefore(pFirstOriginalInstr, pNewInstr);
+		FAIL_CHECK(RewriteIL(moduleId, hook, pFunctionControl), "Failed to rewrite IL for {}", WideToUtf8(definition.TargetMethod));
 	}
 
-	// call MgdEnteredFunction32/64 (may be via memberRef or methodDef)
-	pNewInstr = rewriter->NewILInstr();
-	pNewInstr->m_opcode = CEE_CALL;
-	pNewInstr->m_Arg32 = managedHelperMethod;
-	rewriter->InsertBefore(pFirstOriginalInstr, pNewInstr);
-
-	FAIL_CHECK(rewriter->Export(), "Failed to export modified IL");
-
+	// Runs once per method rather than per instantiation, before any of its ReJIT compilations start
+	if (JitAccounting::IsEnabled()) {
+		UINT64 durationNs = (UINT64)(JitAccounting::Now() - started);
+		JitAccounting::Rewritten(moduleId, methodId, durationNs);
+		JitAccounting::AddProfilerTime(durationNs);
+	}
 	return S_OK;
 }
 
 /// <summary>
-/// Setup the signature for the method we want to hook. This will be used to resolve the method later on
-/// Take special care to ensure the parameters and return types are correct
+/// Raised for each instantiation of a method being recompiled with the IL from GetReJITParameters, once JIT compilations are monitored
+/// https://learn.microsoft.com/en-us/dotnet/framework/unmanaged-api/profiling/icorprofilercallback4-rejitcompilationstarted-method
 /// </summary>
-/// <param name="pImport"></param>
-/// <returns></returns>
-HRESULT ZeroedProfiler::SetupTargetMethodSignature(IMetaDataImport* pImport) {
-	mdTypeDef typeDef;
-	HRESULT hr;
+HRESULT ZeroedProfiler::ReJITCompilationStarted(FunctionID functionId, ReJITID rejitId, BOOL fIsSafeToBlock)
+{
+	if (!JitAccounting::IsEnabled())
+		return S_OK;
 
-	BYTE compressedToken[4];
-	FAIL_CHECK(pImport->FindTypeDefByName(TargetClass, mdTypeDefNil, &typeDef), "Failed to find class '{}'. Error: {}", WideToUtf8(TargetClass), HrToString(hr));
+	INT64 started = JitAccounting::Now();
+	mdToken methodDef;
+	ClassID classID;
+	ModuleID moduleID;
+	FAIL_CHECK(ClrBridge->GetFunctionInfo(functionId, &classID, &moduleID, &methodDef), "GetFunctionInfo failed");
 
-	ULONG tokenLen = CorSigCompressToken(typeDef, compressedToken);
+	JitAccounting::CompilationStarted(functionId, moduleID, methodDef, true, started);
+	JitAccounting::AddProfilerTime((UINT64)(JitAccounting::Now() - started));
+	return S_OK;
+}
 
-	targetMethodSignature = {
-		IMAGE_CEE_CS_CALLCONV_DEFAULT, // Calling convention (DEFAULT = static)
-		1,                             // 1 parameter
-		ELEMENT_TYPE_CLASS,            // Return type - Class
-	};
+HRESULT ZeroedProfiler::ReJITCompilationFinished(FunctionID functionId, ReJITID rejitId, HRESULT hrStatus, BOOL fIsSafeToBlock)
+{
+	if (JitAccounting::IsEnabled())
+		JitAccounting::CompilationFinished(functionId, hrStatus);
+	return S_OK;
+}
 
-	targetMethodSignature.insert(targetMethodSignature.end(), compressedToken, compressedToken + tokenLen);
-	targetMethodSignature.push_back(ELEMENT_TYPE_SZARRAY);// parameter type: byte[]
-	targetMethodSignature.push_back(ELEMENT_TYPE_U1);     // array element type = byte
+HRESULT ZeroedProfiler::ReJITError(ModuleID moduleId, mdMethodDef methodId, FunctionID functionId, HRESULT hrStatus)
+{
+	spdlog::error("ReJIT of method {:x} in module {:x} failed: {}", methodId, moduleId, HrToString(hrStatus));
+	Statistics::Count(ReJitErrorsStat);
+	return S_OK;
+}
 
+/// <summary>
+/// Raised on the throwing thread once EXCEPTION_FILE_VARIABLE is set, before the runtime searches for a handler
+/// https://learn.microsoft.com/en-us/dotnet/framework/unmanaged-api/profiling/icorprofilercallback-exceptionthrown-method
+/// </summary>
+HRESULT ZeroedProfiler::ExceptionThrown(ObjectID thrownObjectId)
+{
+	// An exception of unknown type is skipped rather than counted as type 0, but still tracked until it's caught
+	ClassID classId = 0;
+	if (FAILED(ClrBridge->GetClassFromObject(thrownObjectId, &classId)))
+		classId = 0;
+	ExceptionTracker::Thrown(classId);
 	return S_OK;
 }
 
 /// <summary>
-/// Inject a new type into the target module. This custom type will house our hook function and any custom managed functions we may want to use
+/// Raised for each method the search phase looks for a handler in, starting with the one that threw
+/// https://learn.microsoft.com/en-us/dotnet/framework/unmanaged-api/profiling/icorprofilercallback-exceptionsearchfunctionenter-method
 /// </summary>
-/// <returns></returns>
-HRESULT ZeroedProfiler::DefineCustomType(ModuleID moduleId, mdTypeDef* tdInjectedType, IMetaDataEmit* pEmit, IMetaDataImport* pImport) {
-	// Retrieve a reference to System.Object so we can configure our new type to extend it
-	mdTypeRef systemObjectRef = mdTypeRefNil;
-	FAIL_CHECK(pEmit->DefineTypeRefByName(moduleId, L"System.Object", &systemObjectRef), "Failed to retrieve System.Object");
+HRESULT ZeroedProfiler::ExceptionSearchFunctionEnter(FunctionID functionId)
+{
+	ExceptionTracker::SearchFunctionEnter(functionId);
+	return S_OK;
+}
 
-	// Define a new type so we have somewhere to safely store all our methods
-	FAIL_CHECK(pEmit->DefineTypeDef(TypeName, tdSealed | tdAbstract | tdPublic, systemObjectRef, nullptr, tdInjectedType), "Error encountered whilst injecting {}", WideToUtf8(TypeName));
+/// <summary>
+/// Raised once the stack has been unwound to the handler, just before it runs
+/// https://learn.microsoft.com/en-us/dotnet/framework/unmanaged-api/profiling/icorprofilercallback-exceptioncatcherenter-method
+/// </summary>
+HRESULT ZeroedProfiler::ExceptionCatcherEnter(FunctionID functionId, ObjectID objectId)
+{
+	ExceptionTracker::CatcherEnter(functionId);
+	return S_OK;
+}
+
+/// <summary>
+/// Raised for every allocation once ALLOCATION_FILE_VARIABLE is set, on the allocating thread. Most only count towards the
+/// thread's sampling interval
+/// https://learn.microsoft.com/en-us/dotnet/framework/unmanaged-api/profiling/icorprofilercallback-objectallocated-method
+/// </summary>
+HRESULT ZeroedProfiler::ObjectAllocated(ObjectID objectId, ClassID classId)
+{
+	SIZE_T size = 0;
+	if (SUCCEEDED(ClrBridge->GetObjectSize2(objectId, &size)) && AllocationSampler::Count(size))
+		AllocationSampler::Sample(classId, size);
 
-	// Now that we have setup a new type, we can inject any helper methods in we may need
-	// We don't need any for this demo but this can be handy if you want to run custom managed code as part of your hook
 	return S_OK;
 }
 
-// Resolve the MethodDef for the method we want to hook
-HRESULT ZeroedProfiler::GetTargetMethodToken(mdMethodDef* mdTarget, IMetaDataEmit* pEmit, IMetaDataImport* pImport)
+// GC callbacks, raised once GC_TELEMETRY_VARIABLE is set. The reference callbacks are only raised when GC_SURVIVORS_VARIABLE
+// is set too. The runtime calls the SIZE_T versions of them on profilers implementing ICorProfilerCallback4 and the ULONG
+// versions otherwise, so only one of each pair is counted
+// https://learn.microsoft.com/en-us/dotnet/framework/unmanaged-api/profiling/icorprofilercallback2-garbagecollectionstarted-method
+
+HRESULT ZeroedProfiler::RuntimeSuspendStarted(COR_PRF_SUSPEND_REASON suspendReason)
 {
-	mdTypeDef typeDef;
-	spdlog::debug("Looking for class {}", WideToUtf8(TargetClass));
-	FAIL_CHECK(pImport->FindTypeDefByName(TargetClass, mdTypeDefNil, &typeDef), "Failed to find class '{}'", WideToUtf8(TargetClass));
+	GcTelemetry::SuspendStarted(suspendReason);
+	return S_OK;
+}
+
+HRESULT ZeroedProfiler::RuntimeResumeFinished()
+{
+	GcTelemetry::ResumeFinished();
+	return S_OK;
+}
+
+HRESULT ZeroedProfiler::GarbageCollectionStarted(int cGenerations, BOOL generationCollected[], COR_PRF_GC_REASON reason)
+{
+	GcTelemetry::GcStarted(cGenerations, generationCollected, reason);
+	return S_OK;
+}
+
+HRESULT ZeroedProfiler::GarbageCollectionFinished()
+{
+	GcTelemetry::GcFinished();
+	return S_OK;
+}
 
-	spdlog::debug("Found class, looking for method {}", WideToUtf8(TargetMethod));
+template <typename Length>
+static UINT64 SumLengths(ULONG count, const Length lengths[])
+{
+	UINT64 total = 0;
+	for (ULONG i = 0; i < count; i++)
+		total += lengths[i];
+	return total;
+}
 
+HRESULT ZeroedProfiler::SurvivingReferences(ULONG cSurvivingObjectIDRanges, ObjectID objectIDRangeStart[], ULONG cObjectIDRangeLength[])
+{
+	GcTelemetry::Survived(SumLengths(cSurvivingObjectIDRanges, cObjectIDRangeLength));
+	return S_OK;
+}
 
-	FAIL_CHECK(pImport->FindMethod(typeDef, TargetMethod, targetMethodSignature.data(), targetMethodSignature.size(), mdTarget), "FindMethod with signature failed for {}.{}", WideToUtf8(TargetClass), WideToUtf8(TargetMethod));
+HRESULT ZeroedProfiler::SurvivingReferences2(ULONG cSurvivingObjectIDRanges, ObjectID objectIDRangeStart[], SIZE_T cObjectIDRangeLength[])
+{
+	GcTelemetry::Survived(SumLengths(cSurvivingObjectIDRanges, cObjectIDRangeLength));
+	return S_OK;
+}
 
-	spdlog::debug("Found {} - {}.{}", WideToUtf8(TargetModule), WideToUtf8(TargetClass), WideToUtf8(TargetMethod));
+// A compacting GC reports its survivors as moved rather than surviving
+HRESULT ZeroedProfiler::MovedReferences(ULONG cMovedObjectIDRanges, ObjectID oldObjectIDRangeStart[], ObjectID newObjectIDRangeStart[], ULONG cObjectIDRangeLength[])
+{
+	GcTelemetry::Survived(SumLengths(cMovedObjectIDRanges, cObjectIDRangeLength));
+	return S_OK;
+}
 
+HRESULT ZeroedProfiler::MovedReferences2(ULONG cMovedObjectIDRanges, ObjectID oldObjectIDRangeStart[], ObjectID newObjectIDRangeStart[], SIZE_T cObjectIDRangeLength[])
+{
+	GcTelemetry::Survived(SumLengths(cMovedObjectIDRanges, cObjectIDRangeLength));
 	return S_OK;
 }
 
-// Creates a PInvoke method to inject into our custom type
-HRESULT ZeroedProfiler::AddPInvoke(mdTypeDef td, mdModuleRef mr, IMetaDataEmit* pEmit) {
-	spdlog::debug("Injecting pinvoke {}", WideToUtf8(CallbackMethodName));
-	if (!pEmit) {
-		spdlog::error("IMetaDataEmit pointer is null or invalid!");
-		return E_FAIL;
+bool ZeroedProfiler::FindInstalledHook(ModuleID moduleID, mdMethodDef methodDef, InstalledHook& hook)
+{
+	bool found = false;
+	InstalledHooks.Visit(moduleID, [&](const std::vector<InstalledHook>& hooks) {
+		for (const InstalledHook& candidate : hooks) {
+			if (candidate.TargetMethodDef == methodDef) {
+				hook = candidate;
+				found = true;
+				break;
+			}
+		}
+	});
+
+	return found;
+}
+
+// Uses the general-purpose ILRewriter class to import original
+// IL, rewrite it, and send the result to the CLR. pFunctionControl is only set when rewriting for ReJIT
+HRESULT ZeroedProfiler::RewriteIL(ModuleID moduleID, const InstalledHook& hook, ICorProfilerFunctionControl* pFunctionControl)
+{
+	INT64 started = Statistics::IsEnabled() ? Statistics::Now() : 0;
+
+	// Every probe reads the hook's enable flag, so a hook without one is left alone rather than pointed at null
+	const volatile INT32* enabled = GetHookEnabledFlag(hook.HookId);
+	if (enabled == nullptr) {
+		spdlog::error("Hook {} has no enable flag, method {:x} won't be hooked", hook.HookId, hook.TargetMethodDef);
+		return E_INVALIDARG;
+	}
+
+	ILRewriter rewriter(ClrBridge, pFunctionControl, moduleID, hook.TargetMethodDef);
+
+	FAIL_CHECK(rewriter.Initialize(), "Failed to initalise IL rewriter");
+	FAIL_CHECK(rewriter.Import(), "Failed to import existing method IL");
+
+	// The original first instruction, which the timing probe goes in front of so the hook's own prologue isn't timed
+	ILInstr* pBody = rewriter.GetILList()->m_pNext;
+
+	if (hook.Mode == HookMode::InlineCapture) {
+		const std::vector<short>& captureArgs = Hooks[hook.HookId].CaptureArgs;
+
+		// Slots are the enable flag, hook ID, each argument slot, then the capture function and its calli signature
+		std::vector<INT64> slots;
+		slots.push_back((INT64)(UINT_PTR)enabled);
+		slots.push_back(hook.HookId);
+		slots.insert(slots.end(), captureArgs.begin(), captureArgs.end());
+		slots.push_back((INT64)(UINT_PTR)CaptureBuffer::GetCaptureFunction((int)captureArgs.size()));
+		slots.push_back(hook.CaptureSignature);
+
+		spdlog::debug("Injecting inline capture of {} argument(s) for hook {}", captureArgs.size(), hook.HookId);
+		FAIL_CHECK(CapturePrologues[captureArgs.size()][hook.UnsignedCaptureArgs].SpliceBefore(rewriter, rewriter.GetILList()->m_pNext, slots),
+			"Failed to splice inline capture prologue");
 	}
+	else if (hook.Mode == HookMode::Dispatch) {
+		spdlog::debug("Injecting call to dispatcher {:x} for hook {}", hook.DispatcherMethod, hook.HookId);
+		FAIL_CHECK(HookPrologue.SpliceBefore(rewriter, rewriter.GetILList()->m_pNext,
+			{ (INT64)(UINT_PTR)enabled, hook.HookId, hook.PayloadArg, hook.DispatcherMethod }),
+			"Failed to splice hook prologue");
+	}
+
+	if (hook.Timed || hook.Mode == HookMode::LockWait)
+		FAIL_CHECK(InjectTiming(rewriter, hook, pBody), "Failed to inject timing probes");
+
+	if (OptimizeIL)
+		FAIL_CHECK(rewriter.Optimize(), "Failed to optimize modified IL");
 
-	// Define a new public static pinvoke method in our custom type. This will represent our pinvoke back to native land
-	FAIL_CHECK(pEmit->DefineMethod(td,
-		CallbackMethodName,
-		~mdAbstract & (mdStatic | mdPublic | mdPinvokeImpl), 
-		pInvokeSignature.data(), 
-		pInvokeSignature.size(), 
-		0, 
-		miPreserveSig, 
-		&pInvokeMethod), "Failed in DefineMethod when creating P/Invoke method {}", WideToUtf8(CallbackMethodName));
+	FAIL_CHECK(rewriter.Export(), "Failed to export modified IL");
 
-	FAIL_CHECK(pEmit->DefinePinvokeMap(pInvokeMethod,
-		pmCallConvStdcall | pmNoMangle, 
-		CallbackMethodName, 
-		mr), "Failed in DefinePinvokeMap when creating P/Invoke method {}", WideToUtf8(CallbackMethodName));
-	
+	if (Statistics::IsEnabled()) {
+		Statistics::Count(RewritesStat);
+		Statistics::Record(RewriteNsStat, (UINT64)(Statistics::Now() - started));
+	}
 	return S_OK;
 }
 
 /// <summary>
-/// Define a new method in our custom type. Note that this method will have no body until we set one in the next function
+/// Splice the timing entry probe in front of pBody and the exit probe in front of every ret. Branches and exception clauses
+/// ending at a ret are moved onto its probe, and since ret can't appear inside a protected region every normal return,
+/// including those reached through leave, passes through a probe. Calls ending in an exception aren't recorded. LockWait
+/// hooks get their own exit probe
 /// </summary>
-HRESULT ZeroedProfiler::AddManagedHookMethod(mdTypeDef td, IMetaDataEmit* pEmit, IMetaDataImport* pImport)
+HRESULT ZeroedProfiler::InjectTiming(ILRewriter& rewriter, const InstalledHook& hook, ILInstr* pBody)
 {
-	spdlog::debug("Defining method {}", WideToUtf8(ManagedHelperName), WideToUtf8(TypeName), td);
-	if (!pEmit) {
-		spdlog::error("IMetaDataEmit pointer is null or invalid!");
-		return E_FAIL;
-	}
-
-	FAIL_CHECK(pEmit->DefineMethod(td,
-		ManagedHelperName, 
-		mdStatic | mdPublic, 
-		managedHelperSignature.data(),
-		managedHelperSignature.size(),
-		0,
-		miIL | miNoInlining, 
-		&managedHelperMethod), "Failed to add managed hook method to custom type");
-
-	// As our method will be calling native code, we'll need to add give it the SecuritySafeCriticalAttribute
-	// https://learn.microsoft.com/en-us/dotnet/api/system.security.securitysafecriticalattribute?view=netframework-4.8.1
-
-	// Resolve SecuritySafeCriticalAttribute type
-	mdTypeDef tdSafeCritical;
-	mdMethodDef mdSafeCritical = mdMethodDefNil;
-	FAIL_CHECK(pImport->FindTypeDefByName(L"System.Security.SecuritySafeCriticalAttribute", mdTokenNil, &tdSafeCritical),
-		"FindTypeDefByName(System.Security.SecuritySafeCriticalAttribute) failed");
-
-	COR_SIGNATURE sigSafeCriticalCtor[] = {
-		IMAGE_CEE_CS_CALLCONV_HASTHIS,
-		0x00,                               // Number of arguments
-		ELEMENT_TYPE_VOID,                  // Return type
-	};
+	ILInstr* pList = rewriter.GetILList();
+
+	// Collect the exits before anything is inserted. jmp leaves the method with an empty stack so it's timed like ret.
+	// A tail. prefixed call has to be followed directly by its ret, so the probe goes in front of the prefix instead
+	std::vector<ILInstr*> exits;
+	for (ILInstr* pInstr = pBody; pInstr != pList; pInstr = pInstr->m_pNext) {
+		if (pInstr->m_opcode != CEE_RET && pInstr->m_opcode != CEE_JMP)
+			continue;
+
+		ILInstr* pExit = pInstr;
+		if (pExit->m_opcode == CEE_RET && pExit->m_pPrev != pList && pExit->m_pPrev->m_pPrev != pList && pExit->m_pPrev->m_pPrev->m_opcode == CEE_TAILCALL)
+			pExit = pExit->m_pPrev->m_pPrev;
+		exits.push_back(pExit);
+	}
 
-	FAIL_CHECK(pImport->FindMember(tdSafeCritical, L".ctor", sigSafeCriticalCtor, sizeof(sigSafeCriticalCtor), &mdSafeCritical),
-		"FindMember(System.Security.SecuritySafeCriticalAttribute..ctor) failed");
+	unsigned local;
+	FAIL_CHECK(rewriter.AddLocal(ELEMENT_TYPE_I8, &local), "Failed to add timing local");
+
+	spdlog::debug("Injecting timing probes at entry and {} exit(s) for hook {}", exits.size(), hook.HookId);
+	FAIL_CHECK(TimingEntry.SpliceBefore(rewriter, pBody, { (INT64)(UINT_PTR)GetHookEnabledFlag(hook.HookId),
+		(INT64)(UINT_PTR)MethodTiming::GetEnterFunction(), hook.TimingEnterSignature, local }), "Failed to splice timing entry probe");
+
+	for (ILInstr* pExit : exits) {
+		if (hook.Mode == HookMode::LockWait) {
+			FAIL_CHECK(LockWaitExit.SpliceAt(rewriter, pExit, { local, hook.HookId, hook.PayloadArg, hook.LockIdentityMethod,
+				(INT64)(UINT_PTR)LockContention::GetLeaveFunction(), hook.TimingLeaveSignature,
+				(INT64)(UINT_PTR)LockContention::GetContendedFunction(), hook.LockContendedSignature }), "Failed to splice lock wait exit probe");
+		}
+		else {
+			FAIL_CHECK(TimingExit.SpliceAt(rewriter, pExit, { local, hook.HookId, (INT64)(UINT_PTR)MethodTiming::GetLeaveFunction(), hook.TimingLeaveSignature }),
+				"Failed to splice timing exit probe");
+		}
+	}
 
-	// Attach SecuritySafeCriticalAttribute attribute to target method
-	mdToken tkCustomAttribute;
-	FAIL_CHECK(pEmit->DefineCustomAttribute(managedHelperMethod, mdSafeCritical, NULL, 0, &tkCustomAttribute),
-		"DefineMethod - Failed to define custom attribute");
+	return S_OK;
 }
 
-// Dynamiclly define the IL for the managed helper. This IL should call the pinvoke target, passing any params needed
-// then return following the call
-HRESULT ZeroedProfiler::SetILForHookMethod(IMetaDataEmit* pEmit, IMetaDataImport* pImport)
+/// <summary>
+/// Compile the IL templates injected by the profiler. These are built once and spliced into every method we rewrite
+/// </summary>
+HRESULT ZeroedProfiler::CompileTemplates()
 {
-	/*------Type Vars------*/
-	mdTypeDef tdBytes = mdTypeDefNil; // System.Byte
-
-	/*------Type Resolution------*/
-	// Resolve System.Byte
-	FAIL_CHECK(pImport->FindTypeDefByName(L"System.Byte", mdTypeDefNil, &tdBytes),
-		"Failed to resolve System.Byte");
-
-	/*------Locals Signature Generation------*/
-	std::vector<COR_SIGNATURE> localSig = {
-	  IMAGE_CEE_CS_CALLCONV_LOCAL_SIG,      // SIG_LOCAL_SIG
-	  0x02,                                 // Max stack size
-	  ELEMENT_TYPE_PTR, ELEMENT_TYPE_U1,    // System.Byte*
-	  ELEMENT_TYPE_PINNED,                  // Prevent GC/moving of value
-	  ELEMENT_TYPE_SZARRAY, ELEMENT_TYPE_U1 // System.Byte[]
+	// if (*enabled) Dispatch(hookId, payload)
+	ILSlot enabled = HookPrologue.DefineSlot();
+	ILSlot hookId = HookPrologue.DefineSlot();
+	ILSlot payloadArg = HookPrologue.DefineSlot();
+	ILSlot dispatcherMethod = HookPrologue.DefineSlot();
+	ILLabel skip = HookPrologue.DefineLabel();
+
+	HookPrologue.LdcI8(enabled).Op(CEE_CONV_I).Op(CEE_LDIND_I4).Branch(CEE_BRFALSE, skip)
+		.LdcI4(hookId).Ldarg(payloadArg).Call(CEE_CALL, dispatcherMethod, 2, false)
+		.MarkLabel(skip);
+
+	FAIL_CHECK(HookPrologue.Compile(), "Failed to compile hook prologue");
+
+	// if (*enabled) calli CaptureN(hookId, (long)arg0, ...)
+	for (int argCount = 0; argCount <= MAX_CAPTURE_ARGS; argCount++) {
+		for (int unsignedArgs = 0; unsignedArgs < (1 << argCount); unsignedArgs++) {
+			ILTemplate& il = CapturePrologues[argCount][unsignedArgs];
+			ILLabel skipCapture = il.DefineLabel();
+			il.LdcI8(il.DefineSlot()).Op(CEE_CONV_I).Op(CEE_LDIND_I4).Branch(CEE_BRFALSE, skipCapture);
+
+			il.LdcI4(il.DefineSlot());
+			for (int i = 0; i < argCount; i++)
+				il.Ldarg(il.DefineSlot()).Op((unsignedArgs & (1 << i)) ? CEE_CONV_U8 : CEE_CONV_I8);
+
+			ILSlot function = il.DefineSlot();
+			ILSlot signature = il.DefineSlot();
+			il.LdcI8(function).Op(CEE_CONV_I).Call(CEE_CALLI, signature, argCount + 2, false)
+				.MarkLabel(skipCapture);
+
+			FAIL_CHECK(il.Compile(), "Failed to compile inline capture prologue for {} argument(s)", argCount);
+		}
+	}
+	// if (*enabled) start = calli TimingEnter()
+	{
+		ILSlot timingEnabled = TimingEntry.DefineSlot();
+		ILSlot enterFunction = TimingEntry.DefineSlot();
+		ILSlot enterSignature = TimingEntry.DefineSlot();
+		ILSlot start = TimingEntry.DefineSlot();
+		ILLabel skipEntry = TimingEntry.DefineLabel();
+
+		TimingEntry.LdcI8(timingEnabled).Op(CEE_CONV_I).Op(CEE_LDIND_I4).Branch(CEE_BRFALSE, skipEntry)
+			.LdcI8(enterFunction).Op(CEE_CONV_I).Call(CEE_CALLI, enterSignature, 1, true).Stloc(start)
+			.MarkLabel(skipEntry);
+
+		FAIL_CHECK(TimingEntry.Compile(), "Failed to compile timing entry probe");
+	}
+
+	// if (start != 0) calli TimingLeave(hookId, start)
+	{
+		ILSlot start = TimingExit.DefineSlot();
+		ILSlot timedHookId = TimingExit.DefineSlot();
+		ILSlot leaveFunction = TimingExit.DefineSlot();
+		ILSlot leaveSignature = TimingExit.DefineSlot();
+		ILLabel skipExit = TimingExit.DefineLabel();
+
+		TimingExit.Ldloc(start).Branch(CEE_BRFALSE, skipExit)
+			.LdcI4(timedHookId).Ldloc(start).LdcI8(leaveFunction).Op(CEE_CONV_I).Call(CEE_CALLI, leaveSignature, 3, false)
+			.MarkLabel(skipExit);
+
+		FAIL_CHECK(TimingExit.Compile(), "Failed to compile timing exit probe");
+	}
+
+	// if (start != 0 && (start = calli LockLeave(hookId, start)) != 0) calli LockContended(hookId, start, RuntimeHelpers.GetHashCode(lockObject)).
+	// LockLeave hands back the ticks waited if the wait was contended, so only those pay for hashing the lock. The hash code
+	// stays the same when the GC moves the object, unlike its address
+	{
+		ILSlot start = LockWaitExit.DefineSlot();
+		ILSlot lockHookId = LockWaitExit.DefineSlot();
+		ILSlot lockArg = LockWaitExit.DefineSlot();
+		ILSlot lockIdentity = LockWaitExit.DefineSlot();
+		ILSlot leaveFunction = LockWaitExit.DefineSlot();
+		ILSlot leaveSignature = LockWaitExit.DefineSlot();
+		ILSlot contendedFunction = LockWaitExit.DefineSlot();
+		ILSlot contendedSignature = LockWaitExit.DefineSlot();
+		ILLabel skipExit = LockWaitExit.DefineLabel();
+
+		LockWaitExit.Ldloc(start).Branch(CEE_BRFALSE, skipExit)
+			.LdcI4(lockHookId).Ldloc(start).LdcI8(leaveFunction).Op(CEE_CONV_I).Call(CEE_CALLI, leaveSignature, 3, true).Stloc(start)
+			.Ldloc(start).Branch(CEE_BRFALSE, skipExit)
+			.LdcI4(lockHookId).Ldloc(start).Ldarg(lockArg).Call(CEE_CALL, lockIdentity, 1, true)
+			.LdcI8(contendedFunction).Op(CEE_CONV_I).Call(CEE_CALLI, contendedSignature, 4, false)
+			.MarkLabel(skipExit);
+
+		FAIL_CHECK(LockWaitExit.Compile(), "Failed to compile lock wait exit probe");
+	}
+
+	FAIL_CHECK(InjectionPlan::CompileTemplates(), "Failed to compile dispatcher template");
+
+	return S_OK;
+}
+
+/// <summary>
+/// Setup the signature for Assembly.Load(byte[]). This will be used to resolve the method later on
+/// Take special care to ensure the parameters and return types are correct
+/// </summary>
+/// <param name="pImport"></param>
+/// <returns></returns>
+static HRESULT BuildAssemblyLoadSignature(IMetaDataImport* pImport, std::vector<COR_SIGNATURE>& signature) {
+	mdTypeDef typeDef;
+
+	BYTE compressedToken[4];
+	FAIL_CHECK(pImport->FindTypeDefByName(WSTR("System.Reflection.Assembly"), mdTypeDefNil, &typeDef), "Failed to find class 'System.Reflection.Assembly'");
+
+	ULONG tokenLen = CorSigCompressToken(typeDef, compressedToken);
+
+	signature = {
+		IMAGE_CEE_CS_CALLCONV_DEFAULT, // Calling convention (DEFAULT = static)
+		1,                             // 1 parameter
+		ELEMENT_TYPE_CLASS,            // Return type - Class
 	};
-	
-	mdSignature tkLocalSig = mdTokenNil;
-	FAIL_CHECK(pEmit->GetTokenFromSig(localSig.data(), (ULONG)localSig.size(), &tkLocalSig), "Failed in create local sig");
-
-	/*------Method Vars------*/
-	ILRewriter rewriter(ClrBridge, NULL, ModuleId, managedHelperMethod);
-	rewriter.Initialize(tkLocalSig);
-
-	ILInstr* pFirstOriginalInstr = rewriter.GetILList()->m_pNext;
-	ILInstr* tgt_IL_000C = rewriter.NewILInstr();
-	ILInstr* tgt_IL_0011 = rewriter.NewILInstr();
-	ILInstr* tgt_IL_001A = rewriter.NewILInstr();
-
-	// 0000: nop
-	ILInstr* IL_0000 = rewriter.NewILInstr();
-	IL_0000->m_opcode = CEE_NOP;
-	rewriter.InsertBefore(pFirstOriginalInstr, IL_0000);
-
-	// 0001: nop
-	ILInstr* IL_0001 = rewriter.NewILInstr();
-	IL_0001->m_opcode = CEE_NOP;
-	rewriter.InsertBefore(pFirstOriginalInstr, IL_0001);
-
-	// 0002: ldarg.0
-	ILInstr* IL_0002 = rewriter.NewILInstr();
-	IL_0002->m_opcode = CEE_LDARG_0;
-	rewriter.InsertBefore(pFirstOriginalInstr, IL_0002);
-
-	// 0003: dup
-	ILInstr* IL_0003 = rewriter.NewILInstr();
-	IL_0003->m_opcode = CEE_DUP;
-	rewriter.InsertBefore(pFirstOriginalInstr, IL_0003);
-
-	// 0004: stloc.1
-	ILInstr* IL_0004 = rewriter.NewILInstr();
-	IL_0004->m_opcode = CEE_STLOC_1;
-	rewriter.InsertBefore(pFirstOriginalInstr, IL_0004);
-
-	// 0005: brfalse.s IL_000C: ldc.i4.0
-	ILInstr* IL_0005 = rewriter.NewILInstr();
-	IL_0005->m_opcode = CEE_BRFALSE_S;
-	IL_0005->m_pTarget = tgt_IL_000C;
-	rewriter.InsertBefore(pFirstOriginalInstr, IL_0005);
-
-	// 0007: ldloc.1
-	ILInstr* IL_0007 = rewriter.NewILInstr();
-	IL_0007->m_opcode = CEE_LDLOC_1;
-	rewriter.InsertBefore(pFirstOriginalInstr, IL_0007);
-
-	// 0008: ldlen
-	ILInstr* IL_0008 = rewriter.NewILInstr();
-	IL_0008->m_opcode = CEE_LDLEN;
-	rewriter.InsertBefore(pFirstOriginalInstr, IL_0008);
-
-	// 0009: conv.i4
-	ILInstr* IL_0009 = rewriter.NewILInstr();
-	IL_0009->m_opcode = CEE_CONV_I4;
-	rewriter.InsertBefore(pFirstOriginalInstr, IL_0009);
-
-	// 000A: brtrue.s IL_0011: ldloc.1
-	ILInstr* IL_000A = rewriter.NewILInstr();
-	IL_000A->m_opcode = CEE_BRTRUE_S;
-	IL_000A->m_pTarget = tgt_IL_0011;
-	rewriter.InsertBefore(pFirstOriginalInstr, IL_000A);
-
-	// 000C: ldc.i4.0
-	tgt_IL_000C->m_opcode = CEE_LDC_I4_0;
-	rewriter.InsertBefore(pFirstOriginalInstr, tgt_IL_000C);
-
-	// 000D: conv.u
-	ILInstr* IL_000D = rewriter.NewILInstr();
-	IL_000D->m_opcode = CEE_CONV_U;
-	rewriter.InsertBefore(pFirstOriginalInstr, IL_000D);
-
-	// 000E: stloc.0
-	ILInstr* IL_000E = rewriter.NewILInstr();
-	IL_000E->m_opcode = CEE_STLOC_0;
-	rewriter.InsertBefore(pFirstOriginalInstr, IL_000E);
-
-	// 000F: br.s IL_001A: nop
-	ILInstr* IL_000F = rewriter.NewILInstr();
-	IL_000F->m_opcode = CEE_BR_S;
-	IL_000F->m_pTarget = tgt_IL_001A;
-	rewriter.InsertBefore(pFirstOriginalInstr, IL_000F);
-
-	// 0011: ldloc.1
-	tgt_IL_0011->m_opcode = CEE_LDLOC_1;
-	rewriter.InsertBefore(pFirstOriginalInstr, tgt_IL_0011);
-
-	// 0012: ldc.i4.0
-	ILInstr* IL_0012 = rewriter.NewILInstr();
-	IL_0012->m_opcode = CEE_LDC_I4_0;
-	rewriter.InsertBefore(pFirstOriginalInstr, IL_0012);
-
-	// 0013: ldelema System.Byte
-	ILInstr* IL_0013 = rewriter.NewILInstr();
-	IL_0013->m_opcode = CEE_LDELEMA;
-	IL_0013->m_Arg32 = tdBytes; // TypeRef System.Byte
-	rewriter.InsertBefore(pFirstOriginalInstr, IL_0013);
-
-	// 0018: conv.u
-	ILInstr* IL_0018 = rewriter.NewILInstr();
-	IL_0018->m_opcode = CEE_CONV_U;
-	rewriter.InsertBefore(pFirstOriginalInstr, IL_0018);
-
-	// 0019: stloc.0
-	ILInstr* IL_0019 = rewriter.NewILInstr();
-	IL_0019->m_opcode = CEE_STLOC_0;
-	rewriter.InsertBefore(pFirstOriginalInstr, IL_0019);
-
-	// 001A: nop
-	tgt_IL_001A->m_opcode = CEE_NOP;
-	rewriter.InsertBefore(pFirstOriginalInstr, tgt_IL_001A);
-
-	// 001B: ldloc.0
-	ILInstr* IL_001B = rewriter.NewILInstr();
-	IL_001B->m_opcode = CEE_LDLOC_0;
-	rewriter.InsertBefore(pFirstOriginalInstr, IL_001B);
-
-	// 001C: ldarg.0
-	ILInstr* IL_001C = rewriter.NewILInstr();
-	IL_001C->m_opcode = CEE_LDARG_0;
-	rewriter.InsertBefore(pFirstOriginalInstr, IL_001C);
-
-	// 001D: ldlen
-	ILInstr* IL_001D = rewriter.NewILInstr();
-	IL_001D->m_opcode = CEE_LDLEN;
-	rewriter.InsertBefore(pFirstOriginalInstr, IL_001D);
-
-	// 001E: conv.i4
-	ILInstr* IL_001E = rewriter.NewILInstr();
-	IL_001E->m_opcode = CEE_CONV_I4;
-	rewriter.InsertBefore(pFirstOriginalInstr, IL_001E);
-
-	// 001F: call System.Void ZeroedMethods::AssemblyLoadHook(System.Byte*,System.Int32)
-	ILInstr* IL_001F = rewriter.NewILInstr();
-	IL_001F->m_opcode = CEE_CALL;
-	IL_001F->m_Arg32 = pInvokeMethod; // MethodDef System.Void ZeroedMethods::AssemblyLoadHook(System.Byte*,System.Int32)
-	rewriter.InsertBefore(pFirstOriginalInstr, IL_001F);
-
-	// 0024: nop
-	ILInstr* IL_0024 = rewriter.NewILInstr();
-	IL_0024->m_opcode = CEE_NOP;
-	rewriter.InsertBefore(pFirstOriginalInstr, IL_0024);
-
-	// 0025: nop
-	ILInstr* IL_0025 = rewriter.NewILInstr();
-	IL_0025->m_opcode = CEE_NOP;
-	rewriter.InsertBefore(pFirstOriginalInstr, IL_0025);
-
-	// 0026: ldnull
-	ILInstr* IL_0026 = rewriter.NewILInstr();
-	IL_0026->m_opcode = CEE_LDNULL;
-	rewriter.InsertBefore(pFirstOriginalInstr, IL_0026);
-
-	// 0027: stloc.1
-	ILInstr* IL_0027 = rewriter.NewILInstr();
-	IL_0027->m_opcode = CEE_STLOC_1;
-	rewriter.InsertBefore(pFirstOriginalInstr, IL_0027);
-
-	// 0028: nop
-	ILInstr* IL_0028 = rewriter.NewILInstr();
-	IL_0028->m_opcode = CEE_NOP;
-	rewriter.InsertBefore(pFirstOriginalInstr, IL_0028);
 
-	// 0029: ret
-	ILInstr* IL_0029 = rewriter.NewILInstr();
-	IL_0029->m_opcode = CEE_RET;
-	rewriter.InsertBefore(pFirstOriginalInstr, IL_0029);
-
-	FAIL_CHECK(rewriter.Export(), "Failed to export IL");
+	signature.insert(signature.end(), compressedToken, compressedToken + tokenLen);
+	signature.push_back(ELEMENT_TYPE_SZARRAY);// parameter type: byte[]
+	signature.push_back(ELEMENT_TYPE_U1);     // array element type = byte
+
+	return S_OK;
+}
 
+// Monitor.Enter(object, ref bool), which the C# lock statement calls
+static HRESULT BuildMonitorEnterSignature(IMetaDataImport* pImport, std::vector<COR_SIGNATURE>& signature) {
+	signature = {
+		IMAGE_CEE_CS_CALLCONV_DEFAULT, // Static
+		2,                             // 2 parameters
+		ELEMENT_TYPE_VOID,             // No return
+		ELEMENT_TYPE_OBJECT,           // object obj
+		ELEMENT_TYPE_BYREF,            // ref bool lockTaken
+		ELEMENT_TYPE_BOOLEAN,
+	};
 	return S_OK;
 }
 
+// Monitor.TryEnter(object, int, ref bool), which the other TryEnter overloads taking a timeout in milliseconds call
+static HRESULT BuildMonitorTryEnterSignature(IMetaDataImport* pImport, std::vector<COR_SIGNATURE>& signature) {
+	signature = {
+		IMAGE_CEE_CS_CALLCONV_DEFAULT, // Static
+		3,                             // 3 parameters
+		ELEMENT_TYPE_VOID,             // No return
+		ELEMENT_TYPE_OBJECT,           // object obj
+		ELEMENT_TYPE_I4,               // int millisecondsTimeout
+		ELEMENT_TYPE_BYREF,            // ref bool lockTaken
+		ELEMENT_TYPE_BOOLEAN,
+	};
+	return S_OK;
+}
 
-
-extern "C" void STDAPICALLTYPE AssemblyLoadHook(byte* rawAssembly, int assemblyLength)
+static void STDMETHODCALLTYPE AssemblyLoadHook(int hookId, BYTE* rawAssembly, int assemblyLength)
 {
 	std::ostringstream oss;
 	for (int i = 0; i < assemblyLength; ++i) {
 		oss << std::hex << std::setw(2) << std::setfill('0') << static_cast<int>(rawAssembly[i]);
 	}
 	spdlog::info("[AssembyLoad] Bytes: {}", oss.str());
-}
\ No newline at end of file
+}
+
+/// <summary>
+/// Register every hook the profiler should install. A hook's index is its ID, which the injected dispatcher
+/// passes back to ZeroedDispatch to select the native callback
+/// </summary>
+void ZeroedProfiler::RegisterHooks(const std::string& hookConfig)
+{
+	Hooks.clear();
+	ResetHookCallbacks();
+
+#ifdef _WIN32
+	WSTRING coreLibrary = WSTR("mscorlib.dll");
+#else
+	// CoreCLR only ships mscorlib as a facade, Assembly and Monitor are defined in CoreLib
+	WSTRING coreLibrary = WSTR("System.Private.CoreLib.dll");
+#endif
+
+	HookDefinition assemblyLoad;
+	assemblyLoad.TargetModule = coreLibrary;
+	assemblyLoad.TargetClass = WSTR("System.Reflection.Assembly");
+	assemblyLoad.TargetMethod = WSTR("Load");
+	assemblyLoad.BuildTargetSignature = BuildAssemblyLoadSignature;
+	assemblyLoad.Mode = HookMode::Dispatch;
+	assemblyLoad.PayloadArg = 0; // static Load(byte[] rawAssembly)
+	assemblyLoad.Callback = AssemblyLoadHook;
+	assemblyLoad.Timed = false;
+	// Every loaded assembly is dumped, however many load
+	assemblyLoad.AlwaysCaptured = true;
+	Hooks.push_back(assemblyLoad);
+
+	// Monitor.Exit and Monitor.Enter(object) are implemented by the runtime and have no IL to hook
+	if (TrackLocks) {
+		const std::pair<LPCWSTR, TargetSignatureBuilder> lockMethods[] = {
+			{ WSTR("Enter"), BuildMonitorEnterSignature },
+			{ WSTR("TryEnter"), BuildMonitorTryEnterSignature },
+		};
+		for (const auto& method : lockMethods) {
+			HookDefinition lockWait;
+			lockWait.TargetModule = coreLibrary;
+			lockWait.TargetClass = WSTR("System.Threading.Monitor");
+			lockWait.TargetMethod = method.first;
+			lockWait.BuildTargetSignature = method.second;
+			lockWait.Mode = HookMode::LockWait;
+			lockWait.PayloadArg = 0; // object obj
+			lockWait.Callback = nullptr;
+			lockWait.Timed = false;
+			lockWait.AlwaysCaptured = false;
+			Hooks.push_back(lockWait);
+		}
+	}
+
+	if (!hookConfig.empty() && FAILED(ParseHookConfig(hookConfig, Hooks)))
+		spdlog::error("Ignoring remaining hooks in \"{}\"", hookConfig);
+
+	// Hook IDs index the dispatch and enable tables, so anything past them couldn't be switched on or off
+	if (Hooks.size() > MAX_HOOKS) {
+		spdlog::error("At most {} hooks are supported including the built in ones, ignoring the last {}", MAX_HOOKS, Hooks.size() - MAX_HOOKS);
+		Hooks.erase(Hooks.begin() + MAX_HOOKS, Hooks.end());
+	}
+
+	for (size_t i = 0; i < Hooks.size(); i++) {
+		spdlog::info("Hook {} targets {}.{}", i, WideToUtf8(Hooks[i].TargetClass), WideToUtf8(Hooks[i].TargetMethod));
+
+		if (Hooks[i].Mode != HookMode::Dispatch)
+			continue;
+
+		if (!RegisterHookCallback((int)i, Hooks[i].Callback))
+			spdlog::error("Failed to register callback for {}.{}", WideToUtf8(Hooks[i].TargetClass), WideToUtf8(Hooks[i].TargetMethod));
+	}
+}
@@ -4,14 +4,29 @@
 #include "COMPtrHolder.h"
 #include "stdafx.h"
 #include "ilrewriter.h"
+#include "HookDefinition.h"
+#include "ILTemplate.h"
+#include "ReJitQueue.h"
+#include "ControlChannel.h"
+#include "StackSampler.h"
+#include "ShardedMap.h"
 #include <atomic>
 #include <string>
-#include <map>
+#include <mutex>
+#include <vector>
 
 // {681AD446-325F-4C07-9BF8-6A199302F62A}
 const CLSID CLSID_ZeroedProfiler =
 { 0x681ad446, 0x325f, 0x4c07, { 0x9b, 0xf8, 0x6a, 0x19, 0x93, 0x2, 0xf6, 0x2a } };
 
+// Set to 1 to apply hooks on first JIT with NGEN/ReadyToRun images disabled rather than through ReJIT
+#define DISABLE_NGEN_VARIABLE "ZEROED_PROFILER_DISABLE_NGEN"
+
+// How long threads already inside a hook are given to return before the profiler is unloaded
+#define DETACH_DRAIN_MS 500
+// Passed to RequestProfilerDetach as the expected time for managed code to leave profiler callbacks
+#define DETACH_TIMEOUT_MS 5000
+
 
 class ZeroedProfiler : public BaseProfiler
 {
@@ -27,63 +42,108 @@ public:
     // ICorProfilerCallback
     HRESULT STDMETHODCALLTYPE Initialize(IUnknown* pICorProfilerInfoUnk) override;
     HRESULT STDMETHODCALLTYPE Shutdown() override;
+    HRESULT STDMETHODCALLTYPE InitializeForAttach(IUnknown* pCorProfilerInfoUnk, void* pvClientData, UINT cbClientData) override;
+    HRESULT STDMETHODCALLTYPE ProfilerAttachComplete() override;
+    HRESULT STDMETHODCALLTYPE ProfilerDetachSucceeded() override;
 
-    //HRESULT STDMETHODCALLTYPE AssemblyLoadStarted(AssemblyID assemblyId) override;
-    //HRESULT STDMETHODCALLTYPE AssemblyLoadFinished(AssemblyID assemblyId, HRESULT hrStatus) override;
+    HRESULT STDMETHODCALLTYPE AssemblyLoadStarted(AssemblyID assemblyId) override;
+    HRESULT STDMETHODCALLTYPE AssemblyLoadFinished(AssemblyID assemblyId, HRESULT hrStatus) override;
+    HRESULT STDMETHODCALLTYPE ModuleLoadStarted(ModuleID moduleId) override;
     HRESULT STDMETHODCALLTYPE ModuleLoadFinished(ModuleID moduleId, HRESULT hrStatus) override;
+    HRESULT STDMETHODCALLTYPE ModuleUnloadStarted(ModuleID moduleId) override;
+    HRESULT STDMETHODCALLTYPE ThreadCreated(ThreadID threadId) override;
+    HRESULT STDMETHODCALLTYPE ThreadDestroyed(ThreadID threadId) override;
     HRESULT STDMETHODCALLTYPE JITCompilationStarted(FunctionID functionId, BOOL fIsSafeToBlock) override;
-    //HRESULT STDMETHODCALLTYPE GetReJITParameters(ModuleID moduleId, mdMethodDef methodId, ICorProfilerFunctionControl* pFunctionControl) override;
+    HRESULT STDMETHODCALLTYPE JITCompilationFinished(FunctionID functionId, HRESULT hrStatus, BOOL fIsSafeToBlock) override;
+    HRESULT STDMETHODCALLTYPE JITInlining(FunctionID callerId, FunctionID calleeId, BOOL* pfShouldInline) override;
+    HRESULT STDMETHODCALLTYPE GetReJITParameters(ModuleID moduleId, mdMethodDef methodId, ICorProfilerFunctionControl* pFunctionControl) override;
+    HRESULT STDMETHODCALLTYPE ReJITCompilationStarted(FunctionID functionId, ReJITID rejitId, BOOL fIsSafeToBlock) override;
+    HRESULT STDMETHODCALLTYPE ReJITCompilationFinished(FunctionID functionId, ReJITID rejitId, HRESULT hrStatus, BOOL fIsSafeToBlock) override;
+    HRESULT STDMETHODCALLTYPE ReJITError(ModuleID moduleId, mdMethodDef methodId, FunctionID functionId, HRESULT hrStatus) override;
+    HRESULT STDMETHODCALLTYPE ExceptionThrown(ObjectID thrownObjectId) override;
+    HRESULT STDMETHODCALLTYPE ExceptionSearchFunctionEnter(FunctionID functionId) override;
+    HRESULT STDMETHODCALLTYPE ExceptionCatcherEnter(FunctionID functionId, ObjectID objectId) override;
+    HRESULT STDMETHODCALLTYPE ObjectAllocated(ObjectID objectId, ClassID classId) override;
+    HRESULT STDMETHODCALLTYPE RuntimeSuspendStarted(COR_PRF_SUSPEND_REASON suspendReason) override;
+    HRESULT STDMETHODCALLTYPE RuntimeResumeFinished() override;
+    HRESULT STDMETHODCALLTYPE GarbageCollectionStarted(int cGenerations, BOOL generationCollected[], COR_PRF_GC_REASON reason) override;
+    HRESULT STDMETHODCALLTYPE GarbageCollectionFinished() override;
+    HRESULT STDMETHODCALLTYPE SurvivingReferences(ULONG cSurvivingObjectIDRanges, ObjectID objectIDRangeStart[], ULONG cObjectIDRangeLength[]) override;
+    HRESULT STDMETHODCALLTYPE SurvivingReferences2(ULONG cSurvivingObjectIDRanges, ObjectID objectIDRangeStart[], SIZE_T cObjectIDRangeLength[]) override;
+    HRESULT STDMETHODCALLTYPE MovedReferences(ULONG cMovedObjectIDRanges, ObjectID oldObjectIDRangeStart[], ObjectID newObjectIDRangeStart[], ULONG cObjectIDRangeLength[]) override;
+    HRESULT STDMETHODCALLTYPE MovedReferences2(ULONG cMovedObjectIDRanges, ObjectID oldObjectIDRangeStart[], ObjectID newObjectIDRangeStart[], SIZE_T cObjectIDRangeLength[]) override;
 
     std::atomic<ULONG> m_refCount;
     ICorProfilerInfo4* ClrBridge = nullptr;
 
-    LPCWSTR TargetModule = L"mscorlib.dll";
-    LPCWSTR TargetClass = L"System.Reflection.Assembly";
-    LPCWSTR TargetMethod = L"Load";
-    LPCWSTR TypeName = L"ZeroedProfilerType";
-    LPCWSTR ModuleName = L"ZeroedProfiler";
-    short numArgsToLog = 1;
-    bool targetMethodIsStatic = true;
-
-    // The name of the managed method to be injected into the adopted type
-    LPCWSTR ManagedHelperName = L"AssemblyLoadManagedHelper";
-    // The name of the callback function in the target dll
-    LPCWSTR CallbackMethodName = L"AssemblyLoadHook";
-
-    // Contains a reference to module hooked by this class
-    ModuleID ModuleId = 0;
-    mdMethodDef pInvokeMethod = mdMethodDefNil;
-    mdMethodDef managedHelperMethod = mdMethodDefNil;
-    // The method def of the method being hooked
-    mdMethodDef targetMethodDef = mdMethodDefNil;
-
-    /*
-    *  [DllImport("ZeroedProfiler"), CallingConvention = CallingConvention.StdCall)]
-    *  public static extern void SystemReflectionAssemblyLoadCallback(byte* data, int size);
-    */
-    std::vector<COR_SIGNATURE> pInvokeSignature = {
-        IMAGE_CEE_CS_CALLCONV_DEFAULT,     // Calling convention (DEFAULT = static)
-        2,                                 // 2 inputs
-        ELEMENT_TYPE_VOID,                 // No return
-        ELEMENT_TYPE_PTR, ELEMENT_TYPE_U1, // Byte array pointer,
-        ELEMENT_TYPE_I4                    // Byte array length
-    };
-
-    std::vector<COR_SIGNATURE> managedHelperSignature = {
-        IMAGE_CEE_CS_CALLCONV_DEFAULT,        // Calling convention (DEFAULT = static)
-        1,                                    // 1 inputs
-        ELEMENT_TYPE_VOID,                    // No return
-        ELEMENT_TYPE_SZARRAY, ELEMENT_TYPE_U1 // Byte array
-    };
-
-    std::vector<COR_SIGNATURE> targetMethodSignature;
+    LPCWSTR TypeName = WSTR("ZeroedProfilerType");
+    LPCWSTR ModuleName = WSTR("ZeroedProfiler");
+
+    // Run the ILRewriter peephole pass over rewritten methods before handing them back to the CLR
+    bool OptimizeIL = true;
+
+    // Rewrite hooked methods as they're first JITted, which requires disabling every NGEN/ReadyToRun image in the process.
+    // By default hooks are applied through ReJIT instead so precompiled code stays in use for everything we don't hook
+    bool DisableNgen = false;
+    ReJitQueue ReJitRequests;
+
+    // Switches hooks on and off at runtime when CONTROL_FILE_VARIABLE is set, or after attaching
+    ControlChannel Control;
+
+    // Samples managed stacks when SAMPLE_FILE_VARIABLE is set
+    StackSampler Sampler;
+
+    // Samples allocations when ALLOCATION_FILE_VARIABLE is set at startup. Like disabling NGEN this needs an event flag
+    // which can't be cleared, so the profiler can't detach
+    bool SampleAllocations = false;
+
+    // Tracks where exceptions are thrown and caught when EXCEPTION_FILE_VARIABLE is set
+    bool TrackExceptions = false;
+
+    // Installs the built-in Monitor hooks and measures lock waits when LOCK_FILE_VARIABLE is set
+    bool TrackLocks = false;
+
+    // Set once a detach starts so modules loading in the meantime aren't instrumented
+    std::atomic<bool> Detaching{ false };
+
+    // JIT and ReJIT callbacks arrive on many threads at once and share no mutable state while rewriting. Hooks and the
+    // templates below are built in Start before any callbacks are enabled and are read-only afterwards, each rewrite
+    // has its own ILRewriter, and InstalledHooks locks each shard for reading
+
+    // Every hook the profiler knows about. Hooks are matched against modules as they load and the
+    // matching subset is injected through a single InjectionPlan per module
+    std::vector<HookDefinition> Hooks;
+
+    // Hooks installed into each module, keyed by the module they were injected into. Every module we've injected into
+    // has an entry until it unloads, even if none of its targets could be resolved. Modules loading on different threads
+    // only contend when they share a shard, and lookups from JIT callbacks only wait for writers to the same shard
+    ShardedMap<ModuleID, std::vector<InstalledHook>> InstalledHooks;
+
+    // Call to the dispatcher spliced into every hooked method, skipped while the hook is disabled.
+    // Slots are the hook's enable flag, hook ID, payload argument and dispatcher method
+    ILTemplate HookPrologue;
+
+    // calli to the native capture function spliced into inline capture hooks, skipped while the hook is disabled.
+    // Indexed by the number of arguments captured, then by which of them are unsigned and widened with conv.u8
+    ILTemplate CapturePrologues[MAX_CAPTURE_ARGS + 1][1 << MAX_CAPTURE_ARGS];
+
+    // Timing probes for timed hooks. The entry probe stores a start timestamp in a local added to the method while the hook
+    // is enabled, and the exit probe in front of every ret records the call if the local was set.
+    // Slots are the enable flag, entry function, its calli signature and the local
+    ILTemplate TimingEntry;
+    // Slots are the local, hook ID, exit function and its calli signature
+    ILTemplate TimingExit;
+    // Exit probe of LockWait hooks, which share the entry probe. Slots are the local, hook ID, lock argument,
+    // RuntimeHelpers.GetHashCode, the exit and contended functions and their calli signatures
+    ILTemplate LockWaitExit;
 
 private:
-    HRESULT SetupTargetMethodSignature(IMetaDataImport* pImport);
-    HRESULT DefineCustomType(ModuleID moduleId, mdTypeDef* tdInjectedType, IMetaDataEmit* pEmit, IMetaDataImport* pImport);
-    HRESULT GetTargetMethodToken(mdMethodDef* mdTarget, IMetaDataEmit* pEmit, IMetaDataImport* pImport);
-    HRESULT AddPInvoke(mdTypeDef td, mdModuleRef modrefTarget, IMetaDataEmit* pEmit);
-    HRESULT AddManagedHookMethod(mdTypeDef td, IMetaDataEmit* pEmit, IMetaDataImport* pImport);
-    HRESULT SetILForHookMethod(IMetaDataEmit* pEmit, IMetaDataImport* pImport);
-    HRESULT RewriteIL(ModuleID moduleID, mdMethodDef methodDef);
+    HRESULT Start(IUnknown* pICorProfilerInfoUnk, const std::string& hookConfig, const std::string& controlFile, bool attaching);
+    bool Detach();
+    HRESULT InstrumentModule(ModuleID moduleId);
+    void RegisterHooks(const std::string& hookConfig);
+    HRESULT CompileTemplates();
+    bool FindInstalledHook(ModuleID moduleID, mdMethodDef methodDef, InstalledHook& hook);
+    HRESULT RewriteIL(ModuleID moduleID, const InstalledHook& hook, ICorProfilerFunctionControl* pFunctionControl);
+    HRESULT InjectTiming(ILRewriter& rewriter, const InstalledHook& hook, ILInstr* pBody);
 };
\ No newline at end of file
@@ -0,0 +1,68 @@
+using System;
+using System.Diagnostics;
+using System.Runtime.CompilerServices;
+
+namespace ZeroedAllocation
+{
+    public sealed class Node
+    {
+        public int Value;
+        public Node Next;
+    }
+
+    public static class Program
+    {
+        private const int WarmupIterations = 1_000_000;
+        private const int Rounds = 5;
+
+        // Objects kept alive between iterations so collections have survivors to promote, as a real heap would
+        private const int Survivors = 4096;
+
+        public static int Main(string[] args)
+        {
+            int iterations = args.Length > 0 ? int.Parse(args[0]) : 20_000_000;
+            object[] survivors = new object[Survivors];
+
+            // Run long enough for tiered compilation to promote the loop before timing it
+            Allocate(WarmupIterations, survivors);
+
+            // The fastest round is the one least disturbed by the rest of the machine
+            double best = double.MaxValue;
+            long checksum = 0;
+            for (int round = 0; round < Rounds; round++) {
+                Stopwatch stopwatch = Stopwatch.StartNew();
+                checksum = Allocate(iterations, survivors);
+                stopwatch.Stop();
+                best = Math.Min(best, stopwatch.Elapsed.TotalMilliseconds * 1_000_000.0 / iterations);
+            }
+
+            Console.WriteLine($"{best:F2} ns/iteration (checksum {checksum}, {GC.CollectionCount(0)} gen 0 collections)");
+            return 0;
+        }
+
+        // Each iteration allocates a small object, a small array and a string, and every 64th a 4 KiB buffer, so the mix
+        // has many more objects than bytes in small allocations and the other way round in large ones
+        [MethodImpl(MethodImplOptions.NoInlining)]
+        private static long Allocate(int iterations, object[] survivors)
+        {
+            long sum = 0;
+            Node previous = null;
+            for (int i = 0; i < iterations; i++) {
+                Node node = new Node { Value = i, Next = previous };
+                int[] values = new int[8];
+                values[i & 7] = i;
+                string text = (i & 1023).ToString();
+                sum += node.Value + values[i & 7] + text.Length;
+
+                if ((i & 63) == 0) {
+                    byte[] buffer = new byte[4096];
+                    buffer[i & 4095] = 1;
+                    survivors[(i >> 6) & (Survivors - 1)] = buffer;
+                }
+
+                previous = (i & 15) == 0 ? null : node;
+            }
+            return sum;
+        }
+    }
+}
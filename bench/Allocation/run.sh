@@ -0,0 +1,43 @@
+#!/bin/sh
+# Usage: run.sh <path to built profiler library> [iterations]
+# Measures an allocation heavy loop without the profiler, under the profiler and under the profiler sampling allocations,
+# then prints the cost of sampling. Sampling turns on the ObjectAllocated callback, which sends every allocation down the
+# runtime's slower path whether or not it's sampled, so this is the overhead the native benchmarks can't show.
+set -e
+
+if [ -z "$1" ]; then
+    echo "usage: $0 <profiler library> [iterations]" >&2
+    exit 1
+fi
+
+PROFILER="$1"
+ITERATIONS="${2:-20000000}"
+
+cd "$(dirname "$0")"
+dotnet publish -c Release -o out >/dev/null
+
+REPORT="$(mktemp)"
+trap 'rm -f "$REPORT"' EXIT
+
+# Prints the nanoseconds per iteration of the fastest round
+measure() {
+    ./out/ZeroedAllocation "$ITERATIONS" | awk '/ns\/iteration/ { print $1 }'
+}
+
+NONE=$(measure)
+echo "No profiler:                $NONE ns/iteration"
+
+export CORECLR_ENABLE_PROFILING=1
+export CORECLR_PROFILER="{681AD446-325F-4C07-9BF8-6A199302F62A}"
+export CORECLR_PROFILER_PATH="$PROFILER"
+
+PROFILED=$(measure)
+echo "Profiler:                   $PROFILED ns/iteration"
+
+export ZEROED_PROFILER_ALLOCATION_FILE="$REPORT"
+SAMPLED=$(measure)
+echo "Profiler, sampling allocs:  $SAMPLED ns/iteration"
+
+awk -v profiled="$PROFILED" -v sampled="$SAMPLED" 'BEGIN {
+    printf "Sampling overhead: %.2fx (%+.1f%%)\n", sampled / profiled, (sampled / profiled - 1) * 100
+}'
@@ -0,0 +1,36 @@
+using System;
+using System.Diagnostics;
+using System.Runtime.CompilerServices;
+
+namespace ZeroedDetach
+{
+    public static class Targets
+    {
+        // Hooked with ZeroedDetach.dll!ZeroedDetach.Targets.Hot(0,1)=inline once the profiler is attached
+        [MethodImpl(MethodImplOptions.NoInlining)]
+        public static int Hot(int value, long scale) => value + (int)scale;
+    }
+
+    // Calls the hot method in a tight loop and prints "<unix ms> <calls per second>" once a second until killed
+    public static class Program
+    {
+        public static void Main()
+        {
+            Stopwatch interval = Stopwatch.StartNew();
+            long calls = 0;
+            long sum = 0;
+
+            for (int i = 0; ; i++)
+            {
+                sum += Targets.Hot(i, 3);
+                if (++calls % 1_000_000 != 0 || interval.ElapsedMilliseconds < 1000)
+                    continue;
+
+                double perSecond = calls / interval.Elapsed.TotalSeconds;
+                Console.WriteLine($"{DateTimeOffset.UtcNow.ToUnixTimeMilliseconds()} {perSecond:F0} {sum & 1}");
+                calls = 0;
+                interval.Restart();
+            }
+        }
+    }
+}
@@ -0,0 +1,61 @@
+#!/bin/sh
+# Usage: run.sh <path to built profiler library> [seconds per phase]
+# Measures the throughput of a hot method before the profiler is attached, while it's attached with the method hooked,
+# and after it has detached and reverted the method.
+set -e
+
+if [ -z "$1" ]; then
+    echo "usage: $0 <profiler library> [seconds per phase]" >&2
+    exit 1
+fi
+
+PROFILER="$1"
+PHASE="${2:-5}"
+HOOKS="ZeroedDetach.dll!ZeroedDetach.Targets.Hot(0,1)=inline"
+
+cd "$(dirname "$0")"
+dotnet publish -c Release -o out >/dev/null
+dotnet build -c Release ../../tools/Attach >/dev/null
+
+now_ms() {
+    echo $(($(date +%s%N) / 1000000))
+}
+
+OUTPUT="$(mktemp)"
+./out/ZeroedDetach > "$OUTPUT" &
+PID=$!
+CONTROL="${TMPDIR:-/tmp}/zeroed-profiler-$PID.control"
+trap 'kill $PID 2>/dev/null; rm -f "$OUTPUT" "$CONTROL"' EXIT
+rm -f "$CONTROL"
+
+# Let tiered compilation settle before the first phase
+sleep 2
+BEFORE=$(now_ms)
+sleep "$PHASE"
+ATTACH_START=$(now_ms)
+
+dotnet run --no-build -c Release --project ../../tools/Attach -- $PID "$PROFILER" "$HOOKS"
+# Give ReJIT a moment to replace the method
+sleep 1
+ATTACHED=$(now_ms)
+sleep "$PHASE"
+DETACH_START=$(now_ms)
+
+echo detach > "$CONTROL"
+# Polling, reverting and the drain delay all happen before the detach completes
+sleep 2
+DETACHED=$(now_ms)
+sleep "$PHASE"
+END=$(now_ms)
+
+# Average the per second samples falling inside each phase
+awk -v before="$BEFORE" -v attachStart="$ATTACH_START" -v attached="$ATTACHED" \
+    -v detachStart="$DETACH_START" -v detached="$DETACHED" -v end="$END" '
+    $1 >= before && $1 < attachStart { b += $2; bn++ }
+    $1 >= attached && $1 < detachStart { a += $2; an++ }
+    $1 >= detached && $1 < end { d += $2; dn++ }
+    END {
+        printf "Before attach: %12.0f calls/s\n", bn ? b / bn : 0
+        printf "Attached:      %12.0f calls/s\n", an ? a / an : 0
+        printf "After detach:  %12.0f calls/s\n", dn ? d / dn : 0
+    }' "$OUTPUT"
@@ -0,0 +1,88 @@
+using System;
+using System.Diagnostics;
+using System.Runtime.CompilerServices;
+
+namespace ZeroedBench
+{
+    // Each hooked target has an identical unhooked twin so the difference between them is the hook's cost
+    public static class Targets
+    {
+        [MethodImpl(MethodImplOptions.NoInlining)]
+        public static int Baseline(int value, long scale) => value + (int)scale;
+
+        // Hooked with ZeroedBench.dll!ZeroedBench.Targets.Capture(0,1)=inline
+        [MethodImpl(MethodImplOptions.NoInlining)]
+        public static int Capture(int value, long scale) => value + (int)scale;
+
+        // Hooked with ZeroedBench.dll!ZeroedBench.Targets.Disabled(0,1)=inline then switched off through the control file
+        [MethodImpl(MethodImplOptions.NoInlining)]
+        public static int Disabled(int value, long scale) => value + (int)scale;
+
+        // Hooked with ZeroedBench.dll!ZeroedBench.Targets.Timed()=timed
+        [MethodImpl(MethodImplOptions.NoInlining)]
+        public static int Timed(int value, long scale) => value + (int)scale;
+
+        [MethodImpl(MethodImplOptions.NoInlining)]
+        public static int PayloadBaseline(byte[] payload) => payload.Length;
+
+        // Hooked with ZeroedBench.dll!ZeroedBench.Targets.Payload(0)=dispatch
+        [MethodImpl(MethodImplOptions.NoInlining)]
+        public static int Payload(byte[] payload) => payload.Length;
+    }
+
+    public static class Program
+    {
+        private const int WarmupIterations = 1_000_000;
+
+        public static int Main(string[] args)
+        {
+            int iterations = args.Length > 0 ? int.Parse(args[0]) : 50_000_000;
+            byte[] payload = new byte[16];
+
+            double baseline = Measure("Baseline(int, long)", iterations, () => Loop(iterations, static (i) => Targets.Baseline(i, 3)));
+            double capture = Measure("Capture(int, long) [inline]", iterations, () => Loop(iterations, static (i) => Targets.Capture(i, 3)));
+            double disabled = Measure("Disabled(int, long) [off]", iterations, () => Loop(iterations, static (i) => Targets.Disabled(i, 3)));
+            double timed = Measure("Timed(int, long) [timed]", iterations, () => Loop(iterations, static (i) => Targets.Timed(i, 3)));
+            double payloadBaseline = Measure("PayloadBaseline(byte[])", iterations, () => LoopPayload(iterations, payload, static (p) => Targets.PayloadBaseline(p)));
+            double dispatch = Measure("Payload(byte[]) [dispatch]", iterations, () => LoopPayload(iterations, payload, static (p) => Targets.Payload(p)));
+
+            Console.WriteLine();
+            Console.WriteLine($"Inline capture overhead: {capture - baseline,8:F2} ns/call");
+            Console.WriteLine($"Dispatch overhead:       {dispatch - payloadBaseline,8:F2} ns/call");
+            Console.WriteLine($"Disabled hook overhead:  {disabled - baseline,8:F2} ns/call");
+            Console.WriteLine($"Timing overhead:         {timed - baseline,8:F2} ns/call");
+            return 0;
+        }
+
+        private static double Measure(string name, int iterations, Func<long> body)
+        {
+            // Run long enough for tiered compilation to promote the targets before timing them
+            for (int i = 0; i < WarmupIterations / iterations + 2; i++)
+                body();
+
+            Stopwatch stopwatch = Stopwatch.StartNew();
+            long checksum = body();
+            stopwatch.Stop();
+
+            double nsPerCall = stopwatch.Elapsed.TotalMilliseconds * 1_000_000.0 / iterations;
+            Console.WriteLine($"{name,-30} {nsPerCall,8:F2} ns/call (checksum {checksum})");
+            return nsPerCall;
+        }
+
+        private static long Loop(int iterations, Func<int, int> target)
+        {
+            long sum = 0;
+            for (int i = 0; i < iterations; i++)
+                sum += target(i);
+            return sum;
+        }
+
+        private static long LoopPayload(int iterations, byte[] payload, Func<byte[], int> target)
+        {
+            long sum = 0;
+            for (int i = 0; i < iterations; i++)
+                sum += target(payload);
+            return sum;
+        }
+    }
+}
@@ -0,0 +1,25 @@
+#!/bin/sh
+# Usage: run.sh <path to built profiler library> [iterations]
+# Runs the hook overhead benchmark under the profiler with an inline capture hook, a dispatch hook, a disabled inline
+# capture hook and a timed hook installed.
+set -e
+
+if [ -z "$1" ]; then
+    echo "usage: $0 <profiler library> [iterations]" >&2
+    exit 1
+fi
+
+cd "$(dirname "$0")"
+
+export CORECLR_ENABLE_PROFILING=1
+export CORECLR_PROFILER="{681AD446-325F-4C07-9BF8-6A199302F62A}"
+export CORECLR_PROFILER_PATH="$1"
+export ZEROED_PROFILER_HOOKS="ZeroedBench.dll!ZeroedBench.Targets.Capture(0,1)=inline;ZeroedBench.dll!ZeroedBench.Targets.Payload(0)=dispatch;ZeroedBench.dll!ZeroedBench.Targets.Disabled(0,1)=inline;ZeroedBench.dll!ZeroedBench.Targets.Timed()=timed"
+export ZEROED_PROFILER_CAPTURE_FILE="${ZEROED_PROFILER_CAPTURE_FILE:-/dev/null}"
+
+# Hook 0 is the built in Assembly.Load hook, the configured hooks follow in order
+export ZEROED_PROFILER_CONTROL_FILE="$(mktemp)"
+echo "3 off" > "$ZEROED_PROFILER_CONTROL_FILE"
+trap 'rm -f "$ZEROED_PROFILER_CONTROL_FILE"' EXIT
+
+dotnet run -c Release -- ${2:-50000000}
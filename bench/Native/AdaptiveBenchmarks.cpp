@@ -0,0 +1,47 @@
+#include "stdafx.h"
+#include "AdaptiveCapture.h"
+#include "CaptureBuffer.h"
+#include <benchmark/benchmark.h>
+
+// What adaptive capture adds to an inline hook's capture call, and what a throttled hook's call costs instead. No capture
+// file is opened, so captured records are discarded when buffers fill
+
+typedef void(STDMETHODCALLTYPE* Capture2Func)(int hookId, INT64 arg0, INT64 arg1);
+
+// A hook under the rate limit, which counts the call and captures it
+static void BM_AdaptiveCapture_Unthrottled(benchmark::State& state)
+{
+	if (state.thread_index() == 0)
+		AdaptiveCapture::Start(1e15, ADAPTIVE_DEFAULT_SAMPLE, {}, {});
+
+	Capture2Func capture = (Capture2Func)CaptureBuffer::GetCaptureFunction(2);
+	INT64 arg = state.thread_index();
+	for (auto _ : state)
+		capture(1, arg, arg);
+
+	if (state.thread_index() == 0)
+		AdaptiveCapture::Stop();
+	state.SetItemsProcessed(state.iterations());
+}
+BENCHMARK(BM_AdaptiveCapture_Unthrottled)->Threads(1)->Threads(4);
+
+// A hook over the rate limit, which captures 1 in the given number of calls and only counts the rest
+static void BM_AdaptiveCapture_Throttled(benchmark::State& state)
+{
+	if (state.thread_index() == 0) {
+		AdaptiveCapture::Start(1, (UINT32)state.range(0), {}, {});
+		for (int i = 0; i < 10; i++)
+			AdaptiveCapture::ShouldCapture(1);
+		AdaptiveCapture::Adjust(1.0);
+	}
+
+	Capture2Func capture = (Capture2Func)CaptureBuffer::GetCaptureFunction(2);
+	INT64 arg = state.thread_index();
+	for (auto _ : state)
+		capture(1, arg, arg);
+
+	if (state.thread_index() == 0)
+		AdaptiveCapture::Stop();
+	state.SetItemsProcessed(state.iterations());
+}
+BENCHMARK(BM_AdaptiveCapture_Throttled)->Arg(100)->Arg(0)->Threads(1)->Threads(4);
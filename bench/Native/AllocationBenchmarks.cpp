@@ -0,0 +1,75 @@
+#include "stdafx.h"
+#include "AllocationSampler.h"
+#include <benchmark/benchmark.h>
+#include <random>
+#include <vector>
+
+// The profiler's share of the ObjectAllocated callback: counting every allocation against the sampling interval, and
+// recording the few that are sampled. No runtime is loaded, so sampled stacks aren't walked and are made up instead
+
+// The per allocation check, at the default interval
+static void BM_AllocationSampler_Count(benchmark::State& state)
+{
+	if (state.thread_index() == 0)
+		AllocationSampler::Start(nullptr, "", ALLOCATION_DEFAULT_INTERVAL_BYTES);
+
+	SIZE_T size = (SIZE_T)state.range(0);
+	for (auto _ : state)
+		benchmark::DoNotOptimize(AllocationSampler::Count(size));
+
+	state.SetItemsProcessed(state.iterations());
+	state.SetBytesProcessed(state.iterations() * size);
+}
+BENCHMARK(BM_AllocationSampler_Count)->Arg(24)->Arg(4096)->Threads(1)->Threads(4);
+
+// Recording a sample into the table, spread over a few hundred existing call sites by every thread at once
+static void BM_AllocationSampler_Record(benchmark::State& state)
+{
+	std::mt19937 random(42);
+	std::vector<std::vector<FunctionID>> stacks(256);
+	for (std::vector<FunctionID>& stack : stacks) {
+		for (int i = 0; i < ALLOCATION_STACK_DEPTH; i++)
+			stack.push_back(0x7000 + random() % 64);
+	}
+
+	size_t next = state.thread_index();
+	for (auto _ : state) {
+		const std::vector<FunctionID>& stack = stacks[next++ % stacks.size()];
+		AllocationSampler::Record(0x100 + next % 8, 64, stack.data(), stack.size());
+	}
+
+	state.SetItemsProcessed(state.iterations());
+}
+BENCHMARK(BM_AllocationSampler_Record)->Threads(1)->Threads(4);
+
+// Everything the profiler adds to a stream of allocations with sizes typical of managed code, including the samples it takes.
+// The interval is passed as the argument
+static void BM_AllocationSampler_Stream(benchmark::State& state)
+{
+	if (state.thread_index() == 0)
+		AllocationSampler::Start(nullptr, "", (UINT64)state.range(0));
+
+	// Mostly small objects with the occasional buffer
+	std::mt19937 random(state.thread_index());
+	std::vector<SIZE_T> sizes(4096);
+	for (SIZE_T& size : sizes)
+		size = random() % 16 == 0 ? 1024 + random() % 8192 : 24 + 8 * (random() % 8);
+
+	FunctionID stack[ALLOCATION_STACK_DEPTH];
+	for (int i = 0; i < ALLOCATION_STACK_DEPTH; i++)
+		stack[i] = 0x9000 + i;
+
+	size_t next = 0;
+	INT64 samples = 0;
+	for (auto _ : state) {
+		SIZE_T size = sizes[next++ % sizes.size()];
+		if (AllocationSampler::Count(size)) {
+			AllocationSampler::Record(0x200 + size % 4, size, stack, ALLOCATION_STACK_DEPTH);
+			samples++;
+		}
+	}
+
+	state.SetItemsProcessed(state.iterations());
+	state.counters["samples"] = benchmark::Counter((double)samples);
+}
+BENCHMARK(BM_AllocationSampler_Stream)->Arg(64 * 1024)->Arg(ALLOCATION_DEFAULT_INTERVAL_BYTES)->Threads(1)->Threads(4);
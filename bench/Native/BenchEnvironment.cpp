@@ -0,0 +1,95 @@
+#include "stdafx.h"
+#include "BenchEnvironment.h"
+#include "HookConfig.h"
+#include "Utils.h"
+#include "ZeroedProfiler.h"
+#include <cstdlib>
+
+// The profiler reads its configuration from the environment when it's initialized
+static void SetVariable(const char* name, const char* value)
+{
+#ifdef _WIN32
+	_putenv_s(name, value);
+#else
+	setenv(name, value, 1);
+#endif
+}
+
+static HRESULT OpenFixture(FixtureRuntime& fixture, bool raiseLoad)
+{
+	std::string path = FixturePath();
+	FAIL_CHECK(fixture.Runtime.OpenModule(path, &fixture.Module), "Failed to open fixture {}, build it with run.sh or set " FIXTURE_PATH_VARIABLE, path);
+	FAIL_CHECK(fixture.Runtime.GetModuleMetaData(fixture.Module, ofRead, IID_IMetaDataImport, (IUnknown**)&fixture.Import), "Failed to open fixture metadata");
+
+	if (raiseLoad)
+		fixture.Runtime.RaiseModuleLoad(fixture.Module);
+
+	return S_OK;
+}
+
+mdMethodDef FixtureRuntime::FindMethod(LPCWSTR typeName, LPCWSTR methodName)
+{
+	WSTRING qualifiedName = WSTR("ZeroedFixture.");
+	qualifiedName += typeName;
+
+	mdTypeDef typeDef;
+	mdMethodDef methodDef;
+	if (FAILED(Import->FindTypeDefByName(qualifiedName.c_str(), mdTokenNil, &typeDef)) ||
+		FAILED(Import->FindMethod(typeDef, methodName, nullptr, 0, &methodDef)))
+		return mdMethodDefNil;
+
+	return methodDef;
+}
+
+std::string FixturePath()
+{
+	const char* path = std::getenv(FIXTURE_PATH_VARIABLE);
+	return path != nullptr ? path : ZEROED_BENCH_DEFAULT_FIXTURE;
+}
+
+FixtureRuntime* GetFixtureRuntime()
+{
+	static FixtureRuntime* s_fixture = []() -> FixtureRuntime* {
+		FixtureRuntime* pFixture = new FixtureRuntime();
+		return SUCCEEDED(OpenFixture(*pFixture, false)) ? pFixture : nullptr;
+	}();
+
+	return s_fixture;
+}
+
+ProfiledRuntime* GetProfiledRuntime(std::string& error)
+{
+	static std::string s_error;
+	static ProfiledRuntime* s_profiled = []() -> ProfiledRuntime* {
+		const char* profilerPath = std::getenv(PROFILER_PATH_VARIABLE);
+		std::string path = profilerPath != nullptr ? profilerPath : ZEROED_BENCH_DEFAULT_PROFILER;
+
+		SetVariable(DISABLE_NGEN_VARIABLE, "1");
+		SetVariable(HOOK_CONFIG_VARIABLE, FIXTURE_HOOKS);
+		// Keep the profiler's per module and per method logging out of the timings unless asked for
+		if (std::getenv("ZEROED_PROFILER_LOG_LEVEL") == nullptr)
+			SetVariable("ZEROED_PROFILER_LOG_LEVEL", "warn");
+
+		IUnknown* pProfiler = nullptr;
+		if (FAILED(MockRuntime::CreateProfiler(path, CLSID_ZeroedProfiler, &pProfiler))) {
+			s_error = "Failed to load the profiler from " + path + ", set " PROFILER_PATH_VARIABLE;
+			return nullptr;
+		}
+
+		ProfiledRuntime* pProfiled = new ProfiledRuntime();
+		HRESULT hr = pProfiled->Runtime.LoadProfiler(pProfiler);
+		if (SUCCEEDED(hr))
+			hr = pProfiler->QueryInterface(IID_ICorProfilerCallback4, (void**)&pProfiled->Callback);
+		pProfiler->Release();
+
+		if (FAILED(hr) || FAILED(OpenFixture(*pProfiled, true))) {
+			s_error = "Failed to load the profiler and fixture into the mock runtime";
+			return nullptr;
+		}
+
+		return pProfiled;
+	}();
+
+	error = s_error;
+	return s_profiled;
+}
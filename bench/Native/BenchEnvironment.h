@@ -0,0 +1,38 @@
+#pragma once
+
+#include "stdafx.h"
+#include "MockRuntime.h"
+#include <string>
+
+// Overrides the fixture assembly the benchmarks read, which defaults to the one built by run.sh
+#define FIXTURE_PATH_VARIABLE "ZEROED_BENCH_FIXTURE"
+#define PROFILER_PATH_VARIABLE "CORECLR_PROFILER_PATH"
+
+// Hooks the profiler is loaded with, one of each mode on methods in ZeroedFixture.Targets
+#define FIXTURE_HOOKS "ZeroedFixture.dll!ZeroedFixture.Targets.Dispatch(0)=dispatch;ZeroedFixture.dll!ZeroedFixture.Targets.Inline(0,1)=inline;ZeroedFixture.dll!ZeroedFixture.Targets.Timed()=timed"
+
+// The fixture assembly opened in a mock runtime with no profiler loaded, for benchmarking the profiler's building blocks
+// against real metadata and IL. Created on first use and shared by every benchmark
+struct FixtureRuntime
+{
+	MockRuntime Runtime;
+	ModuleID Module = 0;
+	IMetaDataImport* Import = nullptr;
+
+	// Looks up a method of a type in the fixture's ZeroedFixture namespace, or returns mdMethodDefNil if there isn't one
+	mdMethodDef FindMethod(LPCWSTR typeName, LPCWSTR methodName);
+};
+
+// The profiler loaded into a mock runtime with FIXTURE_HOOKS installed into the fixture assembly. NGEN is disabled so
+// hooks are applied from JITCompilationStarted
+struct ProfiledRuntime : FixtureRuntime
+{
+	ICorProfilerCallback4* Callback = nullptr;
+};
+
+std::string FixturePath();
+
+// Returns nullptr if the fixture couldn't be loaded
+FixtureRuntime* GetFixtureRuntime();
+// Returns nullptr if the fixture or the profiler couldn't be loaded, with the reason in error
+ProfiledRuntime* GetProfiledRuntime(std::string& error);
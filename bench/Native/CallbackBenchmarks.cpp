@@ -0,0 +1,81 @@
+#include "stdafx.h"
+#include "BenchEnvironment.h"
+#include <benchmark/benchmark.h>
+
+// Each module load benchmark iteration leaves a module behind in the runtime, so the count is kept fixed
+#define MODULE_LOAD_ITERATIONS 200
+
+static ProfiledRuntime* GetProfiledRuntimeOrSkip(benchmark::State& state)
+{
+	std::string error;
+	ProfiledRuntime* pProfiled = GetProfiledRuntime(error);
+	if (pProfiled == nullptr)
+		state.SkipWithError(error.c_str());
+
+	return pProfiled;
+}
+
+// The common case, a method being compiled which isn't the target of any hook
+static void BM_JITCompilationStarted_Reject(benchmark::State& state)
+{
+	ProfiledRuntime* pProfiled = GetProfiledRuntimeOrSkip(state);
+	if (pProfiled == nullptr)
+		return;
+
+	FunctionID functionId;
+	pProfiled->Runtime.GetFunctionFromToken(pProfiled->Module, pProfiled->FindMethod(WSTR("Targets"), WSTR("Unhooked")), &functionId);
+
+	for (auto _ : state)
+		benchmark::DoNotOptimize(pProfiled->Callback->JITCompilationStarted(functionId, TRUE));
+}
+BENCHMARK(BM_JITCompilationStarted_Reject);
+
+// Compiling a hooked method, which rewrites its IL. The original IL is put back between iterations so every iteration
+// hooks the same body
+static void BM_JITCompilationStarted_Accept(benchmark::State& state, LPCWSTR methodName)
+{
+	ProfiledRuntime* pProfiled = GetProfiledRuntimeOrSkip(state);
+	if (pProfiled == nullptr)
+		return;
+
+	mdMethodDef methodDef = pProfiled->FindMethod(WSTR("Targets"), methodName);
+	FunctionID functionId;
+	pProfiled->Runtime.GetFunctionFromToken(pProfiled->Module, methodDef, &functionId);
+
+	for (auto _ : state) {
+		if (FAILED(pProfiled->Callback->JITCompilationStarted(functionId, TRUE))) {
+			state.SkipWithError("JITCompilationStarted failed");
+			break;
+		}
+
+		state.PauseTiming();
+		pProfiled->Runtime.RestoreOriginalIL(pProfiled->Module, methodDef);
+		state.ResumeTiming();
+	}
+}
+BENCHMARK_CAPTURE(BM_JITCompilationStarted_Accept, Dispatch, WSTR("Dispatch"));
+BENCHMARK_CAPTURE(BM_JITCompilationStarted_Accept, Inline, WSTR("Inline"));
+BENCHMARK_CAPTURE(BM_JITCompilationStarted_Accept, Timed, WSTR("Timed"));
+
+// Installing the fixture's hooks as it loads, from reading the module's metadata to emitting the dispatchers. Reading the
+// assembly from disk isn't timed
+static void BM_ModuleLoadFinished(benchmark::State& state)
+{
+	ProfiledRuntime* pProfiled = GetProfiledRuntimeOrSkip(state);
+	if (pProfiled == nullptr)
+		return;
+
+	std::string path = FixturePath();
+	for (auto _ : state) {
+		state.PauseTiming();
+		ModuleID moduleId;
+		HRESULT hr = pProfiled->Runtime.OpenModule(path, &moduleId);
+		state.ResumeTiming();
+
+		if (FAILED(hr) || FAILED(pProfiled->Callback->ModuleLoadFinished(moduleId, S_OK))) {
+			state.SkipWithError("Failed to load the fixture");
+			break;
+		}
+	}
+}
+BENCHMARK(BM_ModuleLoadFinished)->Iterations(MODULE_LOAD_ITERATIONS);
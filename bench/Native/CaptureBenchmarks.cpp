@@ -0,0 +1,72 @@
+#include "stdafx.h"
+#include "CaptureBuffer.h"
+#include "HookConfig.h"
+#include "HookDispatch.h"
+#include <benchmark/benchmark.h>
+
+// No capture file is opened, so full buffers are discarded rather than written and only the hot path is timed
+
+typedef void(STDMETHODCALLTYPE* Capture0Func)(int hookId);
+typedef void(STDMETHODCALLTYPE* Capture1Func)(int hookId, INT64 arg0);
+typedef void(STDMETHODCALLTYPE* Capture2Func)(int hookId, INT64 arg0, INT64 arg1);
+typedef void(STDMETHODCALLTYPE* Capture3Func)(int hookId, INT64 arg0, INT64 arg1, INT64 arg2);
+typedef void(STDMETHODCALLTYPE* Capture4Func)(int hookId, INT64 arg0, INT64 arg1, INT64 arg2, INT64 arg3);
+
+// An inline hook's calli into its capture function, by number of captured arguments
+static void BM_CaptureBuffer_Inline(benchmark::State& state)
+{
+	void* pCapture = CaptureBuffer::GetCaptureFunction((int)state.range(0));
+	INT64 arg = state.thread_index();
+
+	switch (state.range(0)) {
+	case 0:
+		for (auto _ : state)
+			((Capture0Func)pCapture)(1);
+		break;
+	case 1:
+		for (auto _ : state)
+			((Capture1Func)pCapture)(1, arg);
+		break;
+	case 2:
+		for (auto _ : state)
+			((Capture2Func)pCapture)(1, arg, arg);
+		break;
+	case 3:
+		for (auto _ : state)
+			((Capture3Func)pCapture)(1, arg, arg, arg);
+		break;
+	case 4:
+		for (auto _ : state)
+			((Capture4Func)pCapture)(1, arg, arg, arg, arg);
+		break;
+	}
+
+	state.SetItemsProcessed(state.iterations());
+}
+BENCHMARK(BM_CaptureBuffer_Inline)->DenseRange(0, MAX_CAPTURE_ARGS)->Threads(1)->Threads(4);
+
+// Registers the callback the configuration parser assigns dispatch hooks as hook 0
+static bool RegisterDispatchCallback()
+{
+	std::vector<HookDefinition> hooks;
+	return SUCCEEDED(ParseHookConfig("Bench.dll!Bench.Target.Handle(0)=dispatch", hooks)) && !hooks.empty() &&
+		RegisterHookCallback(0, hooks[0].Callback);
+}
+
+// A dispatch hook's P/Invoke, through the jump table to its callback
+static void BM_ZeroedDispatch(benchmark::State& state)
+{
+	// Every thread waits for the first to register before dispatching
+	static const bool s_registered = RegisterDispatchCallback();
+	if (!s_registered) {
+		state.SkipWithError("Failed to register the dispatch callback");
+		return;
+	}
+
+	std::vector<BYTE> payload((size_t)state.range(0), 0x5a);
+	for (auto _ : state)
+		ZeroedDispatch(0, payload.data(), (int)payload.size());
+
+	state.SetItemsProcessed(state.iterations());
+}
+BENCHMARK(BM_ZeroedDispatch)->Arg(64)->Threads(1)->Threads(4);
@@ -0,0 +1,50 @@
+#include "stdafx.h"
+#include "Utils.h"
+#include <benchmark/benchmark.h>
+
+// Inputs are generated rather than read from the fixture, the helpers only care about their length
+
+static void BM_HexStringToByteVector(benchmark::State& state)
+{
+	static const char digits[] = "0123456789abcdef";
+	std::string hex;
+	for (int64_t i = 0; i < state.range(0) * 2; i++)
+		hex += digits[(i * 7) % 16];
+
+	for (auto _ : state)
+		benchmark::DoNotOptimize(HexStringToByteVector(hex));
+
+	state.SetBytesProcessed(state.iterations() * (int64_t)hex.size());
+}
+BENCHMARK(BM_HexStringToByteVector)->RangeMultiplier(8)->Range(8, 4096);
+
+// Names handed to and from the runtime, from method names up to long assembly paths
+static std::string MakeName(int64_t length)
+{
+	std::string name;
+	for (int64_t i = 0; i < length; i++)
+		name += (char)('a' + i % 26);
+	return name;
+}
+
+static void BM_WideToUtf8(benchmark::State& state)
+{
+	WSTRING name = Utf8ToWide(MakeName(state.range(0)));
+
+	for (auto _ : state)
+		benchmark::DoNotOptimize(WideToUtf8(name));
+
+	state.SetBytesProcessed(state.iterations() * (int64_t)name.size() * (int64_t)sizeof(WCHAR));
+}
+BENCHMARK(BM_WideToUtf8)->RangeMultiplier(8)->Range(8, 4096);
+
+static void BM_Utf8ToWide(benchmark::State& state)
+{
+	std::string name = MakeName(state.range(0));
+
+	for (auto _ : state)
+		benchmark::DoNotOptimize(Utf8ToWide(name));
+
+	state.SetBytesProcessed(state.iterations() * (int64_t)name.size());
+}
+BENCHMARK(BM_Utf8ToWide)->RangeMultiplier(8)->Range(8, 4096);
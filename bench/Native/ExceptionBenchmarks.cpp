@@ -0,0 +1,27 @@
+#include "stdafx.h"
+#include "ExceptionTracker.h"
+#include <benchmark/benchmark.h>
+
+// The profiler's share of handling an exception, which should be small next to the runtime's two pass unwind. No runtime
+// is loaded, so types and methods aren't named
+
+// The callbacks of one exception thrown, searched for through a few frames and caught, spread over a handful of sites by
+// every thread at once
+static void BM_ExceptionTracker_ThrowCatch(benchmark::State& state)
+{
+	if (state.thread_index() == 0)
+		ExceptionTracker::Start(nullptr, "");
+
+	int frames = (int)state.range(0);
+	size_t next = state.thread_index();
+	for (auto _ : state) {
+		FunctionID thrower = 0x7000 + next++ % 8;
+		ExceptionTracker::Thrown(0x100 + next % 4);
+		for (int i = 0; i < frames; i++)
+			ExceptionTracker::SearchFunctionEnter(thrower + i);
+		ExceptionTracker::CatcherEnter(thrower + frames);
+	}
+
+	state.SetItemsProcessed(state.iterations());
+}
+BENCHMARK(BM_ExceptionTracker_ThrowCatch)->Arg(1)->Arg(8)->Threads(1)->Threads(4);
@@ -0,0 +1,129 @@
+using System;
+using System.Runtime.CompilerServices;
+
+namespace ZeroedFixture
+{
+    // Hooked by the native benchmarks. Targets are matched by name, so none of these can be overloaded
+    public static class Targets
+    {
+        // ZeroedFixture.dll!ZeroedFixture.Targets.Dispatch(0)=dispatch
+        [MethodImpl(MethodImplOptions.NoInlining)]
+        public static int Dispatch(byte[] payload) => payload.Length;
+
+        // ZeroedFixture.dll!ZeroedFixture.Targets.Inline(0,1)=inline
+        [MethodImpl(MethodImplOptions.NoInlining)]
+        public static int Inline(int value, long scale) => value + (int)scale;
+
+        // ZeroedFixture.dll!ZeroedFixture.Targets.Timed()=timed
+        // Returns from a branch and from inside a try, so exit probes have to pick up branch targets and the leave out of the try
+        [MethodImpl(MethodImplOptions.NoInlining)]
+        public static int Timed(int value)
+        {
+            if (value < 0)
+                return -1;
+
+            try
+            {
+                if (value == 0)
+                    return 0;
+                return value * 2;
+            }
+            finally
+            {
+                s_timedCalls++;
+            }
+        }
+
+        private static int s_timedCalls;
+
+        // Lives in a hooked module but isn't hooked itself, the common case when a method is JITted
+        [MethodImpl(MethodImplOptions.NoInlining)]
+        public static int Unhooked(int value) => value * 2;
+    }
+
+    // Methods spanning the range of IL body sizes the rewriter sees, from a tiny header up to a few KB with exception clauses
+    public static class Sizes
+    {
+        public static int Tiny(int left, int right) => left + right;
+
+        public static int Small(int[] values)
+        {
+            int sum = 0;
+            for (int i = 0; i < values.Length; i++)
+            {
+                if (values[i] > 0)
+                    sum += values[i];
+            }
+            return sum;
+        }
+
+        public static string Medium(int kind, string text)
+        {
+            string result;
+            try
+            {
+                switch (kind)
+                {
+                    case 0: result = text.ToUpperInvariant(); break;
+                    case 1: result = text.ToLowerInvariant(); break;
+                    case 2: result = text.Trim(); break;
+                    case 3: result = text + text; break;
+                    case 4: result = text.Substring(1); break;
+                    case 5: result = text.Replace('a', 'b'); break;
+                    case 6: result = string.Concat(text, kind.ToString()); break;
+                    case 7: result = text.PadLeft(kind); break;
+                    default: result = text; break;
+                }
+            }
+            catch (ArgumentException ex)
+            {
+                result = ex.Message;
+            }
+            finally
+            {
+                kind++;
+            }
+
+            foreach (char c in text)
+            {
+                if (char.IsDigit(c))
+                    return result + c;
+            }
+            return result;
+        }
+
+        public static int Large(int kind, int value)
+        {
+            switch (kind)
+            {
+                case 0: return Mix(value, 0); case 1: return Mix(value, 7919); case 2: return Mix(value, 5831); case 3: return Mix(value, 3743); case 4: return Mix(value, 1655); case 5: return Mix(value, 9574); case 6: return Mix(value, 7486); case 7: return Mix(value, 5398);
+                case 8: return Mix(value, 3310); case 9: return Mix(value, 1222); case 10: return Mix(value, 9141); case 11: return Mix(value, 7053); case 12: return Mix(value, 4965); case 13: return Mix(value, 2877); case 14: return Mix(value, 789); case 15: return Mix(value, 8708);
+                case 16: return Mix(value, 6620); case 17: return Mix(value, 4532); case 18: return Mix(value, 2444); case 19: return Mix(value, 356); case 20: return Mix(value, 8275); case 21: return Mix(value, 6187); case 22: return Mix(value, 4099); case 23: return Mix(value, 2011);
+                case 24: return Mix(value, 9930); case 25: return Mix(value, 7842); case 26: return Mix(value, 5754); case 27: return Mix(value, 3666); case 28: return Mix(value, 1578); case 29: return Mix(value, 9497); case 30: return Mix(value, 7409); case 31: return Mix(value, 5321);
+                case 32: return Mix(value, 3233); case 33: return Mix(value, 1145); case 34: return Mix(value, 9064); case 35: return Mix(value, 6976); case 36: return Mix(value, 4888); case 37: return Mix(value, 2800); case 38: return Mix(value, 712); case 39: return Mix(value, 8631);
+                case 40: return Mix(value, 6543); case 41: return Mix(value, 4455); case 42: return Mix(value, 2367); case 43: return Mix(value, 279); case 44: return Mix(value, 8198); case 45: return Mix(value, 6110); case 46: return Mix(value, 4022); case 47: return Mix(value, 1934);
+                case 48: return Mix(value, 9853); case 49: return Mix(value, 7765); case 50: return Mix(value, 5677); case 51: return Mix(value, 3589); case 52: return Mix(value, 1501); case 53: return Mix(value, 9420); case 54: return Mix(value, 7332); case 55: return Mix(value, 5244);
+                case 56: return Mix(value, 3156); case 57: return Mix(value, 1068); case 58: return Mix(value, 8987); case 59: return Mix(value, 6899); case 60: return Mix(value, 4811); case 61: return Mix(value, 2723); case 62: return Mix(value, 635); case 63: return Mix(value, 8554);
+                case 64: return Mix(value, 6466); case 65: return Mix(value, 4378); case 66: return Mix(value, 2290); case 67: return Mix(value, 202); case 68: return Mix(value, 8121); case 69: return Mix(value, 6033); case 70: return Mix(value, 3945); case 71: return Mix(value, 1857);
+                case 72: return Mix(value, 9776); case 73: return Mix(value, 7688); case 74: return Mix(value, 5600); case 75: return Mix(value, 3512); case 76: return Mix(value, 1424); case 77: return Mix(value, 9343); case 78: return Mix(value, 7255); case 79: return Mix(value, 5167);
+                case 80: return Mix(value, 3079); case 81: return Mix(value, 991); case 82: return Mix(value, 8910); case 83: return Mix(value, 6822); case 84: return Mix(value, 4734); case 85: return Mix(value, 2646); case 86: return Mix(value, 558); case 87: return Mix(value, 8477);
+                case 88: return Mix(value, 6389); case 89: return Mix(value, 4301); case 90: return Mix(value, 2213); case 91: return Mix(value, 125); case 92: return Mix(value, 8044); case 93: return Mix(value, 5956); case 94: return Mix(value, 3868); case 95: return Mix(value, 1780);
+                case 96: return Mix(value, 9699); case 97: return Mix(value, 7611); case 98: return Mix(value, 5523); case 99: return Mix(value, 3435); case 100: return Mix(value, 1347); case 101: return Mix(value, 9266); case 102: return Mix(value, 7178); case 103: return Mix(value, 5090);
+                case 104: return Mix(value, 3002); case 105: return Mix(value, 914); case 106: return Mix(value, 8833); case 107: return Mix(value, 6745); case 108: return Mix(value, 4657); case 109: return Mix(value, 2569); case 110: return Mix(value, 481); case 111: return Mix(value, 8400);
+                case 112: return Mix(value, 6312); case 113: return Mix(value, 4224); case 114: return Mix(value, 2136); case 115: return Mix(value, 48); case 116: return Mix(value, 7967); case 117: return Mix(value, 5879); case 118: return Mix(value, 3791); case 119: return Mix(value, 1703);
+                case 120: return Mix(value, 9622); case 121: return Mix(value, 7534); case 122: return Mix(value, 5446); case 123: return Mix(value, 3358); case 124: return Mix(value, 1270); case 125: return Mix(value, 9189); case 126: return Mix(value, 7101); case 127: return Mix(value, 5013);
+                case 128: return Mix(value, 2925); case 129: return Mix(value, 837); case 130: return Mix(value, 8756); case 131: return Mix(value, 6668); case 132: return Mix(value, 4580); case 133: return Mix(value, 2492); case 134: return Mix(value, 404); case 135: return Mix(value, 8323);
+                case 136: return Mix(value, 6235); case 137: return Mix(value, 4147); case 138: return Mix(value, 2059); case 139: return Mix(value, 9978); case 140: return Mix(value, 7890); case 141: return Mix(value, 5802); case 142: return Mix(value, 3714); case 143: return Mix(value, 1626);
+                case 144: return Mix(value, 9545); case 145: return Mix(value, 7457); case 146: return Mix(value, 5369); case 147: return Mix(value, 3281); case 148: return Mix(value, 1193); case 149: return Mix(value, 9112); case 150: return Mix(value, 7024); case 151: return Mix(value, 4936);
+                case 152: return Mix(value, 2848); case 153: return Mix(value, 760); case 154: return Mix(value, 8679); case 155: return Mix(value, 6591); case 156: return Mix(value, 4503); case 157: return Mix(value, 2415); case 158: return Mix(value, 327); case 159: return Mix(value, 8246);
+                case 160: return Mix(value, 6158); case 161: return Mix(value, 4070); case 162: return Mix(value, 1982); case 163: return Mix(value, 9901); case 164: return Mix(value, 7813); case 165: return Mix(value, 5725); case 166: return Mix(value, 3637); case 167: return Mix(value, 1549);
+                case 168: return Mix(value, 9468); case 169: return Mix(value, 7380); case 170: return Mix(value, 5292); case 171: return Mix(value, 3204); case 172: return Mix(value, 1116); case 173: return Mix(value, 9035); case 174: return Mix(value, 6947); case 175: return Mix(value, 4859);
+                case 176: return Mix(value, 2771); case 177: return Mix(value, 683); case 178: return Mix(value, 8602); case 179: return Mix(value, 6514); case 180: return Mix(value, 4426); case 181: return Mix(value, 2338); case 182: return Mix(value, 250); case 183: return Mix(value, 8169);
+                case 184: return Mix(value, 6081); case 185: return Mix(value, 3993); case 186: return Mix(value, 1905); case 187: return Mix(value, 9824); case 188: return Mix(value, 7736); case 189: return Mix(value, 5648); case 190: return Mix(value, 3560); case 191: return Mix(value, 1472);
+                default: return value;
+            }
+        }
+
+        private static int Mix(int value, int salt) => (value * 31) ^ salt;
+    }
+}
@@ -0,0 +1,24 @@
+#include "stdafx.h"
+#include "GcTelemetry.h"
+#include <benchmark/benchmark.h>
+
+// The callbacks of one generation 0 GC as the runtime raises them while it's suspended, reporting survivors in the given
+// number of batches. No runtime is loaded so heap sizes aren't read, and no capture file is open so the records are discarded
+static void BM_GcTelemetry_Collection(benchmark::State& state)
+{
+	GcTelemetry::Start(nullptr, true);
+
+	BOOL generationCollected[] = { TRUE, FALSE, FALSE, FALSE };
+	int batches = (int)state.range(0);
+	for (auto _ : state) {
+		GcTelemetry::SuspendStarted(COR_PRF_SUSPEND_FOR_GC);
+		GcTelemetry::GcStarted(_countof(generationCollected), generationCollected, COR_PRF_GC_OTHER);
+		for (int i = 0; i < batches; i++)
+			GcTelemetry::Survived(4096);
+		GcTelemetry::GcFinished();
+		GcTelemetry::ResumeFinished();
+	}
+
+	state.SetItemsProcessed(state.iterations());
+}
+BENCHMARK(BM_GcTelemetry_Collection)->Arg(1)->Arg(64);
@@ -0,0 +1,40 @@
+#include "stdafx.h"
+#include "JitAccounting.h"
+#include <benchmark/benchmark.h>
+
+// The work the JIT callbacks add to each compilation when JIT costs are accounted, which should be small next to the
+// compilation itself. No runtime is loaded so IL sizes and names aren't read, and no report is written
+
+// A started and finished pair for one of the given number of methods, after each has been compiled once
+static void BM_JitAccounting_Compilation(benchmark::State& state)
+{
+	JitAccounting::Start(nullptr, "");
+
+	int methods = (int)state.range(0);
+	int next = 0;
+	for (auto _ : state) {
+		mdMethodDef methodDef = 0x06000001 + next;
+		JitAccounting::CompilationStarted((FunctionID)(0x1000 + next), 0x100, methodDef, false, JitAccounting::Now());
+		JitAccounting::CompilationFinished((FunctionID)(0x1000 + next), S_OK);
+		next = next + 1 == methods ? 0 : next + 1;
+	}
+
+	state.SetItemsProcessed(state.iterations());
+}
+BENCHMARK(BM_JitAccounting_Compilation)->Arg(1)->Arg(4096);
+
+// A compilation nested inside another, as when compiling a method runs a static constructor which needs compiling too
+static void BM_JitAccounting_Nested(benchmark::State& state)
+{
+	JitAccounting::Start(nullptr, "");
+
+	for (auto _ : state) {
+		JitAccounting::CompilationStarted(0x2000, 0x200, 0x06000001, false, JitAccounting::Now());
+		JitAccounting::CompilationStarted(0x2001, 0x200, 0x06000002, false, JitAccounting::Now());
+		JitAccounting::CompilationFinished(0x2001, S_OK);
+		JitAccounting::CompilationFinished(0x2000, S_OK);
+	}
+
+	state.SetItemsProcessed(state.iterations());
+}
+BENCHMARK(BM_JitAccounting_Nested);
@@ -0,0 +1,49 @@
+#include "stdafx.h"
+#include "LockContention.h"
+#include "Statistics.h"
+#include <benchmark/benchmark.h>
+#include <vector>
+
+// The exit probe's share of a Monitor acquisition. An uncontended one should only cost the probes, while a contended one
+// also hashes the lock and queues an event for the merge thread. No runtime is loaded so stacks aren't walked and are made up instead
+
+// Acquisitions are counted through Statistics, which LockContention::Start would otherwise enable along with the merge thread
+static void EnableStatistics()
+{
+	static const bool enabled = (Statistics::Enable(), true);
+	(void)enabled;
+}
+
+// Counting acquisitions that didn't wait, the common case
+static void BM_LockContention_Uncontended(benchmark::State& state)
+{
+	EnableStatistics();
+	for (auto _ : state)
+		LockContention::Record(40);
+
+	state.SetItemsProcessed(state.iterations());
+}
+BENCHMARK(BM_LockContention_Uncontended)->Threads(1)->Threads(4);
+
+// Queueing contended waits on a few locks. The queue is collected outside the timed region before it can fill, as the
+// merge thread would
+static void BM_LockContention_Contended(benchmark::State& state)
+{
+	EnableStatistics();
+	FunctionID frames[] = { 0x7000, 0x7100, 0x7200 };
+	std::vector<LockWaitSummary> locks, sites;
+	size_t next = state.thread_index();
+	for (auto _ : state) {
+		if (LockContention::Record(1000000))
+			LockContention::RecordContended(0x1000 + (next++ % 8) * 0x40, 1000000, frames, _countof(frames));
+
+		if (next % (LOCK_EVENT_BUFFER / 2) == 0) {
+			state.PauseTiming();
+			LockContention::Merge(locks, sites);
+			state.ResumeTiming();
+		}
+	}
+
+	state.SetItemsProcessed(state.iterations());
+}
+BENCHMARK(BM_LockContention_Contended)->Threads(1)->Threads(4);
@@ -0,0 +1,145 @@
+#include "stdafx.h"
+#include "BenchEnvironment.h"
+#include "ilrewriter.h"
+#include "sigparse.inl"
+#include <benchmark/benchmark.h>
+
+static FixtureRuntime* GetFixtureRuntimeOrSkip(benchmark::State& state)
+{
+	FixtureRuntime* pFixture = GetFixtureRuntime();
+	if (pFixture == nullptr)
+		state.SkipWithError("Failed to load the fixture, build it with run.sh or set " FIXTURE_PATH_VARIABLE);
+
+	return pFixture;
+}
+
+// Size of a fixture method's body including its header and exception clauses, or 0 if it couldn't be found
+static ULONG GetBodySize(FixtureRuntime* pFixture, mdMethodDef methodDef)
+{
+	LPCBYTE pBody;
+	ULONG cbBody = 0;
+	if (IsNilToken(methodDef) || FAILED(pFixture->Runtime.GetILFunctionBody(pFixture->Module, methodDef, &pBody, &cbBody)))
+		return 0;
+
+	return cbBody;
+}
+
+// Parsing a method body into the rewriter's instruction list. Bodies range from a tiny header to a large switch
+static void BM_ILRewriter_Import(benchmark::State& state, LPCWSTR methodName)
+{
+	FixtureRuntime* pFixture = GetFixtureRuntimeOrSkip(state);
+	if (pFixture == nullptr)
+		return;
+
+	mdMethodDef methodDef = pFixture->FindMethod(WSTR("Sizes"), methodName);
+	ULONG cbBody = GetBodySize(pFixture, methodDef);
+	if (cbBody == 0) {
+		state.SkipWithError("Fixture method not found");
+		return;
+	}
+
+	for (auto _ : state) {
+		ILRewriter rewriter(&pFixture->Runtime, nullptr, pFixture->Module, methodDef);
+		if (FAILED(rewriter.Initialize()) || FAILED(rewriter.Import())) {
+			state.SkipWithError("Import failed");
+			break;
+		}
+		benchmark::DoNotOptimize(rewriter.GetILList());
+	}
+
+	state.SetBytesProcessed((int64_t)state.iterations() * cbBody);
+	state.counters["BodyBytes"] = cbBody;
+}
+BENCHMARK_CAPTURE(BM_ILRewriter_Import, Tiny, WSTR("Tiny"));
+BENCHMARK_CAPTURE(BM_ILRewriter_Import, Small, WSTR("Small"));
+BENCHMARK_CAPTURE(BM_ILRewriter_Import, Medium, WSTR("Medium"));
+BENCHMARK_CAPTURE(BM_ILRewriter_Import, Large, WSTR("Large"));
+
+// Encoding the instruction list back into a body. The body is handed back through a function control, as for ReJIT, so
+// nothing is left allocated in the module between iterations
+static void BM_ILRewriter_Export(benchmark::State& state, LPCWSTR methodName)
+{
+	FixtureRuntime* pFixture = GetFixtureRuntimeOrSkip(state);
+	if (pFixture == nullptr)
+		return;
+
+	mdMethodDef methodDef = pFixture->FindMethod(WSTR("Sizes"), methodName);
+	ULONG cbBody = GetBodySize(pFixture, methodDef);
+	if (cbBody == 0) {
+		state.SkipWithError("Fixture method not found");
+		return;
+	}
+
+	MockFunctionControl functionControl;
+	ILRewriter rewriter(&pFixture->Runtime, &functionControl, pFixture->Module, methodDef);
+	if (FAILED(rewriter.Initialize()) || FAILED(rewriter.Import())) {
+		state.SkipWithError("Import failed");
+		return;
+	}
+
+	for (auto _ : state) {
+		if (FAILED(rewriter.Export())) {
+			state.SkipWithError("Export failed");
+			break;
+		}
+		benchmark::DoNotOptimize(functionControl.Body.data());
+	}
+
+	state.SetBytesProcessed((int64_t)state.iterations() * cbBody);
+	state.counters["BodyBytes"] = cbBody;
+}
+BENCHMARK_CAPTURE(BM_ILRewriter_Export, Tiny, WSTR("Tiny"));
+BENCHMARK_CAPTURE(BM_ILRewriter_Export, Small, WSTR("Small"));
+BENCHMARK_CAPTURE(BM_ILRewriter_Export, Medium, WSTR("Medium"));
+BENCHMARK_CAPTURE(BM_ILRewriter_Export, Large, WSTR("Large"));
+
+// Every method and local variable signature in the fixture
+static std::vector<std::vector<sig_byte>> CollectSignatures(FixtureRuntime* pFixture)
+{
+	std::vector<std::vector<sig_byte>> signatures;
+
+	ULONG methodCount = ((MockModule*)pFixture->Module)->Image.RowCount(MetadataTable::MethodDef);
+	for (ULONG rid = 1; rid <= methodCount; rid++) {
+		PCCOR_SIGNATURE pSig;
+		ULONG cbSig;
+		if (SUCCEEDED(pFixture->Import->GetMethodProps(TokenFromRid(rid, mdtMethodDef), nullptr, nullptr, 0, nullptr, nullptr, &pSig, &cbSig, nullptr, nullptr)))
+			signatures.emplace_back(pSig, pSig + cbSig);
+	}
+
+	HCORENUM hEnum = nullptr;
+	mdSignature localSigs[64];
+	ULONG count = 0;
+	while (SUCCEEDED(pFixture->Import->EnumSignatures(&hEnum, localSigs, _countof(localSigs), &count)) && count > 0) {
+		for (ULONG i = 0; i < count; i++) {
+			PCCOR_SIGNATURE pSig;
+			ULONG cbSig;
+			if (SUCCEEDED(pFixture->Import->GetSigFromToken(localSigs[i], &pSig, &cbSig)))
+				signatures.emplace_back(pSig, pSig + cbSig);
+		}
+	}
+	pFixture->Import->CloseEnum(hEnum);
+
+	return signatures;
+}
+
+static void BM_SigParser_Parse(benchmark::State& state)
+{
+	FixtureRuntime* pFixture = GetFixtureRuntimeOrSkip(state);
+	if (pFixture == nullptr)
+		return;
+
+	std::vector<std::vector<sig_byte>> signatures = CollectSignatures(pFixture);
+	size_t totalBytes = 0;
+	for (const auto& signature : signatures)
+		totalBytes += signature.size();
+
+	SigParser parser;
+	for (auto _ : state) {
+		for (auto& signature : signatures)
+			benchmark::DoNotOptimize(parser.Parse(signature.data(), (sig_count)signature.size()));
+	}
+
+	state.SetBytesProcessed((int64_t)(state.iterations() * totalBytes));
+	state.SetItemsProcessed((int64_t)(state.iterations() * signatures.size()));
+}
+BENCHMARK(BM_SigParser_Parse);
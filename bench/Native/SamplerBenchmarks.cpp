@@ -0,0 +1,73 @@
+#include "stdafx.h"
+#include "CallTree.h"
+#include <benchmark/benchmark.h>
+#include <random>
+#include <vector>
+
+// The parts of a sample the sampler does itself while the runtime is suspended. The mock runtime can't walk stacks, so the
+// stacks are made up: paths through a small call graph, so most samples land on nodes that already exist as they would in
+// a real profile
+
+// Stacks of the given depth drawn from a pool of functions, each frame choosing one of a few callees
+static std::vector<std::vector<FunctionID>> MakeStacks(size_t stackCount, size_t depth)
+{
+	std::mt19937 random(42);
+	std::vector<std::vector<FunctionID>> stacks(stackCount);
+	for (std::vector<FunctionID>& stack : stacks) {
+		FunctionID function = 0x1000;
+		for (size_t i = 0; i < depth; i++) {
+			function = function * 3 + random() % 4;
+			stack.push_back(function);
+		}
+	}
+	return stacks;
+}
+
+// Counting one sample, by stack depth
+static void BM_CallTree_Add(benchmark::State& state)
+{
+	std::vector<std::vector<FunctionID>> stacks = MakeStacks(1024, (size_t)state.range(0));
+	CallTree tree;
+	size_t next = 0;
+
+	for (auto _ : state) {
+		const std::vector<FunctionID>& stack = stacks[next++ % stacks.size()];
+		tree.Add(stack.data(), stack.size());
+	}
+
+	state.SetItemsProcessed(state.iterations());
+	state.counters["nodes"] = (double)tree.NodeCount();
+}
+BENCHMARK(BM_CallTree_Add)->Arg(8)->Arg(32)->Arg(128);
+
+// Writing out a tree holding a thousand distinct stacks, as the sample file is rewritten
+static void BM_CallTree_WriteFolded(benchmark::State& state)
+{
+	std::vector<std::vector<FunctionID>> stacks = MakeStacks(1024, 32);
+	CallTree tree;
+	for (const std::vector<FunctionID>& stack : stacks)
+		tree.Add(stack.data(), stack.size());
+
+	std::string name = "Namespace.Type.Method";
+	FILE* sink = tmpfile();
+	for (auto _ : state) {
+		rewind(sink);
+		tree.WriteFolded(sink, [&](FunctionID) -> const std::string& { return name; });
+	}
+	fclose(sink);
+
+	state.SetItemsProcessed(state.iterations() * stacks.size());
+}
+BENCHMARK(BM_CallTree_WriteFolded);
+
+// Reading a thread's CPU counter, done for every managed thread on every sample to skip the idle ones
+static void BM_ThreadCpuCounter(benchmark::State& state)
+{
+	DWORD osThreadId = GetCurrentThreadId();
+	UINT64 counter = 0;
+	for (auto _ : state)
+		benchmark::DoNotOptimize(ThreadCpuCounter(osThreadId, &counter));
+
+	state.SetItemsProcessed(state.iterations());
+}
+BENCHMARK(BM_ThreadCpuCounter);
@@ -0,0 +1,73 @@
+#include "stdafx.h"
+#include "Statistics.h"
+#include <benchmark/benchmark.h>
+
+// Recording a statistic should cost about as much as a plain increment, however many threads record the same one. Started
+// with an empty path and a long interval so the reader thread never runs during a benchmark
+
+static const int BenchCounter = Statistics::Counter("bench.counter");
+static const int BenchGauge = Statistics::Gauge("bench.gauge");
+static const int BenchHistogram = Statistics::Histogram("bench.histogram");
+
+static void StartStatistics()
+{
+	if (!Statistics::IsEnabled())
+		Statistics::Start("", 3600 * 1000);
+}
+
+// One counter incremented from each thread
+static void BM_Statistics_Count(benchmark::State& state)
+{
+	StartStatistics();
+
+	for (auto _ : state)
+		Statistics::Count(BenchCounter);
+
+	state.SetItemsProcessed(state.iterations());
+}
+BENCHMARK(BM_Statistics_Count)->Threads(1)->Threads(4);
+
+// A gauge raised and lowered again
+static void BM_Statistics_Adjust(benchmark::State& state)
+{
+	StartStatistics();
+
+	for (auto _ : state) {
+		Statistics::Adjust(BenchGauge, 1);
+		Statistics::Adjust(BenchGauge, -1);
+	}
+
+	state.SetItemsProcessed(state.iterations());
+}
+BENCHMARK(BM_Statistics_Adjust)->Threads(1)->Threads(4);
+
+// Values spread over many buckets so the histogram isn't all in cache
+static void BM_Statistics_Record(benchmark::State& state)
+{
+	StartStatistics();
+
+	UINT64 value = 1;
+	for (auto _ : state) {
+		Statistics::Record(BenchHistogram, value);
+		value = value * 6364136223846793005ULL + 1442695040888963407ULL;
+		value >>= 40;
+	}
+
+	state.SetItemsProcessed(state.iterations());
+}
+BENCHMARK(BM_Statistics_Record)->Threads(1)->Threads(4);
+
+// Adding every thread's statistics up, which the reader thread does once an interval
+static void BM_Statistics_Snapshot(benchmark::State& state)
+{
+	StartStatistics();
+	Statistics::Count(BenchCounter);
+	Statistics::Record(BenchHistogram, 100);
+
+	std::vector<StatSummary> stats;
+	for (auto _ : state) {
+		Statistics::Snapshot(stats);
+		benchmark::DoNotOptimize(stats.data());
+	}
+}
+BENCHMARK(BM_Statistics_Snapshot);
@@ -0,0 +1,56 @@
+#include "stdafx.h"
+#include "MethodTiming.h"
+#include <benchmark/benchmark.h>
+
+// A timed hook costs the entry probe's calli plus the exit probe's calli, which between them should stay in the tens of
+// nanoseconds. The merge thread is started with an interval longer than any run, so only the hot path is timed
+
+typedef INT64(STDMETHODCALLTYPE* TimingEnterFunc)();
+typedef void(STDMETHODCALLTYPE* TimingLeaveFunc)(int hookId, INT64 start);
+
+// Registers the hooks' histograms, which nothing is recorded without
+static void StartTiming()
+{
+	static const bool started = (MethodTiming::Start("", 3600 * 1000, { "Bench.Untimed", "Bench.Timed" }), true);
+	(void)started;
+}
+
+// Reading a timestamp on its own
+static void BM_MethodTiming_Now(benchmark::State& state)
+{
+	for (auto _ : state)
+		benchmark::DoNotOptimize(MethodTiming::Now());
+
+	state.SetItemsProcessed(state.iterations());
+}
+BENCHMARK(BM_MethodTiming_Now);
+
+// The entry and exit probes of one timed call around an empty body
+static void BM_MethodTiming_Probes(benchmark::State& state)
+{
+	StartTiming();
+	TimingEnterFunc enter = (TimingEnterFunc)MethodTiming::GetEnterFunction();
+	TimingLeaveFunc leave = (TimingLeaveFunc)MethodTiming::GetLeaveFunction();
+	int hookId = (int)state.range(0);
+
+	for (auto _ : state)
+		leave(hookId, enter());
+
+	state.SetItemsProcessed(state.iterations());
+}
+BENCHMARK(BM_MethodTiming_Probes)->Arg(1)->Threads(1)->Threads(4);
+
+// Merging every thread's counts, which the merge thread does once an interval while hooks keep recording
+static void BM_MethodTiming_Merge(benchmark::State& state)
+{
+	// Make sure there's something to merge even when run on its own
+	StartTiming();
+	MethodTiming::Record(1, 0, 100);
+
+	std::vector<HookTimingSummary> summaries;
+	for (auto _ : state) {
+		MethodTiming::Merge(summaries);
+		benchmark::DoNotOptimize(summaries.data());
+	}
+}
+BENCHMARK(BM_MethodTiming_Merge);
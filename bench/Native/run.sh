@@ -0,0 +1,26 @@
+#!/bin/sh
+# Usage: run.sh <build directory> [results file] [benchmark arguments...]
+# Builds the fixture assembly and runs the native benchmarks against it, writing the results to the results file as JSON.
+# The build directory must be configured with -DZEROED_PROFILER_BUILD_BENCHMARKS=ON.
+set -e
+
+if [ -z "$1" ]; then
+    echo "usage: $0 <build directory> [results file] [benchmark arguments...]" >&2
+    exit 1
+fi
+
+BUILD_DIR="$(cd "$1" && pwd)"
+OUTPUT="${2:-native-bench.json}"
+shift
+[ $# -gt 0 ] && shift
+
+cmake --build "$BUILD_DIR" --target ZeroedNativeBench
+
+cd "$(dirname "$0")"
+dotnet build -c Release Fixture/Fixture.csproj
+
+export ZEROED_BENCH_FIXTURE="$(pwd)/Fixture/bin/Release/net8.0/ZeroedFixture.dll"
+export CORECLR_PROFILER_PATH="${CORECLR_PROFILER_PATH:-$BUILD_DIR/libZeroedProfiler.so}"
+
+cd - > /dev/null
+"$BUILD_DIR/bench/Native/ZeroedNativeBench" --benchmark_out="$OUTPUT" --benchmark_out_format=json "$@"
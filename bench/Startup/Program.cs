@@ -0,0 +1,25 @@
+using System.Runtime.CompilerServices;
+
+namespace ZeroedStartup
+{
+    public static class Handler
+    {
+        // Hooked with ZeroedStartup.dll!ZeroedStartup.Handler.Handle(0)=dispatch so startup includes applying a hook
+        [MethodImpl(MethodImplOptions.NoInlining)]
+        public static int Handle(byte[] payload) => payload.Length;
+    }
+
+    public static class Program
+    {
+        public static void Main(string[] args)
+        {
+            WebApplicationBuilder builder = WebApplication.CreateBuilder(args);
+            builder.Logging.ClearProviders();
+
+            WebApplication app = builder.Build();
+            byte[] payload = new byte[16];
+            app.MapGet("/", () => Handler.Handle(payload).ToString());
+            app.Run();
+        }
+    }
+}
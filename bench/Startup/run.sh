@@ -0,0 +1,58 @@
+#!/bin/sh
+# Usage: run.sh <path to built profiler library> [runs]
+# Measures time to first request of a minimal ASP.NET app without the profiler, with hooks applied through ReJIT and
+# with hooks applied on first JIT after disabling NGEN/ReadyToRun images.
+set -e
+
+if [ -z "$1" ]; then
+    echo "usage: $0 <profiler library> [runs]" >&2
+    exit 1
+fi
+
+PROFILER="$1"
+RUNS="${2:-5}"
+PORT=5089
+URL="http://127.0.0.1:$PORT/"
+
+cd "$(dirname "$0")"
+dotnet publish -c Release -o out >/dev/null
+
+now_ms() {
+    echo $(($(date +%s%N) / 1000000))
+}
+
+# Prints the milliseconds between launching the app and its first successful response
+first_request() {
+    start=$(now_ms)
+    ./out/ZeroedStartup --urls "$URL" &
+    pid=$!
+    until curl -sf "$URL" >/dev/null 2>&1; do
+        sleep 0.01
+    done
+    end=$(now_ms)
+    kill $pid
+    wait $pid 2>/dev/null || true
+    echo $((end - start))
+}
+
+measure() {
+    name="$1"
+    total=0
+    for i in $(seq "$RUNS"); do
+        total=$((total + $(first_request)))
+    done
+    echo "$name: $((total / RUNS)) ms to first request (mean of $RUNS)"
+}
+
+measure "No profiler"
+
+export CORECLR_ENABLE_PROFILING=1
+export CORECLR_PROFILER="{681AD446-325F-4C07-9BF8-6A199302F62A}"
+export CORECLR_PROFILER_PATH="$PROFILER"
+export ZEROED_PROFILER_HOOKS="ZeroedStartup.dll!ZeroedStartup.Handler.Handle(0)=dispatch"
+
+export ZEROED_PROFILER_DISABLE_NGEN=0
+measure "Profiler, hooks applied through ReJIT"
+
+export ZEROED_PROFILER_DISABLE_NGEN=1
+measure "Profiler, NGEN/ReadyToRun disabled"
@@ -1,14 +1,15 @@
-#include <windows.h>
-#include <objbase.h>
+#include "stdafx.h"
 #include <iostream>
 #include <spdlog/spdlog.h>
-#include <spdlog/sinks/wincolor_sink.h>
+#include <spdlog/sinks/stdout_color_sinks.h>
+#ifdef _WIN32
 #include "spdlog/sinks/msvc_sink.h"
+#endif
 #include "ZeroedProfiler.h"
+#include <cstdlib>
 
-
-// Externally defined CLSID
-extern "C" const GUID CLSID_ZeroedProfiler;
+// Overrides the default info log level, using spdlog's level names (trace, debug, info, warn, error, critical, off)
+#define LOG_LEVEL_VARIABLE "ZEROED_PROFILER_LOG_LEVEL"
 
 class ZeroedProfilerClassFactory : public IClassFactory {
 public:
@@ -36,29 +37,47 @@ public:
     HRESULT STDMETHODCALLTYPE LockServer(BOOL fLock) override { return S_OK; }
 };
 
-BOOL APIENTRY DllMain(HMODULE hModule, DWORD ul_reason_for_call, LPVOID lpReserved) {
-    // Setup logger
+static void InitializeLogging() {
+    std::vector<spdlog::sink_ptr> sinks;
+
+#ifdef _WIN32
     // Create MSVC sink (logs to Output window in Visual Studio)
     auto msvc_sink = std::make_shared<spdlog::sinks::msvc_sink_mt>();
+    msvc_sink->set_level(spdlog::level::debug);
+    sinks.push_back(msvc_sink);
+#endif
 
     // Create console sink (colored output to stdout)
-    auto wincolor_sink = std::make_shared<spdlog::sinks::wincolor_stdout_sink_mt>();
-    msvc_sink->set_level(spdlog::level::debug);
-    wincolor_sink->set_level(spdlog::level::debug);
+    auto console_sink = std::make_shared<spdlog::sinks::stdout_color_sink_mt>();
+    console_sink->set_level(spdlog::level::debug);
+    sinks.push_back(console_sink);
 
-    // Combine sinks
-    std::vector<spdlog::sink_ptr> sinks{ msvc_sink, wincolor_sink};
     auto logger = std::make_shared<spdlog::logger>("dual_sink_logger", sinks.begin(), sinks.end());
 
     // Set as default logger
     spdlog::set_default_logger(logger);
     spdlog::set_pattern("[%H:%M:%S] [%^%L%$] %v");
-    spdlog::set_level(spdlog::level::info);
+
+    const char* logLevel = std::getenv(LOG_LEVEL_VARIABLE);
+    spdlog::set_level(logLevel != nullptr ? spdlog::level::from_str(logLevel) : spdlog::level::info);
+}
+
+#ifdef _WIN32
+BOOL APIENTRY DllMain(HMODULE hModule, DWORD ul_reason_for_call, LPVOID lpReserved) {
+    if (ul_reason_for_call == DLL_PROCESS_ATTACH) {
+        InitializeLogging();
+    }
 
     return TRUE;
 }
+#else
+// There's no DllMain outside of Windows, so set up logging when the runtime loads the library
+__attribute__((constructor)) static void LibraryLoad() {
+    InitializeLogging();
+}
+#endif
 
-extern "C" HRESULT __stdcall DllGetClassObject(REFCLSID rclsid, REFIID riid, void** ppv) {
+extern "C" ZEROED_EXPORT HRESULT STDMETHODCALLTYPE DllGetClassObject(REFCLSID rclsid, REFIID riid, void** ppv) {
     static ZeroedProfilerClassFactory factory;
 
     if (rclsid == CLSID_ZeroedProfiler) {
@@ -68,7 +87,6 @@ extern "C" HRESULT __stdcall DllGetClassObject(REFCLSID rclsid, REFIID riid, voi
     return CLASS_E_CLASSNOTAVAILABLE;
 }
 
-extern "C" HRESULT __stdcall DllCanUnloadNow(void) {
+extern "C" ZEROED_EXPORT HRESULT STDMETHODCALLTYPE DllCanUnloadNow(void) {
     return S_FALSE;
 }
-
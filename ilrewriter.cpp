@@ -19,6 +19,8 @@
 #include <corhlpr.cpp>
 #include <fstream>
 #include <iomanip>
+#include <unordered_set>
+#include <vector>
 #include "COMPtrHolder.h"
 #include "Utils.h"
 
@@ -38,8 +40,9 @@ void __fastcall UnmanagedInspectObject(void* pv)
 
 ILRewriter::ILRewriter(ICorProfilerInfo* pICorProfilerInfo, ICorProfilerFunctionControl* pICorProfilerFunctionControl, ModuleID moduleID, mdToken tkMethod)
 	: m_pICorProfilerInfo(pICorProfilerInfo), m_pICorProfilerFunctionControl(pICorProfilerFunctionControl),
-	m_moduleId(moduleID), m_tkMethod(tkMethod), m_fGenerateTinyHeader(false),
-	m_pOffsetToInstr(NULL), m_pOutputBuffer(NULL), m_pIMethodMalloc(NULL),
+	m_moduleId(moduleID), m_tkMethod(tkMethod), m_tkLocalVarSig(mdTokenNil),
+	m_maxStack(0), m_flags(0), m_fGenerateTinyHeader(false),
+	m_nEH(0), m_pEH(NULL), m_pOffsetToInstr(NULL), m_CodeSize(0), m_pOutputBuffer(NULL), m_pIMethodMalloc(NULL),
 	m_pMetaDataImport(NULL), m_pMetaDataEmit(NULL)
 {
 	m_IL.m_pNext = &m_IL;
@@ -57,6 +60,7 @@ ILRewriter::~ILRewriter()
 		delete p;
 		p = t;
 	}
+	delete[] m_pEH;
 	delete[] m_pOffsetToInstr;
 	delete[] m_pOutputBuffer;
 
@@ -115,12 +119,15 @@ HRESULT ILRewriter::Import()
 
 	// Import the header flags
 	m_tkLocalVarSig = decoder.GetLocalVarSigTok();
-	m_maxStack = decoder.GetMaxStack();
 	m_flags = (decoder.GetFlags() & CorILMethod_InitLocals);
 
 	m_CodeSize = decoder.GetCodeSize();
 
 	IfFailRet(ImportIL(decoder.Code));
+	IfFailRet(ImportEH(decoder.EH, decoder.EHCount()));
+
+	// Set after importing as InsertBefore accounts for every imported instruction's pushes, which overstates the original max stack
+	m_maxStack = decoder.GetMaxStack();
 
 	return S_OK;
 }
@@ -264,6 +271,43 @@ HRESULT ILRewriter::ImportIL(LPCBYTE pIL)
 	return S_OK;
 }
 
+HRESULT ILRewriter::ImportEH(const COR_ILMETHOD_SECT_EH* pILEH, unsigned nEH)
+{
+	assert(m_pEH == NULL);
+
+	m_nEH = nEH;
+
+	if (nEH == 0)
+		return S_OK;
+
+	m_pEH = new EHClause[m_nEH];
+	IfNullRet(m_pEH);
+
+	for (unsigned iEH = 0; iEH < m_nEH; iEH++)
+	{
+		// If the EH clause is in tiny form, the call to pILEH->EHClause() below will
+		// use this as a scratch buffer to expand the EH clause into its fat form.
+		IMAGE_COR_ILMETHOD_SECT_EH_CLAUSE_FAT scratch;
+
+		const IMAGE_COR_ILMETHOD_SECT_EH_CLAUSE_FAT* ehInfo = pILEH->EHClause(iEH, &scratch);
+
+		EHClause* clause = &(m_pEH[iEH]);
+		clause->m_Flags = ehInfo->Flags;
+
+		// m_pTryEnd is the first instruction after the protected block, m_pHandlerEnd the last instruction inside the handler
+		clause->m_pTryBegin = GetInstrFromOffset(ehInfo->TryOffset);
+		clause->m_pTryEnd = GetInstrFromOffset(ehInfo->TryOffset + ehInfo->TryLength);
+		clause->m_pHandlerBegin = GetInstrFromOffset(ehInfo->HandlerOffset);
+		clause->m_pHandlerEnd = GetInstrFromOffset(ehInfo->HandlerOffset + ehInfo->HandlerLength)->m_pPrev;
+		if ((clause->m_Flags & COR_ILEXCEPTION_CLAUSE_FILTER) == 0)
+			clause->m_ClassToken = ehInfo->ClassToken;
+		else
+			clause->m_pFilter = GetInstrFromOffset(ehInfo->FilterOffset);
+	}
+
+	return S_OK;
+}
+
 ILInstr* ILRewriter::NewILInstr()
 {
 	m_nInstrs++;
@@ -303,17 +347,448 @@ void ILRewriter::InsertAfter(ILInstr* pWhere, ILInstr* pWhat)
 	AdjustState(pWhat);
 }
 
+// Splices an already linked chain of instructions (pFirst through pLast) in front of pWhere with a single list operation.
+// stackDepth is the most evaluation stack the chain uses, which is added to the method's max stack
+void ILRewriter::SpliceBefore(ILInstr* pWhere, ILInstr* pFirst, ILInstr* pLast, unsigned stackDepth)
+{
+	pFirst->m_pPrev = pWhere->m_pPrev;
+	pLast->m_pNext = pWhere;
+
+	pWhere->m_pPrev->m_pNext = pFirst;
+	pWhere->m_pPrev = pLast;
+
+	m_maxStack += stackDepth;
+}
+
 void ILRewriter::AdjustState(ILInstr* pNewInstr)
 {
 	m_maxStack += k_rgnStackPushes[pNewInstr->m_opcode];
 }
 
 
+// Points every branch, switch case and exception clause boundary that refers to pFrom at pTo instead, so code inserted
+// in front of pFrom runs however pFrom is reached. m_pHandlerEnd is inclusive so a handler ending just before pFrom is left alone
+void ILRewriter::RedirectTargets(ILInstr* pFrom, ILInstr* pTo)
+{
+	for (ILInstr* pInstr = m_IL.m_pNext; pInstr != &m_IL; pInstr = pInstr->m_pNext)
+	{
+		if ((s_OpCodeFlags[pInstr->m_opcode] & OPCODEFLAGS_BranchTarget) && pInstr->m_pTarget == pFrom)
+			pInstr->m_pTarget = pTo;
+	}
+
+	for (unsigned iEH = 0; iEH < m_nEH; iEH++)
+	{
+		EHClause* clause = &(m_pEH[iEH]);
+		if (clause->m_pTryBegin == pFrom)
+			clause->m_pTryBegin = pTo;
+		if (clause->m_pTryEnd == pFrom)
+			clause->m_pTryEnd = pTo;
+		if (clause->m_pHandlerBegin == pFrom)
+			clause->m_pHandlerBegin = pTo;
+		if ((clause->m_Flags & COR_ILEXCEPTION_CLAUSE_FILTER) && clause->m_pFilter == pFrom)
+			clause->m_pFilter = pTo;
+	}
+}
+
 ILInstr* ILRewriter::GetILList()
 {
 	return &m_IL;
 }
 
+// Appends a local of the given primitive type to the method's local variable signature, creating one if the method has
+// no locals. The extended signature is emitted into the module and *pIndex receives the new local's index
+HRESULT ILRewriter::AddLocal(CorElementType type, unsigned* pIndex)
+{
+	std::vector<COR_SIGNATURE> locals;
+	ULONG count = 0;
+	if (!IsNilToken(m_tkLocalVarSig))
+	{
+		PCCOR_SIGNATURE pSig;
+		ULONG cbSig;
+		IfFailRet(m_pMetaDataImport->GetSigFromToken(m_tkLocalVarSig, &pSig, &cbSig));
+
+		PCCOR_SIGNATURE pEnd = pSig + cbSig;
+		if (CorSigUncompressCallingConv(pSig) != IMAGE_CEE_CS_CALLCONV_LOCAL_SIG)
+			return E_FAIL;
+		count = CorSigUncompressData(pSig);
+		locals.assign(pSig, pEnd);
+	}
+
+	// Local indices are 16 bit and 0xFFFF is reserved
+	if (count >= 0xFFFE)
+		return E_FAIL;
+
+	COR_SIGNATURE header[1 + sizeof(ULONG)];
+	header[0] = IMAGE_CEE_CS_CALLCONV_LOCAL_SIG;
+	ULONG cbCount = CorSigCompressData(count + 1, &header[1]);
+
+	std::vector<COR_SIGNATURE> signature(header, header + 1 + cbCount);
+	signature.insert(signature.end(), locals.begin(), locals.end());
+	signature.push_back((COR_SIGNATURE)type);
+
+	mdSignature tkLocalVarSig;
+	IfFailRet(m_pMetaDataEmit->GetTokenFromSig(signature.data(), (ULONG)signature.size(), &tkLocalVarSig));
+
+	m_tkLocalVarSig = tkLocalVarSig;
+	*pIndex = count;
+	return S_OK;
+}
+
+/////////////////////////////////////////////////////////////////////////////////////////////////
+//
+// O P T I M I Z E
+//
+////////////////////////////////////////////////////////////////////////////////////////////////
+
+// Collects which locals in a local variable signature can be dropped from a store/load pair. Stores to pinned locals
+// keep objects pinned so they must never be removed, even when the stored value is never read back. Stores to
+// narrow integer and float32 locals truncate or round the value, so skipping the local would change what is loaded
+class LocalsParser : public SigParser
+{
+public:
+	std::vector<bool> Pinned;
+	std::vector<bool> Exact;
+
+protected:
+	void NotifyBeginLocal() override
+	{
+		Pinned.push_back(false);
+		Exact.push_back(false);
+		m_depth = 0;
+		m_fByref = false;
+	}
+
+	void NotifyConstraint(sig_elem_type elem_type) override
+	{
+		if (elem_type == ELEMENT_TYPE_PINNED && !Pinned.empty())
+			Pinned.back() = true;
+	}
+
+	void NotifyByref() override
+	{
+		m_fByref = true;
+	}
+
+	void NotifyBeginType() override
+	{
+		m_depth++;
+	}
+
+	void NotifyEndType() override
+	{
+		m_depth--;
+	}
+
+	void NotifyTypeSimple(sig_elem_type elem_type) override
+	{
+		switch (elem_type)
+		{
+		case ELEMENT_TYPE_I4:
+		case ELEMENT_TYPE_I8:
+		case ELEMENT_TYPE_I:
+		case ELEMENT_TYPE_U:
+		case ELEMENT_TYPE_STRING:
+		case ELEMENT_TYPE_OBJECT:
+			SetExact();
+			break;
+		default:
+			break;
+		}
+	}
+
+	void NotifyTypeClass() override
+	{
+		SetExact();
+	}
+
+	void NotifyTypeSzArray() override
+	{
+		SetExact();
+	}
+
+	void NotifyTypeArray() override
+	{
+		SetExact();
+	}
+
+	void NotifyTypeGenericInst(sig_elem_type elem_type, sig_index_type, sig_index, sig_mem_number) override
+	{
+		if (elem_type == ELEMENT_TYPE_CLASS)
+			SetExact();
+	}
+
+private:
+	int m_depth = 0;
+	bool m_fByref = false;
+
+	// Only the outermost type of the local decides, not generic arguments or array elements
+	void SetExact()
+	{
+		if (m_depth == 1 && !m_fByref && !Exact.empty())
+			Exact.back() = true;
+	}
+};
+
+// Returns the local index an ldloc instruction reads, or -1 for anything else
+static int GetLoadedLocal(const ILInstr* pInstr)
+{
+	switch (pInstr->m_opcode)
+	{
+	case CEE_LDLOC_0: case CEE_LDLOC_1: case CEE_LDLOC_2: case CEE_LDLOC_3:
+		return pInstr->m_opcode - CEE_LDLOC_0;
+	case CEE_LDLOC_S:
+	case CEE_LDLOCA_S:
+		return (BYTE)pInstr->m_Arg8;
+	case CEE_LDLOC:
+	case CEE_LDLOCA:
+		return (UINT16)pInstr->m_Arg16;
+	default:
+		return -1;
+	}
+}
+
+// Returns the local index an stloc instruction writes, or -1 for anything else
+static int GetStoredLocal(const ILInstr* pInstr)
+{
+	switch (pInstr->m_opcode)
+	{
+	case CEE_STLOC_0: case CEE_STLOC_1: case CEE_STLOC_2: case CEE_STLOC_3:
+		return pInstr->m_opcode - CEE_STLOC_0;
+	case CEE_STLOC_S:
+		return (BYTE)pInstr->m_Arg8;
+	case CEE_STLOC:
+		return (UINT16)pInstr->m_Arg16;
+	default:
+		return -1;
+	}
+}
+
+// Rewrite an instruction to the shortest encoding of the same operation. Branches are always made short
+// as Export widens any whose target ends up out of range
+static void ShortenInstr(ILInstr* pInstr)
+{
+	unsigned opcode = pInstr->m_opcode;
+	switch (opcode)
+	{
+	case CEE_LDARG:
+	case CEE_LDLOC:
+	case CEE_STLOC:
+	{
+		unsigned index = (UINT16)pInstr->m_Arg16;
+		unsigned first = opcode == CEE_LDARG ? CEE_LDARG_0 : opcode == CEE_LDLOC ? CEE_LDLOC_0 : CEE_STLOC_0;
+		unsigned shortForm = opcode == CEE_LDARG ? CEE_LDARG_S : opcode == CEE_LDLOC ? CEE_LDLOC_S : CEE_STLOC_S;
+		if (index <= 3)
+		{
+			pInstr->m_opcode = first + index;
+		}
+		else if (index <= 0xFF)
+		{
+			pInstr->m_opcode = shortForm;
+			pInstr->m_Arg8 = (INT8)index;
+		}
+		break;
+	}
+	case CEE_LDARG_S:
+	case CEE_LDLOC_S:
+	case CEE_STLOC_S:
+	{
+		unsigned index = (BYTE)pInstr->m_Arg8;
+		unsigned first = opcode == CEE_LDARG_S ? CEE_LDARG_0 : opcode == CEE_LDLOC_S ? CEE_LDLOC_0 : CEE_STLOC_0;
+		if (index <= 3)
+			pInstr->m_opcode = first + index;
+		break;
+	}
+	case CEE_LDARGA:
+	case CEE_STARG:
+	case CEE_LDLOCA:
+	{
+		unsigned index = (UINT16)pInstr->m_Arg16;
+		if (index <= 0xFF)
+		{
+			pInstr->m_opcode = opcode == CEE_LDARGA ? CEE_LDARGA_S : opcode == CEE_STARG ? CEE_STARG_S : CEE_LDLOCA_S;
+			pInstr->m_Arg8 = (INT8)index;
+		}
+		break;
+	}
+	case CEE_LDC_I4:
+	case CEE_LDC_I4_S:
+	{
+		INT32 value = opcode == CEE_LDC_I4 ? pInstr->m_Arg32 : pInstr->m_Arg8;
+		if (value >= -1 && value <= 8)
+		{
+			pInstr->m_opcode = CEE_LDC_I4_0 + value;
+		}
+		else if (value >= -128 && value <= 127)
+		{
+			pInstr->m_opcode = CEE_LDC_I4_S;
+			pInstr->m_Arg8 = (INT8)value;
+		}
+		break;
+	}
+	case CEE_LEAVE:
+		pInstr->m_opcode = CEE_LEAVE_S;
+		break;
+	default:
+		if (opcode >= CEE_BR && opcode <= CEE_BLT_UN)
+			pInstr->m_opcode = opcode - CEE_BR + CEE_BR_S;
+		break;
+	}
+}
+
+static bool IsUnconditionalBranch(const ILInstr* pInstr)
+{
+	return pInstr->m_opcode == CEE_BR || pInstr->m_opcode == CEE_BR_S;
+}
+
+/// <summary>
+/// Peephole pass over the instruction list, intended to be run just before Export. Picks the shortest encoding for
+/// every instruction, folds branches to unconditional branches, and removes nops, branches to the next instruction
+/// and stloc/ldloc pairs whose local is never otherwise read and holds the stored value without conversion.
+/// Instructions which are branch targets or EH clause boundaries are never removed
+/// </summary>
+HRESULT ILRewriter::Optimize()
+{
+	unsigned originalSize = GetEncodedSize();
+
+	for (ILInstr* pInstr = m_IL.m_pNext; pInstr != &m_IL; pInstr = pInstr->m_pNext)
+		ShortenInstr(pInstr);
+
+	// Branch threading could move a branch into or out of a protected region, which is only legal via leave
+	if (m_nEH == 0)
+	{
+		for (ILInstr* pInstr = m_IL.m_pNext; pInstr != &m_IL; pInstr = pInstr->m_pNext)
+		{
+			if ((s_OpCodeFlags[pInstr->m_opcode] & OPCODEFLAGS_BranchTarget) == 0)
+				continue;
+
+			// Bound the number of hops so a cycle of branches can't hang us
+			ILInstr* pTarget = pInstr->m_pTarget;
+			for (int hops = 0; hops < 8 && pTarget != pInstr && IsUnconditionalBranch(pTarget); hops++)
+				pTarget = pTarget->m_pTarget;
+			pInstr->m_pTarget = pTarget;
+		}
+	}
+
+	// Anything referenced by a branch or an EH clause has to stay where it is
+	std::unordered_set<ILInstr*> referenced;
+	for (ILInstr* pInstr = m_IL.m_pNext; pInstr != &m_IL; pInstr = pInstr->m_pNext)
+	{
+		if (s_OpCodeFlags[pInstr->m_opcode] & OPCODEFLAGS_BranchTarget)
+			referenced.insert(pInstr->m_pTarget);
+	}
+	for (unsigned iEH = 0; iEH < m_nEH; iEH++)
+	{
+		EHClause* clause = &(m_pEH[iEH]);
+		referenced.insert(clause->m_pTryBegin);
+		referenced.insert(clause->m_pTryEnd);
+		referenced.insert(clause->m_pHandlerBegin);
+		referenced.insert(clause->m_pHandlerEnd);
+		if (clause->m_Flags & COR_ILEXCEPTION_CLAUSE_FILTER)
+			referenced.insert(clause->m_pFilter);
+	}
+
+	// Store/load pairs can only go if we know which locals hold the stored value unchanged and the load is the only
+	// read of the local
+	std::vector<bool> exactLocals;
+	std::vector<unsigned> localReads;
+	bool fLocalsKnown = false;
+	if (m_tkLocalVarSig != mdTokenNil && m_pMetaDataImport != NULL)
+	{
+		PCCOR_SIGNATURE pSig;
+		ULONG cbSig;
+		LocalsParser parser;
+		if (SUCCEEDED(m_pMetaDataImport->GetSigFromToken(m_tkLocalVarSig, &pSig, &cbSig)) && parser.Parse((sig_byte*)pSig, cbSig))
+		{
+			exactLocals.resize(parser.Exact.size());
+			for (size_t i = 0; i < exactLocals.size(); i++)
+				exactLocals[i] = parser.Exact[i] && !parser.Pinned[i];
+			localReads.resize(exactLocals.size());
+			fLocalsKnown = true;
+
+			for (ILInstr* pInstr = m_IL.m_pNext; pInstr != &m_IL; pInstr = pInstr->m_pNext)
+			{
+				int local = GetLoadedLocal(pInstr);
+				if (local >= 0 && (unsigned)local < localReads.size())
+					localReads[local]++;
+			}
+		}
+	}
+
+	// Removing one instruction can expose another (eg. a branch over nops to the next real instruction) so repeat until nothing changes
+	bool fChanged = true;
+	while (fChanged)
+	{
+		fChanged = false;
+
+		ILInstr* pInstr = m_IL.m_pNext;
+		while (pInstr != &m_IL)
+		{
+			ILInstr* pNext = pInstr->m_pNext;
+			bool fReferenced = referenced.count(pInstr) != 0;
+
+			if (!fReferenced && pInstr->m_opcode == CEE_NOP)
+			{
+				RemoveInstr(pInstr);
+				fChanged = true;
+			}
+			else if (!fReferenced && IsUnconditionalBranch(pInstr) && pInstr->m_pTarget == pNext)
+			{
+				RemoveInstr(pInstr);
+				fChanged = true;
+			}
+			else if (!fReferenced && fLocalsKnown && pNext != &m_IL && referenced.count(pNext) == 0)
+			{
+				int local = GetStoredLocal(pInstr);
+				if (local >= 0 && (unsigned)local < exactLocals.size() && exactLocals[local] &&
+					GetLoadedLocal(pNext) == local && pNext->m_opcode != CEE_LDLOCA_S && pNext->m_opcode != CEE_LDLOCA &&
+					localReads[local] == 1)
+				{
+					// The value is already on the stack, leave it there
+					ILInstr* pAfter = pNext->m_pNext;
+					RemoveInstr(pInstr);
+					RemoveInstr(pNext);
+					localReads[local] = 0;
+					pNext = pAfter;
+					fChanged = true;
+				}
+			}
+
+			pInstr = pNext;
+		}
+	}
+
+	unsigned optimizedSize = GetEncodedSize();
+	spdlog::debug("Peephole pass on {:x} saved {} bytes ({} -> {})", m_tkMethod, originalSize - optimizedSize, originalSize, optimizedSize);
+
+	return S_OK;
+}
+
+// Size of the instruction stream if every branch keeps its current form
+unsigned ILRewriter::GetEncodedSize()
+{
+	unsigned size = 0;
+	for (ILInstr* pInstr = m_IL.m_pNext; pInstr != &m_IL; pInstr = pInstr->m_pNext)
+	{
+		if (pInstr->m_opcode < CEE_COUNT)
+			size += (pInstr->m_opcode >= 0x100) ? 2 : 1;
+
+		BYTE flags = s_OpCodeFlags[pInstr->m_opcode];
+		size += flags & OPCODEFLAGS_SizeMask;
+		if (flags & OPCODEFLAGS_Switch)
+			size += sizeof(INT32);
+	}
+	return size;
+}
+
+void ILRewriter::RemoveInstr(ILInstr* pInstr)
+{
+	pInstr->m_pPrev->m_pNext = pInstr->m_pNext;
+	pInstr->m_pNext->m_pPrev = pInstr->m_pPrev;
+
+	delete pInstr;
+	m_nInstrs--;
+}
+
 /////////////////////////////////////////////////////////////////////////////////////////////////
 //
 // E X P O R T
@@ -323,9 +798,11 @@ ILInstr* ILRewriter::GetILList()
 
 HRESULT ILRewriter::Export()
 {
-	// One instruction produces 6 bytes in the worst case
-	unsigned maxSize = m_nInstrs * 6;
+	// One instruction produces 9 bytes in the worst case, ldc.i8 and ldc.r8 with their 8 byte operands
+	unsigned maxSize = m_nInstrs * 9;
 
+	// Exporting again re-encodes the current instruction list from scratch
+	delete[] m_pOutputBuffer;
 	m_pOutputBuffer = new BYTE[maxSize];
 	IfNullRet(m_pOutputBuffer);
 
@@ -463,7 +940,7 @@ again:
 	if (m_fGenerateTinyHeader)
 	{
 		// Make sure we can fit in a tiny header
-		if (codeSize >= 64)
+		if (codeSize >= 64 || m_nEH != 0)
 			return E_FAIL;
 
 		totalSize = sizeof(IMAGE_COR_ILMETHOD_TINY) + codeSize;
@@ -485,7 +962,8 @@ again:
 		unsigned alignedCodeSize = (offset + 3) & ~3;
 		//unsigned alignedCodeSize = offset;
 
-		totalSize = sizeof(IMAGE_COR_ILMETHOD_FAT) + alignedCodeSize;
+		totalSize = sizeof(IMAGE_COR_ILMETHOD_FAT) + alignedCodeSize +
+			(m_nEH ? (sizeof(IMAGE_COR_ILMETHOD_SECT_FAT) + sizeof(IMAGE_COR_ILMETHOD_SECT_EH_CLAUSE_FAT) * m_nEH) : 0);
 		//spdlog::error("Allocated {} bytes - IMAGE_COR_ILMETHOD_FAT: {}, Code: {}, Alignment: {}, EH: {}, Offset: {}, CodeSizeWithAlign: {}", totalSize, sizeof(IMAGE_COR_ILMETHOD_FAT), offset, alignedCodeSize - offset, (m_nEH ? (sizeof(IMAGE_COR_ILMETHOD_SECT_FAT) + sizeof(IMAGE_COR_ILMETHOD_SECT_EH_CLAUSE_FAT) * m_nEH) : 0), offset, alignedCodeSize);
 		pBody = AllocateILMemory(totalSize);
 		IfNullRet(pBody);
@@ -493,7 +971,7 @@ again:
 		BYTE* pCurrent = pBody;
 
 		IMAGE_COR_ILMETHOD_FAT* pHeader = (IMAGE_COR_ILMETHOD_FAT*)pCurrent;
-		pHeader->Flags = m_flags | CorILMethod_InitLocals | CorILMethod_FatFormat;
+		pHeader->Flags = m_flags | CorILMethod_InitLocals | (m_nEH ? CorILMethod_MoreSects : 0) | CorILMethod_FatFormat;
 		pHeader->Size = sizeof(IMAGE_COR_ILMETHOD_FAT) / sizeof(DWORD);
 		pHeader->MaxStack = m_maxStack;
 		pHeader->CodeSize = offset;
@@ -509,8 +987,33 @@ again:
 		}
 
 		pCurrent += alignedCodeSize;
-		BYTE* startOfRemainder = pCurrent - (alignedCodeSize - offset);
-		
+
+		if (m_nEH != 0)
+		{
+			IMAGE_COR_ILMETHOD_SECT_FAT* pEH = (IMAGE_COR_ILMETHOD_SECT_FAT*)pCurrent;
+			pEH->Kind = CorILMethod_Sect_EHTable | CorILMethod_Sect_FatFormat;
+			pEH->DataSize = (unsigned)(sizeof(IMAGE_COR_ILMETHOD_SECT_FAT) + sizeof(IMAGE_COR_ILMETHOD_SECT_EH_CLAUSE_FAT) * m_nEH);
+
+			pCurrent = (BYTE*)(pEH + 1);
+
+			for (unsigned iEH = 0; iEH < m_nEH; iEH++)
+			{
+				EHClause* pSrc = &(m_pEH[iEH]);
+				IMAGE_COR_ILMETHOD_SECT_EH_CLAUSE_FAT* pDst = (IMAGE_COR_ILMETHOD_SECT_EH_CLAUSE_FAT*)pCurrent;
+
+				pDst->Flags = pSrc->m_Flags;
+				pDst->TryOffset = pSrc->m_pTryBegin->m_offset;
+				pDst->TryLength = pSrc->m_pTryEnd->m_offset - pSrc->m_pTryBegin->m_offset;
+				pDst->HandlerOffset = pSrc->m_pHandlerBegin->m_offset;
+				pDst->HandlerLength = pSrc->m_pHandlerEnd->m_pNext->m_offset - pSrc->m_pHandlerBegin->m_offset;
+				if ((pSrc->m_Flags & COR_ILEXCEPTION_CLAUSE_FILTER) == 0)
+					pDst->ClassToken = pSrc->m_ClassToken;
+				else
+					pDst->FilterOffset = pSrc->m_pFilter->m_offset;
+
+				pCurrent = (BYTE*)(pDst + 1);
+			}
+		}
 	}
 	//spdlog::debug("Exporting method");
 	//ParseRawILStream(pBody, totalSize);
@@ -112,7 +112,7 @@ static const BYTE s_OpCodeFlags[] =
     4 | OPCODEFLAGS_BranchTarget,   // CEE_SWITCH_ARG
 };
 
-static int k_rgnStackPushes[] = {
+static const int k_rgnStackPushes[] = {
 
 #define OPDEF(c,s,pop,push,args,type,l,s1,s2,ctrl) \
 	{ push },
@@ -138,6 +138,40 @@ static int k_rgnStackPushes[] = {
 #undef PushR8  
 #undef PushRef 
 #undef VarPush 
+#undef OPDEF
+    0,                              // CEE_COUNT
+    0,                              // CEE_SWITCH_ARG
+};
+
+// Number of stack slots each opcode pops. Calls and ret pop a signature dependent number of values and are marked as VarPop
+#define VARIABLE_STACK_POPS -1
+
+static const int k_rgnStackPops[] = {
+
+#define OPDEF(c,s,pop,push,args,type,l,s1,s2,ctrl) \
+	{ pop },
+
+#define Pop0     0
+#define Pop1     1
+#define PopI     1
+#define PopI4    1
+#define PopI8    1
+#define PopR4    1
+#define PopR8    1
+#define PopRef   1
+#define VarPop   VARIABLE_STACK_POPS
+
+#include "opcode.def"
+
+#undef Pop0
+#undef Pop1
+#undef PopI
+#undef PopI4
+#undef PopI8
+#undef PopR4
+#undef PopR8
+#undef PopRef
+#undef VarPop
 #undef OPDEF
 };
 
@@ -158,6 +192,9 @@ private:
 
     ILInstr m_IL; // Double linked list of all il instructions
 
+    unsigned    m_nEH;
+    EHClause* m_pEH;
+
 
     // Helper table for importing.  Sparse array that maps BYTE offset of beginning of an
     // instruction to that instruction's ILInstr*.  BYTE offsets that don't correspond
@@ -184,14 +221,23 @@ public:
 
     HRESULT Import();
     HRESULT ImportIL(LPCBYTE pIL);
+    HRESULT ImportEH(const COR_ILMETHOD_SECT_EH* pILEH, unsigned nEH);
     
     ILInstr* NewILInstr();
     ILInstr* GetInstrFromOffset(unsigned offset);
     void InsertBefore(ILInstr* pWhere, ILInstr* pWhat);
     void InsertAfter(ILInstr* pWhere, ILInstr* pWhat);
+    void SpliceBefore(ILInstr* pWhere, ILInstr* pFirst, ILInstr* pLast, unsigned stackDepth);
     void AdjustState(ILInstr* pNewInstr);
+    void RedirectTargets(ILInstr* pFrom, ILInstr* pTo);
     ILInstr* GetILList();
 
+    HRESULT AddLocal(CorElementType type, unsigned* pIndex);
+
+    HRESULT Optimize();
+    unsigned GetEncodedSize();
+    void RemoveInstr(ILInstr* pInstr);
+
     HRESULT Export();
     HRESULT SetILFunctionBody(unsigned size, LPBYTE pBody);
     LPBYTE AllocateILMemory(unsigned size);
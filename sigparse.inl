@@ -291,7 +291,7 @@ protected:
 	virtual void NotifyTypeSzArray() {}
 };
 
-bool SigParser::Parse(sig_byte* pb, sig_count cbBuffer)
+inline bool SigParser::Parse(sig_byte* pb, sig_count cbBuffer)
 {
 	pbBase = pb;
 	pbCur = pb;
@@ -328,7 +328,7 @@ bool SigParser::Parse(sig_byte* pb, sig_count cbBuffer)
 	return false;
 }
 
-bool SigParser::ParseByte(sig_byte* pbOut)
+inline bool SigParser::ParseByte(sig_byte* pbOut)
 {
 	if (pbCur < pbEnd)
 	{
@@ -340,7 +340,7 @@ bool SigParser::ParseByte(sig_byte* pbOut)
 	return false;
 }
 
-bool SigParser::ParseMethod(sig_elem_type elem_type)
+inline bool SigParser::ParseMethod(sig_elem_type elem_type)
 {
 	// MethodDefSig ::= [[HASTHIS] [EXPLICITTHIS]] (DEFAULT|VARARG|GENERIC GenParamCount)
 	//                    ParamCount RetType Param* [SENTINEL Param+]
@@ -392,7 +392,7 @@ bool SigParser::ParseMethod(sig_elem_type elem_type)
 	return true;
 }
 
-bool SigParser::ParseField(sig_elem_type elem_type)
+inline bool SigParser::ParseField(sig_elem_type elem_type)
 {
 	// FieldSig ::= FIELD CustomMod* Type
 
@@ -409,7 +409,7 @@ bool SigParser::ParseField(sig_elem_type elem_type)
 	return true;
 }
 
-bool SigParser::ParseProperty(sig_elem_type elem_type)
+inline bool SigParser::ParseProperty(sig_elem_type elem_type)
 {
 	// PropertySig ::= PROPERTY [HASTHIS] ParamCount CustomMod* Type Param*
 
@@ -436,7 +436,7 @@ bool SigParser::ParseProperty(sig_elem_type elem_type)
 	return true;
 }
 
-bool SigParser::ParseLocals(sig_elem_type elem_type)
+inline bool SigParser::ParseLocals(sig_elem_type elem_type)
 {
 	//   LocalVarSig ::= LOCAL_SIG Count (TYPEDBYREF | ([CustomMod] [Constraint])* [BYREF] Type)+ 
 
@@ -460,7 +460,7 @@ bool SigParser::ParseLocals(sig_elem_type elem_type)
 	return true;
 }
 
-bool SigParser::ParseLocal()
+inline bool SigParser::ParseLocal()
 {
 	//TYPEDBYREF | ([CustomMod] [Constraint])* [BYREF] Type
 	NotifyBeginLocal();
@@ -495,7 +495,7 @@ Success:
 	return true;
 }
 
-bool SigParser::ParseOptionalCustomModsOrConstraint()
+inline bool SigParser::ParseOptionalCustomModsOrConstraint()
 {
 	for (;;)
 	{
@@ -523,7 +523,7 @@ bool SigParser::ParseOptionalCustomModsOrConstraint()
 	return false;
 }
 
-bool SigParser::ParseOptionalCustomMods()
+inline bool SigParser::ParseOptionalCustomMods()
 {
 	while (true)
 	{
@@ -546,7 +546,7 @@ bool SigParser::ParseOptionalCustomMods()
 	return false;
 }
 
-bool SigParser::ParseCustomMod()
+inline bool SigParser::ParseCustomMod()
 {
 	sig_elem_type cmod = 0;
 	sig_index index;
@@ -567,7 +567,7 @@ bool SigParser::ParseCustomMod()
 	return false;
 }
 
-bool SigParser::ParseParam()
+inline bool SigParser::ParseParam()
 {
 	// Param ::= CustomMod* ( TYPEDBYREF | [BYREF] Type )
 
@@ -600,7 +600,7 @@ Success:
 	return true;
 }
 
-bool SigParser::ParseRetType()
+inline bool SigParser::ParseRetType()
 {
 	// RetType ::= CustomMod* ( VOID | TYPEDBYREF | [BYREF] Type )
 
@@ -640,7 +640,7 @@ Success:
 	return true;
 }
 
-bool SigParser::ParseArrayShape()
+inline bool SigParser::ParseArrayShape()
 {
 	sig_count rank;
 	sig_count numsizes;
@@ -683,7 +683,7 @@ bool SigParser::ParseArrayShape()
 	return true;
 }
 
-bool SigParser::ParseType()
+inline bool SigParser::ParseType()
 {
 	/*
 	Type ::= ( BOOLEAN | CHAR | I1 | U1 | U2 | U2 | I4 | U4 | I8 | U8 | R4 | R8 | I | U |
@@ -863,7 +863,7 @@ bool SigParser::ParseType()
 	return true;
 }
 
-bool SigParser::ParseTypeDefOrRefEncoded(sig_index_type* pIndexTypeOut, sig_index* pIndexOut)
+inline bool SigParser::ParseTypeDefOrRefEncoded(sig_index_type* pIndexTypeOut, sig_index* pIndexOut)
 {
 	// parse an encoded typedef or typeref
 
@@ -877,7 +877,7 @@ bool SigParser::ParseTypeDefOrRefEncoded(sig_index_type* pIndexTypeOut, sig_inde
 	return true;
 }
 
-bool SigParser::ParseNumber(sig_count* pOut)
+inline bool SigParser::ParseNumber(sig_count* pOut)
 {
 	// parse the variable length number format (0-4 bytes)
 
@@ -9,9 +9,11 @@
 
 #pragma once
 
+#ifdef _WIN32
 #define WIN32_LEAN_AND_MEAN // Exclude rarely-used stuff from Windows headers
 // Windows Header Files:
 #include <windows.h>
+#endif
 #include <assert.h>
 #include "cor.h"
 #include "corhdr.h"
@@ -21,4 +23,6 @@
 #include "corpub.h"
 #include "corprof.h"
 #include "mscoree.h"
-#include "spdlog/spdlog.h"
\ No newline at end of file
+#include "spdlog/spdlog.h"
+
+#include "Platform.h"
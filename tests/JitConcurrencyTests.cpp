@@ -0,0 +1,165 @@
+#include "stdafx.h"
+#include "MockRuntime.h"
+#include "HookConfig.h"
+#include "ZeroedProfiler.h"
+#include "Utils.h"
+#include <atomic>
+#include <cstdlib>
+#include <thread>
+#include <vector>
+
+// Raises JITCompilationStarted from many threads at once with NGEN disabled, so every hooked method is rewritten on the
+// thread compiling it while other threads load modules and install hooks. Meant to be run under ThreadSanitizer, see
+// ZEROED_PROFILER_TSAN, which reports any unsynchronized access; without it the test still checks every method compiled
+// and every hooked method was rewritten
+
+#define COMPILING_THREADS 16
+#define INITIAL_MODULES 8
+#define LATE_MODULES 8
+
+// A mix of dispatch, inline and timed hooks across methods of different sizes
+#define CONCURRENCY_HOOKS "ZeroedFixture.dll!ZeroedFixture.Targets.Dispatch(0)=dispatch+timed;" \
+	"ZeroedFixture.dll!ZeroedFixture.Targets.Inline(0,1)=inline;" \
+	"ZeroedFixture.dll!ZeroedFixture.Targets.Timed()=timed;" \
+	"ZeroedFixture.dll!ZeroedFixture.Sizes.Tiny(0,1)=inline;" \
+	"ZeroedFixture.dll!ZeroedFixture.Sizes.Medium()=timed;" \
+	"ZeroedFixture.dll!ZeroedFixture.Sizes.Large(0,1)=inline+timed"
+#define HOOKED_METHODS 6
+
+static void SetVariable(const char* name, const char* value)
+{
+#ifdef _WIN32
+	_putenv_s(name, value);
+#else
+	setenv(name, value, 1);
+#endif
+}
+
+// Every method with a body in the fixture, found by compiling each method definition in a runtime with no profiler
+static std::vector<mdMethodDef> FindMethods(const std::string& fixture)
+{
+	MockRuntime scratch;
+	ModuleID moduleId;
+	std::vector<mdMethodDef> methods;
+	if (FAILED(scratch.LoadModule(fixture, &moduleId)))
+		return methods;
+
+	for (ULONG rid = 1;; rid++) {
+		HRESULT hr = scratch.JitMethod(moduleId, TokenFromRid(rid, mdtMethodDef), nullptr);
+		if (hr == E_INVALIDARG)
+			break;
+		if (SUCCEEDED(hr))
+			methods.push_back(TokenFromRid(rid, mdtMethodDef));
+	}
+	return methods;
+}
+
+static bool IsRewritten(MockRuntime& runtime, ModuleID moduleId, mdMethodDef methodDef, const std::vector<BYTE>& original)
+{
+	std::vector<BYTE> current;
+	return SUCCEEDED(runtime.GetCurrentIL(moduleId, methodDef, current)) && current != original;
+}
+
+int main(int argc, char** argv)
+{
+	if (argc != 3) {
+		fmt::print(stderr, "Usage: JitConcurrencyTests <fixture assembly> <profiler library>\n");
+		return 2;
+	}
+
+	std::string fixture = argv[1];
+	std::vector<mdMethodDef> methods = FindMethods(fixture);
+	if (methods.empty()) {
+		fmt::print(stderr, "Failed to read any methods from the fixture assembly {}\n", fixture);
+		return 2;
+	}
+
+	SetVariable(HOOK_CONFIG_VARIABLE, CONCURRENCY_HOOKS);
+	SetVariable(DISABLE_NGEN_VARIABLE, "1");
+	if (std::getenv("ZEROED_PROFILER_LOG_LEVEL") == nullptr)
+		SetVariable("ZEROED_PROFILER_LOG_LEVEL", "warn");
+
+	MockRuntime runtime;
+	IUnknown* pProfiler = nullptr;
+	if (FAILED(MockRuntime::CreateProfiler(argv[2], CLSID_ZeroedProfiler, &pProfiler)) || FAILED(runtime.LoadProfiler(pProfiler))) {
+		fmt::print(stderr, "Failed to load the profiler from {}\n", argv[2]);
+		return 2;
+	}
+	pProfiler->Release();
+
+	std::vector<ModuleID> modules(INITIAL_MODULES + LATE_MODULES);
+	for (int i = 0; i < INITIAL_MODULES; i++) {
+		if (FAILED(runtime.LoadModule(fixture, &modules[i]))) {
+			fmt::print(stderr, "Failed to load the fixture assembly {}\n", fixture);
+			return 2;
+		}
+	}
+
+	// The original bodies, the same in every copy, to tell which methods the profiler rewrote
+	std::vector<std::vector<BYTE>> originals(methods.size());
+	for (size_t m = 0; m < methods.size(); m++) {
+		LPCBYTE pBody;
+		ULONG cbBody;
+		runtime.GetILFunctionBody(modules[0], methods[m], &pBody, &cbBody);
+		originals[m].assign(pBody, pBody + cbBody);
+	}
+
+	// Each thread compiles every COMPILING_THREADS'th method of every initial module, so all of them compile the same
+	// modules at once but each method only once, as the runtime would. The first few threads then load a late module
+	// each and compile it, installing hooks while the others are still compiling
+	std::atomic<bool> go{ false };
+	std::atomic<int> failures{ 0 };
+	std::vector<std::thread> threads;
+	for (int t = 0; t < COMPILING_THREADS; t++) {
+		threads.emplace_back([&, t] {
+			while (!go.load())
+				std::this_thread::yield();
+
+			for (int i = 0; i < INITIAL_MODULES; i++) {
+				for (size_t m = t; m < methods.size(); m += COMPILING_THREADS) {
+					if (FAILED(runtime.JitMethod(modules[i], methods[m], nullptr)))
+						failures++;
+				}
+			}
+
+			if (t < LATE_MODULES) {
+				ModuleID& moduleId = modules[INITIAL_MODULES + t];
+				if (FAILED(runtime.LoadModule(fixture, &moduleId))) {
+					failures++;
+					return;
+				}
+				for (mdMethodDef methodDef : methods) {
+					if (FAILED(runtime.JitMethod(moduleId, methodDef, nullptr)))
+						failures++;
+				}
+			}
+		});
+	}
+
+	go = true;
+	for (std::thread& thread : threads)
+		thread.join();
+
+	// Whatever one copy had rewritten, every copy should have had rewritten
+	size_t mismatched = 0, rewritten = 0;
+	for (size_t m = 0; m < methods.size(); m++) {
+		bool expected = IsRewritten(runtime, modules[0], methods[m], originals[m]);
+		rewritten += expected;
+		for (ModuleID moduleId : modules) {
+			if (IsRewritten(runtime, moduleId, methods[m], originals[m]) != expected)
+				mismatched++;
+		}
+	}
+
+	runtime.Shutdown();
+
+	fmt::print("{} methods compiled in each of {} modules, {} rewritten\n", methods.size(), modules.size(), rewritten);
+	if (failures != 0 || mismatched != 0 || rewritten != HOOKED_METHODS) {
+		fmt::print(stderr, "{} compilations failed, {} methods rewritten differently across modules, {} of {} hooked methods rewritten\n",
+			failures.load(), mismatched, rewritten, HOOKED_METHODS);
+		return 1;
+	}
+
+	fmt::print("ok\n");
+	return 0;
+}
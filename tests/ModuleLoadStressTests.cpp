@@ -0,0 +1,254 @@
+#include "stdafx.h"
+#include "MockRuntime.h"
+#include "ShardedMap.h"
+#include "HookConfig.h"
+#include "ControlChannel.h"
+#include "ZeroedProfiler.h"
+#include "Utils.h"
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <filesystem>
+#include <fstream>
+#include <thread>
+#include <vector>
+
+// Loads and unloads modules from many threads at once. The first stage hammers ShardedMap directly, the second loads
+// hundreds of copies of the fixture into the profiler on the mock runtime, unloads half of them while more load, and checks
+// every live copy was hooked exactly as if it had loaded alone and that the profiler can still detach afterwards
+
+#define LOADING_THREADS 16
+#define MODULES_PER_THREAD 16
+#define MAP_KEYS_PER_THREAD 2000
+#define REJIT_QUIET_MS 200
+#define DETACH_WAIT_MS 10000
+
+// Dispatch and inline capture hooks, so loads inject both the dispatcher and calli signatures
+#define STRESS_HOOKS "ZeroedFixture.dll!ZeroedFixture.Targets.Dispatch(0);ZeroedFixture.dll!ZeroedFixture.Targets.Inline(0,1)=inline"
+
+static void SetVariable(const char* name, const char* value)
+{
+#ifdef _WIN32
+	_putenv_s(name, value);
+#else
+	setenv(name, value, 1);
+#endif
+}
+
+// Runs body(thread index) on LOADING_THREADS threads, released together so they really do overlap
+template <typename Body>
+static void RunConcurrently(Body body)
+{
+	std::atomic<bool> go{ false };
+	std::vector<std::thread> threads;
+	for (int t = 0; t < LOADING_THREADS; t++) {
+		threads.emplace_back([&, t] {
+			while (!go.load())
+				std::this_thread::yield();
+			body(t);
+		});
+	}
+
+	go = true;
+	for (std::thread& thread : threads)
+		thread.join();
+}
+
+// Each thread adds, overwrites and removes its own keys while reading everyone else's and a reader walks the whole map.
+// Every key ends up removed or holding the last value written to it
+static bool StressShardedMap()
+{
+	ShardedMap<UINT64, std::vector<UINT64>> map;
+	std::atomic<bool> stop{ false };
+	std::atomic<size_t> badReads{ 0 };
+
+	// Values are always three copies of the key's generation, so a torn or stale table shows up as mismatched entries
+	auto check = [&](UINT64, const std::vector<UINT64>& value) {
+		if (value.size() != 3 || value[0] != value[1] || value[1] != value[2])
+			badReads++;
+	};
+	std::thread reader([&] {
+		while (!stop)
+			map.ForEach(check);
+	});
+
+	RunConcurrently([&](int t) {
+		UINT64 first = (UINT64)t * MAP_KEYS_PER_THREAD;
+		for (UINT64 key = first; key < first + MAP_KEYS_PER_THREAD; key++) {
+			if (!map.TryAdd(key, { 1, 1, 1 }) || map.TryAdd(key, { 9, 9, 9 }))
+				badReads++;
+			map.Set(key, { 2, 2, 2 });
+			if (key % 2 == 0 && !map.Remove(key))
+				badReads++;
+
+			// Someone else's key, which may or may not be there yet
+			UINT64 other = (key * 7919) % ((UINT64)LOADING_THREADS * MAP_KEYS_PER_THREAD);
+			map.Visit(other, [&](const std::vector<UINT64>& value) { check(other, value); });
+		}
+	});
+
+	stop = true;
+	reader.join();
+
+	size_t wrong = 0;
+	for (UINT64 key = 0; key < (UINT64)LOADING_THREADS * MAP_KEYS_PER_THREAD; key++) {
+		bool found = map.Visit(key, [&](const std::vector<UINT64>& value) {
+			if (value != std::vector<UINT64>{ 2, 2, 2 })
+				wrong++;
+		});
+		if (found != (key % 2 != 0))
+			wrong++;
+	}
+	map.Clear();
+
+	if (badReads != 0 || wrong != 0) {
+		fmt::print(stderr, "ShardedMap: {} bad reads during the run, {} wrong entries afterwards\n", badReads.load(), wrong);
+		return false;
+	}
+
+	fmt::print("ShardedMap: ok\n");
+	return true;
+}
+
+// Whether the method's current body is the one the profiler rewrote rather than the one it was loaded with
+static bool IsHooked(MockRuntime& runtime, ModuleID moduleId, mdMethodDef methodDef)
+{
+	LPCBYTE pOriginal;
+	ULONG cbOriginal;
+	std::vector<BYTE> current;
+	if (FAILED(runtime.GetILFunctionBody(moduleId, methodDef, &pOriginal, &cbOriginal)) ||
+		FAILED(runtime.GetCurrentIL(moduleId, methodDef, current)))
+		return false;
+
+	return current.size() != cbOriginal || memcmp(current.data(), pOriginal, cbOriginal) != 0;
+}
+
+// Loads MODULES_PER_THREAD copies of the fixture on every thread, adding their IDs to moduleIds
+static bool LoadModules(MockRuntime& runtime, const std::string& fixture, std::vector<ModuleID>& moduleIds, std::vector<ModuleID>* pUnload)
+{
+	std::vector<std::vector<ModuleID>> loaded(LOADING_THREADS);
+	std::atomic<int> failures{ 0 };
+	RunConcurrently([&](int t) {
+		for (int i = 0; i < MODULES_PER_THREAD; i++) {
+			ModuleID moduleId;
+			if (FAILED(runtime.LoadModule(fixture, &moduleId)))
+				failures++;
+			else
+				loaded[t].push_back(moduleId);
+
+			// Unload a module from an earlier round between loads, on whichever thread its turn falls to
+			if (pUnload != nullptr) {
+				size_t index = (size_t)t * MODULES_PER_THREAD + i;
+				if (index < pUnload->size() && FAILED(runtime.UnloadModule((*pUnload)[index])))
+					failures++;
+			}
+		}
+	});
+
+	for (const std::vector<ModuleID>& ids : loaded)
+		moduleIds.insert(moduleIds.end(), ids.begin(), ids.end());
+
+	if (failures != 0) {
+		fmt::print(stderr, "{} module loads or unloads failed\n", failures.load());
+		return false;
+	}
+	return true;
+}
+
+static bool StressProfiler(const std::string& fixture, const std::string& profiler)
+{
+	std::string controlFile = (std::filesystem::temp_directory_path() / fmt::format("zeroed-stress-{}.control", CurrentProcessId())).string();
+	std::remove(controlFile.c_str());
+
+	SetVariable(HOOK_CONFIG_VARIABLE, STRESS_HOOKS);
+	SetVariable(CONTROL_FILE_VARIABLE, controlFile.c_str());
+	if (std::getenv("ZEROED_PROFILER_LOG_LEVEL") == nullptr)
+		SetVariable("ZEROED_PROFILER_LOG_LEVEL", "warn");
+
+	MockRuntime runtime;
+	IUnknown* pProfiler = nullptr;
+	if (FAILED(MockRuntime::CreateProfiler(profiler, CLSID_ZeroedProfiler, &pProfiler)) || FAILED(runtime.LoadProfiler(pProfiler))) {
+		fmt::print(stderr, "Failed to load the profiler from {}\n", profiler);
+		return false;
+	}
+	pProfiler->Release();
+
+	// Every copy of the fixture has the same tokens, so they're looked up in a scratch copy which is never loaded
+	mdMethodDef dispatch, inlined;
+	{
+		MockRuntime scratch;
+		ModuleID moduleId;
+		IMetaDataImport* pImport;
+		mdTypeDef typeDef;
+		if (FAILED(scratch.OpenModule(fixture, &moduleId)) ||
+			FAILED(scratch.GetModuleMetaData(moduleId, ofRead, IID_IMetaDataImport, (IUnknown**)&pImport)) ||
+			FAILED(pImport->FindTypeDefByName(WSTR("ZeroedFixture.Targets"), mdTokenNil, &typeDef)) ||
+			FAILED(pImport->FindMethod(typeDef, WSTR("Dispatch"), nullptr, 0, &dispatch)) ||
+			FAILED(pImport->FindMethod(typeDef, WSTR("Inline"), nullptr, 0, &inlined))) {
+			fmt::print(stderr, "Failed to open the fixture assembly {}\n", fixture);
+			return false;
+		}
+		pImport->Release();
+	}
+
+	// Load a first round, then unload every other module of it while a second round loads
+	std::vector<ModuleID> firstRound;
+	if (!LoadModules(runtime, fixture, firstRound, nullptr))
+		return false;
+
+	std::vector<ModuleID> unload, live;
+	for (size_t i = 0; i < firstRound.size(); i++)
+		(i % 2 == 0 ? unload : live).push_back(firstRound[i]);
+
+	if (!LoadModules(runtime, fixture, live, &unload))
+		return false;
+
+	size_t reJitFailures = 0;
+	size_t reJitted = runtime.ProcessReJITRequests(REJIT_QUIET_MS, &reJitFailures);
+
+	// Unloaded modules are freed, so later loads are often given the same IDs and must not inherit their hooks
+	size_t unhooked = 0;
+	for (ModuleID moduleId : live) {
+		if (!IsHooked(runtime, moduleId, dispatch) || !IsHooked(runtime, moduleId, inlined))
+			unhooked++;
+	}
+
+	fmt::print("Profiler: {} modules loaded, {} unloaded, {} methods recompiled\n", 2 * firstRound.size(), unload.size(), reJitted);
+	if (reJitFailures != 0 || unhooked != 0) {
+		fmt::print(stderr, "Profiler: {} recompilations failed, {} of {} live modules weren't hooked\n", reJitFailures, unhooked, live.size());
+		return false;
+	}
+
+	// Detaching reverts every hooked method, which fails if hooks in the unloaded modules were kept
+	{
+		std::ofstream(controlFile) << "detach\n";
+	}
+	auto deadline = std::chrono::steady_clock::now() + std::chrono::milliseconds(DETACH_WAIT_MS);
+	while (!runtime.DetachRequested() && std::chrono::steady_clock::now() < deadline)
+		std::this_thread::sleep_for(std::chrono::milliseconds(50));
+
+	bool detached = runtime.DetachRequested();
+	runtime.Shutdown();
+	std::remove(controlFile.c_str());
+
+	if (!detached) {
+		fmt::print(stderr, "Profiler: didn't detach after the unloads\n");
+		return false;
+	}
+
+	fmt::print("Profiler: ok\n");
+	return true;
+}
+
+int main(int argc, char** argv)
+{
+	if (argc != 3) {
+		fmt::print(stderr, "Usage: ModuleLoadStressTests <fixture assembly> <profiler library>\n");
+		return 2;
+	}
+
+	bool passed = StressShardedMap();
+	passed = StressProfiler(argv[1], argv[2]) && passed;
+	return passed ? 0 : 1;
+}
@@ -0,0 +1,281 @@
+#include "stdafx.h"
+#include "MockRuntime.h"
+#include "ILValidator.h"
+#include "ilrewriter.h"
+#include "Utils.h"
+#include <cstring>
+#include <vector>
+
+// Checks ILRewriter::Optimize leaves what a method computes unchanged. Each case is a small body with a single local,
+// written into a method of the fixture assembly, evaluated as it was written and again after an Import, Optimize and
+// Export, and the two results compared bit for bit. Stores to locals narrower than the stack slot truncate or round the
+// value, so the store/load pair must survive for those and go for the rest
+
+// A value on the evaluation stack. Integers are kept sign extended to 64 bits, floats as double like the runtime's F type
+struct StackValue
+{
+	bool IsFloat = false;
+	INT64 Int = 0;
+	double Float = 0;
+};
+
+struct TestCase
+{
+	const char* Name;
+	CorElementType LocalType;
+	std::vector<BYTE> Code;
+	// Whether Optimize is expected to remove the store/load pair
+	bool ExpectRemoved;
+};
+
+// The value a store to a local of the given type leaves behind, ECMA-335 III.1.6
+static StackValue StoreTo(CorElementType type, StackValue value)
+{
+	StackValue stored = value;
+	switch (type)
+	{
+	case ELEMENT_TYPE_I1: stored.Int = (INT8)value.Int; break;
+	case ELEMENT_TYPE_BOOLEAN:
+	case ELEMENT_TYPE_U1: stored.Int = (UINT8)value.Int; break;
+	case ELEMENT_TYPE_I2: stored.Int = (INT16)value.Int; break;
+	case ELEMENT_TYPE_CHAR:
+	case ELEMENT_TYPE_U2: stored.Int = (UINT16)value.Int; break;
+	case ELEMENT_TYPE_R4: stored.Float = (float)value.Float; break;
+	default: break;
+	}
+	return stored;
+}
+
+// Runs the handful of opcodes the cases use. Returns false on anything else. Counts the stores so the test can tell
+// whether the pair survived
+static bool Evaluate(const BYTE* pBody, ULONG cbBody, CorElementType localType, StackValue* pResult, unsigned* pStores)
+{
+	MethodBody body;
+	if (FAILED(ParseMethodBody(pBody, cbBody, &body)))
+		return false;
+
+	const BYTE* pCode = pBody + body.HeaderSize;
+	std::vector<StackValue> stack;
+	StackValue local;
+	*pStores = 0;
+
+	ULONG offset = 0;
+	for (unsigned steps = 0; offset < body.CodeSize && steps < 1000; steps++)
+	{
+		BYTE opcode = pCode[offset++];
+		StackValue value;
+		switch (opcode)
+		{
+		case CEE_NOP:
+			break;
+		case CEE_LDC_I4_M1: case CEE_LDC_I4_0: case CEE_LDC_I4_1: case CEE_LDC_I4_2: case CEE_LDC_I4_3:
+		case CEE_LDC_I4_4: case CEE_LDC_I4_5: case CEE_LDC_I4_6: case CEE_LDC_I4_7: case CEE_LDC_I4_8:
+			value.Int = (INT32)opcode - CEE_LDC_I4_0;
+			stack.push_back(value);
+			break;
+		case CEE_LDC_I4_S:
+			value.Int = (INT8)pCode[offset++];
+			stack.push_back(value);
+			break;
+		case CEE_LDC_I4:
+			value.Int = *(UNALIGNED INT32*)&pCode[offset];
+			offset += 4;
+			stack.push_back(value);
+			break;
+		case CEE_LDC_R8:
+			value.IsFloat = true;
+			memcpy(&value.Float, &pCode[offset], sizeof(double));
+			offset += 8;
+			stack.push_back(value);
+			break;
+		case CEE_STLOC_0:
+			if (stack.empty())
+				return false;
+			local = StoreTo(localType, stack.back());
+			stack.pop_back();
+			(*pStores)++;
+			break;
+		case CEE_LDLOC_0:
+			stack.push_back(local);
+			break;
+		case CEE_ADD:
+		{
+			if (stack.size() < 2)
+				return false;
+			StackValue right = stack.back();
+			stack.pop_back();
+			StackValue& left = stack.back();
+			if (left.IsFloat)
+				left.Float += right.Float;
+			else
+				left.Int += right.Int;
+			break;
+		}
+		case CEE_BR_S:
+			offset += (INT8)pCode[offset] + 1;
+			break;
+		case CEE_BR:
+			offset += *(UNALIGNED INT32*)&pCode[offset] + 4;
+			break;
+		case CEE_RET:
+			if (stack.size() != 1)
+				return false;
+			*pResult = stack.back();
+			return true;
+		default:
+			return false;
+		}
+	}
+
+	return false;
+}
+
+static std::vector<BYTE> FatBody(const std::vector<BYTE>& code, mdSignature localVarSig)
+{
+	std::vector<BYTE> body(12);
+	*(UNALIGNED WORD*)&body[0] = (WORD)(CorILMethod_FatFormat | CorILMethod_InitLocals | (3 << 12));
+	*(UNALIGNED WORD*)&body[2] = 8;
+	*(UNALIGNED DWORD*)&body[4] = (DWORD)code.size();
+	*(UNALIGNED DWORD*)&body[8] = localVarSig;
+	body.insert(body.end(), code.begin(), code.end());
+	return body;
+}
+
+static std::vector<BYTE> I4(INT32 value)
+{
+	std::vector<BYTE> code = { CEE_LDC_I4, 0, 0, 0, 0 };
+	memcpy(&code[1], &value, sizeof(value));
+	return code;
+}
+
+static std::vector<BYTE> R8(double value)
+{
+	std::vector<BYTE> code = { CEE_LDC_R8, 0, 0, 0, 0, 0, 0, 0, 0 };
+	memcpy(&code[1], &value, sizeof(value));
+	return code;
+}
+
+static std::vector<BYTE> Concat(std::initializer_list<std::vector<BYTE>> parts)
+{
+	std::vector<BYTE> code;
+	for (const std::vector<BYTE>& part : parts)
+		code.insert(code.end(), part.begin(), part.end());
+	return code;
+}
+
+static bool RunCase(MockRuntime& runtime, ModuleID moduleId, IMetaDataEmit* pEmit, mdMethodDef methodDef, const TestCase& test)
+{
+	COR_SIGNATURE signature[] = { IMAGE_CEE_CS_CALLCONV_LOCAL_SIG, 1, (COR_SIGNATURE)test.LocalType };
+	mdSignature localVarSig;
+	if (FAILED(pEmit->GetTokenFromSig(signature, sizeof(signature), &localVarSig)))
+	{
+		fmt::print(stderr, "{}: failed to define the local signature\n", test.Name);
+		return false;
+	}
+
+	// The rewriter reads the body the same way the profiler does, through the runtime
+	std::vector<BYTE> original = FatBody(test.Code, localVarSig);
+	IMethodMalloc* pMalloc;
+	runtime.GetILFunctionBodyAllocator(moduleId, &pMalloc);
+	BYTE* pOriginal = (BYTE*)pMalloc->Alloc((ULONG)original.size());
+	memcpy(pOriginal, original.data(), original.size());
+	runtime.SetILFunctionBody(moduleId, methodDef, pOriginal);
+
+	MockFunctionControl functionControl;
+	ILRewriter rewriter(&runtime, &functionControl, moduleId, methodDef);
+	HRESULT hr = rewriter.Initialize();
+	if (SUCCEEDED(hr))
+		hr = rewriter.Import();
+	if (SUCCEEDED(hr))
+		hr = rewriter.Optimize();
+	if (SUCCEEDED(hr))
+		hr = rewriter.Export();
+	if (FAILED(hr))
+	{
+		fmt::print(stderr, "{}: rewriting failed with {}\n", test.Name, HrToString(hr));
+		return false;
+	}
+
+	StackValue expected, actual;
+	unsigned originalStores, optimizedStores;
+	if (!Evaluate(original.data(), (ULONG)original.size(), test.LocalType, &expected, &originalStores) ||
+		!Evaluate(functionControl.Body.data(), (ULONG)functionControl.Body.size(), test.LocalType, &actual, &optimizedStores))
+	{
+		fmt::print(stderr, "{}: couldn't evaluate the body\n", test.Name);
+		return false;
+	}
+
+	bool fSame = expected.IsFloat == actual.IsFloat &&
+		(expected.IsFloat ? memcmp(&expected.Float, &actual.Float, sizeof(double)) == 0 : expected.Int == actual.Int);
+	if (!fSame)
+	{
+		fmt::print(stderr, "{}: returned {} before optimizing and {} after\n", test.Name,
+			expected.IsFloat ? fmt::format("{}", expected.Float) : fmt::format("{}", expected.Int),
+			actual.IsFloat ? fmt::format("{}", actual.Float) : fmt::format("{}", actual.Int));
+		return false;
+	}
+
+	bool fRemoved = optimizedStores < originalStores;
+	if (fRemoved != test.ExpectRemoved)
+	{
+		fmt::print(stderr, "{}: store/load pair was {} but should have been {}\n", test.Name,
+			fRemoved ? "removed" : "kept", test.ExpectRemoved ? "removed" : "kept");
+		return false;
+	}
+
+	fmt::print("{}: ok\n", test.Name);
+	return true;
+}
+
+int main(int argc, char** argv)
+{
+	if (argc != 2)
+	{
+		fmt::print(stderr, "Usage: OptimizeTests <fixture assembly>\n");
+		return 2;
+	}
+
+	MockRuntime runtime;
+	ModuleID moduleId;
+	IMetaDataImport* pImport;
+	IMetaDataEmit* pEmit;
+	mdTypeDef typeDef;
+	mdMethodDef methodDef;
+	if (FAILED(runtime.OpenModule(argv[1], &moduleId)) ||
+		FAILED(runtime.GetModuleMetaData(moduleId, ofRead | ofWrite, IID_IMetaDataImport, (IUnknown**)&pImport)) ||
+		FAILED(pImport->QueryInterface(IID_IMetaDataEmit, (void**)&pEmit)) ||
+		FAILED(pImport->FindTypeDefByName(WSTR("ZeroedFixture.Targets"), mdTokenNil, &typeDef)) ||
+		FAILED(pImport->FindMethod(typeDef, WSTR("Unhooked"), nullptr, 0, &methodDef)))
+	{
+		fmt::print(stderr, "Failed to open the fixture assembly {}\n", argv[1]);
+		return 2;
+	}
+
+	const std::vector<BYTE> storeLoad = { CEE_STLOC_0, CEE_LDLOC_0 };
+	const std::vector<BYTE> ret = { CEE_RET };
+	const std::vector<TestCase> cases =
+	{
+		{ "int32 local", ELEMENT_TYPE_I4, Concat({ I4(0x12345678), storeLoad, I4(1), { CEE_ADD }, ret }), true },
+		{ "int64 local", ELEMENT_TYPE_I8, Concat({ I4(-5), storeLoad, ret }), true },
+		{ "native int local behind a nop", ELEMENT_TYPE_I, Concat({ I4(-300), { CEE_NOP }, storeLoad, ret }), true },
+		{ "int8 local", ELEMENT_TYPE_I1, Concat({ I4(300), storeLoad, ret }), false },
+		{ "uint8 local", ELEMENT_TYPE_U1, Concat({ I4(-1), storeLoad, ret }), false },
+		{ "int16 local", ELEMENT_TYPE_I2, Concat({ I4(70000), storeLoad, ret }), false },
+		{ "bool local", ELEMENT_TYPE_BOOLEAN, Concat({ I4(0x100), storeLoad, ret }), false },
+		{ "char local", ELEMENT_TYPE_CHAR, Concat({ I4(0x12345), storeLoad, ret }), false },
+		{ "float32 local", ELEMENT_TYPE_R4, Concat({ R8(0.1), storeLoad, ret }), false },
+	};
+
+	int failures = 0;
+	for (const TestCase& test : cases)
+	{
+		if (!RunCase(runtime, moduleId, pEmit, methodDef, test))
+			failures++;
+	}
+
+	pEmit->Release();
+	pImport->Release();
+
+	fmt::print("{} of {} cases failed\n", failures, cases.size());
+	return failures == 0 ? 0 : 1;
+}
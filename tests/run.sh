@@ -0,0 +1,21 @@
+#!/bin/sh
+# Usage: run.sh <build directory> [ctest arguments...]
+# Builds the fixture assembly and the tests, then runs them through ctest.
+# The build directory must be configured with -DZEROED_PROFILER_BUILD_TESTS=ON.
+set -e
+
+if [ -z "$1" ]; then
+    echo "usage: $0 <build directory> [ctest arguments...]" >&2
+    exit 1
+fi
+
+BUILD_DIR="$(cd "$1" && pwd)"
+shift
+
+cmake --build "$BUILD_DIR"
+
+cd "$(dirname "$0")/../bench/Native"
+dotnet build -c Release Fixture/Fixture.csproj
+
+cd "$BUILD_DIR"
+ctest --output-on-failure "$@"
@@ -0,0 +1,34 @@
+using System;
+using System.Text;
+using Microsoft.Diagnostics.NETCore.Client;
+
+namespace ZeroedAttach
+{
+    // Attaches the profiler to a running .NET process through the diagnostics IPC channel
+    public static class Program
+    {
+        private static readonly Guid ProfilerClsid = new Guid("681AD446-325F-4C07-9BF8-6A199302F62A");
+
+        public static int Main(string[] args)
+        {
+            if (args.Length != 3)
+            {
+                Console.Error.WriteLine("usage: ZeroedAttach <pid> <profiler library> <hooks>");
+                Console.Error.WriteLine("  hooks uses the ZEROED_PROFILER_HOOKS format, eg. App.dll!App.Handler.Handle(0)=dispatch");
+                return 1;
+            }
+
+            int pid = int.Parse(args[0]);
+            string profilerPath = args[1];
+
+            // The profiler receives the hook configuration as its client data
+            byte[] clientData = Encoding.UTF8.GetBytes(args[2]);
+
+            DiagnosticsClient client = new DiagnosticsClient(pid);
+            client.AttachProfiler(TimeSpan.FromSeconds(10), ProfilerClsid, profilerPath, clientData);
+
+            Console.WriteLine($"Attached {profilerPath} to {pid}");
+            return 0;
+        }
+    }
+}
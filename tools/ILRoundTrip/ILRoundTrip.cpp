@@ -0,0 +1,335 @@
+#include "stdafx.h"
+#include "MockRuntime.h"
+#include "ILValidator.h"
+#include "ilrewriter.h"
+#include "Utils.h"
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+#include <filesystem>
+#include <thread>
+
+// Methods listed by --slowest unless a count is given
+#define DEFAULT_SLOWEST 10
+
+// How an exported body differs from the body it was imported from, in the order they're checked
+enum class Mismatch
+{
+	None,
+	MalformedInput,
+	ImportFailed,
+	ExportFailed,
+	MalformedOutput,
+	Code,
+	MaxStack,
+	LocalVarSig,
+	ExceptionClauses,
+	Count
+};
+
+static const char* const s_MismatchNames[] =
+{
+	"ok",
+	"malformed input",
+	"import failed",
+	"export failed",
+	"malformed output",
+	"code",
+	"max stack",
+	"local signature",
+	"exception clauses",
+};
+
+struct MethodResult
+{
+	mdMethodDef Token;
+	ULONG CodeSize;
+	double ImportUs;
+	double ExportUs;
+	Mismatch Result;
+	// ILRewriter always sets InitLocals, so methods which skip zeroing their locals gain it. Reported but not a mismatch
+	bool InitLocalsAdded;
+	std::string Detail;
+};
+
+struct AssemblyResult
+{
+	bool Loaded = false;
+	std::vector<MethodResult> Methods;
+};
+
+static void PrintUsage()
+{
+	fmt::print(stderr,
+		"Usage: ILRoundTrip [-j <threads>] [--csv <file>] [--slowest <count>] <assembly or directory>...\n"
+		"Imports every method body in the given assemblies, and the .dll and .exe files in the given directories, into\n"
+		"ILRewriter and exports it again without changes, then reports every body which didn't come back the same.\n"
+		"Assemblies are spread across -j threads, one per core by default. --csv writes every method's timings to a file\n");
+}
+
+static double MicrosecondsSince(std::chrono::steady_clock::time_point start)
+{
+	return std::chrono::duration<double, std::micro>(std::chrono::steady_clock::now() - start).count();
+}
+
+static bool HasInitLocals(const BYTE* pBody, const MethodBody& body)
+{
+	// Tiny headers have no flags and no locals to initialize
+	return body.HeaderSize > 1 && (pBody[0] & CorILMethod_InitLocals) != 0;
+}
+
+// Exported bodies always have fat headers and fat exception clauses, so bodies are compared by what their headers and
+// clauses decode to rather than byte for byte. The instructions themselves must match exactly
+static Mismatch CompareBodies(const BYTE* pOriginal, const MethodBody& original, const BYTE* pExported, const MethodBody& exported, std::string& detail)
+{
+	const BYTE* pOriginalCode = pOriginal + original.HeaderSize;
+	const BYTE* pExportedCode = pExported + exported.HeaderSize;
+	ULONG commonSize = std::min(original.CodeSize, exported.CodeSize);
+	ULONG offset = 0;
+	while (offset < commonSize && pOriginalCode[offset] == pExportedCode[offset])
+		offset++;
+
+	if (offset < commonSize || original.CodeSize != exported.CodeSize) {
+		detail = fmt::format("first difference at IL_{:04x}, {} bytes of code became {}", offset, original.CodeSize, exported.CodeSize);
+		return Mismatch::Code;
+	}
+
+	if (original.MaxStack != exported.MaxStack) {
+		detail = fmt::format("{} became {}", original.MaxStack, exported.MaxStack);
+		return Mismatch::MaxStack;
+	}
+
+	if (original.LocalVarSig != exported.LocalVarSig) {
+		detail = fmt::format("{:08x} became {:08x}", original.LocalVarSig, exported.LocalVarSig);
+		return Mismatch::LocalVarSig;
+	}
+
+	if (original.Clauses.size() != exported.Clauses.size()) {
+		detail = fmt::format("{} clauses became {}", original.Clauses.size(), exported.Clauses.size());
+		return Mismatch::ExceptionClauses;
+	}
+
+	for (size_t i = 0; i < original.Clauses.size(); i++) {
+		const MethodBodyClause& before = original.Clauses[i];
+		const MethodBodyClause& after = exported.Clauses[i];
+		if (before.Flags != after.Flags || before.TryOffset != after.TryOffset || before.TryLength != after.TryLength ||
+			before.HandlerOffset != after.HandlerOffset || before.HandlerLength != after.HandlerLength ||
+			before.ClassTokenOrFilterOffset != after.ClassTokenOrFilterOffset) {
+			detail = fmt::format("clause {} IL_{:04x}+{} handled at IL_{:04x}+{} became IL_{:04x}+{} handled at IL_{:04x}+{}", i,
+				before.TryOffset, before.TryLength, before.HandlerOffset, before.HandlerLength,
+				after.TryOffset, after.TryLength, after.HandlerOffset, after.HandlerLength);
+			return Mismatch::ExceptionClauses;
+		}
+	}
+
+	return Mismatch::None;
+}
+
+static MethodResult RoundTripMethod(MockRuntime& runtime, ModuleID moduleId, mdMethodDef methodDef)
+{
+	MethodResult result = {};
+	result.Token = methodDef;
+
+	LPCBYTE pOriginal;
+	ULONG cbOriginal;
+	MethodBody original;
+	HRESULT hr = runtime.GetILFunctionBody(moduleId, methodDef, &pOriginal, &cbOriginal);
+	if (FAILED(hr) || FAILED(ParseMethodBody(pOriginal, cbOriginal, &original))) {
+		result.Result = Mismatch::MalformedInput;
+		return result;
+	}
+	result.CodeSize = original.CodeSize;
+
+	// Exporting through a function control, as for ReJIT, leaves the body in functionControl rather than the module
+	MockFunctionControl functionControl;
+	ILRewriter rewriter(&runtime, &functionControl, moduleId, methodDef);
+
+	auto importStart = std::chrono::steady_clock::now();
+	hr = rewriter.Initialize();
+	if (SUCCEEDED(hr))
+		hr = rewriter.Import();
+	result.ImportUs = MicrosecondsSince(importStart);
+	if (FAILED(hr)) {
+		result.Result = Mismatch::ImportFailed;
+		result.Detail = HrToString(hr);
+		return result;
+	}
+
+	auto exportStart = std::chrono::steady_clock::now();
+	hr = rewriter.Export();
+	result.ExportUs = MicrosecondsSince(exportStart);
+	if (FAILED(hr)) {
+		result.Result = Mismatch::ExportFailed;
+		result.Detail = HrToString(hr);
+		return result;
+	}
+
+	const BYTE* pExported = functionControl.Body.data();
+	MethodBody exported;
+	if (FAILED(ParseMethodBody(pExported, (ULONG)functionControl.Body.size(), &exported))) {
+		result.Result = Mismatch::MalformedOutput;
+		return result;
+	}
+
+	result.Result = CompareBodies(pOriginal, original, pExported, exported, result.Detail);
+	result.InitLocalsAdded = !HasInitLocals(pOriginal, original) && HasInitLocals(pExported, exported) && !IsNilToken(original.LocalVarSig);
+	return result;
+}
+
+// Each assembly gets its own runtime so threads never share a module, and its memory is released once it's checked
+static AssemblyResult RoundTripAssembly(const std::string& path)
+{
+	AssemblyResult result;
+
+	MockRuntime runtime;
+	ModuleID moduleId;
+	if (FAILED(runtime.OpenModule(path, &moduleId)))
+		return result;
+	result.Loaded = true;
+
+	MockModule* pModule = (MockModule*)moduleId;
+	ULONG methodCount = pModule->Image.RowCount(MetadataTable::MethodDef);
+	for (ULONG rid = 1; rid <= methodCount; rid++) {
+		// Abstract, runtime implemented and P/Invoke methods have no body
+		if (pModule->Image.Get(MetadataTable::MethodDef, rid, Col::MethodRva) != 0)
+			result.Methods.push_back(RoundTripMethod(runtime, moduleId, TokenFromRid(rid, mdtMethodDef)));
+	}
+
+	return result;
+}
+
+static bool IsAssemblyFile(const std::filesystem::path& path)
+{
+	std::string extension = path.extension().string();
+	std::transform(extension.begin(), extension.end(), extension.begin(), [](char c) { return (char)tolower(c); });
+	return extension == ".dll" || extension == ".exe";
+}
+
+int main(int argc, char** argv)
+{
+	unsigned threadCount = std::max(1u, std::thread::hardware_concurrency());
+	const char* csvPath = nullptr;
+	size_t slowestCount = DEFAULT_SLOWEST;
+	std::vector<std::string> assemblies;
+
+	for (int i = 1; i < argc; i++) {
+		if (strcmp(argv[i], "-j") == 0 && i + 1 < argc)
+			threadCount = std::max(1, atoi(argv[++i]));
+		else if (strcmp(argv[i], "--csv") == 0 && i + 1 < argc)
+			csvPath = argv[++i];
+		else if (strcmp(argv[i], "--slowest") == 0 && i + 1 < argc)
+			slowestCount = (size_t)atoi(argv[++i]);
+		else if (argv[i][0] == '-') {
+			PrintUsage();
+			return 1;
+		}
+		else if (std::filesystem::is_directory(argv[i])) {
+			// Sorted so reports are in the same order from run to run
+			std::vector<std::string> found;
+			for (const auto& entry : std::filesystem::directory_iterator(argv[i])) {
+				if (entry.is_regular_file() && IsAssemblyFile(entry.path()))
+					found.push_back(entry.path().string());
+			}
+			std::sort(found.begin(), found.end());
+			assemblies.insert(assemblies.end(), found.begin(), found.end());
+		}
+		else
+			assemblies.push_back(argv[i]);
+	}
+
+	if (assemblies.empty()) {
+		PrintUsage();
+		return 1;
+	}
+
+	// Threads take the next unchecked assembly until there are none left. Results are kept in input order
+	std::vector<AssemblyResult> results(assemblies.size());
+	std::atomic<size_t> nextAssembly(0);
+	auto start = std::chrono::steady_clock::now();
+
+	std::vector<std::thread> threads;
+	for (unsigned i = 0; i < std::min<size_t>(threadCount, assemblies.size()); i++) {
+		threads.emplace_back([&]() {
+			for (size_t index = nextAssembly++; index < assemblies.size(); index = nextAssembly++)
+				results[index] = RoundTripAssembly(assemblies[index]);
+		});
+	}
+	for (std::thread& thread : threads)
+		thread.join();
+
+	double elapsedMs = MicrosecondsSince(start) / 1000;
+
+	size_t loaded = 0;
+	size_t methods = 0;
+	size_t initLocalsAdded = 0;
+	size_t mismatches[(size_t)Mismatch::Count] = {};
+	double importUs = 0;
+	double exportUs = 0;
+	std::vector<std::pair<size_t, const MethodResult*>> timed;
+
+	for (size_t i = 0; i < assemblies.size(); i++) {
+		if (!results[i].Loaded)
+			continue;
+		loaded++;
+
+		for (const MethodResult& method : results[i].Methods) {
+			methods++;
+			mismatches[(size_t)method.Result]++;
+			initLocalsAdded += method.InitLocalsAdded ? 1 : 0;
+			importUs += method.ImportUs;
+			exportUs += method.ExportUs;
+			timed.emplace_back(i, &method);
+
+			if (method.Result != Mismatch::None) {
+				fmt::print("{} {:08x}: {}{}{}\n", assemblies[i], method.Token, s_MismatchNames[(size_t)method.Result],
+					method.Detail.empty() ? "" : ", ", method.Detail);
+			}
+		}
+	}
+
+	if (csvPath != nullptr) {
+		FILE* csv = fopen(csvPath, "w");
+		if (csv == nullptr) {
+			spdlog::error("Failed to open {}", csvPath);
+			return 1;
+		}
+
+		fmt::print(csv, "assembly,token,code_size,import_us,export_us,result\n");
+		for (const auto& entry : timed) {
+			const MethodResult& method = *entry.second;
+			fmt::print(csv, "{},{:08x},{},{:.3f},{:.3f},{}\n", assemblies[entry.first], method.Token, method.CodeSize,
+				method.ImportUs, method.ExportUs, s_MismatchNames[(size_t)method.Result]);
+		}
+		fclose(csv);
+	}
+
+	size_t failed = methods - mismatches[(size_t)Mismatch::None];
+	fmt::print("Assemblies:       {} checked, {} skipped\n", loaded, assemblies.size() - loaded);
+	fmt::print("Methods:          {} checked, {} round tripped unchanged, {} didn't\n", methods, mismatches[(size_t)Mismatch::None], failed);
+	for (size_t kind = (size_t)Mismatch::None + 1; kind < (size_t)Mismatch::Count; kind++) {
+		if (mismatches[kind] != 0)
+			fmt::print("  {:<16}{}\n", s_MismatchNames[kind], mismatches[kind]);
+	}
+	fmt::print("InitLocals added: {} methods with locals\n", initLocalsAdded);
+	fmt::print("Import:           {:.3f} ms, {:.3f} us per method\n", importUs / 1000, methods != 0 ? importUs / methods : 0);
+	fmt::print("Export:           {:.3f} ms, {:.3f} us per method\n", exportUs / 1000, methods != 0 ? exportUs / methods : 0);
+	fmt::print("Elapsed:          {:.3f} ms on {} threads\n", elapsedMs, threads.size());
+
+	if (slowestCount != 0 && !timed.empty()) {
+		size_t count = std::min(slowestCount, timed.size());
+		std::partial_sort(timed.begin(), timed.begin() + count, timed.end(), [](const auto& left, const auto& right) {
+			return left.second->ImportUs + left.second->ExportUs > right.second->ImportUs + right.second->ExportUs;
+		});
+
+		fmt::print("Slowest:\n");
+		for (size_t i = 0; i < count; i++) {
+			const MethodResult& method = *timed[i].second;
+			fmt::print("  {} {:08x}: {} bytes, import {:.3f} us, export {:.3f} us\n", assemblies[timed[i].first], method.Token,
+				method.CodeSize, method.ImportUs, method.ExportUs);
+		}
+	}
+
+	return failed == 0 ? 0 : 2;
+}
@@ -0,0 +1,611 @@
+#include "stdafx.h"
+#include "EcmaImage.h"
+#include "Utils.h"
+#include <algorithm>
+#include <fstream>
+#include <iterator>
+
+// Heaps grow in chunks of this size so appending never moves existing data
+#define HEAP_CHUNK_SIZE (64 * 1024)
+
+// Images larger than this are assumed to be corrupt rather than mapped
+#define MAX_IMAGE_SIZE (1024 * 1024 * 1024)
+
+#define METADATA_SIGNATURE 0x424A5342
+#define CLI_HEADER_DIRECTORY 14
+
+enum CodedIndex
+{
+	TypeDefOrRef,
+	HasConstant,
+	HasCustomAttribute,
+	HasFieldMarshal,
+	HasDeclSecurity,
+	MemberRefParent,
+	HasSemantics,
+	MethodDefOrRef,
+	MemberForwarded,
+	Implementation,
+	CustomAttributeType,
+	ResolutionScope,
+	TypeOrMethodDef,
+	CodedIndexCount
+};
+
+// Tag values map to tables in this order, NoTable marks tags that are reserved (ECMA-335 II.24.2.6)
+#define NoTable 0xFF
+
+struct CodedIndexDefinition
+{
+	int TagBits;
+	BYTE Tables[24];
+	int TableCount;
+};
+
+static const CodedIndexDefinition CodedIndexes[CodedIndexCount] = {
+	{ 2, { 0x02, 0x01, 0x1B }, 3 },
+	{ 2, { 0x04, 0x08, 0x17 }, 3 },
+	{ 5, { 0x06, 0x04, 0x01, 0x02, 0x08, 0x09, 0x0A, 0x00, 0x0E, 0x17, 0x14, 0x11, 0x1A, 0x1B, 0x20, 0x23, 0x26, 0x27, 0x28, 0x2A, 0x2C, 0x2B }, 22 },
+	{ 1, { 0x04, 0x08 }, 2 },
+	{ 2, { 0x02, 0x06, 0x20 }, 3 },
+	{ 3, { 0x02, 0x01, 0x1A, 0x06, 0x1B }, 5 },
+	{ 1, { 0x14, 0x17 }, 2 },
+	{ 1, { 0x06, 0x0A }, 2 },
+	{ 1, { 0x04, 0x06 }, 2 },
+	{ 2, { 0x26, 0x23, 0x27 }, 3 },
+	{ 3, { NoTable, NoTable, 0x06, 0x0A, NoTable }, 5 },
+	{ 2, { 0x00, 0x1A, 0x23, 0x01 }, 4 },
+	{ 1, { 0x02, 0x06 }, 2 },
+};
+
+enum class ColumnKind : BYTE
+{
+	Fixed2,
+	Fixed4,
+	String,
+	Guid,
+	Blob,
+	// Index into the table in Target
+	Table,
+	// Coded index of the kind in Target
+	Coded
+};
+
+struct ColumnDefinition
+{
+	ColumnKind Kind;
+	BYTE Target;
+};
+
+#define F2 { ColumnKind::Fixed2, 0 }
+#define F4 { ColumnKind::Fixed4, 0 }
+#define STR { ColumnKind::String, 0 }
+#define GUID_ { ColumnKind::Guid, 0 }
+#define BLOB { ColumnKind::Blob, 0 }
+#define TBL(t) { ColumnKind::Table, (BYTE)MetadataTable::t }
+#define CODED(c) { ColumnKind::Coded, (BYTE)c }
+
+// Column layout of every table (ECMA-335 II.22)
+static const std::vector<ColumnDefinition> TableSchemas[(int)MetadataTable::Count] = {
+	/* Module */ { F2, STR, GUID_, GUID_, GUID_ },
+	/* TypeRef */ { CODED(ResolutionScope), STR, STR },
+	/* TypeDef */ { F4, STR, STR, CODED(TypeDefOrRef), TBL(Field), TBL(MethodDef) },
+	/* FieldPtr */ { TBL(Field) },
+	/* Field */ { F2, STR, BLOB },
+	/* MethodPtr */ { TBL(MethodDef) },
+	/* MethodDef */ { F4, F2, F2, STR, BLOB, TBL(Param) },
+	/* ParamPtr */ { TBL(Param) },
+	/* Param */ { F2, F2, STR },
+	/* InterfaceImpl */ { TBL(TypeDef), CODED(TypeDefOrRef) },
+	/* MemberRef */ { CODED(MemberRefParent), STR, BLOB },
+	/* Constant */ { F2, CODED(HasConstant), BLOB },
+	/* CustomAttribute */ { CODED(HasCustomAttribute), CODED(CustomAttributeType), BLOB },
+	/* FieldMarshal */ { CODED(HasFieldMarshal), BLOB },
+	/* DeclSecurity */ { F2, CODED(HasDeclSecurity), BLOB },
+	/* ClassLayout */ { F2, F4, TBL(TypeDef) },
+	/* FieldLayout */ { F4, TBL(Field) },
+	/* StandAloneSig */ { BLOB },
+	/* EventMap */ { TBL(TypeDef), TBL(Event) },
+	/* EventPtr */ { TBL(Event) },
+	/* Event */ { F2, STR, CODED(TypeDefOrRef) },
+	/* PropertyMap */ { TBL(TypeDef), TBL(Property) },
+	/* PropertyPtr */ { TBL(Property) },
+	/* Property */ { F2, STR, BLOB },
+	/* MethodSemantics */ { F2, TBL(MethodDef), CODED(HasSemantics) },
+	/* MethodImpl */ { TBL(TypeDef), CODED(MethodDefOrRef), CODED(MethodDefOrRef) },
+	/* ModuleRef */ { STR },
+	/* TypeSpec */ { BLOB },
+	/* ImplMap */ { F2, CODED(MemberForwarded), STR, TBL(ModuleRef) },
+	/* FieldRVA */ { F4, TBL(Field) },
+	/* ENCLog */ { F4, F4 },
+	/* ENCMap */ { F4 },
+	/* Assembly */ { F4, F2, F2, F2, F2, F4, BLOB, STR, STR },
+	/* AssemblyProcessor */ { F4 },
+	/* AssemblyOS */ { F4, F4, F4 },
+	/* AssemblyRef */ { F2, F2, F2, F2, F4, BLOB, STR, STR, BLOB },
+	/* AssemblyRefProcessor */ { F4, TBL(AssemblyRef) },
+	/* AssemblyRefOS */ { F4, F4, F4, TBL(AssemblyRef) },
+	/* File */ { F4, STR, BLOB },
+	/* ExportedType */ { F4, F4, STR, STR, CODED(Implementation) },
+	/* ManifestResource */ { F4, F4, STR, CODED(Implementation) },
+	/* NestedClass */ { TBL(TypeDef), TBL(TypeDef) },
+	/* GenericParam */ { F2, F2, CODED(TypeOrMethodDef), STR },
+	/* MethodSpec */ { CODED(MethodDefOrRef), BLOB },
+	/* GenericParamConstraint */ { TBL(GenericParam), CODED(TypeDefOrRef) },
+};
+
+#undef F2
+#undef F4
+#undef STR
+#undef GUID_
+#undef BLOB
+#undef TBL
+#undef CODED
+
+static UINT16 ReadU16(const BYTE* p)
+{
+	UINT16 value;
+	memcpy(&value, p, sizeof(value));
+	return value;
+}
+
+static UINT32 ReadU32(const BYTE* p)
+{
+	UINT32 value;
+	memcpy(&value, p, sizeof(value));
+	return value;
+}
+
+static UINT64 ReadU64(const BYTE* p)
+{
+	UINT64 value;
+	memcpy(&value, p, sizeof(value));
+	return value;
+}
+
+// Reads a compressed unsigned integer (ECMA-335 II.23.2), returning false if it runs past pEnd
+static bool ReadCompressed(const BYTE*& p, const BYTE* pEnd, ULONG* pValue)
+{
+	if (p >= pEnd)
+		return false;
+
+	if ((p[0] & 0x80) == 0) {
+		*pValue = p[0];
+		p += 1;
+	}
+	else if ((p[0] & 0xC0) == 0x80) {
+		if (pEnd - p < 2)
+			return false;
+		*pValue = ((p[0] & 0x3F) << 8) | p[1];
+		p += 2;
+	}
+	else {
+		if (pEnd - p < 4)
+			return false;
+		*pValue = ((p[0] & 0x1F) << 24) | (p[1] << 16) | (p[2] << 8) | p[3];
+		p += 4;
+	}
+	return true;
+}
+
+static void WriteCompressed(std::vector<BYTE>& out, ULONG value)
+{
+	if (value < 0x80) {
+		out.push_back((BYTE)value);
+	}
+	else if (value < 0x4000) {
+		out.push_back((BYTE)(0x80 | (value >> 8)));
+		out.push_back((BYTE)value);
+	}
+	else {
+		out.push_back((BYTE)(0xC0 | (value >> 24)));
+		out.push_back((BYTE)(value >> 16));
+		out.push_back((BYTE)(value >> 8));
+		out.push_back((BYTE)value);
+	}
+}
+
+void MetadataHeap::Assign(const BYTE* data, ULONG size)
+{
+	m_chunks.clear();
+
+	std::unique_ptr<Chunk> chunk(new Chunk());
+	chunk->Start = 0;
+	chunk->Data.assign(data, data + size);
+	m_chunks.push_back(std::move(chunk));
+	m_size = size;
+}
+
+const BYTE* MetadataHeap::At(UINT32 offset, ULONG* pAvailable) const
+{
+	auto next = std::upper_bound(m_chunks.begin(), m_chunks.end(), offset,
+		[](UINT32 value, const std::unique_ptr<Chunk>& chunk) { return value < chunk->Start; });
+	if (next == m_chunks.begin())
+		return nullptr;
+
+	const Chunk& chunk = **(next - 1);
+	UINT32 chunkOffset = offset - chunk.Start;
+	if (chunkOffset >= chunk.Data.size())
+		return nullptr;
+
+	*pAvailable = (ULONG)chunk.Data.size() - chunkOffset;
+	return chunk.Data.data() + chunkOffset;
+}
+
+UINT32 MetadataHeap::Append(const BYTE* data, ULONG size)
+{
+	// Only append within the last chunk's capacity, growing it would move everything handed out from it
+	Chunk* last = m_chunks.empty() ? nullptr : m_chunks.back().get();
+	if (last == nullptr || last->Data.size() + size > last->Data.capacity()) {
+		std::unique_ptr<Chunk> chunk(new Chunk());
+		chunk->Start = m_size;
+		chunk->Data.reserve(std::max<ULONG>(HEAP_CHUNK_SIZE, size));
+		last = chunk.get();
+		m_chunks.push_back(std::move(chunk));
+	}
+
+	UINT32 offset = m_size;
+	last->Data.insert(last->Data.end(), data, data + size);
+	m_size += size;
+	return offset;
+}
+
+HRESULT EcmaImage::Load(const std::string& path)
+{
+	std::ifstream stream(path, std::ios::binary);
+	if (!stream) {
+		spdlog::error("Failed to open {}", path);
+		return E_FAIL;
+	}
+
+	std::vector<BYTE> file((std::istreambuf_iterator<char>(stream)), std::istreambuf_iterator<char>());
+
+	ULONG cliHeaderRva = 0;
+	FAIL_CHECK(MapImage(file, &cliHeaderRva), "{} is not a PE image", path);
+
+	const BYTE* pCorHeader = cliHeaderRva != 0 ? AtRva(cliHeaderRva, sizeof(IMAGE_COR20_HEADER)) : nullptr;
+	if (pCorHeader == nullptr) {
+		spdlog::error("{} has no CLI header, it isn't a managed assembly", path);
+		return E_FAIL;
+	}
+
+	UINT32 metadataRva = ReadU32(pCorHeader + 8);
+	UINT32 metadataSize = ReadU32(pCorHeader + 12);
+	const BYTE* pMetadata = AtRva(metadataRva, metadataSize);
+	if (pMetadata == nullptr) {
+		spdlog::error("{} has a metadata directory outside of the image", path);
+		return CLDB_E_FILE_CORRUPT;
+	}
+
+	FAIL_CHECK(ReadMetadata(pMetadata, metadataSize), "Failed to read metadata from {}", path);
+	return S_OK;
+}
+
+const BYTE* EcmaImage::AtRva(ULONG rva, ULONG size) const
+{
+	if (rva > m_image.size() || size > m_image.size() - rva)
+		return nullptr;
+
+	return m_image.data() + rva;
+}
+
+HRESULT EcmaImage::MapImage(const std::vector<BYTE>& file, ULONG* pCliHeaderRva)
+{
+	if (file.size() < 0x40 || file[0] != 'M' || file[1] != 'Z')
+		return E_FAIL;
+
+	UINT32 peOffset = ReadU32(&file[0x3C]);
+	if (peOffset > file.size() - 24 || memcmp(&file[peOffset], "PE\0\0", 4) != 0)
+		return E_FAIL;
+
+	UINT16 sectionCount = ReadU16(&file[peOffset + 6]);
+	UINT16 optionalSize = ReadU16(&file[peOffset + 20]);
+	size_t optionalOffset = peOffset + 24;
+	size_t sectionsOffset = optionalOffset + optionalSize;
+	if (optionalSize < 112 || sectionsOffset + sectionCount * 40 > file.size())
+		return E_FAIL;
+
+	// The CLI header's location is in the optional header's data directories, which start later in PE32+ images
+	bool pe32Plus = ReadU16(&file[optionalOffset]) == 0x20B;
+	UINT32 directoryCount = ReadU32(&file[optionalOffset + (pe32Plus ? 108 : 92)]);
+	size_t cliDirectoryOffset = (pe32Plus ? 112 : 96) + CLI_HEADER_DIRECTORY * 8;
+	*pCliHeaderRva = directoryCount > CLI_HEADER_DIRECTORY && cliDirectoryOffset + 8 <= optionalSize ?
+		ReadU32(&file[optionalOffset + cliDirectoryOffset]) : 0;
+
+	UINT32 imageSize = ReadU32(&file[optionalOffset + 56]);
+	UINT32 headersSize = ReadU32(&file[optionalOffset + 60]);
+	if (imageSize > MAX_IMAGE_SIZE || imageSize < sectionsOffset + sectionCount * 40)
+		return E_FAIL;
+
+	m_image.assign(imageSize, 0);
+	memcpy(m_image.data(), file.data(), std::min<size_t>({ headersSize, file.size(), imageSize }));
+
+	for (UINT16 i = 0; i < sectionCount; i++) {
+		const BYTE* pSection = &file[sectionsOffset + i * 40];
+		UINT32 virtualAddress = ReadU32(pSection + 12);
+		UINT32 rawSize = ReadU32(pSection + 16);
+		UINT32 rawOffset = ReadU32(pSection + 20);
+		if (rawOffset > file.size() || virtualAddress > imageSize)
+			return E_FAIL;
+
+		size_t size = std::min<size_t>({ rawSize, file.size() - rawOffset, imageSize - virtualAddress });
+		memcpy(&m_image[virtualAddress], &file[rawOffset], size);
+	}
+
+	return S_OK;
+}
+
+HRESULT EcmaImage::ReadMetadata(const BYTE* pMetadata, ULONG size)
+{
+	const BYTE* pEnd = pMetadata + size;
+	if (size < 16 || ReadU32(pMetadata) != METADATA_SIGNATURE)
+		return CLDB_E_FILE_CORRUPT;
+
+	// Skip the version string, its length is already padded to a multiple of 4
+	UINT32 versionLength = ReadU32(pMetadata + 12);
+	const BYTE* p = pMetadata + 16 + versionLength;
+	if (p + 4 > pEnd)
+		return CLDB_E_FILE_CORRUPT;
+
+	UINT16 streamCount = ReadU16(p + 2);
+	p += 4;
+
+	const BYTE* pTables = nullptr;
+	ULONG tablesSize = 0;
+	for (UINT16 i = 0; i < streamCount; i++) {
+		if (p + 8 > pEnd)
+			return CLDB_E_FILE_CORRUPT;
+
+		UINT32 offset = ReadU32(p);
+		UINT32 streamSize = ReadU32(p + 4);
+		const char* name = (const char*)(p + 8);
+		size_t nameLength = strnlen(name, pEnd - (p + 8));
+		p += 8 + ((nameLength + 4) & ~3);
+
+		if (offset > size || streamSize > size - offset)
+			return CLDB_E_FILE_CORRUPT;
+
+		const BYTE* pStream = pMetadata + offset;
+		if (strcmp(name, "#~") == 0) {
+			pTables = pStream;
+			tablesSize = streamSize;
+		}
+		else if (strcmp(name, "#-") == 0) {
+			spdlog::error("Uncompressed (#-) metadata isn't supported");
+			return E_NOTIMPL;
+		}
+		else if (strcmp(name, "#Strings") == 0) {
+			m_strings.Assign(pStream, streamSize);
+		}
+		else if (strcmp(name, "#Blob") == 0) {
+			m_blobs.Assign(pStream, streamSize);
+		}
+		else if (strcmp(name, "#US") == 0) {
+			m_userStrings.Assign(pStream, streamSize);
+		}
+		else if (strcmp(name, "#GUID") == 0) {
+			m_guids.Assign(pStream, streamSize);
+		}
+	}
+
+	// Offset 0 of every heap but the GUIDs is the empty entry, which must exist even if the heap doesn't
+	static const BYTE empty = 0;
+	if (m_strings.Size() == 0)
+		m_strings.Assign(&empty, 1);
+	if (m_blobs.Size() == 0)
+		m_blobs.Assign(&empty, 1);
+	if (m_userStrings.Size() == 0)
+		m_userStrings.Assign(&empty, 1);
+
+	if (pTables == nullptr)
+		return CLDB_E_FILE_CORRUPT;
+
+	return ReadTables(pTables, tablesSize);
+}
+
+HRESULT EcmaImage::ReadTables(const BYTE* pTables, ULONG size)
+{
+	const BYTE* pEnd = pTables + size;
+	if (size < 24)
+		return CLDB_E_FILE_CORRUPT;
+
+	BYTE heapSizes = pTables[6];
+	UINT64 valid = ReadU64(pTables + 8);
+
+	UINT32 rowCounts[64] = {};
+	const BYTE* p = pTables + 24;
+	for (int i = 0; i < 64; i++) {
+		if ((valid & (1ull << i)) == 0)
+			continue;
+		if (p + 4 > pEnd)
+			return CLDB_E_FILE_CORRUPT;
+
+		rowCounts[i] = ReadU32(p);
+		p += 4;
+	}
+
+	// Extra data follows the row counts when this bit is set
+	if (heapSizes & 0x40)
+		p += 4;
+
+	// Optimised metadata never has the pointer tables, supporting them would mean indirecting every list
+	for (MetadataTable ptrTable : { MetadataTable::FieldPtr, MetadataTable::MethodPtr, MetadataTable::ParamPtr, MetadataTable::EventPtr, MetadataTable::PropertyPtr }) {
+		if (rowCounts[(int)ptrTable] != 0) {
+			spdlog::error("Metadata with indirection tables isn't supported");
+			return E_NOTIMPL;
+		}
+	}
+
+	auto columnSize = [&](const ColumnDefinition& column) -> int {
+		switch (column.Kind) {
+		case ColumnKind::Fixed2: return 2;
+		case ColumnKind::Fixed4: return 4;
+		case ColumnKind::String: return (heapSizes & 0x01) ? 4 : 2;
+		case ColumnKind::Guid: return (heapSizes & 0x02) ? 4 : 2;
+		case ColumnKind::Blob: return (heapSizes & 0x04) ? 4 : 2;
+		case ColumnKind::Table: return rowCounts[column.Target] < 0x10000 ? 2 : 4;
+		case ColumnKind::Coded: {
+			const CodedIndexDefinition& coded = CodedIndexes[column.Target];
+			UINT32 maxRows = 0;
+			for (int i = 0; i < coded.TableCount; i++) {
+				if (coded.Tables[i] != NoTable)
+					maxRows = std::max(maxRows, rowCounts[coded.Tables[i]]);
+			}
+			return maxRows < (1u << (16 - coded.TagBits)) ? 2 : 4;
+		}
+		}
+		return 4;
+	};
+
+	for (int t = 0; t < (int)MetadataTable::Count; t++) {
+		const std::vector<ColumnDefinition>& schema = TableSchemas[t];
+		Table& table = m_tables[t];
+		table.Columns = (int)schema.size();
+		table.Cells.clear();
+		table.Cells.reserve((size_t)rowCounts[t] * schema.size());
+
+		for (UINT32 row = 0; row < rowCounts[t]; row++) {
+			for (const ColumnDefinition& column : schema) {
+				int width = columnSize(column);
+				if (p + width > pEnd)
+					return CLDB_E_FILE_CORRUPT;
+
+				UINT32 value = width == 2 ? ReadU16(p) : ReadU32(p);
+				p += width;
+
+				if (column.Kind == ColumnKind::Coded) {
+					const CodedIndexDefinition& coded = CodedIndexes[column.Target];
+					UINT32 tag = value & ((1u << coded.TagBits) - 1);
+					if ((int)tag >= coded.TableCount || coded.Tables[tag] == NoTable)
+						return CLDB_E_FILE_CORRUPT;
+
+					value = TokenFromRid(value >> coded.TagBits, (UINT32)coded.Tables[tag] << 24);
+				}
+				table.Cells.push_back(value);
+			}
+		}
+	}
+
+	return S_OK;
+}
+
+ULONG EcmaImage::RowCount(MetadataTable table) const
+{
+	const Table& t = m_tables[(int)table];
+	return t.Columns == 0 ? 0 : (ULONG)(t.Cells.size() / t.Columns);
+}
+
+UINT32 EcmaImage::Get(MetadataTable table, ULONG rid, int column) const
+{
+	const Table& t = m_tables[(int)table];
+	return t.Cells[(size_t)(rid - 1) * t.Columns + column];
+}
+
+void EcmaImage::Set(MetadataTable table, ULONG rid, int column, UINT32 value)
+{
+	Table& t = m_tables[(int)table];
+	t.Cells[(size_t)(rid - 1) * t.Columns + column] = value;
+}
+
+ULONG EcmaImage::AddRow(MetadataTable table, const std::vector<UINT32>& values)
+{
+	Table& t = m_tables[(int)table];
+	t.Columns = (int)TableSchemas[(int)table].size();
+	assert(values.size() == (size_t)t.Columns);
+
+	t.Cells.insert(t.Cells.end(), values.begin(), values.end());
+	return RowCount(table);
+}
+
+const char* EcmaImage::GetString(UINT32 offset) const
+{
+	ULONG available = 0;
+	const BYTE* p = m_strings.At(offset, &available);
+	if (p == nullptr || memchr(p, 0, available) == nullptr)
+		return "";
+
+	return (const char*)p;
+}
+
+bool EcmaImage::GetBlob(UINT32 offset, PCCOR_SIGNATURE* ppData, ULONG* pcbData) const
+{
+	ULONG available = 0;
+	const BYTE* p = m_blobs.At(offset, &available);
+	if (p == nullptr)
+		return false;
+
+	const BYTE* pEnd = p + available;
+	ULONG length = 0;
+	if (!ReadCompressed(p, pEnd, &length) || length > (ULONG)(pEnd - p))
+		return false;
+
+	*ppData = p;
+	*pcbData = length;
+	return true;
+}
+
+bool EcmaImage::GetUserString(UINT32 offset, const BYTE** ppData, ULONG* pcbData) const
+{
+	ULONG available = 0;
+	const BYTE* p = m_userStrings.At(offset, &available);
+	if (p == nullptr)
+		return false;
+
+	const BYTE* pEnd = p + available;
+	ULONG length = 0;
+	if (!ReadCompressed(p, pEnd, &length) || length > (ULONG)(pEnd - p))
+		return false;
+
+	// The length includes a trailing flag byte after the UTF-16 data
+	*ppData = p;
+	*pcbData = length > 0 ? length - 1 : 0;
+	return true;
+}
+
+const GUID* EcmaImage::GetGuid(UINT32 index) const
+{
+	if (index == 0)
+		return nullptr;
+
+	ULONG available = 0;
+	const BYTE* p = m_guids.At((index - 1) * sizeof(GUID), &available);
+	return p != nullptr && available >= sizeof(GUID) ? (const GUID*)p : nullptr;
+}
+
+UINT32 EcmaImage::AddString(const std::string& value)
+{
+	if (value.empty())
+		return 0;
+
+	return m_strings.Append((const BYTE*)value.c_str(), (ULONG)value.size() + 1);
+}
+
+UINT32 EcmaImage::AddBlob(const BYTE* data, ULONG size)
+{
+	if (size == 0)
+		return 0;
+
+	std::vector<BYTE> entry;
+	WriteCompressed(entry, size);
+	entry.insert(entry.end(), data, data + size);
+	return m_blobs.Append(entry.data(), (ULONG)entry.size());
+}
+
+UINT32 EcmaImage::AddUserString(const UINT16* data, ULONG cch)
+{
+	std::vector<BYTE> entry;
+	WriteCompressed(entry, cch * 2 + 1);
+
+	// The trailing byte flags strings which need more than a byte-wise comparison (ECMA-335 II.24.2.4)
+	BYTE special = 0;
+	for (ULONG i = 0; i < cch; i++) {
+		UINT16 c = data[i];
+		entry.push_back((BYTE)c);
+		entry.push_back((BYTE)(c >> 8));
+		if (c > 0xFF || (c >= 0x01 && c <= 0x08) || (c >= 0x0E && c <= 0x1F) || c == 0x27 || c == 0x2D || c == 0x7F)
+			special = 1;
+	}
+	entry.push_back(special);
+
+	return m_userStrings.Append(entry.data(), (ULONG)entry.size());
+}
@@ -0,0 +1,152 @@
+#pragma once
+
+#include "stdafx.h"
+#include <memory>
+#include <string>
+#include <vector>
+
+// Metadata tables in the order they're numbered in the #~ stream (ECMA-335 II.22). A table's number is also the top
+// byte of its tokens, so TokenFromRid(rid, (ULONG)table << 24) gives a row's token
+enum class MetadataTable : BYTE
+{
+	Module = 0x00,
+	TypeRef = 0x01,
+	TypeDef = 0x02,
+	FieldPtr = 0x03,
+	Field = 0x04,
+	MethodPtr = 0x05,
+	MethodDef = 0x06,
+	ParamPtr = 0x07,
+	Param = 0x08,
+	InterfaceImpl = 0x09,
+	MemberRef = 0x0A,
+	Constant = 0x0B,
+	CustomAttribute = 0x0C,
+	FieldMarshal = 0x0D,
+	DeclSecurity = 0x0E,
+	ClassLayout = 0x0F,
+	FieldLayout = 0x10,
+	StandAloneSig = 0x11,
+	EventMap = 0x12,
+	EventPtr = 0x13,
+	Event = 0x14,
+	PropertyMap = 0x15,
+	PropertyPtr = 0x16,
+	Property = 0x17,
+	MethodSemantics = 0x18,
+	MethodImpl = 0x19,
+	ModuleRef = 0x1A,
+	TypeSpec = 0x1B,
+	ImplMap = 0x1C,
+	FieldRVA = 0x1D,
+	ENCLog = 0x1E,
+	ENCMap = 0x1F,
+	Assembly = 0x20,
+	AssemblyProcessor = 0x21,
+	AssemblyOS = 0x22,
+	AssemblyRef = 0x23,
+	AssemblyRefProcessor = 0x24,
+	AssemblyRefOS = 0x25,
+	File = 0x26,
+	ExportedType = 0x27,
+	ManifestResource = 0x28,
+	NestedClass = 0x29,
+	GenericParam = 0x2A,
+	MethodSpec = 0x2B,
+	GenericParamConstraint = 0x2C,
+	Count
+};
+
+// Column indexes for the tables the mock runtime reads or writes, in ECMA-335 column order
+namespace Col
+{
+	enum Module { ModuleGeneration, ModuleName, ModuleMvid, ModuleEncId, ModuleEncBaseId };
+	enum TypeRef { TypeRefScope, TypeRefName, TypeRefNamespace };
+	enum TypeDef { TypeDefFlags, TypeDefName, TypeDefNamespace, TypeDefExtends, TypeDefFieldList, TypeDefMethodList };
+	enum Field { FieldFlags, FieldName, FieldSignature };
+	enum MethodDef { MethodRva, MethodImplFlags, MethodFlags, MethodName, MethodSignature, MethodParamList };
+	enum Param { ParamFlags, ParamSequence, ParamName };
+	enum InterfaceImpl { InterfaceImplClass, InterfaceImplInterface };
+	enum MemberRef { MemberRefClass, MemberRefName, MemberRefSignature };
+	enum CustomAttribute { CustomAttributeParent, CustomAttributeType, CustomAttributeValue };
+	enum StandAloneSig { StandAloneSigSignature };
+	enum ModuleRef { ModuleRefName };
+	enum TypeSpec { TypeSpecSignature };
+	enum ImplMap { ImplMapFlags, ImplMapMember, ImplMapImportName, ImplMapImportScope };
+	enum Assembly { AssemblyHashAlgId, AssemblyMajor, AssemblyMinor, AssemblyBuild, AssemblyRevision, AssemblyFlags, AssemblyPublicKey, AssemblyName, AssemblyCulture };
+	enum AssemblyRef { AssemblyRefMajor, AssemblyRefMinor, AssemblyRefBuild, AssemblyRefRevision, AssemblyRefFlags, AssemblyRefPublicKey, AssemblyRefName, AssemblyRefCulture, AssemblyRefHashValue };
+	enum NestedClass { NestedClassNested, NestedClassEnclosing };
+}
+
+// Heap data that can be appended to without moving anything already handed out, so signatures and names returned by
+// the metadata interfaces stay valid while the profiler emits more
+class MetadataHeap
+{
+public:
+	void Assign(const BYTE* data, ULONG size);
+
+	// Returns the data at offset and how many bytes follow it within the same chunk, or nullptr if out of range
+	const BYTE* At(UINT32 offset, ULONG* pAvailable) const;
+	UINT32 Append(const BYTE* data, ULONG size);
+	ULONG Size() const { return m_size; }
+
+private:
+	struct Chunk
+	{
+		UINT32 Start;
+		std::vector<BYTE> Data;
+	};
+
+	std::vector<std::unique_ptr<Chunk>> m_chunks;
+	ULONG m_size = 0;
+};
+
+// A managed assembly read from disk, laid out at its section RVAs the way the loader maps it, with its metadata decoded
+// into tables the mock metadata interfaces query and extend. Coded index columns are stored as full tokens and simple
+// index columns (eg. TypeDef.MethodList) as RIDs so callers never deal with the on-disk encoding
+class EcmaImage
+{
+public:
+	HRESULT Load(const std::string& path);
+
+	const BYTE* Base() const { return m_image.data(); }
+	ULONG ImageSize() const { return (ULONG)m_image.size(); }
+	// Returns the image data at rva, or nullptr unless size bytes are available there
+	const BYTE* AtRva(ULONG rva, ULONG size) const;
+
+	ULONG RowCount(MetadataTable table) const;
+	// rid is 1-based as in tokens
+	UINT32 Get(MetadataTable table, ULONG rid, int column) const;
+	void Set(MetadataTable table, ULONG rid, int column, UINT32 value);
+	// Appends a row, which must have a value for every column, returning its rid
+	ULONG AddRow(MetadataTable table, const std::vector<UINT32>& values);
+
+	const char* GetString(UINT32 offset) const;
+	bool GetBlob(UINT32 offset, PCCOR_SIGNATURE* ppData, ULONG* pcbData) const;
+	bool GetUserString(UINT32 offset, const BYTE** ppData, ULONG* pcbData) const;
+	const GUID* GetGuid(UINT32 index) const;
+
+	UINT32 AddString(const std::string& value);
+	UINT32 AddBlob(const BYTE* data, ULONG size);
+	// Takes UTF-16 code units, which is what the #US heap stores regardless of the platform's WCHAR
+	UINT32 AddUserString(const UINT16* data, ULONG cch);
+
+private:
+	HRESULT MapImage(const std::vector<BYTE>& file, ULONG* pCliHeaderRva);
+	HRESULT ReadMetadata(const BYTE* pMetadata, ULONG size);
+	HRESULT ReadTables(const BYTE* pTables, ULONG size);
+
+	std::vector<BYTE> m_image;
+
+	struct Table
+	{
+		int Columns = 0;
+		std::vector<UINT32> Cells;
+	};
+	Table m_tables[(int)MetadataTable::Count];
+
+	MetadataHeap m_strings;
+	MetadataHeap m_blobs;
+	MetadataHeap m_userStrings;
+	MetadataHeap m_guids;
+};
@@ -0,0 +1,292 @@
+#include "stdafx.h"
+#include "ILValidator.h"
+#include "ilrewriter.h"
+
+enum class OperandKind : BYTE
+{
+	None,
+	Int8,
+	Int16,
+	Int32,
+	Int64,
+	Branch8,
+	Branch32,
+	Switch,
+	Method,
+	Field,
+	Type,
+	String,
+	Signature,
+	Token
+};
+
+static const OperandKind s_OperandKinds[] =
+{
+#define InlineNone OperandKind::None
+#define ShortInlineVar OperandKind::Int8
+#define InlineVar OperandKind::Int16
+#define ShortInlineI OperandKind::Int8
+#define InlineI OperandKind::Int32
+#define InlineI8 OperandKind::Int64
+#define ShortInlineR OperandKind::Int32
+#define InlineR OperandKind::Int64
+#define ShortInlineBrTarget OperandKind::Branch8
+#define InlineBrTarget OperandKind::Branch32
+#define InlineMethod OperandKind::Method
+#define InlineField OperandKind::Field
+#define InlineType OperandKind::Type
+#define InlineString OperandKind::String
+#define InlineSig OperandKind::Signature
+#define InlineRVA OperandKind::Int32
+#define InlineTok OperandKind::Token
+#define InlineSwitch OperandKind::Switch
+
+#define OPDEF(c,s,pop,push,args,type,l,s1,s2,flow) args,
+#include "opcode.def"
+#undef OPDEF
+
+#undef InlineNone
+#undef ShortInlineVar
+#undef InlineVar
+#undef ShortInlineI
+#undef InlineI
+#undef InlineI8
+#undef ShortInlineR
+#undef InlineR
+#undef ShortInlineBrTarget
+#undef InlineBrTarget
+#undef InlineMethod
+#undef InlineField
+#undef InlineType
+#undef InlineString
+#undef InlineSig
+#undef InlineRVA
+#undef InlineTok
+#undef InlineSwitch
+};
+
+static const char* const s_OpcodeNames[] =
+{
+#define OPDEF(c,s,pop,push,args,type,l,s1,s2,flow) s,
+#include "opcode.def"
+#undef OPDEF
+};
+
+static UINT16 ReadU16(const BYTE* p)
+{
+	return (UINT16)(p[0] | (p[1] << 8));
+}
+
+static UINT32 ReadU32(const BYTE* p)
+{
+	return p[0] | (p[1] << 8) | (p[2] << 16) | ((UINT32)p[3] << 24);
+}
+
+HRESULT ParseMethodBody(const BYTE* pBody, ULONG cbAvailable, MethodBody* pMethodBody)
+{
+	if (cbAvailable < 1)
+		return COR_E_INVALIDPROGRAM;
+
+	MethodBody& body = *pMethodBody;
+	body = MethodBody();
+
+	if ((pBody[0] & 3) == CorILMethod_TinyFormat) {
+		body.HeaderSize = 1;
+		body.CodeSize = pBody[0] >> 2;
+		body.MaxStack = 8;
+		body.TotalSize = 1 + body.CodeSize;
+		return body.TotalSize <= cbAvailable ? S_OK : COR_E_INVALIDPROGRAM;
+	}
+
+	if ((pBody[0] & 3) != CorILMethod_FatFormat || cbAvailable < 12)
+		return COR_E_INVALIDPROGRAM;
+
+	UINT16 flagsAndSize = ReadU16(pBody);
+	body.HeaderSize = (flagsAndSize >> 12) * 4;
+	body.MaxStack = ReadU16(pBody + 2);
+	body.CodeSize = ReadU32(pBody + 4);
+	body.LocalVarSig = ReadU32(pBody + 8);
+	if (body.HeaderSize < 12 || body.CodeSize > cbAvailable - body.HeaderSize)
+		return COR_E_INVALIDPROGRAM;
+
+	ULONG offset = body.HeaderSize + body.CodeSize;
+	bool moreSections = (flagsAndSize & CorILMethod_MoreSects) != 0;
+	while (moreSections) {
+		// Sections are 4 byte aligned
+		offset = (offset + 3) & ~3u;
+		if (offset + 4 > cbAvailable)
+			return COR_E_INVALIDPROGRAM;
+
+		BYTE kind = pBody[offset];
+		bool fat = (kind & CorILMethod_Sect_FatFormat) != 0;
+		ULONG dataSize = fat ? (ReadU32(pBody + offset) >> 8) : pBody[offset + 1];
+		if (dataSize < 4 || dataSize > cbAvailable - offset)
+			return COR_E_INVALIDPROGRAM;
+
+		if ((kind & CorILMethod_Sect_KindMask) == CorILMethod_Sect_EHTable) {
+			const BYTE* p = pBody + offset + 4;
+			ULONG clauseSize = fat ? 24 : 12;
+			for (ULONG i = 0; i < (dataSize - 4) / clauseSize; i++, p += clauseSize) {
+				MethodBodyClause clause;
+				if (fat) {
+					clause = { ReadU32(p), ReadU32(p + 4), ReadU32(p + 8), ReadU32(p + 12), ReadU32(p + 16), ReadU32(p + 20) };
+				}
+				else {
+					clause = { ReadU16(p), ReadU16(p + 2), p[4], ReadU16(p + 5), p[7], ReadU32(p + 8) };
+				}
+				body.Clauses.push_back(clause);
+			}
+		}
+
+		offset += dataSize;
+		moreSections = (kind & CorILMethod_Sect_MoreSects) != 0;
+	}
+
+	body.TotalSize = offset;
+	return S_OK;
+}
+
+static bool IsTokenOfType(mdToken token, std::initializer_list<ULONG> types)
+{
+	for (ULONG type : types) {
+		if (TypeFromToken(token) == type)
+			return true;
+	}
+	return false;
+}
+
+HRESULT ValidateMethodBody(const BYTE* pBody, ULONG cbAvailable, IMetaDataImport* pImport)
+{
+	MethodBody body;
+	if (FAILED(ParseMethodBody(pBody, cbAvailable, &body))) {
+		spdlog::error("Malformed method header");
+		return COR_E_INVALIDPROGRAM;
+	}
+
+	if (!IsNilToken(body.LocalVarSig) && (TypeFromToken(body.LocalVarSig) != mdtSignature || !pImport->IsValidToken(body.LocalVarSig))) {
+		spdlog::error("Invalid local variable signature {:x}", body.LocalVarSig);
+		return COR_E_INVALIDPROGRAM;
+	}
+
+	const BYTE* pCode = pBody + body.HeaderSize;
+	std::vector<bool> boundaries(body.CodeSize + 1, false);
+	std::vector<std::pair<ULONG, ULONG>> branches;
+
+	ULONG offset = 0;
+	while (offset < body.CodeSize) {
+		ULONG start = offset;
+		boundaries[start] = true;
+
+		unsigned opcode = pCode[offset++];
+		if (opcode == CEE_PREFIX1) {
+			if (offset >= body.CodeSize) {
+				spdlog::error("Truncated two byte opcode at IL_{:04x}", start);
+				return COR_E_INVALIDPROGRAM;
+			}
+			opcode = 0x100 + pCode[offset++];
+		}
+
+		// The table is indexed by encoding, so the gaps in it are filled with unused entries. The one byte prefixes are
+		// reserved and the entries after the two byte opcodes are the runtime's own
+		if (opcode >= CEE_ILLEGAL || (CEE_PREFIX7 <= opcode && opcode <= CEE_PREFIXREF) ||
+			strncmp(s_OpcodeNames[opcode], "unused", 6) == 0) {
+			spdlog::error("Invalid opcode {:x} at IL_{:04x}", opcode, start);
+			return COR_E_INVALIDPROGRAM;
+		}
+
+		OperandKind kind = s_OperandKinds[opcode];
+		ULONG size = 0;
+		switch (kind) {
+		case OperandKind::None: size = 0; break;
+		case OperandKind::Int8: case OperandKind::Branch8: size = 1; break;
+		case OperandKind::Int16: size = 2; break;
+		case OperandKind::Int64: size = 8; break;
+		default: size = 4; break;
+		}
+
+		if (size > body.CodeSize - offset) {
+			spdlog::error("Operand of {} at IL_{:04x} runs past the end of the method", s_OpcodeNames[opcode], start);
+			return COR_E_INVALIDPROGRAM;
+		}
+
+		const BYTE* pOperand = pCode + offset;
+		offset += size;
+
+		switch (kind) {
+		case OperandKind::Branch8:
+			branches.emplace_back(start, offset + (INT8)pOperand[0]);
+			break;
+		case OperandKind::Branch32:
+			branches.emplace_back(start, offset + (INT32)ReadU32(pOperand));
+			break;
+		case OperandKind::Switch: {
+			ULONG targetCount = ReadU32(pOperand);
+			if (targetCount > (body.CodeSize - offset) / 4) {
+				spdlog::error("Switch at IL_{:04x} runs past the end of the method", start);
+				return COR_E_INVALIDPROGRAM;
+			}
+
+			// Targets are relative to the end of the whole instruction
+			ULONG next = offset + targetCount * 4;
+			for (ULONG i = 0; i < targetCount; i++)
+				branches.emplace_back(start, next + (INT32)ReadU32(pCode + offset + i * 4));
+			offset = next;
+			break;
+		}
+		case OperandKind::Method:
+		case OperandKind::Field:
+		case OperandKind::Type:
+		case OperandKind::String:
+		case OperandKind::Signature:
+		case OperandKind::Token: {
+			mdToken token = ReadU32(pOperand);
+			bool expectedType = true;
+			switch (kind) {
+			case OperandKind::Method: expectedType = IsTokenOfType(token, { mdtMethodDef, mdtMemberRef, mdtMethodSpec }); break;
+			case OperandKind::Field: expectedType = IsTokenOfType(token, { mdtFieldDef, mdtMemberRef }); break;
+			case OperandKind::Type: expectedType = IsTokenOfType(token, { mdtTypeDef, mdtTypeRef, mdtTypeSpec }); break;
+			case OperandKind::String: expectedType = TypeFromToken(token) == mdtString; break;
+			case OperandKind::Signature: expectedType = TypeFromToken(token) == mdtSignature; break;
+			default: break;
+			}
+
+			if (!expectedType || !pImport->IsValidToken(token)) {
+				spdlog::error("Invalid token {:x} for {} at IL_{:04x}", token, s_OpcodeNames[opcode], start);
+				return COR_E_INVALIDPROGRAM;
+			}
+			break;
+		}
+		default:
+			break;
+		}
+	}
+
+	for (const auto& branch : branches) {
+		if (branch.second >= body.CodeSize || !boundaries[branch.second]) {
+			spdlog::error("Branch at IL_{:04x} targets IL_{:04x}, which isn't the start of an instruction", branch.first, branch.second);
+			return COR_E_INVALIDPROGRAM;
+		}
+	}
+
+	// Protected regions and handlers start on an instruction and end on one or at the end of the method
+	boundaries[body.CodeSize] = true;
+	for (const MethodBodyClause& clause : body.Clauses) {
+		bool valid = clause.TryOffset < body.CodeSize && boundaries[clause.TryOffset] &&
+			clause.TryLength <= body.CodeSize - clause.TryOffset && boundaries[clause.TryOffset + clause.TryLength] &&
+			clause.HandlerOffset < body.CodeSize && boundaries[clause.HandlerOffset] &&
+			clause.HandlerLength <= body.CodeSize - clause.HandlerOffset && boundaries[clause.HandlerOffset + clause.HandlerLength];
+
+		if (clause.Flags & COR_ILEXCEPTION_CLAUSE_FILTER)
+			valid = valid && clause.ClassTokenOrFilterOffset < body.CodeSize && boundaries[clause.ClassTokenOrFilterOffset];
+		else if (clause.Flags == COR_ILEXCEPTION_CLAUSE_NONE)
+			valid = valid && pImport->IsValidToken(clause.ClassTokenOrFilterOffset);
+
+		if (!valid) {
+			spdlog::error("Exception clause IL_{:04x}+{} handled at IL_{:04x}+{} doesn't fit the method's instructions",
+				clause.TryOffset, clause.TryLength, clause.HandlerOffset, clause.HandlerLength);
+			return COR_E_INVALIDPROGRAM;
+		}
+	}
+
+	return S_OK;
+}
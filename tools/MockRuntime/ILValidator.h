@@ -0,0 +1,35 @@
+#pragma once
+
+#include "stdafx.h"
+#include <vector>
+
+struct MethodBodyClause
+{
+	DWORD Flags;
+	DWORD TryOffset;
+	DWORD TryLength;
+	DWORD HandlerOffset;
+	DWORD HandlerLength;
+	// Class token, or the filter's offset for filter clauses
+	DWORD ClassTokenOrFilterOffset;
+};
+
+// A method body decoded from its tiny or fat header (ECMA-335 II.25.4)
+struct MethodBody
+{
+	ULONG HeaderSize = 0;
+	ULONG CodeSize = 0;
+	ULONG MaxStack = 0;
+	mdSignature LocalVarSig = mdTokenNil;
+	// Header, code and any trailing sections
+	ULONG TotalSize = 0;
+	std::vector<MethodBodyClause> Clauses;
+};
+
+// Decodes the method body at pBody, failing if it's malformed or runs past cbAvailable bytes
+HRESULT ParseMethodBody(const BYTE* pBody, ULONG cbAvailable, MethodBody* pMethodBody);
+
+// Stands in for the JIT's importer. Checks every opcode and operand is well formed, branches and exception clauses land on
+// instruction boundaries, and tokens resolve in pImport. It doesn't type check the stack, so IL that passes can still be
+// rejected by a real runtime
+HRESULT ValidateMethodBody(const BYTE* pBody, ULONG cbAvailable, IMetaDataImport* pImport);
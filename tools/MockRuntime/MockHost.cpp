@@ -0,0 +1,161 @@
+#include "stdafx.h"
+#include "MockRuntime.h"
+#include "Utils.h"
+#include <chrono>
+#include <cstdlib>
+#include <cstring>
+
+#define ENABLE_PROFILING_VARIABLE "CORECLR_ENABLE_PROFILING"
+#define PROFILER_VARIABLE "CORECLR_PROFILER"
+#define PROFILER_PATH_VARIABLE "CORECLR_PROFILER_PATH"
+
+// Time to wait for the profiler's ReJIT thread to stop requesting before recompiling
+#define DEFAULT_REJIT_QUIET_MS 200
+
+static void PrintUsage()
+{
+	fmt::print(stderr,
+		"Usage: MockHost [--attach <hook configuration>] [--jit-all] [--rejit-quiet-ms <ms>] <assembly>...\n"
+		"Loads the profiler named by " PROFILER_VARIABLE " and " PROFILER_PATH_VARIABLE " into a mock runtime and loads each assembly\n"
+		"into it in order. With --attach the assemblies are loaded before the profiler, which is attached with the given\n"
+		"hook configuration as its client data. --jit-all compiles every method with a body once the assemblies are loaded\n");
+}
+
+// Parses a GUID in registry format, {xxxxxxxx-xxxx-xxxx-xxxx-xxxxxxxxxxxx}
+static bool ParseGuid(const char* text, GUID* pGuid)
+{
+	unsigned int data1, data2, data3, data4[8];
+	int consumed = 0;
+	if (sscanf(text, "{%8x-%4x-%4x-%2x%2x-%2x%2x%2x%2x%2x%2x}%n", &data1, &data2, &data3,
+		&data4[0], &data4[1], &data4[2], &data4[3], &data4[4], &data4[5], &data4[6], &data4[7], &consumed) != 11 ||
+		text[consumed] != 0)
+		return false;
+
+	pGuid->Data1 = data1;
+	pGuid->Data2 = (USHORT)data2;
+	pGuid->Data3 = (USHORT)data3;
+	for (int i = 0; i < 8; i++)
+		pGuid->Data4[i] = (BYTE)data4[i];
+
+	return true;
+}
+
+static double MillisecondsSince(std::chrono::steady_clock::time_point start)
+{
+	return std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+}
+
+int main(int argc, char** argv)
+{
+	const char* attachConfig = nullptr;
+	bool jitAll = false;
+	DWORD reJitQuietMs = DEFAULT_REJIT_QUIET_MS;
+	std::vector<std::string> assemblies;
+
+	for (int i = 1; i < argc; i++) {
+		if (strcmp(argv[i], "--attach") == 0 && i + 1 < argc)
+			attachConfig = argv[++i];
+		else if (strcmp(argv[i], "--jit-all") == 0)
+			jitAll = true;
+		else if (strcmp(argv[i], "--rejit-quiet-ms") == 0 && i + 1 < argc)
+			reJitQuietMs = (DWORD)atoi(argv[++i]);
+		else if (argv[i][0] == '-') {
+			PrintUsage();
+			return 1;
+		}
+		else
+			assemblies.push_back(argv[i]);
+	}
+
+	const char* enableProfiling = std::getenv(ENABLE_PROFILING_VARIABLE);
+	const char* profilerClsid = std::getenv(PROFILER_VARIABLE);
+	const char* profilerPath = std::getenv(PROFILER_PATH_VARIABLE);
+	if (assemblies.empty() || profilerClsid == nullptr || profilerPath == nullptr) {
+		PrintUsage();
+		return 1;
+	}
+
+	// Attaching doesn't need profiling enabled at startup
+	if (attachConfig == nullptr && (enableProfiling == nullptr || strcmp(enableProfiling, "1") != 0)) {
+		spdlog::error(ENABLE_PROFILING_VARIABLE " isn't set to 1, the runtime wouldn't load the profiler");
+		return 1;
+	}
+
+	CLSID clsid;
+	if (!ParseGuid(profilerClsid, &clsid)) {
+		spdlog::error("Invalid " PROFILER_VARIABLE " {}", profilerClsid);
+		return 1;
+	}
+
+	IUnknown* pProfiler = nullptr;
+	if (FAILED(MockRuntime::CreateProfiler(profilerPath, clsid, &pProfiler)))
+		return 1;
+
+	MockRuntime runtime;
+	auto start = std::chrono::steady_clock::now();
+
+	if (attachConfig == nullptr && FAILED(runtime.LoadProfiler(pProfiler)))
+		return 1;
+	double initializeMs = MillisecondsSince(start);
+
+	std::vector<ModuleID> modules;
+	auto loadStart = std::chrono::steady_clock::now();
+	for (const std::string& assembly : assemblies) {
+		ModuleID moduleId;
+		if (FAILED(runtime.LoadModule(assembly, &moduleId)))
+			return 1;
+		modules.push_back(moduleId);
+	}
+	double loadMs = MillisecondsSince(loadStart);
+
+	if (attachConfig != nullptr) {
+		auto attachStart = std::chrono::steady_clock::now();
+		if (FAILED(runtime.AttachProfiler(pProfiler, (void*)attachConfig, (UINT)strlen(attachConfig) + 1)))
+			return 1;
+		initializeMs = MillisecondsSince(attachStart);
+	}
+	pProfiler->Release();
+
+	size_t jitted = 0;
+	size_t jitFailures = 0;
+	auto jitStart = std::chrono::steady_clock::now();
+	if (jitAll) {
+		for (ModuleID moduleId : modules) {
+			MockModule* pModule = (MockModule*)moduleId;
+			ULONG methodCount = pModule->Image.RowCount(MetadataTable::MethodDef);
+			for (ULONG rid = 1; rid <= methodCount; rid++) {
+				HRESULT hr = runtime.JitMethod(moduleId, TokenFromRid(rid, mdtMethodDef), nullptr);
+				if (hr == CORPROF_E_FUNCTION_NOT_IL)
+					continue;
+
+				jitted++;
+				if (FAILED(hr)) {
+					spdlog::error("Method {:x} in {} failed to compile: {}", TokenFromRid(rid, mdtMethodDef), pModule->Path, HrToString(hr));
+					jitFailures++;
+				}
+			}
+		}
+	}
+	double jitMs = MillisecondsSince(jitStart);
+
+	auto reJitStart = std::chrono::steady_clock::now();
+	size_t reJitFailures = 0;
+	size_t reJitted = runtime.ProcessReJITRequests(reJitQuietMs, &reJitFailures);
+	double reJitMs = MillisecondsSince(reJitStart);
+
+	size_t allocated = 0;
+	for (ModuleID moduleId : modules)
+		allocated += ((MockModule*)moduleId)->Allocator.BytesAllocated();
+
+	bool detached = runtime.DetachRequested();
+	runtime.Shutdown();
+
+	fmt::print("Initialize:       {:.3f} ms\n", initializeMs);
+	fmt::print("Module loads:     {} in {:.3f} ms\n", modules.size(), loadMs);
+	fmt::print("Methods JITted:   {} in {:.3f} ms, {} failed\n", jitted, jitMs, jitFailures);
+	fmt::print("Methods ReJITted: {} in {:.3f} ms, {} failed, including {} ms waiting for requests\n", reJitted, reJitMs, reJitFailures, reJitQuietMs);
+	fmt::print("IL allocated:     {} bytes\n", allocated);
+	fmt::print("Detached:         {}\n", detached ? "yes" : "no");
+
+	return jitFailures == 0 && reJitFailures == 0 ? 0 : 2;
+}
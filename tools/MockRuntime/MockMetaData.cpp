@@ -0,0 +1,1033 @@
+#include "stdafx.h"
+#include "MockMetaData.h"
+#include "Utils.h"
+#include <algorithm>
+#include <mutex>
+
+// Copies a name out the way RegMeta does. The length reported includes the terminator and a name that doesn't fit is
+// truncated, still terminated, with CLDB_S_TRUNCATION
+static HRESULT CopyName(const std::string& name, LPWSTR szName, ULONG cchName, ULONG* pchName)
+{
+	WSTRING wide = Utf8ToWStr(name.c_str(), name.size());
+	if (pchName != nullptr)
+		*pchName = (ULONG)wide.size() + 1;
+
+	if (szName == nullptr || cchName == 0)
+		return S_OK;
+
+	ULONG copied = std::min<ULONG>((ULONG)wide.size(), cchName - 1);
+	memcpy(szName, wide.c_str(), copied * sizeof(WCHAR));
+	szName[copied] = 0;
+	return copied < wide.size() ? CLDB_S_TRUNCATION : S_OK;
+}
+
+static void SplitTypeName(const std::string& name, std::string& typeNamespace, std::string& typeName)
+{
+	size_t separator = name.rfind('.');
+	if (separator == std::string::npos) {
+		typeNamespace.clear();
+		typeName = name;
+	}
+	else {
+		typeNamespace = name.substr(0, separator);
+		typeName = name.substr(separator + 1);
+	}
+}
+
+static void FillAssemblyMetadata(const EcmaImage& image, MetadataTable table, ULONG rid, int majorColumn, UINT32 culture, ASSEMBLYMETADATA* pMetaData)
+{
+	if (pMetaData == nullptr)
+		return;
+
+	pMetaData->usMajorVersion = (USHORT)image.Get(table, rid, majorColumn);
+	pMetaData->usMinorVersion = (USHORT)image.Get(table, rid, majorColumn + 1);
+	pMetaData->usBuildNumber = (USHORT)image.Get(table, rid, majorColumn + 2);
+	pMetaData->usRevisionNumber = (USHORT)image.Get(table, rid, majorColumn + 3);
+
+	ULONG cbLocale = pMetaData->cbLocale;
+	CopyName(image.GetString(culture), pMetaData->szLocale, cbLocale, &pMetaData->cbLocale);
+
+	// Processor and OS tables are never emitted by modern compilers
+	pMetaData->ulProcessor = 0;
+	pMetaData->ulOS = 0;
+}
+
+MockMetaData::MockMetaData(EcmaImage& image) : m_image(image)
+{
+	ULONG typeCount = image.RowCount(MetadataTable::TypeDef);
+	ULONG methodCount = image.RowCount(MetadataTable::MethodDef);
+	ULONG fieldCount = image.RowCount(MetadataTable::Field);
+
+	// Indexed by rid, so slot 0 is unused
+	m_typeMethods.resize(typeCount + 1);
+	m_typeFields.resize(typeCount + 1);
+	m_methodOwners.assign(methodCount + 1, mdTypeDefNil);
+	m_fieldOwners.assign(fieldCount + 1, mdTypeDefNil);
+
+	for (ULONG rid = 1; rid <= typeCount; rid++) {
+		mdTypeDef td = TokenFromRid(rid, mdtTypeDef);
+
+		// A type's members run up to the first member of the next type
+		ULONG methodEnd = rid < typeCount ? image.Get(MetadataTable::TypeDef, rid + 1, Col::TypeDefMethodList) : methodCount + 1;
+		for (ULONG method = image.Get(MetadataTable::TypeDef, rid, Col::TypeDefMethodList); method < methodEnd && method <= methodCount; method++) {
+			m_typeMethods[rid].push_back(method);
+			m_methodOwners[method] = td;
+		}
+
+		ULONG fieldEnd = rid < typeCount ? image.Get(MetadataTable::TypeDef, rid + 1, Col::TypeDefFieldList) : fieldCount + 1;
+		for (ULONG field = image.Get(MetadataTable::TypeDef, rid, Col::TypeDefFieldList); field < fieldEnd && field <= fieldCount; field++) {
+			m_typeFields[rid].push_back(field);
+			m_fieldOwners[field] = td;
+		}
+	}
+
+	for (ULONG rid = 1; rid <= image.RowCount(MetadataTable::NestedClass); rid++) {
+		m_enclosingTypes[image.Get(MetadataTable::NestedClass, rid, Col::NestedClassNested)] =
+			TokenFromRid(image.Get(MetadataTable::NestedClass, rid, Col::NestedClassEnclosing), mdtTypeDef);
+	}
+
+	for (ULONG rid = 1; rid <= typeCount; rid++) {
+		if (m_enclosingTypes.find(rid) == m_enclosingTypes.end())
+			m_typeDefsByName.emplace(TypeDefName(rid), TokenFromRid(rid, mdtTypeDef));
+	}
+}
+
+HRESULT STDMETHODCALLTYPE MockMetaData::QueryInterface(REFIID riid, void** ppvObject)
+{
+	if (riid == IID_IUnknown || riid == IID_IMetaDataImport) {
+		*ppvObject = static_cast<IMetaDataImport*>(this);
+	}
+	else if (riid == IID_IMetaDataEmit) {
+		*ppvObject = static_cast<IMetaDataEmit*>(this);
+	}
+	else if (riid == IID_IMetaDataAssemblyImport) {
+		*ppvObject = static_cast<IMetaDataAssemblyImport*>(this);
+	}
+	else {
+		*ppvObject = nullptr;
+		return E_NOINTERFACE;
+	}
+
+	AddRef();
+	return S_OK;
+}
+
+ULONG STDMETHODCALLTYPE MockMetaData::AddRef()
+{
+	return ++m_refCount;
+}
+
+ULONG STDMETHODCALLTYPE MockMetaData::Release()
+{
+	ULONG refCount = --m_refCount;
+	if (refCount == 0)
+		delete this;
+
+	return refCount;
+}
+
+std::string MockMetaData::GetTypeName(mdTypeDef td)
+{
+	std::shared_lock<std::shared_mutex> lock(m_lock);
+	return IsValidRow(td, MetadataTable::TypeDef) ? TypeDefName(RidFromToken(td)) : std::string();
+}
+
+bool MockMetaData::IsValidRow(mdToken tk, MetadataTable table) const
+{
+	return TypeFromToken(tk) == ((ULONG)table << 24) && RidFromToken(tk) != 0 && RidFromToken(tk) <= m_image.RowCount(table);
+}
+
+std::string MockMetaData::TypeDefName(ULONG rid) const
+{
+	std::string typeNamespace = m_image.GetString(m_image.Get(MetadataTable::TypeDef, rid, Col::TypeDefNamespace));
+	std::string typeName = m_image.GetString(m_image.Get(MetadataTable::TypeDef, rid, Col::TypeDefName));
+	return typeNamespace.empty() ? typeName : typeNamespace + "." + typeName;
+}
+
+mdTypeDef MockMetaData::FindTypeDef(const std::string& name, mdTypeDef tdEncloser) const
+{
+	if (IsNilToken(tdEncloser)) {
+		auto found = m_typeDefsByName.find(name);
+		return found != m_typeDefsByName.end() ? found->second : mdTypeDefNil;
+	}
+
+	for (const auto& nested : m_enclosingTypes) {
+		if (nested.second == tdEncloser && TypeDefName(nested.first) == name)
+			return TokenFromRid(nested.first, mdtTypeDef);
+	}
+	return mdTypeDefNil;
+}
+
+mdTypeRef MockMetaData::FindTypeRefLocked(mdToken tkResolutionScope, const std::string& name) const
+{
+	std::string typeNamespace, typeName;
+	SplitTypeName(name, typeNamespace, typeName);
+
+	for (ULONG rid = 1; rid <= m_image.RowCount(MetadataTable::TypeRef); rid++) {
+		if (m_image.Get(MetadataTable::TypeRef, rid, Col::TypeRefScope) == tkResolutionScope &&
+			typeName == m_image.GetString(m_image.Get(MetadataTable::TypeRef, rid, Col::TypeRefName)) &&
+			typeNamespace == m_image.GetString(m_image.Get(MetadataTable::TypeRef, rid, Col::TypeRefNamespace)))
+			return TokenFromRid(rid, mdtTypeRef);
+	}
+	return mdTypeRefNil;
+}
+
+mdToken MockMetaData::FindMemberLocked(const std::vector<ULONG>& members, MetadataTable table, int nameColumn, int signatureColumn,
+	const std::string& name, PCCOR_SIGNATURE pvSigBlob, ULONG cbSigBlob) const
+{
+	for (ULONG rid : members) {
+		if (name != m_image.GetString(m_image.Get(table, rid, nameColumn)))
+			continue;
+
+		// Without a signature the first member with the name matches
+		if (cbSigBlob == 0 || BlobEquals(m_image.Get(table, rid, signatureColumn), pvSigBlob, cbSigBlob))
+			return TokenFromRid(rid, (ULONG)table << 24);
+	}
+	return mdTokenNil;
+}
+
+bool MockMetaData::BlobEquals(UINT32 offset, PCCOR_SIGNATURE pvSig, ULONG cbSig) const
+{
+	PCCOR_SIGNATURE pBlob = nullptr;
+	ULONG cbBlob = 0;
+	return m_image.GetBlob(offset, &pBlob, &cbBlob) && cbBlob == cbSig && memcmp(pBlob, pvSig, cbSig) == 0;
+}
+
+template <class Fill>
+HRESULT MockMetaData::Enumerate(HCORENUM* phEnum, Fill fill, mdToken rTokens[], ULONG cMax, ULONG* pcTokens)
+{
+	if (phEnum == nullptr)
+		return E_INVALIDARG;
+
+	TokenEnum* pEnum = (TokenEnum*)*phEnum;
+	if (pEnum == nullptr) {
+		pEnum = new TokenEnum();
+		{
+			std::shared_lock<std::shared_mutex> lock(m_lock);
+			fill(pEnum->Tokens);
+		}
+		*phEnum = pEnum;
+	}
+
+	ULONG count = std::min<ULONG>(cMax, (ULONG)pEnum->Tokens.size() - pEnum->Position);
+	std::copy_n(pEnum->Tokens.begin() + pEnum->Position, count, rTokens);
+	pEnum->Position += count;
+
+	if (pcTokens != nullptr)
+		*pcTokens = count;
+	return count > 0 ? S_OK : S_FALSE;
+}
+
+void STDMETHODCALLTYPE MockMetaData::CloseEnum(HCORENUM hEnum)
+{
+	delete (TokenEnum*)hEnum;
+}
+
+HRESULT STDMETHODCALLTYPE MockMetaData::CountEnum(HCORENUM hEnum, ULONG* pulCount)
+{
+	*pulCount = hEnum != nullptr ? (ULONG)((TokenEnum*)hEnum)->Tokens.size() : 0;
+	return S_OK;
+}
+
+HRESULT STDMETHODCALLTYPE MockMetaData::ResetEnum(HCORENUM hEnum, ULONG ulPos)
+{
+	if (hEnum != nullptr) {
+		TokenEnum* pEnum = (TokenEnum*)hEnum;
+		pEnum->Position = std::min<ULONG>(ulPos, (ULONG)pEnum->Tokens.size());
+	}
+	return S_OK;
+}
+
+HRESULT STDMETHODCALLTYPE MockMetaData::EnumTypeDefs(HCORENUM* phEnum, mdTypeDef rTypeDefs[], ULONG cMax, ULONG* pcTypeDefs)
+{
+	return Enumerate(phEnum, [&](std::vector<mdToken>& tokens) {
+		// The first row is the <Module> type holding globals, which the runtime leaves out
+		for (ULONG rid = 2; rid <= m_image.RowCount(MetadataTable::TypeDef); rid++)
+			tokens.push_back(TokenFromRid(rid, mdtTypeDef));
+	}, rTypeDefs, cMax, pcTypeDefs);
+}
+
+HRESULT STDMETHODCALLTYPE MockMetaData::EnumInterfaceImpls(HCORENUM* phEnum, mdTypeDef td, mdInterfaceImpl rImpls[], ULONG cMax, ULONG* pcImpls)
+{
+	return Enumerate(phEnum, [&](std::vector<mdToken>& tokens) {
+		for (ULONG rid = 1; rid <= m_image.RowCount(MetadataTable::InterfaceImpl); rid++) {
+			if (m_image.Get(MetadataTable::InterfaceImpl, rid, Col::InterfaceImplClass) == RidFromToken(td))
+				tokens.push_back(TokenFromRid(rid, mdtInterfaceImpl));
+		}
+	}, rImpls, cMax, pcImpls);
+}
+
+HRESULT STDMETHODCALLTYPE MockMetaData::EnumTypeRefs(HCORENUM* phEnum, mdTypeRef rTypeRefs[], ULONG cMax, ULONG* pcTypeRefs)
+{
+	return Enumerate(phEnum, [&](std::vector<mdToken>& tokens) {
+		for (ULONG rid = 1; rid <= m_image.RowCount(MetadataTable::TypeRef); rid++)
+			tokens.push_back(TokenFromRid(rid, mdtTypeRef));
+	}, rTypeRefs, cMax, pcTypeRefs);
+}
+
+HRESULT STDMETHODCALLTYPE MockMetaData::FindTypeDefByName(LPCWSTR szTypeDef, mdToken tkEnclosingClass, mdTypeDef* ptd)
+{
+	std::shared_lock<std::shared_mutex> lock(m_lock);
+	*ptd = FindTypeDef(WideToUtf8(szTypeDef), tkEnclosingClass);
+	return IsNilToken(*ptd) ? CLDB_E_RECORD_NOTFOUND : S_OK;
+}
+
+HRESULT STDMETHODCALLTYPE MockMetaData::GetScopeProps(LPWSTR szName, ULONG cchName, ULONG* pchName, GUID* pmvid)
+{
+	std::shared_lock<std::shared_mutex> lock(m_lock);
+	if (pmvid != nullptr) {
+		const GUID* mvid = m_image.GetGuid(m_image.Get(MetadataTable::Module, 1, Col::ModuleMvid));
+		*pmvid = mvid != nullptr ? *mvid : GUID{};
+	}
+	return CopyName(m_image.GetString(m_image.Get(MetadataTable::Module, 1, Col::ModuleName)), szName, cchName, pchName);
+}
+
+HRESULT STDMETHODCALLTYPE MockMetaData::GetModuleFromScope(mdModule* pmd)
+{
+	*pmd = TokenFromRid(1, mdtModule);
+	return S_OK;
+}
+
+HRESULT STDMETHODCALLTYPE MockMetaData::GetTypeDefProps(mdTypeDef td, LPWSTR szTypeDef, ULONG cchTypeDef, ULONG* pchTypeDef, DWORD* pdwTypeDefFlags, mdToken* ptkExtends)
+{
+	std::shared_lock<std::shared_mutex> lock(m_lock);
+	if (!IsValidRow(td, MetadataTable::TypeDef))
+		return E_INVALIDARG;
+
+	ULONG rid = RidFromToken(td);
+	if (pdwTypeDefFlags != nullptr)
+		*pdwTypeDefFlags = m_image.Get(MetadataTable::TypeDef, rid, Col::TypeDefFlags);
+	if (ptkExtends != nullptr)
+		*ptkExtends = m_image.Get(MetadataTable::TypeDef, rid, Col::TypeDefExtends);
+
+	return CopyName(TypeDefName(rid), szTypeDef, cchTypeDef, pchTypeDef);
+}
+
+HRESULT STDMETHODCALLTYPE MockMetaData::GetInterfaceImplProps(mdInterfaceImpl iiImpl, mdTypeDef* pClass, mdToken* ptkIface)
+{
+	std::shared_lock<std::shared_mutex> lock(m_lock);
+	if (!IsValidRow(iiImpl, MetadataTable::InterfaceImpl))
+		return E_INVALIDARG;
+
+	if (pClass != nullptr)
+		*pClass = TokenFromRid(m_image.Get(MetadataTable::InterfaceImpl, RidFromToken(iiImpl), Col::InterfaceImplClass), mdtTypeDef);
+	if (ptkIface != nullptr)
+		*ptkIface = m_image.Get(MetadataTable::InterfaceImpl, RidFromToken(iiImpl), Col::InterfaceImplInterface);
+	return S_OK;
+}
+
+HRESULT STDMETHODCALLTYPE MockMetaData::GetTypeRefProps(mdTypeRef tr, mdToken* ptkResolutionScope, LPWSTR szName, ULONG cchName, ULONG* pchName)
+{
+	std::shared_lock<std::shared_mutex> lock(m_lock);
+	if (!IsValidRow(tr, MetadataTable::TypeRef))
+		return E_INVALIDARG;
+
+	ULONG rid = RidFromToken(tr);
+	if (ptkResolutionScope != nullptr)
+		*ptkResolutionScope = m_image.Get(MetadataTable::TypeRef, rid, Col::TypeRefScope);
+
+	std::string typeNamespace = m_image.GetString(m_image.Get(MetadataTable::TypeRef, rid, Col::TypeRefNamespace));
+	std::string typeName = m_image.GetString(m_image.Get(MetadataTable::TypeRef, rid, Col::TypeRefName));
+	return CopyName(typeNamespace.empty() ? typeName : typeNamespace + "." + typeName, szName, cchName, pchName);
+}
+
+HRESULT STDMETHODCALLTYPE MockMetaData::EnumMembers(HCORENUM* phEnum, mdTypeDef cl, mdToken rMembers[], ULONG cMax, ULONG* pcTokens)
+{
+	return EnumMembersWithName(phEnum, cl, nullptr, rMembers, cMax, pcTokens);
+}
+
+HRESULT STDMETHODCALLTYPE MockMetaData::EnumMembersWithName(HCORENUM* phEnum, mdTypeDef cl, LPCWSTR szName, mdToken rMembers[], ULONG cMax, ULONG* pcTokens)
+{
+	std::string name = szName != nullptr ? WideToUtf8(szName) : std::string();
+	return Enumerate(phEnum, [&](std::vector<mdToken>& tokens) {
+		if (!IsValidRow(cl, MetadataTable::TypeDef))
+			return;
+
+		// Methods come before fields, as they do from the runtime
+		for (ULONG rid : m_typeMethods[RidFromToken(cl)]) {
+			if (szName == nullptr || name == m_image.GetString(m_image.Get(MetadataTable::MethodDef, rid, Col::MethodName)))
+				tokens.push_back(TokenFromRid(rid, mdtMethodDef));
+		}
+		for (ULONG rid : m_typeFields[RidFromToken(cl)]) {
+			if (szName == nullptr || name == m_image.GetString(m_image.Get(MetadataTable::Field, rid, Col::FieldName)))
+				tokens.push_back(TokenFromRid(rid, mdtFieldDef));
+		}
+	}, rMembers, cMax, pcTokens);
+}
+
+HRESULT STDMETHODCALLTYPE MockMetaData::EnumMethods(HCORENUM* phEnum, mdTypeDef cl, mdMethodDef rMethods[], ULONG cMax, ULONG* pcTokens)
+{
+	return EnumMethodsWithName(phEnum, cl, nullptr, rMethods, cMax, pcTokens);
+}
+
+HRESULT STDMETHODCALLTYPE MockMetaData::EnumMethodsWithName(HCORENUM* phEnum, mdTypeDef cl, LPCWSTR szName, mdMethodDef rMethods[], ULONG cMax, ULONG* pcTokens)
+{
+	std::string name = szName != nullptr ? WideToUtf8(szName) : std::string();
+	return Enumerate(phEnum, [&](std::vector<mdToken>& tokens) {
+		if (!IsValidRow(cl, MetadataTable::TypeDef))
+			return;
+
+		for (ULONG rid : m_typeMethods[RidFromToken(cl)]) {
+			if (szName == nullptr || name == m_image.GetString(m_image.Get(MetadataTable::MethodDef, rid, Col::MethodName)))
+				tokens.push_back(TokenFromRid(rid, mdtMethodDef));
+		}
+	}, rMethods, cMax, pcTokens);
+}
+
+HRESULT STDMETHODCALLTYPE MockMetaData::EnumFields(HCORENUM* phEnum, mdTypeDef cl, mdFieldDef rFields[], ULONG cMax, ULONG* pcTokens)
+{
+	return EnumFieldsWithName(phEnum, cl, nullptr, rFields, cMax, pcTokens);
+}
+
+HRESULT STDMETHODCALLTYPE MockMetaData::EnumFieldsWithName(HCORENUM* phEnum, mdTypeDef cl, LPCWSTR szName, mdFieldDef rFields[], ULONG cMax, ULONG* pcTokens)
+{
+	std::string name = szName != nullptr ? WideToUtf8(szName) : std::string();
+	return Enumerate(phEnum, [&](std::vector<mdToken>& tokens) {
+		if (!IsValidRow(cl, MetadataTable::TypeDef))
+			return;
+
+		for (ULONG rid : m_typeFields[RidFromToken(cl)]) {
+			if (szName == nullptr || name == m_image.GetString(m_image.Get(MetadataTable::Field, rid, Col::FieldName)))
+				tokens.push_back(TokenFromRid(rid, mdtFieldDef));
+		}
+	}, rFields, cMax, pcTokens);
+}
+
+HRESULT STDMETHODCALLTYPE MockMetaData::EnumMemberRefs(HCORENUM* phEnum, mdToken tkParent, mdMemberRef rMemberRefs[], ULONG cMax, ULONG* pcTokens)
+{
+	return Enumerate(phEnum, [&](std::vector<mdToken>& tokens) {
+		for (ULONG rid = 1; rid <= m_image.RowCount(MetadataTable::MemberRef); rid++) {
+			if (m_image.Get(MetadataTable::MemberRef, rid, Col::MemberRefClass) == tkParent)
+				tokens.push_back(TokenFromRid(rid, mdtMemberRef));
+		}
+	}, rMemberRefs, cMax, pcTokens);
+}
+
+HRESULT STDMETHODCALLTYPE MockMetaData::FindMember(mdTypeDef td, LPCWSTR szName, PCCOR_SIGNATURE pvSigBlob, ULONG cbSigBlob, mdToken* pmb)
+{
+	if (SUCCEEDED(FindMethod(td, szName, pvSigBlob, cbSigBlob, pmb)))
+		return S_OK;
+
+	return FindField(td, szName, pvSigBlob, cbSigBlob, pmb);
+}
+
+HRESULT STDMETHODCALLTYPE MockMetaData::FindMethod(mdTypeDef td, LPCWSTR szName, PCCOR_SIGNATURE pvSigBlob, ULONG cbSigBlob, mdMethodDef* pmb)
+{
+	std::shared_lock<std::shared_mutex> lock(m_lock);
+	if (!IsValidRow(td, MetadataTable::TypeDef))
+		return E_INVALIDARG;
+
+	*pmb = FindMemberLocked(m_typeMethods[RidFromToken(td)], MetadataTable::MethodDef, Col::MethodName, Col::MethodSignature,
+		WideToUtf8(szName), pvSigBlob, cbSigBlob);
+	return IsNilToken(*pmb) ? CLDB_E_RECORD_NOTFOUND : S_OK;
+}
+
+HRESULT STDMETHODCALLTYPE MockMetaData::FindField(mdTypeDef td, LPCWSTR szName, PCCOR_SIGNATURE pvSigBlob, ULONG cbSigBlob, mdFieldDef* pmb)
+{
+	std::shared_lock<std::shared_mutex> lock(m_lock);
+	if (!IsValidRow(td, MetadataTable::TypeDef))
+		return E_INVALIDARG;
+
+	*pmb = FindMemberLocked(m_typeFields[RidFromToken(td)], MetadataTable::Field, Col::FieldName, Col::FieldSignature,
+		WideToUtf8(szName), pvSigBlob, cbSigBlob);
+	return IsNilToken(*pmb) ? CLDB_E_RECORD_NOTFOUND : S_OK;
+}
+
+HRESULT STDMETHODCALLTYPE MockMetaData::FindMemberRef(mdTypeRef td, LPCWSTR szName, PCCOR_SIGNATURE pvSigBlob, ULONG cbSigBlob, mdMemberRef* pmr)
+{
+	std::shared_lock<std::shared_mutex> lock(m_lock);
+	std::string name = WideToUtf8(szName);
+
+	for (ULONG rid = 1; rid <= m_image.RowCount(MetadataTable::MemberRef); rid++) {
+		if (m_image.Get(MetadataTable::MemberRef, rid, Col::MemberRefClass) == td &&
+			name == m_image.GetString(m_image.Get(MetadataTable::MemberRef, rid, Col::MemberRefName)) &&
+			(cbSigBlob == 0 || BlobEquals(m_image.Get(MetadataTable::MemberRef, rid, Col::MemberRefSignature), pvSigBlob, cbSigBlob))) {
+			*pmr = TokenFromRid(rid, mdtMemberRef);
+			return S_OK;
+		}
+	}
+
+	*pmr = mdMemberRefNil;
+	return CLDB_E_RECORD_NOTFOUND;
+}
+
+HRESULT STDMETHODCALLTYPE MockMetaData::GetMethodProps(mdMethodDef mb, mdTypeDef* pClass, LPWSTR szMethod, ULONG cchMethod, ULONG* pchMethod, DWORD* pdwAttr, PCCOR_SIGNATURE* ppvSigBlob, ULONG* pcbSigBlob, ULONG* pulCodeRVA, DWORD* pdwImplFlags)
+{
+	std::shared_lock<std::shared_mutex> lock(m_lock);
+	if (!IsValidRow(mb, MetadataTable::MethodDef))
+		return E_INVALIDARG;
+
+	ULONG rid = RidFromToken(mb);
+	if (pClass != nullptr)
+		*pClass = m_methodOwners[rid];
+	if (pdwAttr != nullptr)
+		*pdwAttr = m_image.Get(MetadataTable::MethodDef, rid, Col::MethodFlags);
+	if (pulCodeRVA != nullptr)
+		*pulCodeRVA = m_image.Get(MetadataTable::MethodDef, rid, Col::MethodRva);
+	if (pdwImplFlags != nullptr)
+		*pdwImplFlags = m_image.Get(MetadataTable::MethodDef, rid, Col::MethodImplFlags);
+	if (ppvSigBlob != nullptr && pcbSigBlob != nullptr) {
+		if (!m_image.GetBlob(m_image.Get(MetadataTable::MethodDef, rid, Col::MethodSignature), ppvSigBlob, pcbSigBlob))
+			return CLDB_E_FILE_CORRUPT;
+	}
+
+	return CopyName(m_image.GetString(m_image.Get(MetadataTable::MethodDef, rid, Col::MethodName)), szMethod, cchMethod, pchMethod);
+}
+
+HRESULT STDMETHODCALLTYPE MockMetaData::GetMemberRefProps(mdMemberRef mr, mdToken* ptk, LPWSTR szMember, ULONG cchMember, ULONG* pchMember, PCCOR_SIGNATURE* ppvSigBlob, ULONG* pbSig)
+{
+	std::shared_lock<std::shared_mutex> lock(m_lock);
+	if (!IsValidRow(mr, MetadataTable::MemberRef))
+		return E_INVALIDARG;
+
+	ULONG rid = RidFromToken(mr);
+	if (ptk != nullptr)
+		*ptk = m_image.Get(MetadataTable::MemberRef, rid, Col::MemberRefClass);
+	if (ppvSigBlob != nullptr && pbSig != nullptr) {
+		if (!m_image.GetBlob(m_image.Get(MetadataTable::MemberRef, rid, Col::MemberRefSignature), ppvSigBlob, pbSig))
+			return CLDB_E_FILE_CORRUPT;
+	}
+
+	return CopyName(m_image.GetString(m_image.Get(MetadataTable::MemberRef, rid, Col::MemberRefName)), szMember, cchMember, pchMember);
+}
+
+HRESULT STDMETHODCALLTYPE MockMetaData::GetRVA(mdToken tk, ULONG* pulCodeRVA, DWORD* pdwImplFlags)
+{
+	std::shared_lock<std::shared_mutex> lock(m_lock);
+	if (!IsValidRow(tk, MetadataTable::MethodDef))
+		return E_INVALIDARG;
+
+	if (pulCodeRVA != nullptr)
+		*pulCodeRVA = m_image.Get(MetadataTable::MethodDef, RidFromToken(tk), Col::MethodRva);
+	if (pdwImplFlags != nullptr)
+		*pdwImplFlags = m_image.Get(MetadataTable::MethodDef, RidFromToken(tk), Col::MethodImplFlags);
+	return S_OK;
+}
+
+HRESULT STDMETHODCALLTYPE MockMetaData::GetSigFromToken(mdSignature mdSig, PCCOR_SIGNATURE* ppvSig, ULONG* pcbSig)
+{
+	std::shared_lock<std::shared_mutex> lock(m_lock);
+	if (!IsValidRow(mdSig, MetadataTable::StandAloneSig))
+		return E_INVALIDARG;
+
+	if (!m_image.GetBlob(m_image.Get(MetadataTable::StandAloneSig, RidFromToken(mdSig), Col::StandAloneSigSignature), ppvSig, pcbSig))
+		return CLDB_E_FILE_CORRUPT;
+	return S_OK;
+}
+
+HRESULT STDMETHODCALLTYPE MockMetaData::GetModuleRefProps(mdModuleRef mur, LPWSTR szName, ULONG cchName, ULONG* pchName)
+{
+	std::shared_lock<std::shared_mutex> lock(m_lock);
+	if (!IsValidRow(mur, MetadataTable::ModuleRef))
+		return E_INVALIDARG;
+
+	return CopyName(m_image.GetString(m_image.Get(MetadataTable::ModuleRef, RidFromToken(mur), Col::ModuleRefName)), szName, cchName, pchName);
+}
+
+HRESULT STDMETHODCALLTYPE MockMetaData::EnumModuleRefs(HCORENUM* phEnum, mdModuleRef rModuleRefs[], ULONG cmax, ULONG* pcModuleRefs)
+{
+	return Enumerate(phEnum, [&](std::vector<mdToken>& tokens) {
+		for (ULONG rid = 1; rid <= m_image.RowCount(MetadataTable::ModuleRef); rid++)
+			tokens.push_back(TokenFromRid(rid, mdtModuleRef));
+	}, rModuleRefs, cmax, pcModuleRefs);
+}
+
+HRESULT STDMETHODCALLTYPE MockMetaData::GetTypeSpecFromToken(mdTypeSpec typespec, PCCOR_SIGNATURE* ppvSig, ULONG* pcbSig)
+{
+	std::shared_lock<std::shared_mutex> lock(m_lock);
+	if (!IsValidRow(typespec, MetadataTable::TypeSpec))
+		return E_INVALIDARG;
+
+	if (!m_image.GetBlob(m_image.Get(MetadataTable::TypeSpec, RidFromToken(typespec), Col::TypeSpecSignature), ppvSig, pcbSig))
+		return CLDB_E_FILE_CORRUPT;
+	return S_OK;
+}
+
+HRESULT STDMETHODCALLTYPE MockMetaData::GetNameFromToken(mdToken tk, MDUTF8CSTR* pszUtf8NamePtr)
+{
+	std::shared_lock<std::shared_mutex> lock(m_lock);
+
+	// Tables whose rows have a name, and the column it's in
+	static const std::pair<MetadataTable, int> namedTables[] = {
+		{ MetadataTable::Module, Col::ModuleName },
+		{ MetadataTable::TypeRef, Col::TypeRefName },
+		{ MetadataTable::TypeDef, Col::TypeDefName },
+		{ MetadataTable::Field, Col::FieldName },
+		{ MetadataTable::MethodDef, Col::MethodName },
+		{ MetadataTable::Param, Col::ParamName },
+		{ MetadataTable::MemberRef, Col::MemberRefName },
+		{ MetadataTable::ModuleRef, Col::ModuleRefName },
+	};
+
+	for (const auto& named : namedTables) {
+		if (IsValidRow(tk, named.first)) {
+			*pszUtf8NamePtr = m_image.GetString(m_image.Get(named.first, RidFromToken(tk), named.second));
+			return S_OK;
+		}
+	}
+	return E_INVALIDARG;
+}
+
+HRESULT STDMETHODCALLTYPE MockMetaData::GetUserString(mdString stk, LPWSTR szString, ULONG cchString, ULONG* pchString)
+{
+	std::shared_lock<std::shared_mutex> lock(m_lock);
+	const BYTE* pData = nullptr;
+	ULONG cbData = 0;
+	if (TypeFromToken(stk) != mdtString || !m_image.GetUserString(RidFromToken(stk), &pData, &cbData))
+		return E_INVALIDARG;
+
+	// User strings are UTF-16 and, unlike names, aren't terminated
+	ULONG cch = cbData / 2;
+	if (pchString != nullptr)
+		*pchString = cch;
+	if (szString == nullptr)
+		return S_OK;
+
+	ULONG copied = std::min(cch, cchString);
+	for (ULONG i = 0; i < copied; i++)
+		szString[i] = (WCHAR)(pData[i * 2] | (pData[i * 2 + 1] << 8));
+	return copied < cch ? CLDB_S_TRUNCATION : S_OK;
+}
+
+HRESULT STDMETHODCALLTYPE MockMetaData::GetPinvokeMap(mdToken tk, DWORD* pdwMappingFlags, LPWSTR szImportName, ULONG cchImportName, ULONG* pchImportName, mdModuleRef* pmrImportDLL)
+{
+	std::shared_lock<std::shared_mutex> lock(m_lock);
+	for (ULONG rid = 1; rid <= m_image.RowCount(MetadataTable::ImplMap); rid++) {
+		if (m_image.Get(MetadataTable::ImplMap, rid, Col::ImplMapMember) != tk)
+			continue;
+
+		if (pdwMappingFlags != nullptr)
+			*pdwMappingFlags = m_image.Get(MetadataTable::ImplMap, rid, Col::ImplMapFlags);
+		if (pmrImportDLL != nullptr)
+			*pmrImportDLL = TokenFromRid(m_image.Get(MetadataTable::ImplMap, rid, Col::ImplMapImportScope), mdtModuleRef);
+		return CopyName(m_image.GetString(m_image.Get(MetadataTable::ImplMap, rid, Col::ImplMapImportName)), szImportName, cchImportName, pchImportName);
+	}
+	return CLDB_E_RECORD_NOTFOUND;
+}
+
+HRESULT STDMETHODCALLTYPE MockMetaData::EnumSignatures(HCORENUM* phEnum, mdSignature rSignatures[], ULONG cmax, ULONG* pcSignatures)
+{
+	return Enumerate(phEnum, [&](std::vector<mdToken>& tokens) {
+		for (ULONG rid = 1; rid <= m_image.RowCount(MetadataTable::StandAloneSig); rid++)
+			tokens.push_back(TokenFromRid(rid, mdtSignature));
+	}, rSignatures, cmax, pcSignatures);
+}
+
+HRESULT STDMETHODCALLTYPE MockMetaData::EnumTypeSpecs(HCORENUM* phEnum, mdTypeSpec rTypeSpecs[], ULONG cmax, ULONG* pcTypeSpecs)
+{
+	return Enumerate(phEnum, [&](std::vector<mdToken>& tokens) {
+		for (ULONG rid = 1; rid <= m_image.RowCount(MetadataTable::TypeSpec); rid++)
+			tokens.push_back(TokenFromRid(rid, mdtTypeSpec));
+	}, rTypeSpecs, cmax, pcTypeSpecs);
+}
+
+HRESULT STDMETHODCALLTYPE MockMetaData::EnumCustomAttributes(HCORENUM* phEnum, mdToken tk, mdToken tkType, mdCustomAttribute rCustomAttributes[], ULONG cMax, ULONG* pcCustomAttributes)
+{
+	return Enumerate(phEnum, [&](std::vector<mdToken>& tokens) {
+		for (ULONG rid = 1; rid <= m_image.RowCount(MetadataTable::CustomAttribute); rid++) {
+			if (!IsNilToken(tk) && m_image.Get(MetadataTable::CustomAttribute, rid, Col::CustomAttributeParent) != tk)
+				continue;
+
+			// An attribute's type is whatever declares its constructor
+			if (!IsNilToken(tkType)) {
+				mdToken tkCtor = m_image.Get(MetadataTable::CustomAttribute, rid, Col::CustomAttributeType);
+				mdToken tkCtorType = mdTokenNil;
+				if (IsValidRow(tkCtor, MetadataTable::MethodDef))
+					tkCtorType = m_methodOwners[RidFromToken(tkCtor)];
+				else if (IsValidRow(tkCtor, MetadataTable::MemberRef))
+					tkCtorType = m_image.Get(MetadataTable::MemberRef, RidFromToken(tkCtor), Col::MemberRefClass);
+
+				if (tkCtorType != tkType)
+					continue;
+			}
+
+			tokens.push_back(TokenFromRid(rid, mdtCustomAttribute));
+		}
+	}, rCustomAttributes, cMax, pcCustomAttributes);
+}
+
+HRESULT STDMETHODCALLTYPE MockMetaData::GetCustomAttributeProps(mdCustomAttribute cv, mdToken* ptkObj, mdToken* ptkType, void const** ppBlob, ULONG* pcbSize)
+{
+	std::shared_lock<std::shared_mutex> lock(m_lock);
+	if (!IsValidRow(cv, MetadataTable::CustomAttribute))
+		return E_INVALIDARG;
+
+	ULONG rid = RidFromToken(cv);
+	if (ptkObj != nullptr)
+		*ptkObj = m_image.Get(MetadataTable::CustomAttribute, rid, Col::CustomAttributeParent);
+	if (ptkType != nullptr)
+		*ptkType = m_image.Get(MetadataTable::CustomAttribute, rid, Col::CustomAttributeType);
+	if (ppBlob != nullptr && pcbSize != nullptr) {
+		PCCOR_SIGNATURE pBlob = nullptr;
+		*pcbSize = 0;
+		m_image.GetBlob(m_image.Get(MetadataTable::CustomAttribute, rid, Col::CustomAttributeValue), &pBlob, pcbSize);
+		*ppBlob = pBlob;
+	}
+	return S_OK;
+}
+
+HRESULT STDMETHODCALLTYPE MockMetaData::FindTypeRef(mdToken tkResolutionScope, LPCWSTR szName, mdTypeRef* ptr)
+{
+	std::shared_lock<std::shared_mutex> lock(m_lock);
+	*ptr = FindTypeRefLocked(tkResolutionScope, WideToUtf8(szName));
+	return IsNilToken(*ptr) ? CLDB_E_RECORD_NOTFOUND : S_OK;
+}
+
+HRESULT STDMETHODCALLTYPE MockMetaData::GetFieldProps(mdFieldDef mb, mdTypeDef* pClass, LPWSTR szField, ULONG cchField, ULONG* pchField, DWORD* pdwAttr, PCCOR_SIGNATURE* ppvSigBlob, ULONG* pcbSigBlob, DWORD* pdwCPlusTypeFlag, UVCP_CONSTANT* ppValue, ULONG* pcchValue)
+{
+	std::shared_lock<std::shared_mutex> lock(m_lock);
+	if (!IsValidRow(mb, MetadataTable::Field))
+		return E_INVALIDARG;
+
+	ULONG rid = RidFromToken(mb);
+	if (pClass != nullptr)
+		*pClass = m_fieldOwners[rid];
+	if (pdwAttr != nullptr)
+		*pdwAttr = m_image.Get(MetadataTable::Field, rid, Col::FieldFlags);
+	if (ppvSigBlob != nullptr && pcbSigBlob != nullptr) {
+		if (!m_image.GetBlob(m_image.Get(MetadataTable::Field, rid, Col::FieldSignature), ppvSigBlob, pcbSigBlob))
+			return CLDB_E_FILE_CORRUPT;
+	}
+
+	// Constant values aren't read, every field is reported as having none
+	if (pdwCPlusTypeFlag != nullptr)
+		*pdwCPlusTypeFlag = ELEMENT_TYPE_VOID;
+	if (ppValue != nullptr)
+		*ppValue = nullptr;
+	if (pcchValue != nullptr)
+		*pcchValue = 0;
+
+	return CopyName(m_image.GetString(m_image.Get(MetadataTable::Field, rid, Col::FieldName)), szField, cchField, pchField);
+}
+
+BOOL STDMETHODCALLTYPE MockMetaData::IsValidToken(mdToken tk)
+{
+	std::shared_lock<std::shared_mutex> lock(m_lock);
+	if (TypeFromToken(tk) == mdtString) {
+		const BYTE* pData = nullptr;
+		ULONG cbData = 0;
+		return m_image.GetUserString(RidFromToken(tk), &pData, &cbData);
+	}
+
+	ULONG table = TypeFromToken(tk) >> 24;
+	return table < (ULONG)MetadataTable::Count && IsValidRow(tk, (MetadataTable)table);
+}
+
+HRESULT STDMETHODCALLTYPE MockMetaData::GetNestedClassProps(mdTypeDef tdNestedClass, mdTypeDef* ptdEnclosingClass)
+{
+	std::shared_lock<std::shared_mutex> lock(m_lock);
+	auto found = m_enclosingTypes.find(RidFromToken(tdNestedClass));
+	if (TypeFromToken(tdNestedClass) != mdtTypeDef || found == m_enclosingTypes.end())
+		return CLDB_E_RECORD_NOTFOUND;
+
+	*ptdEnclosingClass = found->second;
+	return S_OK;
+}
+
+mdTypeDef MockMetaData::AddTypeDef(const std::string& name, DWORD dwTypeDefFlags, mdToken tkExtends, mdToken rtkImplements[])
+{
+	std::string typeNamespace, typeName;
+	SplitTypeName(name, typeNamespace, typeName);
+
+	// Emitted types start with an empty member list at the end of the method and field tables
+	ULONG rid = m_image.AddRow(MetadataTable::TypeDef, {
+		dwTypeDefFlags,
+		m_image.AddString(typeName),
+		m_image.AddString(typeNamespace),
+		tkExtends,
+		m_image.RowCount(MetadataTable::Field) + 1,
+		m_image.RowCount(MetadataTable::MethodDef) + 1 });
+	m_typeMethods.emplace_back();
+	m_typeFields.emplace_back();
+
+	for (int i = 0; rtkImplements != nullptr && !IsNilToken(rtkImplements[i]); i++)
+		m_image.AddRow(MetadataTable::InterfaceImpl, { rid, rtkImplements[i] });
+
+	return TokenFromRid(rid, mdtTypeDef);
+}
+
+HRESULT STDMETHODCALLTYPE MockMetaData::DefineTypeDef(LPCWSTR szTypeDef, DWORD dwTypeDefFlags, mdToken tkExtends, mdToken rtkImplements[], mdTypeDef* ptd)
+{
+	std::unique_lock<std::shared_mutex> lock(m_lock);
+	std::string name = WideToUtf8(szTypeDef);
+
+	mdTypeDef existing = FindTypeDef(name, mdTypeDefNil);
+	if (!IsNilToken(existing)) {
+		*ptd = existing;
+		return CLDB_E_RECORD_DUPLICATE;
+	}
+
+	*ptd = AddTypeDef(name, dwTypeDefFlags, tkExtends, rtkImplements);
+	m_typeDefsByName.emplace(name, *ptd);
+	return S_OK;
+}
+
+HRESULT STDMETHODCALLTYPE MockMetaData::DefineNestedType(LPCWSTR szTypeDef, DWORD dwTypeDefFlags, mdToken tkExtends, mdToken rtkImplements[], mdTypeDef tdEncloser, mdTypeDef* ptd)
+{
+	std::unique_lock<std::shared_mutex> lock(m_lock);
+	if (!IsValidRow(tdEncloser, MetadataTable::TypeDef))
+		return E_INVALIDARG;
+
+	std::string name = WideToUtf8(szTypeDef);
+	mdTypeDef existing = FindTypeDef(name, tdEncloser);
+	if (!IsNilToken(existing)) {
+		*ptd = existing;
+		return CLDB_E_RECORD_DUPLICATE;
+	}
+
+	*ptd = AddTypeDef(name, dwTypeDefFlags, tkExtends, rtkImplements);
+	m_image.AddRow(MetadataTable::NestedClass, { RidFromToken(*ptd), RidFromToken(tdEncloser) });
+	m_enclosingTypes[RidFromToken(*ptd)] = tdEncloser;
+	return S_OK;
+}
+
+HRESULT STDMETHODCALLTYPE MockMetaData::DefineMethod(mdTypeDef td, LPCWSTR szName, DWORD dwMethodFlags, PCCOR_SIGNATURE pvSigBlob, ULONG cbSigBlob, ULONG ulCodeRVA, DWORD dwImplFlags, mdMethodDef* pmd)
+{
+	std::unique_lock<std::shared_mutex> lock(m_lock);
+	if (!IsValidRow(td, MetadataTable::TypeDef))
+		return E_INVALIDARG;
+
+	ULONG rid = m_image.AddRow(MetadataTable::MethodDef, {
+		ulCodeRVA,
+		dwImplFlags,
+		dwMethodFlags,
+		m_image.AddString(WideToUtf8(szName)),
+		m_image.AddBlob(pvSigBlob, cbSigBlob),
+		m_image.RowCount(MetadataTable::Param) + 1 });
+	m_typeMethods[RidFromToken(td)].push_back(rid);
+	m_methodOwners.push_back(td);
+
+	*pmd = TokenFromRid(rid, mdtMethodDef);
+	return S_OK;
+}
+
+HRESULT STDMETHODCALLTYPE MockMetaData::DefineTypeRefByName(mdToken tkResolutionScope, LPCWSTR szName, mdTypeRef* ptr)
+{
+	std::unique_lock<std::shared_mutex> lock(m_lock);
+	std::string name = WideToUtf8(szName);
+
+	// Type refs are shared, defining one that already exists returns it
+	*ptr = FindTypeRefLocked(tkResolutionScope, name);
+	if (!IsNilToken(*ptr))
+		return S_OK;
+
+	std::string typeNamespace, typeName;
+	SplitTypeName(name, typeNamespace, typeName);
+	ULONG rid = m_image.AddRow(MetadataTable::TypeRef, { tkResolutionScope, m_image.AddString(typeName), m_image.AddString(typeNamespace) });
+
+	*ptr = TokenFromRid(rid, mdtTypeRef);
+	return S_OK;
+}
+
+HRESULT STDMETHODCALLTYPE MockMetaData::DefineMemberRef(mdToken tkImport, LPCWSTR szName, PCCOR_SIGNATURE pvSigBlob, ULONG cbSigBlob, mdMemberRef* pmr)
+{
+	std::unique_lock<std::shared_mutex> lock(m_lock);
+	std::string name = WideToUtf8(szName);
+
+	for (ULONG rid = 1; rid <= m_image.RowCount(MetadataTable::MemberRef); rid++) {
+		if (m_image.Get(MetadataTable::MemberRef, rid, Col::MemberRefClass) == tkImport &&
+			name == m_image.GetString(m_image.Get(MetadataTable::MemberRef, rid, Col::MemberRefName)) &&
+			BlobEquals(m_image.Get(MetadataTable::MemberRef, rid, Col::MemberRefSignature), pvSigBlob, cbSigBlob)) {
+			*pmr = TokenFromRid(rid, mdtMemberRef);
+			return S_OK;
+		}
+	}
+
+	ULONG rid = m_image.AddRow(MetadataTable::MemberRef, { tkImport, m_image.AddString(name), m_image.AddBlob(pvSigBlob, cbSigBlob) });
+	*pmr = TokenFromRid(rid, mdtMemberRef);
+	return S_OK;
+}
+
+HRESULT STDMETHODCALLTYPE MockMetaData::SetRVA(mdMethodDef md, ULONG ulRVA)
+{
+	std::unique_lock<std::shared_mutex> lock(m_lock);
+	if (!IsValidRow(md, MetadataTable::MethodDef))
+		return E_INVALIDARG;
+
+	m_image.Set(MetadataTable::MethodDef, RidFromToken(md), Col::MethodRva, ulRVA);
+	return S_OK;
+}
+
+HRESULT STDMETHODCALLTYPE MockMetaData::GetTokenFromSig(PCCOR_SIGNATURE pvSig, ULONG cbSig, mdSignature* pmsig)
+{
+	std::unique_lock<std::shared_mutex> lock(m_lock);
+	for (ULONG rid = 1; rid <= m_image.RowCount(MetadataTable::StandAloneSig); rid++) {
+		if (BlobEquals(m_image.Get(MetadataTable::StandAloneSig, rid, Col::StandAloneSigSignature), pvSig, cbSig)) {
+			*pmsig = TokenFromRid(rid, mdtSignature);
+			return S_OK;
+		}
+	}
+
+	ULONG rid = m_image.AddRow(MetadataTable::StandAloneSig, { m_image.AddBlob(pvSig, cbSig) });
+	*pmsig = TokenFromRid(rid, mdtSignature);
+	return S_OK;
+}
+
+HRESULT STDMETHODCALLTYPE MockMetaData::DefineModuleRef(LPCWSTR szName, mdModuleRef* pmur)
+{
+	std::unique_lock<std::shared_mutex> lock(m_lock);
+	std::string name = WideToUtf8(szName);
+
+	for (ULONG rid = 1; rid <= m_image.RowCount(MetadataTable::ModuleRef); rid++) {
+		if (name == m_image.GetString(m_image.Get(MetadataTable::ModuleRef, rid, Col::ModuleRefName))) {
+			*pmur = TokenFromRid(rid, mdtModuleRef);
+			return S_OK;
+		}
+	}
+
+	ULONG rid = m_image.AddRow(MetadataTable::ModuleRef, { m_image.AddString(name) });
+	*pmur = TokenFromRid(rid, mdtModuleRef);
+	return S_OK;
+}
+
+HRESULT STDMETHODCALLTYPE MockMetaData::GetTokenFromTypeSpec(PCCOR_SIGNATURE pvSig, ULONG cbSig, mdTypeSpec* ptypespec)
+{
+	std::unique_lock<std::shared_mutex> lock(m_lock);
+	for (ULONG rid = 1; rid <= m_image.RowCount(MetadataTable::TypeSpec); rid++) {
+		if (BlobEquals(m_image.Get(MetadataTable::TypeSpec, rid, Col::TypeSpecSignature), pvSig, cbSig)) {
+			*ptypespec = TokenFromRid(rid, mdtTypeSpec);
+			return S_OK;
+		}
+	}
+
+	ULONG rid = m_image.AddRow(MetadataTable::TypeSpec, { m_image.AddBlob(pvSig, cbSig) });
+	*ptypespec = TokenFromRid(rid, mdtTypeSpec);
+	return S_OK;
+}
+
+HRESULT STDMETHODCALLTYPE MockMetaData::DefineUserString(LPCWSTR szString, ULONG cchString, mdString* pstk)
+{
+	std::unique_lock<std::shared_mutex> lock(m_lock);
+	std::vector<UINT16> data(szString, szString + cchString);
+
+	*pstk = TokenFromRid(m_image.AddUserString(data.data(), cchString), mdtString);
+	return S_OK;
+}
+
+HRESULT STDMETHODCALLTYPE MockMetaData::SetMethodProps(mdMethodDef md, DWORD dwMethodFlags, ULONG ulCodeRVA, DWORD dwImplFlags)
+{
+	std::unique_lock<std::shared_mutex> lock(m_lock);
+	if (!IsValidRow(md, MetadataTable::MethodDef))
+		return E_INVALIDARG;
+
+	// -1 leaves a value as it is
+	ULONG rid = RidFromToken(md);
+	if (dwMethodFlags != (DWORD)-1)
+		m_image.Set(MetadataTable::MethodDef, rid, Col::MethodFlags, dwMethodFlags);
+	if (ulCodeRVA != (ULONG)-1)
+		m_image.Set(MetadataTable::MethodDef, rid, Col::MethodRva, ulCodeRVA);
+	if (dwImplFlags != (DWORD)-1)
+		m_image.Set(MetadataTable::MethodDef, rid, Col::MethodImplFlags, dwImplFlags);
+	return S_OK;
+}
+
+HRESULT STDMETHODCALLTYPE MockMetaData::DefinePinvokeMap(mdToken tk, DWORD dwMappingFlags, LPCWSTR szImportName, mdModuleRef mrImportDLL)
+{
+	std::unique_lock<std::shared_mutex> lock(m_lock);
+	if (!IsValidRow(tk, MetadataTable::MethodDef) || !IsValidRow(mrImportDLL, MetadataTable::ModuleRef))
+		return E_INVALIDARG;
+
+	for (ULONG rid = 1; rid <= m_image.RowCount(MetadataTable::ImplMap); rid++) {
+		if (m_image.Get(MetadataTable::ImplMap, rid, Col::ImplMapMember) == tk)
+			return CLDB_E_RECORD_DUPLICATE;
+	}
+
+	m_image.AddRow(MetadataTable::ImplMap, { dwMappingFlags, tk, m_image.AddString(WideToUtf8(szImportName)), RidFromToken(mrImportDLL) });
+	return S_OK;
+}
+
+HRESULT STDMETHODCALLTYPE MockMetaData::DefineCustomAttribute(mdToken tkOwner, mdToken tkCtor, void const* pCustomAttribute, ULONG cbCustomAttribute, mdCustomAttribute* pcv)
+{
+	std::unique_lock<std::shared_mutex> lock(m_lock);
+	if (!IsValidRow(tkCtor, MetadataTable::MethodDef) && !IsValidRow(tkCtor, MetadataTable::MemberRef))
+		return E_INVALIDARG;
+
+	ULONG rid = m_image.AddRow(MetadataTable::CustomAttribute, { tkOwner, tkCtor, m_image.AddBlob((const BYTE*)pCustomAttribute, cbCustomAttribute) });
+	if (pcv != nullptr)
+		*pcv = TokenFromRid(rid, mdtCustomAttribute);
+	return S_OK;
+}
+
+HRESULT STDMETHODCALLTYPE MockMetaData::DefineField(mdTypeDef td, LPCWSTR szName, DWORD dwFieldFlags, PCCOR_SIGNATURE pvSigBlob, ULONG cbSigBlob, DWORD dwCPlusTypeFlag, void const* pValue, ULONG cchValue, mdFieldDef* pmd)
+{
+	// Fields with a constant value would need the Constant table, which nothing reads back
+	if (pValue != nullptr)
+		return E_NOTIMPL;
+
+	std::unique_lock<std::shared_mutex> lock(m_lock);
+	if (!IsValidRow(td, MetadataTable::TypeDef))
+		return E_INVALIDARG;
+
+	ULONG rid = m_image.AddRow(MetadataTable::Field, { dwFieldFlags, m_image.AddString(WideToUtf8(szName)), m_image.AddBlob(pvSigBlob, cbSigBlob) });
+	m_typeFields[RidFromToken(td)].push_back(rid);
+	m_fieldOwners.push_back(td);
+
+	*pmd = TokenFromRid(rid, mdtFieldDef);
+	return S_OK;
+}
+
+HRESULT STDMETHODCALLTYPE MockMetaData::GetAssemblyProps(mdAssembly mda, const void** ppbPublicKey, ULONG* pcbPublicKey, ULONG* pulHashAlgId, LPWSTR szName, ULONG cchName, ULONG* pchName, ASSEMBLYMETADATA* pMetaData, DWORD* pdwAssemblyFlags)
+{
+	std::shared_lock<std::shared_mutex> lock(m_lock);
+	if (!IsValidRow(mda, MetadataTable::Assembly))
+		return E_INVALIDARG;
+
+	ULONG rid = RidFromToken(mda);
+	if (ppbPublicKey != nullptr && pcbPublicKey != nullptr) {
+		PCCOR_SIGNATURE pKey = nullptr;
+		*pcbPublicKey = 0;
+		m_image.GetBlob(m_image.Get(MetadataTable::Assembly, rid, Col::AssemblyPublicKey), &pKey, pcbPublicKey);
+		*ppbPublicKey = pKey;
+	}
+	if (pulHashAlgId != nullptr)
+		*pulHashAlgId = m_image.Get(MetadataTable::Assembly, rid, Col::AssemblyHashAlgId);
+	if (pdwAssemblyFlags != nullptr)
+		*pdwAssemblyFlags = m_image.Get(MetadataTable::Assembly, rid, Col::AssemblyFlags);
+	FillAssemblyMetadata(m_image, MetadataTable::Assembly, rid, Col::AssemblyMajor, m_image.Get(MetadataTable::Assembly, rid, Col::AssemblyCulture), pMetaData);
+
+	return CopyName(m_image.GetString(m_image.Get(MetadataTable::Assembly, rid, Col::AssemblyName)), szName, cchName, pchName);
+}
+
+HRESULT STDMETHODCALLTYPE MockMetaData::GetAssemblyRefProps(mdAssemblyRef mdar, const void** ppbPublicKeyOrToken, ULONG* pcbPublicKeyOrToken, LPWSTR szName, ULONG cchName, ULONG* pchName, ASSEMBLYMETADATA* pMetaData, const void** ppbHashValue, ULONG* pcbHashValue, DWORD* pdwAssemblyRefFlags)
+{
+	std::shared_lock<std::shared_mutex> lock(m_lock);
+	if (!IsValidRow(mdar, MetadataTable::AssemblyRef))
+		return E_INVALIDARG;
+
+	ULONG rid = RidFromToken(mdar);
+	if (ppbPublicKeyOrToken != nullptr && pcbPublicKeyOrToken != nullptr) {
+		PCCOR_SIGNATURE pKey = nullptr;
+		*pcbPublicKeyOrToken = 0;
+		m_image.GetBlob(m_image.Get(MetadataTable::AssemblyRef, rid, Col::AssemblyRefPublicKey), &pKey, pcbPublicKeyOrToken);
+		*ppbPublicKeyOrToken = pKey;
+	}
+	if (ppbHashValue != nullptr && pcbHashValue != nullptr) {
+		PCCOR_SIGNATURE pHash = nullptr;
+		*pcbHashValue = 0;
+		m_image.GetBlob(m_image.Get(MetadataTable::AssemblyRef, rid, Col::AssemblyRefHashValue), &pHash, pcbHashValue);
+		*ppbHashValue = pHash;
+	}
+	if (pdwAssemblyRefFlags != nullptr)
+		*pdwAssemblyRefFlags = m_image.Get(MetadataTable::AssemblyRef, rid, Col::AssemblyRefFlags);
+	FillAssemblyMetadata(m_image, MetadataTable::AssemblyRef, rid, Col::AssemblyRefMajor, m_image.Get(MetadataTable::AssemblyRef, rid, Col::AssemblyRefCulture), pMetaData);
+
+	return CopyName(m_image.GetString(m_image.Get(MetadataTable::AssemblyRef, rid, Col::AssemblyRefName)), szName, cchName, pchName);
+}
+
+HRESULT STDMETHODCALLTYPE MockMetaData::EnumAssemblyRefs(HCORENUM* phEnum, mdAssemblyRef rAssemblyRefs[], ULONG cMax, ULONG* pcTokens)
+{
+	return Enumerate(phEnum, [&](std::vector<mdToken>& tokens) {
+		for (ULONG rid = 1; rid <= m_image.RowCount(MetadataTable::AssemblyRef); rid++)
+			tokens.push_back(TokenFromRid(rid, mdtAssemblyRef));
+	}, rAssemblyRefs, cMax, pcTokens);
+}
+
+HRESULT STDMETHODCALLTYPE MockMetaData::GetAssemblyFromScope(mdAssembly* ptkAssembly)
+{
+	std::shared_lock<std::shared_mutex> lock(m_lock);
+	if (m_image.RowCount(MetadataTable::Assembly) == 0)
+		return CLDB_E_RECORD_NOTFOUND;
+
+	*ptkAssembly = TokenFromRid(1, mdtAssembly);
+	return S_OK;
+}
@@ -0,0 +1,194 @@
+#pragma once
+
+#include "stdafx.h"
+#include "EcmaImage.h"
+#include <atomic>
+#include <shared_mutex>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+// The metadata scope of one loaded module, handed out through GetModuleMetaData like the runtime's RegMeta. Reads come
+// straight from the module's EcmaImage and emitted rows are appended to it, so they're visible to later lookups the same
+// way they are in the runtime. Only what the profiler and the mock host use is implemented, everything else returns E_NOTIMPL
+class MockMetaData : public IMetaDataImport, public IMetaDataEmit, public IMetaDataAssemblyImport
+{
+public:
+	explicit MockMetaData(EcmaImage& image);
+	virtual ~MockMetaData() {}
+
+	// IUnknown
+	STDMETHODIMP QueryInterface(REFIID riid, void** ppvObject) override;
+	STDMETHODIMP_(ULONG) AddRef() override;
+	STDMETHODIMP_(ULONG) Release() override;
+
+	// IMetaDataImport
+	STDMETHODIMP_(void) CloseEnum(HCORENUM hEnum) override;
+	STDMETHODIMP CountEnum(HCORENUM hEnum, ULONG* pulCount) override;
+	STDMETHODIMP ResetEnum(HCORENUM hEnum, ULONG ulPos) override;
+	STDMETHODIMP EnumTypeDefs(HCORENUM* phEnum, mdTypeDef rTypeDefs[], ULONG cMax, ULONG* pcTypeDefs) override;
+	STDMETHODIMP EnumInterfaceImpls(HCORENUM* phEnum, mdTypeDef td, mdInterfaceImpl rImpls[], ULONG cMax, ULONG* pcImpls) override;
+	STDMETHODIMP EnumTypeRefs(HCORENUM* phEnum, mdTypeRef rTypeRefs[], ULONG cMax, ULONG* pcTypeRefs) override;
+	STDMETHODIMP FindTypeDefByName(LPCWSTR szTypeDef, mdToken tkEnclosingClass, mdTypeDef* ptd) override;
+	STDMETHODIMP GetScopeProps(LPWSTR szName, ULONG cchName, ULONG* pchName, GUID* pmvid) override;
+	STDMETHODIMP GetModuleFromScope(mdModule* pmd) override;
+	STDMETHODIMP GetTypeDefProps(mdTypeDef td, LPWSTR szTypeDef, ULONG cchTypeDef, ULONG* pchTypeDef, DWORD* pdwTypeDefFlags, mdToken* ptkExtends) override;
+	STDMETHODIMP GetInterfaceImplProps(mdInterfaceImpl iiImpl, mdTypeDef* pClass, mdToken* ptkIface) override;
+	STDMETHODIMP GetTypeRefProps(mdTypeRef tr, mdToken* ptkResolutionScope, LPWSTR szName, ULONG cchName, ULONG* pchName) override;
+	STDMETHODIMP ResolveTypeRef(mdTypeRef tr, REFIID riid, IUnknown** ppIScope, mdTypeDef* ptd) override { return E_NOTIMPL; }
+	STDMETHODIMP EnumMembers(HCORENUM* phEnum, mdTypeDef cl, mdToken rMembers[], ULONG cMax, ULONG* pcTokens) override;
+	STDMETHODIMP EnumMembersWithName(HCORENUM* phEnum, mdTypeDef cl, LPCWSTR szName, mdToken rMembers[], ULONG cMax, ULONG* pcTokens) override;
+	STDMETHODIMP EnumMethods(HCORENUM* phEnum, mdTypeDef cl, mdMethodDef rMethods[], ULONG cMax, ULONG* pcTokens) override;
+	STDMETHODIMP EnumMethodsWithName(HCORENUM* phEnum, mdTypeDef cl, LPCWSTR szName, mdMethodDef rMethods[], ULONG cMax, ULONG* pcTokens) override;
+	STDMETHODIMP EnumFields(HCORENUM* phEnum, mdTypeDef cl, mdFieldDef rFields[], ULONG cMax, ULONG* pcTokens) override;
+	STDMETHODIMP EnumFieldsWithName(HCORENUM* phEnum, mdTypeDef cl, LPCWSTR szName, mdFieldDef rFields[], ULONG cMax, ULONG* pcTokens) override;
+	STDMETHODIMP EnumParams(HCORENUM* phEnum, mdMethodDef mb, mdParamDef rParams[], ULONG cMax, ULONG* pcTokens) override { return E_NOTIMPL; }
+	STDMETHODIMP EnumMemberRefs(HCORENUM* phEnum, mdToken tkParent, mdMemberRef rMemberRefs[], ULONG cMax, ULONG* pcTokens) override;
+	STDMETHODIMP EnumMethodImpls(HCORENUM* phEnum, mdTypeDef td, mdToken rMethodBody[], mdToken rMethodDecl[], ULONG cMax, ULONG* pcTokens) override { return E_NOTIMPL; }
+	STDMETHODIMP EnumPermissionSets(HCORENUM* phEnum, mdToken tk, DWORD dwActions, mdPermission rPermission[], ULONG cMax, ULONG* pcTokens) override { return E_NOTIMPL; }
+	STDMETHODIMP FindMember(mdTypeDef td, LPCWSTR szName, PCCOR_SIGNATURE pvSigBlob, ULONG cbSigBlob, mdToken* pmb) override;
+	STDMETHODIMP FindMethod(mdTypeDef td, LPCWSTR szName, PCCOR_SIGNATURE pvSigBlob, ULONG cbSigBlob, mdMethodDef* pmb) override;
+	STDMETHODIMP FindField(mdTypeDef td, LPCWSTR szName, PCCOR_SIGNATURE pvSigBlob, ULONG cbSigBlob, mdFieldDef* pmb) override;
+	STDMETHODIMP FindMemberRef(mdTypeRef td, LPCWSTR szName, PCCOR_SIGNATURE pvSigBlob, ULONG cbSigBlob, mdMemberRef* pmr) override;
+	STDMETHODIMP GetMethodProps(mdMethodDef mb, mdTypeDef* pClass, LPWSTR szMethod, ULONG cchMethod, ULONG* pchMethod, DWORD* pdwAttr, PCCOR_SIGNATURE* ppvSigBlob, ULONG* pcbSigBlob, ULONG* pulCodeRVA, DWORD* pdwImplFlags) override;
+	STDMETHODIMP GetMemberRefProps(mdMemberRef mr, mdToken* ptk, LPWSTR szMember, ULONG cchMember, ULONG* pchMember, PCCOR_SIGNATURE* ppvSigBlob, ULONG* pbSig) override;
+	STDMETHODIMP EnumProperties(HCORENUM* phEnum, mdTypeDef td, mdProperty rProperties[], ULONG cMax, ULONG* pcProperties) override { return E_NOTIMPL; }
+	STDMETHODIMP EnumEvents(HCORENUM* phEnum, mdTypeDef td, mdEvent rEvents[], ULONG cMax, ULONG* pcEvents) override { return E_NOTIMPL; }
+	STDMETHODIMP GetEventProps(mdEvent ev, mdTypeDef* pClass, LPCWSTR szEvent, ULONG cchEvent, ULONG* pchEvent, DWORD* pdwEventFlags, mdToken* ptkEventType, mdMethodDef* pmdAddOn, mdMethodDef* pmdRemoveOn, mdMethodDef* pmdFire, mdMethodDef rmdOtherMethod[], ULONG cMax, ULONG* pcOtherMethod) override { return E_NOTIMPL; }
+	STDMETHODIMP EnumMethodSemantics(HCORENUM* phEnum, mdMethodDef mb, mdToken rEventProp[], ULONG cMax, ULONG* pcEventProp) override { return E_NOTIMPL; }
+	STDMETHODIMP GetMethodSemantics(mdMethodDef mb, mdToken tkEventProp, DWORD* pdwSemanticsFlags) override { return E_NOTIMPL; }
+	STDMETHODIMP GetClassLayout(mdTypeDef td, DWORD* pdwPackSize, COR_FIELD_OFFSET rFieldOffset[], ULONG cMax, ULONG* pcFieldOffset, ULONG* pulClassSize) override { return E_NOTIMPL; }
+	STDMETHODIMP GetFieldMarshal(mdToken tk, PCCOR_SIGNATURE* ppvNativeType, ULONG* pcbNativeType) override { return E_NOTIMPL; }
+	STDMETHODIMP GetRVA(mdToken tk, ULONG* pulCodeRVA, DWORD* pdwImplFlags) override;
+	STDMETHODIMP GetPermissionSetProps(mdPermission pm, DWORD* pdwAction, void const** ppvPermission, ULONG* pcbPermission) override { return E_NOTIMPL; }
+	STDMETHODIMP GetSigFromToken(mdSignature mdSig, PCCOR_SIGNATURE* ppvSig, ULONG* pcbSig) override;
+	STDMETHODIMP GetModuleRefProps(mdModuleRef mur, LPWSTR szName, ULONG cchName, ULONG* pchName) override;
+	STDMETHODIMP EnumModuleRefs(HCORENUM* phEnum, mdModuleRef rModuleRefs[], ULONG cmax, ULONG* pcModuleRefs) override;
+	STDMETHODIMP GetTypeSpecFromToken(mdTypeSpec typespec, PCCOR_SIGNATURE* ppvSig, ULONG* pcbSig) override;
+	STDMETHODIMP GetNameFromToken(mdToken tk, MDUTF8CSTR* pszUtf8NamePtr) override;
+	STDMETHODIMP EnumUnresolvedMethods(HCORENUM* phEnum, mdToken rMethods[], ULONG cMax, ULONG* pcTokens) override { return E_NOTIMPL; }
+	STDMETHODIMP GetUserString(mdString stk, LPWSTR szString, ULONG cchString, ULONG* pchString) override;
+	STDMETHODIMP GetPinvokeMap(mdToken tk, DWORD* pdwMappingFlags, LPWSTR szImportName, ULONG cchImportName, ULONG* pchImportName, mdModuleRef* pmrImportDLL) override;
+	STDMETHODIMP EnumSignatures(HCORENUM* phEnum, mdSignature rSignatures[], ULONG cmax, ULONG* pcSignatures) override;
+	STDMETHODIMP EnumTypeSpecs(HCORENUM* phEnum, mdTypeSpec rTypeSpecs[], ULONG cmax, ULONG* pcTypeSpecs) override;
+	STDMETHODIMP EnumUserStrings(HCORENUM* phEnum, mdString rStrings[], ULONG cmax, ULONG* pcStrings) override { return E_NOTIMPL; }
+	STDMETHODIMP GetParamForMethodIndex(mdMethodDef md, ULONG ulParamSeq, mdParamDef* ppd) override { return E_NOTIMPL; }
+	STDMETHODIMP EnumCustomAttributes(HCORENUM* phEnum, mdToken tk, mdToken tkType, mdCustomAttribute rCustomAttributes[], ULONG cMax, ULONG* pcCustomAttributes) override;
+	STDMETHODIMP GetCustomAttributeProps(mdCustomAttribute cv, mdToken* ptkObj, mdToken* ptkType, void const** ppBlob, ULONG* pcbSize) override;
+	STDMETHODIMP FindTypeRef(mdToken tkResolutionScope, LPCWSTR szName, mdTypeRef* ptr) override;
+	STDMETHODIMP GetMemberProps(mdToken mb, mdTypeDef* pClass, LPWSTR szMember, ULONG cchMember, ULONG* pchMember, DWORD* pdwAttr, PCCOR_SIGNATURE* ppvSigBlob, ULONG* pcbSigBlob, ULONG* pulCodeRVA, DWORD* pdwImplFlags, DWORD* pdwCPlusTypeFlag, UVCP_CONSTANT* ppValue, ULONG* pcchValue) override { return E_NOTIMPL; }
+	STDMETHODIMP GetFieldProps(mdFieldDef mb, mdTypeDef* pClass, LPWSTR szField, ULONG cchField, ULONG* pchField, DWORD* pdwAttr, PCCOR_SIGNATURE* ppvSigBlob, ULONG* pcbSigBlob, DWORD* pdwCPlusTypeFlag, UVCP_CONSTANT* ppValue, ULONG* pcchValue) override;
+	STDMETHODIMP GetPropertyProps(mdProperty prop, mdTypeDef* pClass, LPCWSTR szProperty, ULONG cchProperty, ULONG* pchProperty, DWORD* pdwPropFlags, PCCOR_SIGNATURE* ppvSig, ULONG* pbSig, DWORD* pdwCPlusTypeFlag, UVCP_CONSTANT* ppDefaultValue, ULONG* pcchDefaultValue, mdMethodDef* pmdSetter, mdMethodDef* pmdGetter, mdMethodDef rmdOtherMethod[], ULONG cMax, ULONG* pcOtherMethod) override { return E_NOTIMPL; }
+	STDMETHODIMP GetParamProps(mdParamDef tk, mdMethodDef* pmd, ULONG* pulSequence, LPWSTR szName, ULONG cchName, ULONG* pchName, DWORD* pdwAttr, DWORD* pdwCPlusTypeFlag, UVCP_CONSTANT* ppValue, ULONG* pcchValue) override { return E_NOTIMPL; }
+	STDMETHODIMP GetCustomAttributeByName(mdToken tkObj, LPCWSTR szName, const void** ppData, ULONG* pcbData) override { return E_NOTIMPL; }
+	STDMETHODIMP_(BOOL) IsValidToken(mdToken tk) override;
+	STDMETHODIMP GetNestedClassProps(mdTypeDef tdNestedClass, mdTypeDef* ptdEnclosingClass) override;
+	STDMETHODIMP GetNativeCallConvFromSig(void const* pvSig, ULONG cbSig, ULONG* pCallConv) override { return E_NOTIMPL; }
+	STDMETHODIMP IsGlobal(mdToken pd, int* pbGlobal) override { return E_NOTIMPL; }
+
+	// IMetaDataEmit
+	STDMETHODIMP SetModuleProps(LPCWSTR szName) override { return E_NOTIMPL; }
+	STDMETHODIMP Save(LPCWSTR szFile, DWORD dwSaveFlags) override { return E_NOTIMPL; }
+	STDMETHODIMP SaveToStream(IStream* pIStream, DWORD dwSaveFlags) override { return E_NOTIMPL; }
+	STDMETHODIMP GetSaveSize(CorSaveSize fSave, DWORD* pdwSaveSize) override { return E_NOTIMPL; }
+	STDMETHODIMP DefineTypeDef(LPCWSTR szTypeDef, DWORD dwTypeDefFlags, mdToken tkExtends, mdToken rtkImplements[], mdTypeDef* ptd) override;
+	STDMETHODIMP DefineNestedType(LPCWSTR szTypeDef, DWORD dwTypeDefFlags, mdToken tkExtends, mdToken rtkImplements[], mdTypeDef tdEncloser, mdTypeDef* ptd) override;
+	STDMETHODIMP SetHandler(IUnknown* pUnk) override { return S_OK; }
+	STDMETHODIMP DefineMethod(mdTypeDef td, LPCWSTR szName, DWORD dwMethodFlags, PCCOR_SIGNATURE pvSigBlob, ULONG cbSigBlob, ULONG ulCodeRVA, DWORD dwImplFlags, mdMethodDef* pmd) override;
+	STDMETHODIMP DefineMethodImpl(mdTypeDef td, mdToken tkBody, mdToken tkDecl) override { return E_NOTIMPL; }
+	STDMETHODIMP DefineTypeRefByName(mdToken tkResolutionScope, LPCWSTR szName, mdTypeRef* ptr) override;
+	STDMETHODIMP DefineImportType(IMetaDataAssemblyImport* pAssemImport, const void* pbHashValue, ULONG cbHashValue, IMetaDataImport* pImport, mdTypeDef tdImport, IMetaDataAssemblyEmit* pAssemEmit, mdTypeRef* ptr) override { return E_NOTIMPL; }
+	STDMETHODIMP DefineMemberRef(mdToken tkImport, LPCWSTR szName, PCCOR_SIGNATURE pvSigBlob, ULONG cbSigBlob, mdMemberRef* pmr) override;
+	STDMETHODIMP DefineImportMember(IMetaDataAssemblyImport* pAssemImport, const void* pbHashValue, ULONG cbHashValue, IMetaDataImport* pImport, mdToken mbMember, IMetaDataAssemblyEmit* pAssemEmit, mdToken tkParent, mdMemberRef* pmr) override { return E_NOTIMPL; }
+	STDMETHODIMP DefineEvent(mdTypeDef td, LPCWSTR szEvent, DWORD dwEventFlags, mdToken tkEventType, mdMethodDef mdAddOn, mdMethodDef mdRemoveOn, mdMethodDef mdFire, mdMethodDef rmdOtherMethods[], mdEvent* pmdEvent) override { return E_NOTIMPL; }
+	STDMETHODIMP SetClassLayout(mdTypeDef td, DWORD dwPackSize, COR_FIELD_OFFSET rFieldOffsets[], ULONG ulClassSize) override { return E_NOTIMPL; }
+	STDMETHODIMP DeleteClassLayout(mdTypeDef td) override { return E_NOTIMPL; }
+	STDMETHODIMP SetFieldMarshal(mdToken tk, PCCOR_SIGNATURE pvNativeType, ULONG cbNativeType) override { return E_NOTIMPL; }
+	STDMETHODIMP DeleteFieldMarshal(mdToken tk) override { return E_NOTIMPL; }
+	STDMETHODIMP DefinePermissionSet(mdToken tk, DWORD dwAction, void const* pvPermission, ULONG cbPermission, mdPermission* ppm) override { return E_NOTIMPL; }
+	STDMETHODIMP SetRVA(mdMethodDef md, ULONG ulRVA) override;
+	STDMETHODIMP GetTokenFromSig(PCCOR_SIGNATURE pvSig, ULONG cbSig, mdSignature* pmsig) override;
+	STDMETHODIMP DefineModuleRef(LPCWSTR szName, mdModuleRef* pmur) override;
+	STDMETHODIMP SetParent(mdMemberRef mr, mdToken tk) override { return E_NOTIMPL; }
+	STDMETHODIMP GetTokenFromTypeSpec(PCCOR_SIGNATURE pvSig, ULONG cbSig, mdTypeSpec* ptypespec) override;
+	STDMETHODIMP SaveToMemory(void* pbData, ULONG cbData) override { return E_NOTIMPL; }
+	STDMETHODIMP DefineUserString(LPCWSTR szString, ULONG cchString, mdString* pstk) override;
+	STDMETHODIMP DeleteToken(mdToken tkObj) override { return E_NOTIMPL; }
+	STDMETHODIMP SetMethodProps(mdMethodDef md, DWORD dwMethodFlags, ULONG ulCodeRVA, DWORD dwImplFlags) override;
+	STDMETHODIMP SetTypeDefProps(mdTypeDef td, DWORD dwTypeDefFlags, mdToken tkExtends, mdToken rtkImplements[]) override { return E_NOTIMPL; }
+	STDMETHODIMP SetEventProps(mdEvent ev, DWORD dwEventFlags, mdToken tkEventType, mdMethodDef mdAddOn, mdMethodDef mdRemoveOn, mdMethodDef mdFire, mdMethodDef rmdOtherMethods[]) override { return E_NOTIMPL; }
+	STDMETHODIMP SetPermissionSetProps(mdToken tk, DWORD dwAction, void const* pvPermission, ULONG cbPermission, mdPermission* ppm) override { return E_NOTIMPL; }
+	STDMETHODIMP DefinePinvokeMap(mdToken tk, DWORD dwMappingFlags, LPCWSTR szImportName, mdModuleRef mrImportDLL) override;
+	STDMETHODIMP SetPinvokeMap(mdToken tk, DWORD dwMappingFlags, LPCWSTR szImportName, mdModuleRef mrImportDLL) override { return E_NOTIMPL; }
+	STDMETHODIMP DeletePinvokeMap(mdToken tk) override { return E_NOTIMPL; }
+	STDMETHODIMP DefineCustomAttribute(mdToken tkOwner, mdToken tkCtor, void const* pCustomAttribute, ULONG cbCustomAttribute, mdCustomAttribute* pcv) override;
+	STDMETHODIMP SetCustomAttributeValue(mdCustomAttribute pcv, void const* pCustomAttribute, ULONG cbCustomAttribute) override { return E_NOTIMPL; }
+	STDMETHODIMP DefineField(mdTypeDef td, LPCWSTR szName, DWORD dwFieldFlags, PCCOR_SIGNATURE pvSigBlob, ULONG cbSigBlob, DWORD dwCPlusTypeFlag, void const* pValue, ULONG cchValue, mdFieldDef* pmd) override;
+	STDMETHODIMP DefineProperty(mdTypeDef td, LPCWSTR szProperty, DWORD dwPropFlags, PCCOR_SIGNATURE pvSig, ULONG cbSig, DWORD dwCPlusTypeFlag, void const* pValue, ULONG cchValue, mdMethodDef mdSetter, mdMethodDef mdGetter, mdMethodDef rmdOtherMethods[], mdProperty* pmdProp) override { return E_NOTIMPL; }
+	STDMETHODIMP DefineParam(mdMethodDef md, ULONG ulParamSeq, LPCWSTR szName, DWORD dwParamFlags, DWORD dwCPlusTypeFlag, void const* pValue, ULONG cchValue, mdParamDef* ppd) override { return E_NOTIMPL; }
+	STDMETHODIMP SetFieldProps(mdFieldDef fd, DWORD dwFieldFlags, DWORD dwCPlusTypeFlag, void const* pValue, ULONG cchValue) override { return E_NOTIMPL; }
+	STDMETHODIMP SetPropertyProps(mdProperty pr, DWORD dwPropFlags, DWORD dwCPlusTypeFlag, void const* pValue, ULONG cchValue, mdMethodDef mdSetter, mdMethodDef mdGetter, mdMethodDef rmdOtherMethods[]) override { return E_NOTIMPL; }
+	STDMETHODIMP SetParamProps(mdParamDef pd, LPCWSTR szName, DWORD dwParamFlags, DWORD dwCPlusTypeFlag, void const* pValue, ULONG cchValue) override { return E_NOTIMPL; }
+	STDMETHODIMP DefineSecurityAttributeSet(mdToken tkObj, COR_SECATTR rSecAttrs[], ULONG cSecAttrs, ULONG* pulErrorAttr) override { return E_NOTIMPL; }
+	STDMETHODIMP ApplyEditAndContinue(IUnknown* pImport) override { return E_NOTIMPL; }
+	STDMETHODIMP TranslateSigWithScope(IMetaDataAssemblyImport* pAssemImport, const void* pbHashValue, ULONG cbHashValue, IMetaDataImport* import, PCCOR_SIGNATURE pbSigBlob, ULONG cbSigBlob, IMetaDataAssemblyEmit* pAssemEmit, IMetaDataEmit* emit, PCOR_SIGNATURE pvTranslatedSig, ULONG cbTranslatedSigMax, ULONG* pcbTranslatedSig) override { return E_NOTIMPL; }
+	STDMETHODIMP SetMethodImplFlags(mdMethodDef md, DWORD dwImplFlags) override { return E_NOTIMPL; }
+	STDMETHODIMP SetFieldRVA(mdFieldDef fd, ULONG ulRVA) override { return E_NOTIMPL; }
+	STDMETHODIMP Merge(IMetaDataImport* pImport, IMapToken* pHostMapToken, IUnknown* pHandler) override { return E_NOTIMPL; }
+	STDMETHODIMP MergeEnd() override { return E_NOTIMPL; }
+
+	// IMetaDataAssemblyImport
+	STDMETHODIMP GetAssemblyProps(mdAssembly mda, const void** ppbPublicKey, ULONG* pcbPublicKey, ULONG* pulHashAlgId, LPWSTR szName, ULONG cchName, ULONG* pchName, ASSEMBLYMETADATA* pMetaData, DWORD* pdwAssemblyFlags) override;
+	STDMETHODIMP GetAssemblyRefProps(mdAssemblyRef mdar, const void** ppbPublicKeyOrToken, ULONG* pcbPublicKeyOrToken, LPWSTR szName, ULONG cchName, ULONG* pchName, ASSEMBLYMETADATA* pMetaData, const void** ppbHashValue, ULONG* pcbHashValue, DWORD* pdwAssemblyRefFlags) override;
+	STDMETHODIMP GetFileProps(mdFile mdf, LPWSTR szName, ULONG cchName, ULONG* pchName, const void** ppbHashValue, ULONG* pcbHashValue, DWORD* pdwFileFlags) override { return E_NOTIMPL; }
+	STDMETHODIMP GetExportedTypeProps(mdExportedType mdct, LPWSTR szName, ULONG cchName, ULONG* pchName, mdToken* ptkImplementation, mdTypeDef* ptkTypeDef, DWORD* pdwExportedTypeFlags) override { return E_NOTIMPL; }
+	STDMETHODIMP GetManifestResourceProps(mdManifestResource mdmr, LPWSTR szName, ULONG cchName, ULONG* pchName, mdToken* ptkImplementation, DWORD* pdwOffset, DWORD* pdwResourceFlags) override { return E_NOTIMPL; }
+	STDMETHODIMP EnumAssemblyRefs(HCORENUM* phEnum, mdAssemblyRef rAssemblyRefs[], ULONG cMax, ULONG* pcTokens) override;
+	STDMETHODIMP EnumFiles(HCORENUM* phEnum, mdFile rFiles[], ULONG cMax, ULONG* pcTokens) override { return E_NOTIMPL; }
+	STDMETHODIMP EnumExportedTypes(HCORENUM* phEnum, mdExportedType rExportedTypes[], ULONG cMax, ULONG* pcTokens) override { return E_NOTIMPL; }
+	STDMETHODIMP EnumManifestResources(HCORENUM* phEnum, mdManifestResource rManifestResources[], ULONG cMax, ULONG* pcTokens) override { return E_NOTIMPL; }
+	STDMETHODIMP GetAssemblyFromScope(mdAssembly* ptkAssembly) override;
+	STDMETHODIMP FindExportedTypeByName(LPCWSTR szName, mdToken mdtExportedType, mdExportedType* ptkExportedType) override { return E_NOTIMPL; }
+	STDMETHODIMP FindManifestResourceByName(LPCWSTR szName, mdManifestResource* ptkManifestResource) override { return E_NOTIMPL; }
+	STDMETHODIMP FindAssembliesByName(LPCWSTR szAppBase, LPCWSTR szPrivateBin, LPCWSTR szAssemblyName, IUnknown* ppIUnk[], ULONG cMax, ULONG* pcAssemblies) override { return E_NOTIMPL; }
+
+	// Name of a type as FindTypeDefByName takes it, "Namespace.Name"
+	std::string GetTypeName(mdTypeDef td);
+
+private:
+	struct TokenEnum
+	{
+		std::vector<mdToken> Tokens;
+		ULONG Position = 0;
+	};
+
+	// Creates the enumerator on the first call, filling it through fill, then hands out the next cMax tokens
+	template <class Fill>
+	HRESULT Enumerate(HCORENUM* phEnum, Fill fill, mdToken rTokens[], ULONG cMax, ULONG* pcTokens);
+
+	// Callers hold m_lock, shared or exclusive
+	bool IsValidRow(mdToken tk, MetadataTable table) const;
+	std::string TypeDefName(ULONG rid) const;
+	mdTypeDef FindTypeDef(const std::string& name, mdTypeDef tdEncloser) const;
+	mdTypeRef FindTypeRefLocked(mdToken tkResolutionScope, const std::string& name) const;
+	mdToken FindMemberLocked(const std::vector<ULONG>& members, MetadataTable table, int nameColumn, int signatureColumn,
+		const std::string& name, PCCOR_SIGNATURE pvSigBlob, ULONG cbSigBlob) const;
+	bool BlobEquals(UINT32 offset, PCCOR_SIGNATURE pvSig, ULONG cbSig) const;
+	mdTypeDef AddTypeDef(const std::string& name, DWORD dwTypeDefFlags, mdToken tkExtends, mdToken rtkImplements[]);
+
+	std::atomic<ULONG> m_refCount{ 1 };
+	EcmaImage& m_image;
+
+	// Emits take this exclusively and imports shared, as RegMeta does for a scope opened for write
+	std::shared_mutex m_lock;
+
+	// Methods and fields of each type by TypeDef rid. Emitted members are appended to the end of their tables, so after an
+	// emit a type's members are no longer the contiguous range its MethodList and FieldList columns describe
+	std::vector<std::vector<ULONG>> m_typeMethods;
+	std::vector<std::vector<ULONG>> m_typeFields;
+	std::vector<mdTypeDef> m_methodOwners;
+	std::vector<mdTypeDef> m_fieldOwners;
+	std::unordered_map<ULONG, mdTypeDef> m_enclosingTypes;
+	// Top level types keyed by "Namespace.Name"
+	std::unordered_map<std::string, mdTypeDef> m_typeDefsByName;
+};
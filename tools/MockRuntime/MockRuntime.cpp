@@ -0,0 +1,813 @@
+#include "stdafx.h"
+#include "MockRuntime.h"
+#include "ILValidator.h"
+#include "Utils.h"
+#include <algorithm>
+#include <chrono>
+#include <set>
+
+#ifndef _WIN32
+#include <dlfcn.h>
+#endif
+
+static const AppDomainID MOCK_APP_DOMAIN_ID = 1;
+static const WCHAR MOCK_APP_DOMAIN_NAME[] = WSTR("MockRuntime");
+
+typedef HRESULT(STDMETHODCALLTYPE* DllGetClassObjectFunc)(REFCLSID rclsid, REFIID riid, void** ppv);
+
+// Copies a name the way the profiling API does, reporting the full length including the terminator and truncating to fit
+static void CopyName(const WSTRING& name, ULONG cchName, ULONG* pcchName, WCHAR szName[])
+{
+	if (pcchName != nullptr)
+		*pcchName = (ULONG)name.size() + 1;
+
+	if (szName == nullptr || cchName == 0)
+		return;
+
+	ULONG copied = std::min<ULONG>((ULONG)name.size(), cchName - 1);
+	memcpy(szName, name.c_str(), copied * sizeof(WCHAR));
+	szName[copied] = 0;
+}
+
+// A snapshot of the modules loaded when EnumModules was called
+class MockModuleEnum : public ICorProfilerModuleEnum
+{
+public:
+	explicit MockModuleEnum(std::vector<ModuleID> modules) : m_modules(std::move(modules)) {}
+	virtual ~MockModuleEnum() {}
+
+	STDMETHODIMP QueryInterface(REFIID riid, void** ppvObject) override
+	{
+		if (ppvObject == nullptr)
+			return E_POINTER;
+
+		if (riid == IID_IUnknown || riid == IID_ICorProfilerModuleEnum) {
+			*ppvObject = static_cast<ICorProfilerModuleEnum*>(this);
+			AddRef();
+			return S_OK;
+		}
+
+		*ppvObject = nullptr;
+		return E_NOINTERFACE;
+	}
+
+	STDMETHODIMP_(ULONG) AddRef() override
+	{
+		return std::atomic_fetch_add(&m_refCount, 1) + 1;
+	}
+
+	STDMETHODIMP_(ULONG) Release() override
+	{
+		int count = std::atomic_fetch_sub(&m_refCount, 1) - 1;
+		if (count <= 0)
+			delete this;
+
+		return count;
+	}
+
+	STDMETHODIMP Skip(ULONG celt) override
+	{
+		m_position = std::min(m_position + celt, (ULONG)m_modules.size());
+		return m_position < m_modules.size() ? S_OK : S_FALSE;
+	}
+
+	STDMETHODIMP Reset() override
+	{
+		m_position = 0;
+		return S_OK;
+	}
+
+	STDMETHODIMP Clone(ICorProfilerModuleEnum** ppEnum) override
+	{
+		MockModuleEnum* pClone = new MockModuleEnum(m_modules);
+		pClone->m_position = m_position;
+		*ppEnum = pClone;
+		return S_OK;
+	}
+
+	STDMETHODIMP GetCount(ULONG* pcelt) override
+	{
+		*pcelt = (ULONG)m_modules.size();
+		return S_OK;
+	}
+
+	STDMETHODIMP Next(ULONG celt, ModuleID ids[], ULONG* pceltFetched) override
+	{
+		ULONG fetched = std::min(celt, (ULONG)m_modules.size() - m_position);
+		std::copy_n(m_modules.begin() + m_position, fetched, ids);
+		m_position += fetched;
+
+		if (pceltFetched != nullptr)
+			*pceltFetched = fetched;
+
+		return fetched == celt ? S_OK : S_FALSE;
+	}
+
+private:
+	std::atomic<int> m_refCount{ 1 };
+	std::vector<ModuleID> m_modules;
+	ULONG m_position = 0;
+};
+
+HRESULT MockFunctionControl::QueryInterface(REFIID riid, void** ppvObject)
+{
+	if (ppvObject == nullptr)
+		return E_POINTER;
+
+	if (riid == IID_IUnknown || riid == IID_ICorProfilerFunctionControl) {
+		*ppvObject = static_cast<ICorProfilerFunctionControl*>(this);
+		return S_OK;
+	}
+
+	*ppvObject = nullptr;
+	return E_NOINTERFACE;
+}
+
+HRESULT MockFunctionControl::SetILFunctionBody(ULONG cbNewILMethodHeader, LPCBYTE pbNewILMethodHeader)
+{
+	if (pbNewILMethodHeader == nullptr || cbNewILMethodHeader == 0)
+		return E_INVALIDARG;
+
+	Body.assign(pbNewILMethodHeader, pbNewILMethodHeader + cbNewILMethodHeader);
+	return S_OK;
+}
+
+HRESULT MockMethodMalloc::QueryInterface(REFIID riid, void** ppvObject)
+{
+	if (ppvObject == nullptr)
+		return E_POINTER;
+
+	if (riid == IID_IUnknown || riid == IID_IMethodMalloc) {
+		*ppvObject = static_cast<IMethodMalloc*>(this);
+		return S_OK;
+	}
+
+	*ppvObject = nullptr;
+	return E_NOINTERFACE;
+}
+
+PVOID MockMethodMalloc::Alloc(ULONG cb)
+{
+	std::lock_guard<std::mutex> lock(m_lock);
+	m_blocks.emplace_back(new BYTE[cb]);
+	m_bytesAllocated += cb;
+	return m_blocks.back().get();
+}
+
+MockModule::~MockModule()
+{
+	if (MetaData != nullptr)
+		MetaData->Release();
+}
+
+MockRuntime::MockRuntime() : m_refCount(1), m_eventMask(0), m_highEventMask(0), m_detachRequested(false)
+{
+}
+
+MockRuntime::~MockRuntime()
+{
+	Shutdown();
+}
+
+HRESULT MockRuntime::CreateProfiler(const std::string& path, REFCLSID clsid, IUnknown** ppProfiler)
+{
+	// Like the runtime the library is never unloaded, hooks it injected may still point into it
+#ifdef _WIN32
+	HMODULE library = LoadLibraryA(path.c_str());
+	DllGetClassObjectFunc getClassObject = library != nullptr ? (DllGetClassObjectFunc)GetProcAddress(library, "DllGetClassObject") : nullptr;
+#else
+	void* library = dlopen(path.c_str(), RTLD_NOW | RTLD_LOCAL);
+	DllGetClassObjectFunc getClassObject = library != nullptr ? (DllGetClassObjectFunc)dlsym(library, "DllGetClassObject") : nullptr;
+#endif
+
+	if (getClassObject == nullptr) {
+#ifdef _WIN32
+		spdlog::error("Failed to load profiler {}: {}", path, SystemErrorMessage(HRESULT_FROM_WIN32(GetLastError())));
+#else
+		spdlog::error("Failed to load profiler {}: {}", path, dlerror());
+#endif
+		return E_FAIL;
+	}
+
+	IClassFactory* pFactory = nullptr;
+	FAIL_CHECK(getClassObject(clsid, IID_IClassFactory, (void**)&pFactory), "DllGetClassObject failed for {}", path);
+
+	HRESULT createResult = pFactory->CreateInstance(nullptr, IID_ICorProfilerCallback4, (void**)ppProfiler);
+	pFactory->Release();
+	FAIL_CHECK(createResult, "Failed to create profiler from {}", path);
+
+	return S_OK;
+}
+
+HRESULT MockRuntime::LoadProfiler(IUnknown* pProfiler)
+{
+	FAIL_CHECK(pProfiler->QueryInterface(IID_ICorProfilerCallback4, (void**)&m_pCallback), "Profiler doesn't implement ICorProfilerCallback4");
+
+	m_initializing = true;
+	HRESULT initializeResult = m_pCallback->Initialize(static_cast<ICorProfilerInfo4*>(this));
+	m_initializing = false;
+
+	FAIL_CHECK(initializeResult, "Profiler failed to initialize");
+	return S_OK;
+}
+
+HRESULT MockRuntime::AttachProfiler(IUnknown* pProfiler, void* pvClientData, UINT cbClientData)
+{
+	FAIL_CHECK(pProfiler->QueryInterface(IID_ICorProfilerCallback4, (void**)&m_pCallback), "Profiler doesn't implement ICorProfilerCallback4");
+
+	m_initializing = true;
+	HRESULT initializeResult = m_pCallback->InitializeForAttach(static_cast<ICorProfilerInfo4*>(this), pvClientData, cbClientData);
+	m_initializing = false;
+
+	FAIL_CHECK(initializeResult, "Profiler failed to initialize for attach");
+	FAIL_CHECK(m_pCallback->ProfilerAttachComplete(), "ProfilerAttachComplete failed");
+	return S_OK;
+}
+
+HRESULT MockRuntime::LoadModule(const std::string& path, ModuleID* pModuleId)
+{
+	ModuleID moduleId;
+	FAIL_CHECK(OpenModule(path, &moduleId), "Failed to load module {}", path);
+	RaiseModuleLoad(moduleId);
+
+	if (pModuleId != nullptr)
+		*pModuleId = moduleId;
+
+	return S_OK;
+}
+
+HRESULT MockRuntime::OpenModule(const std::string& path, ModuleID* pModuleId)
+{
+	std::unique_ptr<MockModule> module(new MockModule());
+	module->Path = path;
+	module->Name = Utf8ToWStr(path.c_str(), path.size());
+
+	HRESULT hr = module->Image.Load(path);
+	if (FAILED(hr))
+		return hr;
+	module->MetaData = new MockMetaData(module->Image);
+
+	*pModuleId = (ModuleID)module.get();
+
+	std::lock_guard<std::mutex> lock(m_modulesLock);
+	m_modules.push_back(std::move(module));
+	return S_OK;
+}
+
+void MockRuntime::RaiseModuleLoad(ModuleID moduleId)
+{
+	if (m_pCallback == nullptr)
+		return;
+
+	// The same sequence the runtime raises for an assembly with a single module
+	DWORD eventMask = m_eventMask;
+	if (eventMask & COR_PRF_MONITOR_ASSEMBLY_LOADS)
+		m_pCallback->AssemblyLoadStarted(moduleId);
+
+	if (eventMask & COR_PRF_MONITOR_MODULE_LOADS) {
+		m_pCallback->ModuleLoadStarted(moduleId);
+		m_pCallback->ModuleLoadFinished(moduleId, S_OK);
+		m_pCallback->ModuleAttachedToAssembly(moduleId, moduleId);
+	}
+
+	if (eventMask & COR_PRF_MONITOR_ASSEMBLY_LOADS)
+		m_pCallback->AssemblyLoadFinished(moduleId, S_OK);
+}
+
+HRESULT MockRuntime::UnloadModule(ModuleID moduleId)
+{
+	if (FindModule(moduleId) == nullptr)
+		return E_INVALIDARG;
+
+	DWORD eventMask = m_pCallback != nullptr ? (DWORD)m_eventMask : 0;
+	if (eventMask & COR_PRF_MONITOR_ASSEMBLY_LOADS)
+		m_pCallback->AssemblyUnloadStarted(moduleId);
+	if (eventMask & COR_PRF_MONITOR_MODULE_LOADS)
+		m_pCallback->ModuleUnloadStarted(moduleId);
+
+	{
+		std::lock_guard<std::mutex> lock(m_modulesLock);
+		for (size_t i = 0; i < m_modules.size(); i++) {
+			if ((ModuleID)m_modules[i].get() == moduleId) {
+				m_modules.erase(m_modules.begin() + i);
+				break;
+			}
+		}
+	}
+
+	if (eventMask & COR_PRF_MONITOR_MODULE_LOADS)
+		m_pCallback->ModuleUnloadFinished(moduleId, S_OK);
+	if (eventMask & COR_PRF_MONITOR_ASSEMBLY_LOADS)
+		m_pCallback->AssemblyUnloadFinished(moduleId, S_OK);
+
+	return S_OK;
+}
+
+HRESULT MockRuntime::JitMethod(ModuleID moduleId, mdMethodDef methodDef, FunctionID* pFunctionId)
+{
+	MockModule* pModule = FindModule(moduleId);
+	if (pModule == nullptr || TypeFromToken(methodDef) != mdtMethodDef || RidFromToken(methodDef) == 0 ||
+		RidFromToken(methodDef) > pModule->Image.RowCount(MetadataTable::MethodDef))
+		return E_INVALIDARG;
+
+	// Abstract, runtime implemented and P/Invoke methods have no body and are never JITted
+	if (pModule->Image.Get(MetadataTable::MethodDef, RidFromToken(methodDef), Col::MethodRva) == 0)
+		return CORPROF_E_FUNCTION_NOT_IL;
+
+	FunctionID functionId = (FunctionID)GetFunction(pModule, methodDef);
+	if (pFunctionId != nullptr)
+		*pFunctionId = functionId;
+
+	bool notify = m_pCallback != nullptr && (m_eventMask & COR_PRF_MONITOR_JIT_COMPILATION);
+	if (notify)
+		m_pCallback->JITCompilationStarted(functionId, TRUE);
+
+	LPCBYTE pBody = nullptr;
+	ULONG cbBody = 0;
+	HRESULT hr = GetILFunctionBody(moduleId, methodDef, &pBody, &cbBody);
+	if (SUCCEEDED(hr))
+		hr = ValidateMethodBody(pBody, cbBody, pModule->MetaData);
+
+	if (notify)
+		m_pCallback->JITCompilationFinished(functionId, hr, TRUE);
+
+	return hr;
+}
+
+size_t MockRuntime::ProcessReJITRequests(DWORD quietMs, size_t* pFailures)
+{
+	std::vector<std::pair<ModuleID, mdMethodDef>> requests;
+	{
+		std::unique_lock<std::mutex> lock(m_reJitLock);
+		for (;;) {
+			ULONG generation = m_reJitGeneration;
+			if (!m_reJitRequested.wait_for(lock, std::chrono::milliseconds(quietMs), [&] { return m_reJitGeneration != generation; }))
+				break;
+		}
+
+		requests.swap(m_reJitRequests);
+	}
+
+	// Methods requested more than once before recompiling are only recompiled once
+	std::set<std::pair<ModuleID, mdMethodDef>> seen;
+	size_t recompiled = 0;
+	size_t failures = 0;
+	for (const auto& request : requests) {
+		if (!seen.insert(request).second)
+			continue;
+
+		ModuleID moduleId = request.first;
+		mdMethodDef methodDef = request.second;
+		MockModule* pModule = FindModule(moduleId);
+		if (pModule == nullptr)
+			continue;
+
+		FunctionID functionId = (FunctionID)GetFunction(pModule, methodDef);
+		ReJITID reJitId = m_nextReJitId++;
+
+		MockFunctionControl control;
+		HRESULT hr = m_pCallback->GetReJITParameters(moduleId, methodDef, &control);
+
+		bool notify = (m_eventMask & COR_PRF_MONITOR_JIT_COMPILATION) != 0;
+		if (notify)
+			m_pCallback->ReJITCompilationStarted(functionId, reJitId, TRUE);
+
+		if (SUCCEEDED(hr) && !control.Body.empty())
+			hr = ValidateMethodBody(control.Body.data(), (ULONG)control.Body.size(), pModule->MetaData);
+
+		if (FAILED(hr)) {
+			m_pCallback->ReJITError(moduleId, methodDef, functionId, hr);
+			failures++;
+		}
+		else if (!control.Body.empty()) {
+			std::lock_guard<std::mutex> lock(pModule->Lock);
+			pModule->ReJITBodies[methodDef] = std::move(control.Body);
+		}
+
+		if (notify)
+			m_pCallback->ReJITCompilationFinished(functionId, reJitId, hr, TRUE);
+
+		recompiled++;
+	}
+
+	if (pFailures != nullptr)
+		*pFailures = failures;
+
+	return recompiled;
+}
+
+HRESULT MockRuntime::GetCurrentIL(ModuleID moduleId, mdMethodDef methodDef, std::vector<BYTE>& body)
+{
+	MockModule* pModule = FindModule(moduleId);
+	if (pModule == nullptr)
+		return E_INVALIDARG;
+
+	{
+		std::lock_guard<std::mutex> lock(pModule->Lock);
+		auto reJitBody = pModule->ReJITBodies.find(methodDef);
+		if (reJitBody != pModule->ReJITBodies.end()) {
+			body = reJitBody->second;
+			return S_OK;
+		}
+	}
+
+	LPCBYTE pBody = nullptr;
+	ULONG cbBody = 0;
+	HRESULT hr = GetILFunctionBody(moduleId, methodDef, &pBody, &cbBody);
+	if (FAILED(hr))
+		return hr;
+
+	body.assign(pBody, pBody + cbBody);
+	return S_OK;
+}
+
+HRESULT MockRuntime::RestoreOriginalIL(ModuleID moduleId, mdMethodDef methodDef)
+{
+	MockModule* pModule = FindModule(moduleId);
+	if (pModule == nullptr)
+		return E_INVALIDARG;
+
+	std::lock_guard<std::mutex> lock(pModule->Lock);
+	pModule->ILBodies.erase(methodDef);
+	pModule->ReJITBodies.erase(methodDef);
+	return S_OK;
+}
+
+void MockRuntime::Shutdown()
+{
+	if (m_pCallback == nullptr)
+		return;
+
+	if (m_detachRequested)
+		m_pCallback->ProfilerDetachSucceeded();
+	else
+		m_pCallback->Shutdown();
+
+	m_pCallback->Release();
+	m_pCallback = nullptr;
+}
+
+HRESULT MockRuntime::QueryInterface(REFIID riid, void** ppvObject)
+{
+	if (ppvObject == nullptr)
+		return E_POINTER;
+
+	if (riid == IID_IUnknown || riid == IID_ICorProfilerInfo || riid == IID_ICorProfilerInfo2 ||
+		riid == IID_ICorProfilerInfo3 || riid == IID_ICorProfilerInfo4 || riid == IID_ICorProfilerInfo5) {
+		*ppvObject = static_cast<ICorProfilerInfo5*>(this);
+		AddRef();
+		return S_OK;
+	}
+
+	*ppvObject = nullptr;
+	return E_NOINTERFACE;
+}
+
+ULONG MockRuntime::AddRef()
+{
+	return std::atomic_fetch_add(&m_refCount, 1) + 1;
+}
+
+// The host owns the runtime, so it isn't deleted when the profiler lets go of it
+ULONG MockRuntime::Release()
+{
+	return std::atomic_fetch_sub(&m_refCount, 1) - 1;
+}
+
+HRESULT MockRuntime::GetEventMask(DWORD* pdwEvents)
+{
+	*pdwEvents = m_eventMask;
+	return S_OK;
+}
+
+HRESULT MockRuntime::SetEventMask(DWORD dwEvents)
+{
+	if (!m_initializing && ((dwEvents ^ m_eventMask) & COR_PRF_MONITOR_IMMUTABLE))
+		return CORPROF_E_IMMUTABLE_FLAGS_SET;
+
+	m_eventMask = dwEvents;
+	return S_OK;
+}
+
+HRESULT MockRuntime::GetEventMask2(DWORD* pdwEventsLow, DWORD* pdwEventsHigh)
+{
+	*pdwEventsLow = m_eventMask;
+	*pdwEventsHigh = m_highEventMask;
+	return S_OK;
+}
+
+// No high events are raised, they're only kept so the profiler can read them back
+HRESULT MockRuntime::SetEventMask2(DWORD dwEventsLow, DWORD dwEventsHigh)
+{
+	HRESULT hr = SetEventMask(dwEventsLow);
+	if (SUCCEEDED(hr))
+		m_highEventMask = dwEventsHigh;
+	return hr;
+}
+
+HRESULT MockRuntime::GetFunctionFromToken(ModuleID moduleId, mdToken token, FunctionID* pFunctionId)
+{
+	MockModule* pModule = FindModule(moduleId);
+	if (pModule == nullptr || TypeFromToken(token) != mdtMethodDef)
+		return E_INVALIDARG;
+
+	*pFunctionId = (FunctionID)GetFunction(pModule, token);
+	return S_OK;
+}
+
+HRESULT MockRuntime::GetCurrentThreadID(ThreadID* pThreadId)
+{
+	// Any unique value per thread will do, the profiler only compares them
+	static thread_local char threadMarker;
+	*pThreadId = (ThreadID)&threadMarker;
+	return S_OK;
+}
+
+HRESULT MockRuntime::GetFunctionInfo(FunctionID functionId, ClassID* pClassId, ModuleID* pModuleId, mdToken* pToken)
+{
+	if (functionId == 0)
+		return E_INVALIDARG;
+
+	MockFunction* pFunction = (MockFunction*)functionId;
+	// Classes are never loaded, so there's no ClassID to hand out
+	if (pClassId != nullptr)
+		*pClassId = 0;
+	if (pModuleId != nullptr)
+		*pModuleId = (ModuleID)pFunction->Module;
+	if (pToken != nullptr)
+		*pToken = pFunction->Token;
+
+	return S_OK;
+}
+
+HRESULT MockRuntime::GetFunctionInfo2(FunctionID funcId, COR_PRF_FRAME_INFO frameInfo, ClassID* pClassId, ModuleID* pModuleId, mdToken* pToken, ULONG32 cTypeArgs, ULONG32* pcTypeArgs, ClassID typeArgs[])
+{
+	if (pcTypeArgs != nullptr)
+		*pcTypeArgs = 0;
+
+	return GetFunctionInfo(funcId, pClassId, pModuleId, pToken);
+}
+
+HRESULT MockRuntime::GetTokenAndMetaDataFromFunction(FunctionID functionId, REFIID riid, IUnknown** ppImport, mdToken* pToken)
+{
+	if (functionId == 0)
+		return E_INVALIDARG;
+
+	MockFunction* pFunction = (MockFunction*)functionId;
+	if (pToken != nullptr)
+		*pToken = pFunction->Token;
+
+	return pFunction->Module->MetaData->QueryInterface(riid, (void**)ppImport);
+}
+
+HRESULT MockRuntime::GetModuleInfo(ModuleID moduleId, LPCBYTE* ppBaseLoadAddress, ULONG cchName, ULONG* pcchName, WCHAR szName[], AssemblyID* pAssemblyId)
+{
+	return GetModuleInfo2(moduleId, ppBaseLoadAddress, cchName, pcchName, szName, pAssemblyId, nullptr);
+}
+
+HRESULT MockRuntime::GetModuleMetaData(ModuleID moduleId, DWORD dwOpenFlags, REFIID riid, IUnknown** ppOut)
+{
+	MockModule* pModule = FindModule(moduleId);
+	if (pModule == nullptr)
+		return E_INVALIDARG;
+
+	return pModule->MetaData->QueryInterface(riid, (void**)ppOut);
+}
+
+HRESULT MockRuntime::GetILFunctionBody(ModuleID moduleId, mdMethodDef methodId, LPCBYTE* ppMethodHeader, ULONG* pcbMethodSize)
+{
+	MockModule* pModule = FindModule(moduleId);
+	if (pModule == nullptr)
+		return E_INVALIDARG;
+
+	{
+		std::lock_guard<std::mutex> lock(pModule->Lock);
+		auto body = pModule->ILBodies.find(methodId);
+		if (body != pModule->ILBodies.end()) {
+			*ppMethodHeader = body->second.first;
+			if (pcbMethodSize != nullptr)
+				*pcbMethodSize = body->second.second;
+			return S_OK;
+		}
+	}
+
+	return GetOriginalIL(pModule, methodId, ppMethodHeader, pcbMethodSize);
+}
+
+HRESULT MockRuntime::GetILFunctionBodyAllocator(ModuleID moduleId, IMethodMalloc** ppMalloc)
+{
+	MockModule* pModule = FindModule(moduleId);
+	if (pModule == nullptr)
+		return E_INVALIDARG;
+
+	*ppMalloc = &pModule->Allocator;
+	return S_OK;
+}
+
+HRESULT MockRuntime::SetILFunctionBody(ModuleID moduleId, mdMethodDef methodid, LPCBYTE pbNewILMethodHeader)
+{
+	MockModule* pModule = FindModule(moduleId);
+	if (pModule == nullptr || pbNewILMethodHeader == nullptr)
+		return E_INVALIDARG;
+
+	// The runtime only gets a pointer, so the size comes from the header. Sections are the last thing in a body so the
+	// parse can't read past the allocation of a well formed one
+	MethodBody body;
+	if (FAILED(ParseMethodBody(pbNewILMethodHeader, (ULONG)-1, &body)))
+		return E_INVALIDARG;
+
+	std::lock_guard<std::mutex> lock(pModule->Lock);
+	pModule->ILBodies[methodid] = { pbNewILMethodHeader, body.TotalSize };
+	return S_OK;
+}
+
+HRESULT MockRuntime::GetAppDomainInfo(AppDomainID appDomainId, ULONG cchName, ULONG* pcchName, WCHAR szName[], ProcessID* pProcessId)
+{
+	if (appDomainId != MOCK_APP_DOMAIN_ID)
+		return E_INVALIDARG;
+
+	CopyName(MOCK_APP_DOMAIN_NAME, cchName, pcchName, szName);
+	if (pProcessId != nullptr)
+		*pProcessId = CurrentProcessId();
+
+	return S_OK;
+}
+
+HRESULT MockRuntime::GetAssemblyInfo(AssemblyID assemblyId, ULONG cchName, ULONG* pcchName, WCHAR szName[], AppDomainID* pAppDomainId, ModuleID* pModuleId)
+{
+	MockModule* pModule = FindModule(assemblyId);
+	if (pModule == nullptr)
+		return E_INVALIDARG;
+
+	std::string name;
+	if (pModule->Image.RowCount(MetadataTable::Assembly) > 0)
+		name = pModule->Image.GetString(pModule->Image.Get(MetadataTable::Assembly, 1, Col::AssemblyName));
+
+	CopyName(Utf8ToWStr(name.c_str(), name.size()), cchName, pcchName, szName);
+	if (pAppDomainId != nullptr)
+		*pAppDomainId = MOCK_APP_DOMAIN_ID;
+	if (pModuleId != nullptr)
+		*pModuleId = assemblyId;
+
+	return S_OK;
+}
+
+HRESULT MockRuntime::RequestProfilerDetach(DWORD dwExpectedCompletionMilliseconds)
+{
+	// ProfilerDetachSucceeded is raised when the host shuts the runtime down
+	m_detachRequested = true;
+	return S_OK;
+}
+
+HRESULT MockRuntime::EnumModules(ICorProfilerModuleEnum** ppEnum)
+{
+	std::vector<ModuleID> modules;
+	{
+		std::lock_guard<std::mutex> lock(m_modulesLock);
+		for (const auto& module : m_modules)
+			modules.push_back((ModuleID)module.get());
+	}
+
+	*ppEnum = new MockModuleEnum(std::move(modules));
+	return S_OK;
+}
+
+HRESULT MockRuntime::GetRuntimeInformation(USHORT* pClrInstanceId, COR_PRF_RUNTIME_TYPE* pRuntimeType, USHORT* pMajorVersion, USHORT* pMinorVersion, USHORT* pBuildNumber, USHORT* pQFEVersion, ULONG cchVersionString, ULONG* pcchVersionString, WCHAR szVersionString[])
+{
+	if (pClrInstanceId != nullptr)
+		*pClrInstanceId = 0;
+	if (pRuntimeType != nullptr)
+		*pRuntimeType = COR_PRF_CORE_CLR;
+	if (pMajorVersion != nullptr)
+		*pMajorVersion = 0;
+	if (pMinorVersion != nullptr)
+		*pMinorVersion = 0;
+	if (pBuildNumber != nullptr)
+		*pBuildNumber = 0;
+	if (pQFEVersion != nullptr)
+		*pQFEVersion = 0;
+
+	CopyName(WSTR("mock"), cchVersionString, pcchVersionString, szVersionString);
+	return S_OK;
+}
+
+HRESULT MockRuntime::GetAppDomainsContainingModule(ModuleID moduleId, ULONG32 cAppDomainIds, ULONG32* pcAppDomainIds, AppDomainID appDomainIds[])
+{
+	if (FindModule(moduleId) == nullptr)
+		return E_INVALIDARG;
+
+	if (pcAppDomainIds != nullptr)
+		*pcAppDomainIds = 1;
+	if (cAppDomainIds > 0 && appDomainIds != nullptr)
+		appDomainIds[0] = MOCK_APP_DOMAIN_ID;
+
+	return S_OK;
+}
+
+HRESULT MockRuntime::GetModuleInfo2(ModuleID moduleId, LPCBYTE* ppBaseLoadAddress, ULONG cchName, ULONG* pcchName, WCHAR szName[], AssemblyID* pAssemblyId, DWORD* pdwModuleFlags)
+{
+	MockModule* pModule = FindModule(moduleId);
+	if (pModule == nullptr)
+		return E_INVALIDARG;
+
+	if (ppBaseLoadAddress != nullptr)
+		*ppBaseLoadAddress = pModule->Image.Base();
+
+	CopyName(pModule->Name, cchName, pcchName, szName);
+	if (pAssemblyId != nullptr)
+		*pAssemblyId = moduleId;
+	if (pdwModuleFlags != nullptr)
+		*pdwModuleFlags = COR_PRF_MODULE_DISK;
+
+	return S_OK;
+}
+
+HRESULT MockRuntime::RequestReJIT(ULONG cFunctions, ModuleID moduleIds[], mdMethodDef methodIds[])
+{
+	if (!(m_eventMask & COR_PRF_ENABLE_REJIT))
+		return CORPROF_E_REJIT_NOT_ENABLED;
+
+	for (ULONG i = 0; i < cFunctions; i++) {
+		if (FindModule(moduleIds[i]) == nullptr)
+			return E_INVALIDARG;
+	}
+
+	{
+		std::lock_guard<std::mutex> lock(m_reJitLock);
+		for (ULONG i = 0; i < cFunctions; i++)
+			m_reJitRequests.emplace_back(moduleIds[i], methodIds[i]);
+		m_reJitGeneration++;
+	}
+
+	m_reJitRequested.notify_all();
+	return S_OK;
+}
+
+HRESULT MockRuntime::RequestRevert(ULONG cFunctions, ModuleID moduleIds[], mdMethodDef methodIds[], HRESULT status[])
+{
+	if (!(m_eventMask & COR_PRF_ENABLE_REJIT))
+		return CORPROF_E_REJIT_NOT_ENABLED;
+
+	for (ULONG i = 0; i < cFunctions; i++) {
+		MockModule* pModule = FindModule(moduleIds[i]);
+		HRESULT hr = E_INVALIDARG;
+		if (pModule != nullptr) {
+			std::lock_guard<std::mutex> lock(pModule->Lock);
+			pModule->ReJITBodies.erase(methodIds[i]);
+			hr = S_OK;
+		}
+
+		if (status != nullptr)
+			status[i] = hr;
+	}
+
+	return S_OK;
+}
+
+MockModule* MockRuntime::FindModule(ModuleID moduleId)
+{
+	std::lock_guard<std::mutex> lock(m_modulesLock);
+	for (const auto& module : m_modules) {
+		if ((ModuleID)module.get() == moduleId)
+			return module.get();
+	}
+
+	return nullptr;
+}
+
+MockFunction* MockRuntime::GetFunction(MockModule* pModule, mdMethodDef methodDef)
+{
+	std::lock_guard<std::mutex> lock(pModule->Lock);
+	std::unique_ptr<MockFunction>& function = pModule->Functions[methodDef];
+	if (!function)
+		function.reset(new MockFunction{ pModule, methodDef });
+
+	return function.get();
+}
+
+HRESULT MockRuntime::GetOriginalIL(MockModule* pModule, mdMethodDef methodDef, LPCBYTE* ppMethodHeader, ULONG* pcbMethodSize)
+{
+	ULONG rid = RidFromToken(methodDef);
+	if (TypeFromToken(methodDef) != mdtMethodDef || rid == 0 || rid > pModule->Image.RowCount(MetadataTable::MethodDef))
+		return E_INVALIDARG;
+
+	ULONG rva = pModule->Image.Get(MetadataTable::MethodDef, rid, Col::MethodRva);
+	if (rva == 0)
+		return CORPROF_E_FUNCTION_NOT_IL;
+
+	// The header says how long the body is, so first map what's left of the image after it
+	const BYTE* pBody = pModule->Image.AtRva(rva, 1);
+	if (pBody == nullptr)
+		return CORPROF_E_FUNCTION_NOT_IL;
+
+	MethodBody body;
+	ULONG available = (ULONG)(pModule->Image.Base() + pModule->Image.ImageSize() - pBody);
+	if (FAILED(ParseMethodBody(pBody, available, &body)))
+		return COR_E_INVALIDPROGRAM;
+
+	*ppMethodHeader = pBody;
+	if (pcbMethodSize != nullptr)
+		*pcbMethodSize = body.TotalSize;
+
+	return S_OK;
+}
@@ -0,0 +1,237 @@
+#pragma once
+
+#include "stdafx.h"
+#include "EcmaImage.h"
+#include "MockMetaData.h"
+#include <atomic>
+#include <condition_variable>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+struct MockModule;
+
+// Hands out memory for replacement method bodies. Like the runtime's allocator nothing is freed until the module goes away
+class MockMethodMalloc : public IMethodMalloc
+{
+public:
+	STDMETHODIMP QueryInterface(REFIID riid, void** ppvObject) override;
+	// Owned by its module rather than reference counted
+	STDMETHODIMP_(ULONG) AddRef() override { return 1; }
+	STDMETHODIMP_(ULONG) Release() override { return 1; }
+
+	STDMETHODIMP_(PVOID) Alloc(ULONG cb) override;
+
+	size_t BytesAllocated() const { return m_bytesAllocated; }
+
+private:
+	std::mutex m_lock;
+	std::vector<std::unique_ptr<BYTE[]>> m_blocks;
+	size_t m_bytesAllocated = 0;
+};
+
+// Handed to GetReJITParameters. The runtime copies the new body out of the profiler's buffer, so it's kept here until the
+// callback returns
+class MockFunctionControl : public ICorProfilerFunctionControl
+{
+public:
+	STDMETHODIMP QueryInterface(REFIID riid, void** ppvObject) override;
+	// Only lives for the duration of the callback
+	STDMETHODIMP_(ULONG) AddRef() override { return 1; }
+	STDMETHODIMP_(ULONG) Release() override { return 1; }
+
+	STDMETHODIMP SetCodegenFlags(DWORD flags) override { return S_OK; }
+	STDMETHODIMP SetILFunctionBody(ULONG cbNewILMethodHeader, LPCBYTE pbNewILMethodHeader) override;
+	STDMETHODIMP SetILInstrumentedCodeMap(ULONG cILMapEntries, COR_IL_MAP rgILMapEntries[]) override { return S_OK; }
+
+	std::vector<BYTE> Body;
+};
+
+struct MockFunction
+{
+	MockModule* Module;
+	mdMethodDef Token;
+};
+
+// A loaded module. Its address is used as both its ModuleID and AssemblyID since every assembly has a single module
+struct MockModule
+{
+	std::string Path;
+	WSTRING Name;
+	EcmaImage Image;
+	MockMetaData* MetaData = nullptr;
+	MockMethodMalloc Allocator;
+
+	std::mutex Lock;
+	// Bodies set through SetILFunctionBody, pointing into Allocator's memory
+	std::map<mdMethodDef, std::pair<LPCBYTE, ULONG>> ILBodies;
+	// Bodies handed back through ICorProfilerFunctionControl, which the runtime copies
+	std::map<mdMethodDef, std::vector<BYTE>> ReJITBodies;
+	std::map<mdMethodDef, std::unique_ptr<MockFunction>> Functions;
+
+	~MockModule();
+};
+
+// Stands in for the runtime so the profiler can be loaded and driven without one. Modules are read from assemblies on disk
+// and the load, JIT and ReJIT callbacks are raised by the host when it asks for them rather than by running managed code,
+// so every run over the same inputs sees the same callbacks in the same order. Method bodies the profiler hands back are
+// checked by ILValidator in place of the JIT. Only the parts of ICorProfilerInfo5 the profiler uses are implemented,
+// everything else returns E_NOTIMPL
+class MockRuntime : public ICorProfilerInfo5
+{
+public:
+	MockRuntime();
+	virtual ~MockRuntime();
+
+	// Creates the profiler with the given CLSID from the library at path, the same way the runtime does at startup
+	static HRESULT CreateProfiler(const std::string& path, REFCLSID clsid, IUnknown** ppProfiler);
+
+	// Hands the profiler this runtime through Initialize, as if it was loaded at startup
+	HRESULT LoadProfiler(IUnknown* pProfiler);
+	// Hands the profiler this runtime through InitializeForAttach and completes the attach, as if it was attached to a
+	// process with the modules already loaded
+	HRESULT AttachProfiler(IUnknown* pProfiler, void* pvClientData, UINT cbClientData);
+
+	// Loads the assembly at path, raising the load callbacks the profiler subscribed to
+	HRESULT LoadModule(const std::string& path, ModuleID* pModuleId);
+	// The two halves of LoadModule, so reading the assembly can be kept apart from the profiler's handling of the load
+	HRESULT OpenModule(const std::string& path, ModuleID* pModuleId);
+	void RaiseModuleLoad(ModuleID moduleId);
+	// Unloads a module as if its collectible assembly was collected, raising the unload callbacks the profiler subscribed to.
+	// The module is freed between ModuleUnloadStarted and ModuleUnloadFinished, so the ID means nothing afterwards
+	HRESULT UnloadModule(ModuleID moduleId);
+	// Compiles a method, raising the JIT callbacks the profiler subscribed to. Fails with COR_E_INVALIDPROGRAM if the body
+	// the profiler left behind doesn't validate
+	HRESULT JitMethod(ModuleID moduleId, mdMethodDef methodDef, FunctionID* pFunctionId);
+	// Waits until no ReJIT has been requested for quietMs, then recompiles every method requested so far. Returns how many
+	// methods were recompiled, and how many of them failed through pFailures
+	size_t ProcessReJITRequests(DWORD quietMs, size_t* pFailures = nullptr);
+	// The body the method would run with now, taking ReJIT and SetILFunctionBody into account
+	HRESULT GetCurrentIL(ModuleID moduleId, mdMethodDef methodDef, std::vector<BYTE>& body);
+	// Drops any body set by the profiler so the method is back to the IL it was loaded with
+	HRESULT RestoreOriginalIL(ModuleID moduleId, mdMethodDef methodDef);
+
+	bool DetachRequested() const { return m_detachRequested; }
+	// Unloads the profiler, through ProfilerDetachSucceeded if it asked to detach and Shutdown otherwise
+	void Shutdown();
+
+	// IUnknown
+	STDMETHODIMP QueryInterface(REFIID riid, void** ppvObject) override;
+	STDMETHODIMP_(ULONG) AddRef() override;
+	STDMETHODIMP_(ULONG) Release() override;
+
+	// ICorProfilerInfo
+	STDMETHODIMP GetClassFromObject(ObjectID objectId, ClassID* pClassId) override { return E_NOTIMPL; }
+	STDMETHODIMP GetClassFromToken(ModuleID moduleId, mdTypeDef typeDef, ClassID* pClassId) override { return E_NOTIMPL; }
+	STDMETHODIMP GetCodeInfo(FunctionID functionId, LPCBYTE* pStart, ULONG* pcSize) override { return E_NOTIMPL; }
+	STDMETHODIMP GetEventMask(DWORD* pdwEvents) override;
+	STDMETHODIMP GetFunctionFromIP(LPCBYTE ip, FunctionID* pFunctionId) override { return E_NOTIMPL; }
+	STDMETHODIMP GetFunctionFromToken(ModuleID moduleId, mdToken token, FunctionID* pFunctionId) override;
+	STDMETHODIMP GetHandleFromThread(ThreadID threadId, HANDLE* phThread) override { return E_NOTIMPL; }
+	STDMETHODIMP GetObjectSize(ObjectID objectId, ULONG* pcSize) override { return E_NOTIMPL; }
+	STDMETHODIMP IsArrayClass(ClassID classId, CorElementType* pBaseElemType, ClassID* pBaseClassId, ULONG* pcRank) override { return E_NOTIMPL; }
+	STDMETHODIMP GetThreadInfo(ThreadID threadId, DWORD* pdwWin32ThreadId) override { return E_NOTIMPL; }
+	STDMETHODIMP GetCurrentThreadID(ThreadID* pThreadId) override;
+	STDMETHODIMP GetClassIDInfo(ClassID classId, ModuleID* pModuleId, mdTypeDef* pTypeDefToken) override { return E_NOTIMPL; }
+	STDMETHODIMP GetFunctionInfo(FunctionID functionId, ClassID* pClassId, ModuleID* pModuleId, mdToken* pToken) override;
+	STDMETHODIMP SetEventMask(DWORD dwEvents) override;
+	STDMETHODIMP SetEnterLeaveFunctionHooks(FunctionEnter* pFuncEnter, FunctionLeave* pFuncLeave, FunctionTailcall* pFuncTailcall) override { return E_NOTIMPL; }
+	STDMETHODIMP SetFunctionIDMapper(FunctionIDMapper* pFunc) override { return E_NOTIMPL; }
+	STDMETHODIMP GetTokenAndMetaDataFromFunction(FunctionID functionId, REFIID riid, IUnknown** ppImport, mdToken* pToken) override;
+	STDMETHODIMP GetModuleInfo(ModuleID moduleId, LPCBYTE* ppBaseLoadAddress, ULONG cchName, ULONG* pcchName, WCHAR szName[], AssemblyID* pAssemblyId) override;
+	STDMETHODIMP GetModuleMetaData(ModuleID moduleId, DWORD dwOpenFlags, REFIID riid, IUnknown** ppOut) override;
+	STDMETHODIMP GetILFunctionBody(ModuleID moduleId, mdMethodDef methodId, LPCBYTE* ppMethodHeader, ULONG* pcbMethodSize) override;
+	STDMETHODIMP GetILFunctionBodyAllocator(ModuleID moduleId, IMethodMalloc** ppMalloc) override;
+	STDMETHODIMP SetILFunctionBody(ModuleID moduleId, mdMethodDef methodid, LPCBYTE pbNewILMethodHeader) override;
+	STDMETHODIMP GetAppDomainInfo(AppDomainID appDomainId, ULONG cchName, ULONG* pcchName, WCHAR szName[], ProcessID* pProcessId) override;
+	STDMETHODIMP GetAssemblyInfo(AssemblyID assemblyId, ULONG cchName, ULONG* pcchName, WCHAR szName[], AppDomainID* pAppDomainId, ModuleID* pModuleId) override;
+	STDMETHODIMP SetFunctionReJIT(FunctionID functionId) override { return E_NOTIMPL; }
+	STDMETHODIMP ForceGC() override { return E_NOTIMPL; }
+	STDMETHODIMP SetILInstrumentedCodeMap(FunctionID functionId, BOOL fStartJit, ULONG cILMapEntries, COR_IL_MAP rgILMapEntries[]) override { return S_OK; }
+	STDMETHODIMP GetInprocInspectionInterface(IUnknown** ppicd) override { return E_NOTIMPL; }
+	STDMETHODIMP GetInprocInspectionIThisThread(IUnknown** ppicd) override { return E_NOTIMPL; }
+	STDMETHODIMP GetThreadContext(ThreadID threadId, ContextID* pContextId) override { return E_NOTIMPL; }
+	STDMETHODIMP BeginInprocDebugging(BOOL fThisThreadOnly, DWORD* pdwProfilerContext) override { return E_NOTIMPL; }
+	STDMETHODIMP EndInprocDebugging(DWORD dwProfilerContext) override { return E_NOTIMPL; }
+	STDMETHODIMP GetILToNativeMapping(FunctionID functionId, ULONG32 cMap, ULONG32* pcMap, COR_DEBUG_IL_TO_NATIVE_MAP map[]) override { return E_NOTIMPL; }
+
+	// ICorProfilerInfo2
+	STDMETHODIMP DoStackSnapshot(ThreadID thread, StackSnapshotCallback* callback, ULONG32 infoFlags, void* clientData, BYTE context[], ULONG32 contextSize) override { return E_NOTIMPL; }
+	STDMETHODIMP SetEnterLeaveFunctionHooks2(FunctionEnter2* pFuncEnter, FunctionLeave2* pFuncLeave, FunctionTailcall2* pFuncTailcall) override { return E_NOTIMPL; }
+	STDMETHODIMP GetFunctionInfo2(FunctionID funcId, COR_PRF_FRAME_INFO frameInfo, ClassID* pClassId, ModuleID* pModuleId, mdToken* pToken, ULONG32 cTypeArgs, ULONG32* pcTypeArgs, ClassID typeArgs[]) override;
+	STDMETHODIMP GetStringLayout(ULONG* pBufferLengthOffset, ULONG* pStringLengthOffset, ULONG* pBufferOffset) override { return E_NOTIMPL; }
+	STDMETHODIMP GetClassLayout(ClassID classID, COR_FIELD_OFFSET rFieldOffset[], ULONG cFieldOffset, ULONG* pcFieldOffset, ULONG* pulClassSize) override { return E_NOTIMPL; }
+	STDMETHODIMP GetClassIDInfo2(ClassID classId, ModuleID* pModuleId, mdTypeDef* pTypeDefToken, ClassID* pParentClassId, ULONG32 cNumTypeArgs, ULONG32* pcNumTypeArgs, ClassID typeArgs[]) override { return E_NOTIMPL; }
+	STDMETHODIMP GetCodeInfo2(FunctionID functionID, ULONG32 cCodeInfos, ULONG32* pcCodeInfos, COR_PRF_CODE_INFO codeInfos[]) override { return E_NOTIMPL; }
+	STDMETHODIMP GetClassFromTokenAndTypeArgs(ModuleID moduleID, mdTypeDef typeDef, ULONG32 cTypeArgs, ClassID typeArgs[], ClassID* pClassID) override { return E_NOTIMPL; }
+	STDMETHODIMP GetFunctionFromTokenAndTypeArgs(ModuleID moduleID, mdMethodDef funcDef, ClassID classId, ULONG32 cTypeArgs, ClassID typeArgs[], FunctionID* pFunctionID) override { return E_NOTIMPL; }
+	STDMETHODIMP EnumModuleFrozenObjects(ModuleID moduleID, ICorProfilerObjectEnum** ppEnum) override { return E_NOTIMPL; }
+	STDMETHODIMP GetArrayObjectInfo(ObjectID objectId, ULONG32 cDimensions, ULONG32 pDimensionSizes[], int pDimensionLowerBounds[], BYTE** ppData) override { return E_NOTIMPL; }
+	STDMETHODIMP GetBoxClassLayout(ClassID classId, ULONG32* pBufferOffset) override { return E_NOTIMPL; }
+	STDMETHODIMP GetThreadAppDomain(ThreadID threadId, AppDomainID* pAppDomainId) override { return E_NOTIMPL; }
+	STDMETHODIMP GetRVAStaticAddress(ClassID classId, mdFieldDef fieldToken, void** ppAddress) override { return E_NOTIMPL; }
+	STDMETHODIMP GetAppDomainStaticAddress(ClassID classId, mdFieldDef fieldToken, AppDomainID appDomainId, void** ppAddress) override { return E_NOTIMPL; }
+	STDMETHODIMP GetThreadStaticAddress(ClassID classId, mdFieldDef fieldToken, ThreadID threadId, void** ppAddress) override { return E_NOTIMPL; }
+	STDMETHODIMP GetContextStaticAddress(ClassID classId, mdFieldDef fieldToken, ContextID contextId, void** ppAddress) override { return E_NOTIMPL; }
+	STDMETHODIMP GetStaticFieldInfo(ClassID classId, mdFieldDef fieldToken, COR_PRF_STATIC_TYPE* pFieldInfo) override { return E_NOTIMPL; }
+	STDMETHODIMP GetGenerationBounds(ULONG cObjectRanges, ULONG* pcObjectRanges, COR_PRF_GC_GENERATION_RANGE ranges[]) override { return E_NOTIMPL; }
+	STDMETHODIMP GetObjectGeneration(ObjectID objectId, COR_PRF_GC_GENERATION_RANGE* range) override { return E_NOTIMPL; }
+	STDMETHODIMP GetNotifiedExceptionClauseInfo(COR_PRF_EX_CLAUSE_INFO* pinfo) override { return E_NOTIMPL; }
+
+	// ICorProfilerInfo3
+	STDMETHODIMP EnumJITedFunctions(ICorProfilerFunctionEnum** ppEnum) override { return E_NOTIMPL; }
+	STDMETHODIMP RequestProfilerDetach(DWORD dwExpectedCompletionMilliseconds) override;
+	STDMETHODIMP SetFunctionIDMapper2(FunctionIDMapper2* pFunc, void* clientData) override { return E_NOTIMPL; }
+	STDMETHODIMP GetStringLayout2(ULONG* pStringLengthOffset, ULONG* pBufferOffset) override { return E_NOTIMPL; }
+	STDMETHODIMP SetEnterLeaveFunctionHooks3(FunctionEnter3* pFuncEnter3, FunctionLeave3* pFuncLeave3, FunctionTailcall3* pFuncTailcall3) override { return E_NOTIMPL; }
+	STDMETHODIMP SetEnterLeaveFunctionHooks3WithInfo(FunctionEnter3WithInfo* pFuncEnter3WithInfo, FunctionLeave3WithInfo* pFuncLeave3WithInfo, FunctionTailcall3WithInfo* pFuncTailcall3WithInfo) override { return E_NOTIMPL; }
+	STDMETHODIMP GetFunctionEnter3Info(FunctionID functionId, COR_PRF_ELT_INFO eltInfo, COR_PRF_FRAME_INFO* pFrameInfo, ULONG* pcbArgumentInfo, COR_PRF_FUNCTION_ARGUMENT_INFO* pArgumentInfo) override { return E_NOTIMPL; }
+	STDMETHODIMP GetFunctionLeave3Info(FunctionID functionId, COR_PRF_ELT_INFO eltInfo, COR_PRF_FRAME_INFO* pFrameInfo, COR_PRF_FUNCTION_ARGUMENT_RANGE* pRetvalRange) override { return E_NOTIMPL; }
+	STDMETHODIMP GetFunctionTailcall3Info(FunctionID functionId, COR_PRF_ELT_INFO eltInfo, COR_PRF_FRAME_INFO* pFrameInfo) override { return E_NOTIMPL; }
+	STDMETHODIMP EnumModules(ICorProfilerModuleEnum** ppEnum) override;
+	STDMETHODIMP GetRuntimeInformation(USHORT* pClrInstanceId, COR_PRF_RUNTIME_TYPE* pRuntimeType, USHORT* pMajorVersion, USHORT* pMinorVersion, USHORT* pBuildNumber, USHORT* pQFEVersion, ULONG cchVersionString, ULONG* pcchVersionString, WCHAR szVersionString[]) override;
+	STDMETHODIMP GetThreadStaticAddress2(ClassID classId, mdFieldDef fieldToken, AppDomainID appDomainId, ThreadID threadId, void** ppAddress) override { return E_NOTIMPL; }
+	STDMETHODIMP GetAppDomainsContainingModule(ModuleID moduleId, ULONG32 cAppDomainIds, ULONG32* pcAppDomainIds, AppDomainID appDomainIds[]) override;
+	STDMETHODIMP GetModuleInfo2(ModuleID moduleId, LPCBYTE* ppBaseLoadAddress, ULONG cchName, ULONG* pcchName, WCHAR szName[], AssemblyID* pAssemblyId, DWORD* pdwModuleFlags) override;
+
+	// ICorProfilerInfo4
+	STDMETHODIMP EnumThreads(ICorProfilerThreadEnum** ppEnum) override { return E_NOTIMPL; }
+	STDMETHODIMP InitializeCurrentThread() override { return S_OK; }
+	STDMETHODIMP RequestReJIT(ULONG cFunctions, ModuleID moduleIds[], mdMethodDef methodIds[]) override;
+	STDMETHODIMP RequestRevert(ULONG cFunctions, ModuleID moduleIds[], mdMethodDef methodIds[], HRESULT status[]) override;
+	STDMETHODIMP GetCodeInfo3(FunctionID functionID, ReJITID reJitId, ULONG32 cCodeInfos, ULONG32* pcCodeInfos, COR_PRF_CODE_INFO codeInfos[]) override { return E_NOTIMPL; }
+	STDMETHODIMP GetFunctionFromIP2(LPCBYTE ip, FunctionID* pFunctionId, ReJITID* pReJitId) override { return E_NOTIMPL; }
+	STDMETHODIMP GetReJITIDs(FunctionID functionId, ULONG cReJitIds, ULONG* pcReJitIds, ReJITID reJitIds[]) override { return E_NOTIMPL; }
+	STDMETHODIMP GetILToNativeMapping2(FunctionID functionId, ReJITID reJitId, ULONG32 cMap, ULONG32* pcMap, COR_DEBUG_IL_TO_NATIVE_MAP map[]) override { return E_NOTIMPL; }
+	STDMETHODIMP EnumJITedFunctions2(ICorProfilerFunctionEnum** ppEnum) override { return E_NOTIMPL; }
+	STDMETHODIMP GetObjectSize2(ObjectID objectId, SIZE_T* pcSize) override { return E_NOTIMPL; }
+
+	// ICorProfilerInfo5
+	STDMETHODIMP GetEventMask2(DWORD* pdwEventsLow, DWORD* pdwEventsHigh) override;
+	STDMETHODIMP SetEventMask2(DWORD dwEventsLow, DWORD dwEventsHigh) override;
+
+private:
+	MockModule* FindModule(ModuleID moduleId);
+	MockFunction* GetFunction(MockModule* pModule, mdMethodDef methodDef);
+	HRESULT GetOriginalIL(MockModule* pModule, mdMethodDef methodDef, LPCBYTE* ppMethodHeader, ULONG* pcbMethodSize);
+
+	std::atomic<ULONG> m_refCount;
+	ICorProfilerCallback4* m_pCallback = nullptr;
+	std::atomic<DWORD> m_eventMask;
+	std::atomic<DWORD> m_highEventMask;
+	// Flags which can only be set from Initialize are rejected once it returns
+	bool m_initializing = false;
+	std::atomic<bool> m_detachRequested;
+
+	std::mutex m_modulesLock;
+	std::vector<std::unique_ptr<MockModule>> m_modules;
+
+	std::mutex m_reJitLock;
+	std::condition_variable m_reJitRequested;
+	std::vector<std::pair<ModuleID, mdMethodDef>> m_reJitRequests;
+	// Bumped on every request so ProcessReJITRequests can tell when the profiler has stopped asking
+	ULONG m_reJitGeneration = 0;
+	ReJITID m_nextReJitId = 1;
+};